@@ -0,0 +1,429 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - fan-in bandwidth estimator
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "naconnect.h"
+#include "bandwidth.h"
+#include "tap.h"
+
+struct source
+{
+  snd_seq_addr_t addr;
+  int used;
+  int seen;                             /* still in the model at this sample */
+  unsigned int samples;                 /* taken since it is metered */
+  uint64_t bytes[BANDWIDTH_WINDOW];     /* counter at the last samples, indexed like g_times */
+  unsigned int rate;                    /* bytes/s over the window */
+};
+
+struct flagged
+{
+  snd_seq_addr_t dest;
+  unsigned int rate;
+};
+
+static unsigned int g_budget;
+static int g_port = -1;
+
+/*
+ * Slot of each source for the reader thread, 0 if it is not metered.
+ * The counters are written by the reader thread only; a slot handed to
+ * another source starts from the counter as it is.
+ */
+static unsigned char g_slots[256][256];
+static uint64_t g_counters[BANDWIDTH_SOURCES + 1];
+
+static struct source g_sources[BANDWIDTH_SOURCES + 1];
+static uint64_t g_times[BANDWIDTH_WINDOW];
+static unsigned long g_samples;
+static unsigned long long g_next_ns;
+
+/* sums per destination while flagging, only entries of connected ones are used */
+static unsigned int g_fan_in[256][256];
+
+static struct flagged g_flagged[BANDWIDTH_FLAGGED];
+static unsigned int g_flagged_count;
+
+static
+unsigned long long
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* bytes the event takes on a MIDI cable, without running status */
+static
+unsigned int
+wire_size(const snd_seq_event_t * event_ptr)
+{
+  switch (event_ptr->type)
+  {
+  case SND_SEQ_EVENT_NOTEON:
+  case SND_SEQ_EVENT_NOTEOFF:
+  case SND_SEQ_EVENT_KEYPRESS:
+  case SND_SEQ_EVENT_CONTROLLER:
+  case SND_SEQ_EVENT_PITCHBEND:
+  case SND_SEQ_EVENT_SONGPOS:
+    return 3;
+  case SND_SEQ_EVENT_PGMCHANGE:
+  case SND_SEQ_EVENT_CHANPRESS:
+  case SND_SEQ_EVENT_SONGSEL:
+  case SND_SEQ_EVENT_QFRAME:
+    return 2;
+  case SND_SEQ_EVENT_CLOCK:
+  case SND_SEQ_EVENT_START:
+  case SND_SEQ_EVENT_CONTINUE:
+  case SND_SEQ_EVENT_STOP:
+  case SND_SEQ_EVENT_SENSING:
+  case SND_SEQ_EVENT_TUNE_REQUEST:
+  case SND_SEQ_EVENT_RESET:
+    return 1;
+  case SND_SEQ_EVENT_NOTE:              /* a note on and, later, its note off */
+  case SND_SEQ_EVENT_CONTROL14:         /* MSB and LSB controllers */
+    return 6;
+  case SND_SEQ_EVENT_NONREGPARAM:
+  case SND_SEQ_EVENT_REGPARAM:          /* two parameter number and two data entry controllers */
+    return 12;
+  case SND_SEQ_EVENT_SYSEX:
+    return event_ptr->data.ext.len;
+  }
+
+  return 0;
+}
+
+static
+void
+tap_event(void * context, const snd_seq_event_t * event_ptr, uint64_t time_ns)
+{
+  unsigned int slot;
+
+  slot = __atomic_load_n(&g_slots[event_ptr->source.client][event_ptr->source.port], __ATOMIC_RELAXED);
+  if (slot == 0)
+    return;
+
+  __atomic_store_n(g_counters + slot, g_counters[slot] + wire_size(event_ptr), __ATOMIC_RELAXED);
+}
+
+int bandwidth_open(unsigned int budget)
+{
+  if (tap_open() < 0)
+    return -1;
+
+  if (g_port < 0)
+  {
+    g_port = tap_create_port("bandwidth", 0, tap_event, NULL);
+    if (g_port < 0)
+      return -1;
+  }
+
+  g_budget = budget;
+  g_next_ns = 0;
+
+  return 0;
+}
+
+static
+void
+stop_metering(snd_seq_t * seq_handle, unsigned int slot)
+{
+  snd_seq_addr_t dest;
+
+  dest.client = tap_client();
+  dest.port = g_port;
+
+  /* fails when the source is gone, which ended the subscription as well */
+  unsubscribe_ports(seq_handle, &g_sources[slot].addr, &dest);
+
+  __atomic_store_n(&g_slots[g_sources[slot].addr.client][g_sources[slot].addr.port], 0, __ATOMIC_RELAXED);
+  g_sources[slot].used = 0;
+}
+
+void bandwidth_close(snd_seq_t * seq_handle)
+{
+  unsigned int slot;
+
+  if (g_budget == 0)
+    return;
+
+  for (slot = 1 ; slot <= BANDWIDTH_SOURCES ; slot++)
+  {
+    if (g_sources[slot].used)
+      stop_metering(seq_handle, slot);
+  }
+
+  g_budget = 0;
+  g_flagged_count = 0;
+}
+
+unsigned int bandwidth_budget(void)
+{
+  return g_budget;
+}
+
+int bandwidth_timeout(void)
+{
+  unsigned long long now;
+
+  if (g_budget == 0)
+    return -1;
+
+  now = now_ns();
+  if (now >= g_next_ns)
+    return 0;
+
+  return (g_next_ns - now + 999999) / 1000000;
+}
+
+/* subscribe to sources new in the model, let go of those gone from it */
+static
+void
+meter_sources(snd_seq_t * seq_handle)
+{
+  struct list_head * node_ptr;
+  struct port * port_ptr;
+  struct source * source_ptr;
+  snd_seq_addr_t dest;
+  unsigned int slot;
+  unsigned int free_slot;
+
+  dest.client = tap_client();
+  dest.port = g_port;
+
+  for (slot = 1 ; slot <= BANDWIDTH_SOURCES ; slot++)
+    g_sources[slot].seen = 0;
+
+  free_slot = 1;
+
+  list_for_each(node_ptr, &g_input_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+
+    /* the timer and the announces are not MIDI */
+    if (port_ptr->client == SND_SEQ_CLIENT_SYSTEM)
+      continue;
+
+    slot = g_slots[port_ptr->client][port_ptr->port];
+    if (slot != 0)
+    {
+      g_sources[slot].seen = 1;
+      continue;
+    }
+
+    while (free_slot <= BANDWIDTH_SOURCES && g_sources[free_slot].used)
+      free_slot++;
+
+    if (free_slot > BANDWIDTH_SOURCES)
+      break;
+
+    source_ptr = g_sources + free_slot;
+    source_ptr->addr.client = port_ptr->client;
+    source_ptr->addr.port = port_ptr->port;
+
+    if (subscribe_ports(seq_handle, &source_ptr->addr, &dest) < 0)
+      continue;
+
+    source_ptr->used = 1;
+    source_ptr->seen = 1;
+    source_ptr->samples = 0;
+    source_ptr->rate = 0;
+
+    __atomic_store_n(&g_slots[port_ptr->client][port_ptr->port], free_slot, __ATOMIC_RELAXED);
+  }
+
+  for (slot = 1 ; slot <= BANDWIDTH_SOURCES ; slot++)
+  {
+    if (g_sources[slot].used && !g_sources[slot].seen)
+      stop_metering(seq_handle, slot);
+  }
+}
+
+int bandwidth_limited(const snd_seq_addr_t * dest_ptr)
+{
+  struct port * port_ptr;
+
+  port_ptr = find_port(dest_ptr->client, dest_ptr->port, &g_output_ports);
+
+  return port_ptr != NULL && (port_ptr->type & SND_SEQ_PORT_TYPE_HARDWARE);
+}
+
+static
+unsigned int
+source_rate(unsigned int client, unsigned int port)
+{
+  unsigned int slot;
+
+  slot = g_slots[client & 0xff][port & 0xff];
+
+  return slot == 0 ? 0 : g_sources[slot].rate;
+}
+
+unsigned int bandwidth_rate(const snd_seq_addr_t * source_ptr)
+{
+  return source_rate(source_ptr->client, source_ptr->port);
+}
+
+/* connections on their way out no longer count */
+#define COUNTS(connection_ptr) ((connection_ptr)->pending != CONNECTION_PENDING_DISCONNECT)
+
+unsigned int bandwidth_fan_in(const snd_seq_addr_t * dest_ptr)
+{
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
+  unsigned int rate;
+
+  rate = 0;
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if (COUNTS(connection_ptr) && connection_ptr->dest_client == dest_ptr->client && connection_ptr->dest_port == dest_ptr->port)
+      rate += source_rate(connection_ptr->source_client, connection_ptr->source_port);
+  }
+
+  return rate;
+}
+
+/* returns 1 if the flagged destinations or their shown rates changed */
+static
+int
+flag_destinations(void)
+{
+  struct flagged flagged[BANDWIDTH_FLAGGED];
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
+  snd_seq_addr_t dest;
+  unsigned int count;
+  unsigned int i;
+  int changed;
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    g_fan_in[connection_ptr->dest_client & 0xff][connection_ptr->dest_port & 0xff] = 0;
+  }
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if (COUNTS(connection_ptr))
+      g_fan_in[connection_ptr->dest_client & 0xff][connection_ptr->dest_port & 0xff] += source_rate(connection_ptr->source_client, connection_ptr->source_port);
+  }
+
+  /* each destination once, its sum is cleared when it is looked at */
+  count = 0;
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+
+    dest.client = connection_ptr->dest_client;
+    dest.port = connection_ptr->dest_port;
+
+    if (g_fan_in[dest.client][dest.port] > g_budget && count < BANDWIDTH_FLAGGED && bandwidth_limited(&dest))
+    {
+      flagged[count].dest = dest;
+      flagged[count].rate = g_fan_in[dest.client][dest.port];
+      count++;
+    }
+
+    g_fan_in[dest.client][dest.port] = 0;
+  }
+
+  changed = count != g_flagged_count;
+
+  for (i = 0 ; i < count && !changed ; i++)
+  {
+    if (flagged[i].dest.client != g_flagged[i].dest.client ||
+        flagged[i].dest.port != g_flagged[i].dest.port ||
+        flagged[i].rate / 100 != g_flagged[i].rate / 100)
+      changed = 1;
+  }
+
+  memcpy(g_flagged, flagged, count * sizeof(struct flagged));
+  g_flagged_count = count;
+
+  return changed;
+}
+
+int bandwidth_sample(snd_seq_t * seq_handle)
+{
+  struct source * source_ptr;
+  unsigned long long now;
+  unsigned int slot;
+  unsigned int index;
+  unsigned int oldest;
+  unsigned int span;
+  uint64_t count;
+
+  if (bandwidth_timeout() != 0)
+    return 0;
+
+  now = now_ns();
+  g_next_ns = now + BANDWIDTH_INTERVAL_MS * 1000000ULL;
+
+  meter_sources(seq_handle);
+
+  index = g_samples % BANDWIDTH_WINDOW;
+
+  for (slot = 1 ; slot <= BANDWIDTH_SOURCES ; slot++)
+  {
+    source_ptr = g_sources + slot;
+    if (!source_ptr->used)
+      continue;
+
+    count = __atomic_load_n(g_counters + slot, __ATOMIC_RELAXED);
+
+    /* over the window, or as much of it as the source has been metered */
+    if (source_ptr->samples > 0)
+    {
+      span = source_ptr->samples < BANDWIDTH_WINDOW ? source_ptr->samples : BANDWIDTH_WINDOW;
+      oldest = (g_samples - span) % BANDWIDTH_WINDOW;
+      source_ptr->rate = (count - source_ptr->bytes[oldest]) * 1000000000ULL / (now - g_times[oldest]);
+    }
+
+    source_ptr->bytes[index] = count;
+    source_ptr->samples++;
+  }
+
+  g_times[index] = now;
+  g_samples++;
+
+  return flag_destinations();
+}
+
+int bandwidth_describe(unsigned int client, unsigned int port, char * buf, size_t size)
+{
+  unsigned int i;
+
+  for (i = 0 ; i < g_flagged_count ; i++)
+  {
+    if (g_flagged[i].dest.client == client && g_flagged[i].dest.port == port)
+    {
+      snprintf(buf, size, "in %.1f kB/s, budget %.1f", g_flagged[i].rate / 1000.0, g_budget / 1000.0);
+      return 1;
+    }
+  }
+
+  return 0;
+}
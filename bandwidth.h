@@ -0,0 +1,56 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Fan-in bandwidth estimator.
+ *
+ *  A 5-pin DIN MIDI port carries 31250 baud, 10 bits a byte, so 3125
+ *  bytes/s; several busy sources merged into one hardware port queue up
+ *  there, adding latency and eventually dropping events. With a budget
+ *  set, a port on the tap client is subscribed to every source in the
+ *  model and the reader thread adds the wire size of each event (without
+ *  running status) to a counter of its source. Every
+ *  BANDWIDTH_INTERVAL_MS the UI reads the counters into a ring of the
+ *  last BANDWIDTH_WINDOW samples, which gives each source its rate over
+ *  a sliding window, and sums the rates of the sources connected to each
+ *  hardware destination. Destinations over the budget are flagged.
+ *
+ *****************************************************************************/
+
+#ifndef BANDWIDTH_H__
+#define BANDWIDTH_H__
+
+#include <alsa/asoundlib.h>
+
+#define BANDWIDTH_DIN_BUDGET 3125       /* bytes/s */
+#define BANDWIDTH_INTERVAL_MS 250
+#define BANDWIDTH_WINDOW 8              /* samples, two seconds */
+#define BANDWIDTH_SOURCES 255           /* metered at once at most */
+#define BANDWIDTH_FLAGGED 64            /* destinations shown over budget at most */
+
+/* starts metering with a budget in bytes/s per destination, returns 0 or -1 */
+int bandwidth_open(unsigned int budget);
+void bandwidth_close(snd_seq_t * seq_handle);
+
+/* the budget, 0 when not metering */
+unsigned int bandwidth_budget(void);
+
+/* ms until the next sample is due, 0 if it is due now, -1 when not metering */
+int bandwidth_timeout(void);
+
+/* meter new sources and take a sample if one is due, returns 1 if the flagged destinations changed */
+int bandwidth_sample(snd_seq_t * seq_handle);
+
+/* bytes/s out of a metered source, 0 if it is not metered */
+unsigned int bandwidth_rate(const snd_seq_addr_t * source_ptr);
+
+/* bytes/s into dest from the sources connected to it in the model, pending connections included */
+unsigned int bandwidth_fan_in(const snd_seq_addr_t * dest_ptr);
+
+/* a hardware port the budget applies to */
+int bandwidth_limited(const snd_seq_addr_t * dest_ptr);
+
+/* rate of a flagged destination into buf, returns 0 and leaves buf alone if it is within budget */
+int bandwidth_describe(unsigned int client, unsigned int port, char * buf, size_t size);
+
+#endif /* #ifndef BANDWIDTH_H__ */
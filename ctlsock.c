@@ -0,0 +1,788 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - control socket
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "naconnect.h"
+#include "ctlsock.h"
+#include "intern.h"
+#include "seqops.h"
+
+#define CTLSOCK_LINE_MAX 512
+#define CTLSOCK_OUT_MAX (1024 * 1024)
+#define CTLSOCK_BATCH_MAX 4096
+
+struct ctlsock_op
+{
+  int subscribe;
+  snd_seq_addr_t sender;
+  snd_seq_addr_t dest;
+};
+
+struct ctlsock_client
+{
+  int fd;
+  char in[CTLSOCK_LINE_MAX];
+  size_t in_len;
+  int discard_line;             /* current line overflowed, skip until '\n' */
+  char * out;
+  size_t out_len;
+  size_t out_size;
+  unsigned int serial;          /* owner of its changes queued to the worker */
+  int in_batch;
+  const char * batch_err;       /* the batch failed, lines up to "end" are dropped */
+  struct ctlsock_op * batch;
+  int batch_count;
+  int batch_size;
+  int applying;                 /* the batch is being made, later lines wait */
+  int batch_sent;               /* ops handed to the worker or made here */
+  int waiting;                  /* of those, results not back yet */
+};
+
+static int g_listen_fd = -1;
+static char g_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct ctlsock_client g_clients[CTLSOCK_MAX_CLIENTS];
+static int g_topology_dirty;
+static unsigned int g_serial;
+
+static
+int
+set_nonblock(int fd)
+{
+  int flags;
+
+  flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return -1;
+
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int ctlsock_open(const char * path)
+{
+  struct sockaddr_un addr;
+  int i;
+
+  for (i = 0 ; i < CTLSOCK_MAX_CLIENTS ; i++)
+  {
+    g_clients[i].fd = -1;
+  }
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    ERR_OUT("Control socket path too long.");
+    return -1;
+  }
+
+  g_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (g_listen_fd < 0)
+  {
+    ERR_OUT("socket() failed - %s", strerror(errno));
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  /* a stale socket from a previous run would make bind() fail */
+  unlink(path);
+
+  if (bind(g_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    ERR_OUT("Cannot bind control socket %s - %s", path, strerror(errno));
+    goto close_fd;
+  }
+
+  if (listen(g_listen_fd, CTLSOCK_MAX_CLIENTS) < 0 || set_nonblock(g_listen_fd) < 0)
+  {
+    ERR_OUT("Cannot listen on control socket - %s", strerror(errno));
+    goto unlink_path;
+  }
+
+  strcpy(g_socket_path, path);
+
+  return 0;
+
+unlink_path:
+  unlink(path);
+close_fd:
+  close(g_listen_fd);
+  g_listen_fd = -1;
+  return -1;
+}
+
+static
+void
+client_close(struct ctlsock_client * client_ptr)
+{
+  close(client_ptr->fd);
+  client_ptr->fd = -1;
+  free(client_ptr->out);
+  free(client_ptr->batch);
+  memset(client_ptr, 0, sizeof(struct ctlsock_client));
+  client_ptr->fd = -1;
+}
+
+void ctlsock_close(void)
+{
+  int i;
+
+  if (g_listen_fd < 0)
+    return;
+
+  for (i = 0 ; i < CTLSOCK_MAX_CLIENTS ; i++)
+  {
+    if (g_clients[i].fd >= 0)
+      client_close(g_clients + i);
+  }
+
+  close(g_listen_fd);
+  g_listen_fd = -1;
+  unlink(g_socket_path);
+}
+
+int ctlsock_pollfds(struct pollfd * pfds)
+{
+  int i;
+  int count;
+
+  if (g_listen_fd < 0)
+    return 0;
+
+  pfds[0].fd = g_listen_fd;
+  pfds[0].events = POLLIN;
+  count = 1;
+
+  for (i = 0 ; i < CTLSOCK_MAX_CLIENTS ; i++)
+  {
+    if (g_clients[i].fd < 0)
+      continue;
+
+    pfds[count].fd = g_clients[i].fd;
+    pfds[count].events = g_clients[i].applying ? 0 : POLLIN;
+    if (g_clients[i].out_len > 0)
+      pfds[count].events |= POLLOUT;
+    count++;
+  }
+
+  return count;
+}
+
+static
+void
+reply(struct ctlsock_client * client_ptr, const char * format, ...)
+{
+  va_list ap;
+  int len;
+  size_t size;
+  char * out;
+
+  if (client_ptr->fd < 0)
+    return;
+
+  for (;;)
+  {
+    va_start(ap, format);
+    len = vsnprintf(client_ptr->out + client_ptr->out_len, client_ptr->out_size - client_ptr->out_len, format, ap);
+    va_end(ap);
+
+    if (len < 0)
+      return;
+
+    if (client_ptr->out_len + len < client_ptr->out_size)
+    {
+      client_ptr->out_len += len;
+      return;
+    }
+
+    size = client_ptr->out_size == 0 ? 4096 : client_ptr->out_size * 2;
+    if (size > CTLSOCK_OUT_MAX)
+    {
+      /* the peer does not read its replies, give up on it */
+      client_close(client_ptr);
+      return;
+    }
+
+    out = realloc(client_ptr->out, size);
+    if (out == NULL)
+    {
+      ERR_OUT("realloc() failed.");
+      client_close(client_ptr);
+      return;
+    }
+
+    client_ptr->out = out;
+    client_ptr->out_size = size;
+  }
+}
+
+static
+void
+flush_output(struct ctlsock_client * client_ptr)
+{
+  ssize_t ret;
+
+  while (client_ptr->fd >= 0 && client_ptr->out_len > 0)
+  {
+    ret = send(client_ptr->fd, client_ptr->out, client_ptr->out_len, MSG_NOSIGNAL);
+    if (ret < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return;
+
+      client_close(client_ptr);
+      return;
+    }
+
+    memmove(client_ptr->out, client_ptr->out + ret, client_ptr->out_len - ret);
+    client_ptr->out_len -= ret;
+  }
+}
+
+static
+int
+parse_addr(const char * str, snd_seq_addr_t * addr_ptr)
+{
+  unsigned int client, port;
+  char tail;
+
+  if (str == NULL || sscanf(str, "%u:%u%c", &client, &port, &tail) != 2)
+    return -1;
+
+  if (client > 255 || port > 255)
+    return -1;
+
+  addr_ptr->client = client;
+  addr_ptr->port = port;
+
+  return 0;
+}
+
+static
+const char *
+name_or_unknown(unsigned int name_id)
+{
+  return (name_id == INTERN_EMPTY) ? "???" : intern_str(name_id);
+}
+
+/* the model already has the changes, publish them once per dispatch */
+static
+void
+sync_topology(snd_seq_t * seq_handle, int * rebuilt_ptr)
+{
+  if (!g_topology_dirty)
+    return;
+
+  publish_topology();
+  g_topology_dirty = 0;
+  *rebuilt_ptr = 1;
+}
+
+static
+void
+cmd_list(struct ctlsock_client * client_ptr)
+{
+  struct list_head * node_ptr;
+  struct port * port_ptr;
+  int count;
+
+  count = 0;
+  list_for_each(node_ptr, &g_input_ports)
+    count++;
+  list_for_each(node_ptr, &g_output_ports)
+    count++;
+
+  reply(client_ptr, "OK %d\n", count);
+
+  list_for_each(node_ptr, &g_input_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+    reply(
+      client_ptr,
+      "in %u:%u %s\n",
+      port_ptr->client,
+      port_ptr->port,
+      intern_str(port_ptr->name_id));
+  }
+
+  list_for_each(node_ptr, &g_output_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+    reply(
+      client_ptr,
+      "out %u:%u %s\n",
+      port_ptr->client,
+      port_ptr->port,
+      intern_str(port_ptr->name_id));
+  }
+}
+
+static
+void
+cmd_neighbors(struct ctlsock_client * client_ptr, const snd_seq_addr_t * addr_ptr)
+{
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
+  int count;
+
+  count = 0;
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if ((connection_ptr->source_client == addr_ptr->client && connection_ptr->source_port == addr_ptr->port) ||
+        (connection_ptr->dest_client == addr_ptr->client && connection_ptr->dest_port == addr_ptr->port))
+      count++;
+  }
+
+  reply(client_ptr, "OK %d\n", count);
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+
+    if (connection_ptr->source_client == addr_ptr->client && connection_ptr->source_port == addr_ptr->port)
+    {
+      reply(
+        client_ptr,
+        "to %u:%u %s\n",
+        connection_ptr->dest_client,
+        connection_ptr->dest_port,
+        name_or_unknown(connection_ptr->dest_name_id));
+    }
+
+    if (connection_ptr->dest_client == addr_ptr->client && connection_ptr->dest_port == addr_ptr->port)
+    {
+      reply(
+        client_ptr,
+        "from %u:%u %s\n",
+        connection_ptr->source_client,
+        connection_ptr->source_port,
+        name_or_unknown(connection_ptr->source_name_id));
+    }
+  }
+}
+
+/*
+ * The ops go to the operations worker, as many as its queue takes; the
+ * rest are tried again on the next dispatch. Their results are answered
+ * by ctlsock_settle(). Without the worker they are made here.
+ */
+static
+void
+submit_ops(struct ctlsock_client * client_ptr, snd_seq_t * seq_handle)
+{
+  struct ctlsock_op * op_ptr;
+  int ret;
+
+  while (client_ptr->batch_sent < client_ptr->batch_count)
+  {
+    op_ptr = client_ptr->batch + client_ptr->batch_sent;
+
+    if (seqops_client() < 0)
+    {
+      ret = change_subscription(seq_handle, &op_ptr->sender, &op_ptr->dest, op_ptr->subscribe);
+      if (ret < 0)
+      {
+        reply(client_ptr, "ERR %s\n", snd_strerror(ret));
+      }
+      else
+      {
+        reply(client_ptr, "OK\n");
+        g_topology_dirty = 1;
+      }
+    }
+    else
+    {
+      if (seqops_submit(op_ptr->subscribe, &op_ptr->sender, &op_ptr->dest, client_ptr->serial) < 0)
+        return;
+
+      model_pending(seq_handle, &op_ptr->sender, &op_ptr->dest, op_ptr->subscribe);
+      g_topology_dirty = 1;
+      client_ptr->waiting++;
+    }
+
+    client_ptr->batch_sent++;
+  }
+}
+
+static
+void
+apply_batch(struct ctlsock_client * client_ptr, snd_seq_t * seq_handle)
+{
+  client_ptr->applying = 1;
+  client_ptr->batch_sent = 0;
+  client_ptr->waiting = 0;
+
+  submit_ops(client_ptr, seq_handle);
+}
+
+/* returns 1 once the batch being made is answered in full */
+static
+int
+applied(struct ctlsock_client * client_ptr)
+{
+  if (!client_ptr->applying)
+    return 1;
+
+  if (client_ptr->batch_sent < client_ptr->batch_count || client_ptr->waiting > 0)
+    return 0;
+
+  client_ptr->applying = 0;
+  client_ptr->batch_count = 0;
+
+  return 1;
+}
+
+void ctlsock_settle(unsigned int owner, int error)
+{
+  int i;
+
+  for (i = 0 ; i < CTLSOCK_MAX_CLIENTS ; i++)
+  {
+    /* a client that hung up meanwhile is not asked */
+    if (g_clients[i].fd < 0 || g_clients[i].serial != owner || g_clients[i].waiting == 0)
+      continue;
+
+    if (error < 0)
+      reply(g_clients + i, "ERR %s\n", snd_strerror(error));
+    else
+      reply(g_clients + i, "OK\n");
+
+    g_clients[i].waiting--;
+    return;
+  }
+}
+
+/* on failure the batch is answered with a single ERR at its "end" */
+static
+void
+batch_add(struct ctlsock_client * client_ptr, const struct ctlsock_op * op_ptr)
+{
+  struct ctlsock_op * batch;
+  int size;
+
+  if (client_ptr->batch_count == client_ptr->batch_size)
+  {
+    if (client_ptr->batch_size >= CTLSOCK_BATCH_MAX)
+    {
+      client_ptr->batch_err = "batch too large";
+      return;
+    }
+
+    size = client_ptr->batch_size == 0 ? 64 : client_ptr->batch_size * 2;
+    batch = realloc(client_ptr->batch, size * sizeof(struct ctlsock_op));
+    if (batch == NULL)
+    {
+      client_ptr->batch_err = "out of memory";
+      return;
+    }
+
+    client_ptr->batch = batch;
+    client_ptr->batch_size = size;
+  }
+
+  client_ptr->batch[client_ptr->batch_count++] = *op_ptr;
+}
+
+static
+void
+handle_line(struct ctlsock_client * client_ptr, char * line, snd_seq_t * seq_handle, int * rebuilt_ptr)
+{
+  char * saveptr;
+  const char * cmd;
+  const char * arg1;
+  const char * arg2;
+  struct ctlsock_op op;
+
+  cmd = strtok_r(line, " \t\r", &saveptr);
+  if (cmd == NULL)
+    return;                     /* empty lines are ignored, not answered */
+
+  arg1 = strtok_r(NULL, " \t\r", &saveptr);
+  arg2 = strtok_r(NULL, " \t\r", &saveptr);
+
+  if (client_ptr->in_batch && client_ptr->batch_err != NULL)
+  {
+    if (strcmp(cmd, "end") == 0)
+    {
+      reply(client_ptr, "ERR %s, batch aborted\n", client_ptr->batch_err);
+      client_ptr->in_batch = 0;
+      client_ptr->batch_err = NULL;
+      client_ptr->batch_count = 0;
+    }
+
+    return;
+  }
+
+  if (strcmp(cmd, "connect") == 0 || strcmp(cmd, "disconnect") == 0)
+  {
+    op.subscribe = cmd[0] == 'c';
+    if (parse_addr(arg1, &op.sender) < 0 || parse_addr(arg2, &op.dest) < 0)
+    {
+      if (client_ptr->in_batch)
+        client_ptr->batch_err = "bad batch line";
+      else
+        reply(client_ptr, "ERR usage: %s <client>:<port> <client>:<port>\n", cmd);
+      return;
+    }
+
+    if (client_ptr->in_batch)
+    {
+      batch_add(client_ptr, &op);
+      return;
+    }
+
+    /* made as a batch of one, without the "OK <n>" */
+    client_ptr->batch_count = 0;
+    batch_add(client_ptr, &op);
+    if (client_ptr->batch_err != NULL)
+    {
+      reply(client_ptr, "ERR %s\n", client_ptr->batch_err);
+      client_ptr->batch_err = NULL;
+      return;
+    }
+
+    apply_batch(client_ptr, seq_handle);
+    return;
+  }
+
+  if (client_ptr->in_batch)
+  {
+    if (strcmp(cmd, "end") == 0)
+    {
+      reply(client_ptr, "OK %d\n", client_ptr->batch_count);
+      client_ptr->in_batch = 0;
+      apply_batch(client_ptr, seq_handle);
+      return;
+    }
+
+    client_ptr->batch_err = "only connect/disconnect allowed in batch";
+    return;
+  }
+
+  if (strcmp(cmd, "apply-batch") == 0)
+  {
+    client_ptr->in_batch = 1;
+    client_ptr->batch_err = NULL;
+    client_ptr->batch_count = 0;
+    return;
+  }
+
+  /* queries must see the effect of mutations pipelined before them */
+  sync_topology(seq_handle, rebuilt_ptr);
+
+  if (strcmp(cmd, "list") == 0)
+  {
+    cmd_list(client_ptr);
+    return;
+  }
+
+  if (strcmp(cmd, "neighbors") == 0)
+  {
+    if (parse_addr(arg1, &op.sender) < 0)
+    {
+      reply(client_ptr, "ERR usage: neighbors <client>:<port>\n");
+      return;
+    }
+
+    cmd_neighbors(client_ptr, &op.sender);
+    return;
+  }
+
+  if (strcmp(cmd, "connected") == 0)
+  {
+    if (parse_addr(arg1, &op.sender) < 0 || parse_addr(arg2, &op.dest) < 0)
+    {
+      reply(client_ptr, "ERR usage: connected <client>:<port> <client>:<port>\n");
+      return;
+    }
+
+    reply(
+      client_ptr,
+      "OK %d\n",
+      find_connection(op.sender.client, op.sender.port, op.dest.client, op.dest.port) != NULL);
+    return;
+  }
+
+  reply(client_ptr, "ERR unknown command '%s'\n", cmd);
+}
+
+/* lines after a connect, a disconnect or a batch wait until it is answered */
+static
+void
+handle_lines(struct ctlsock_client * client_ptr, snd_seq_t * seq_handle, int * rebuilt_ptr)
+{
+  char * start_ptr;
+  char * end_ptr;
+  size_t len;
+
+  start_ptr = client_ptr->in;
+  while (applied(client_ptr) &&
+         (end_ptr = memchr(start_ptr, '\n', client_ptr->in + client_ptr->in_len - start_ptr)) != NULL)
+  {
+    *end_ptr = 0;
+    if (client_ptr->discard_line)
+      client_ptr->discard_line = 0;
+    else
+      handle_line(client_ptr, start_ptr, seq_handle, rebuilt_ptr);
+
+    if (client_ptr->fd < 0)
+      return;
+
+    start_ptr = end_ptr + 1;
+  }
+
+  len = client_ptr->in + client_ptr->in_len - start_ptr;
+  memmove(client_ptr->in, start_ptr, len);
+  client_ptr->in_len = len;
+
+  /* full of lines that wait is not too long */
+  if (client_ptr->in_len == sizeof(client_ptr->in) && !client_ptr->applying)
+  {
+    if (!client_ptr->discard_line)
+      reply(client_ptr, "ERR line too long\n");
+    client_ptr->discard_line = 1;
+    client_ptr->in_len = 0;
+  }
+}
+
+static
+void
+client_read(struct ctlsock_client * client_ptr, snd_seq_t * seq_handle, int * rebuilt_ptr)
+{
+  ssize_t ret;
+
+  /* not read while lines wait, ctlsock_dispatch() goes on once they can */
+  while (!client_ptr->applying)
+  {
+    ret = recv(client_ptr->fd, client_ptr->in + client_ptr->in_len, sizeof(client_ptr->in) - client_ptr->in_len, 0);
+    if (ret < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return;
+
+      client_close(client_ptr);
+      return;
+    }
+
+    if (ret == 0)
+    {
+      /* answer what is already queued, then hang up */
+      flush_output(client_ptr);
+      if (client_ptr->fd >= 0)
+        client_close(client_ptr);
+      return;
+    }
+
+    client_ptr->in_len += ret;
+
+    handle_lines(client_ptr, seq_handle, rebuilt_ptr);
+    if (client_ptr->fd < 0)
+      return;
+  }
+}
+
+static
+void
+accept_clients(void)
+{
+  int fd;
+  int i;
+
+  while ((fd = accept(g_listen_fd, NULL, NULL)) >= 0)
+  {
+    for (i = 0 ; i < CTLSOCK_MAX_CLIENTS ; i++)
+    {
+      if (g_clients[i].fd < 0)
+        break;
+    }
+
+    if (i == CTLSOCK_MAX_CLIENTS || set_nonblock(fd) < 0)
+    {
+      close(fd);
+      continue;
+    }
+
+    memset(g_clients + i, 0, sizeof(struct ctlsock_client));
+    g_clients[i].fd = fd;
+
+    /* 0 is the UI's */
+    if (++g_serial == 0)
+      g_serial = 1;
+    g_clients[i].serial = g_serial;
+  }
+}
+
+int ctlsock_dispatch(snd_seq_t * seq_handle, const struct pollfd * pfds, int count)
+{
+  int i, j;
+  int rebuilt;
+
+  rebuilt = 0;
+
+  for (i = 1 ; i < count ; i++)
+  {
+    if (pfds[i].revents == 0)
+      continue;
+
+    for (j = 0 ; j < CTLSOCK_MAX_CLIENTS ; j++)
+    {
+      if (g_clients[j].fd == pfds[i].fd)
+        break;
+    }
+
+    if (j == CTLSOCK_MAX_CLIENTS)
+      continue;
+
+    /* there is nobody left to answer */
+    if (g_clients[j].applying && (pfds[i].revents & (POLLHUP | POLLERR)))
+    {
+      client_close(g_clients + j);
+      continue;
+    }
+
+    if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+      client_read(g_clients + j, seq_handle, &rebuilt);
+
+    if (g_clients[j].fd >= 0)
+      flush_output(g_clients + j);
+  }
+
+  /* go on with the clients whose changes were answered or that wait for room in the queue */
+  for (j = 0 ; j < CTLSOCK_MAX_CLIENTS ; j++)
+  {
+    if (g_clients[j].fd < 0 || !g_clients[j].applying)
+      continue;
+
+    submit_ops(g_clients + j, seq_handle);
+    handle_lines(g_clients + j, seq_handle, &rebuilt);
+
+    if (g_clients[j].fd >= 0)
+      flush_output(g_clients + j);
+  }
+
+  if (count > 0 && (pfds[0].revents & POLLIN))
+    accept_clients();
+
+  sync_topology(seq_handle, &rebuilt);
+
+  return rebuilt;
+}
@@ -0,0 +1,50 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Unix domain socket control interface.
+ *
+ *  The protocol is line based. Every request is answered, in order, with a
+ *  line starting with "OK" or "ERR". Replies that carry a list have the
+ *  form "OK <n>" followed by exactly n lines. Requests can be pipelined.
+ *
+ *   list                         - all ports, "in|out <client>:<port> <name>"
+ *   neighbors <c>:<p>            - connected ports, "to|from <client>:<port> <name>"
+ *   connected <c>:<p> <c>:<p>    - "OK 1" or "OK 0"
+ *   connect <c>:<p> <c>:<p>
+ *   disconnect <c>:<p> <c>:<p>
+ *   apply-batch                  - following connect/disconnect lines are
+ *   end                            collected and applied at "end", answered
+ *                                  with "OK <n>" and one result line per op,
+ *                                  or one "ERR" if a line was bad or it could
+ *                                  not be held
+ *
+ *  Connects and disconnects are made by the operations worker (seqops.h)
+ *  and answered once it is done, so they do not hold up the UI. Lines
+ *  after them are read only then, which keeps the replies in order and
+ *  lets queries see their effect.
+ *
+ *****************************************************************************/
+
+#ifndef CTLSOCK_H__
+#define CTLSOCK_H__
+
+#include <poll.h>
+#include <alsa/asoundlib.h>
+
+#define CTLSOCK_MAX_CLIENTS 16
+#define CTLSOCK_MAX_POLLFDS (CTLSOCK_MAX_CLIENTS + 1)
+
+int ctlsock_open(const char * path);
+void ctlsock_close(void);
+
+/* returns number of pollfds filled, at most CTLSOCK_MAX_POLLFDS */
+int ctlsock_pollfds(struct pollfd * pfds);
+
+/* returns 1 if the in-memory topology was rebuilt */
+int ctlsock_dispatch(snd_seq_t * seq_handle, const struct pollfd * pfds, int count);
+
+/* answers a change queued for a client, owner as given to seqops_submit() */
+void ctlsock_settle(unsigned int owner, int error);
+
+#endif /* #ifndef CTLSOCK_H__ */
@@ -0,0 +1,193 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - frame scheduler
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+
+#include "frame.h"
+
+static int g_fd = -1;
+static uint64_t g_interval_ns;  /* 0 when idle */
+static uint64_t g_last_ns;      /* start of the last frame */
+static int g_armed;
+
+static int g_io_fd = -1;        /* I/O counters of the UI thread */
+static unsigned long g_written; /* by the UI thread when the refresh began */
+static unsigned long g_output;  /* by refreshes */
+
+static
+uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int frame_open(int fps)
+{
+  if (fps <= 0)
+  {
+    g_interval_ns = 0;
+    return 0;
+  }
+
+  if (fps > FRAME_MAX_FPS)
+    fps = FRAME_MAX_FPS;
+
+  g_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (g_fd < 0)
+  {
+    fprintf(stderr, "timerfd_create() failed - %s\n", strerror(errno));
+    return -1;
+  }
+
+  g_interval_ns = 1000000000 / fps;
+  g_last_ns = 0;
+  g_armed = 0;
+
+  return 0;
+}
+
+void frame_close(void)
+{
+  if (g_fd >= 0)
+  {
+    close(g_fd);
+    g_fd = -1;
+  }
+
+  if (g_io_fd >= 0)
+  {
+    close(g_io_fd);
+    g_io_fd = -1;
+  }
+}
+
+int frame_idle(void)
+{
+  return g_interval_ns == 0;
+}
+
+int frame_interval_ms(void)
+{
+  if (g_interval_ns == 0)
+    return -1;
+
+  return g_interval_ns / 1000000;
+}
+
+int frame_fd(void)
+{
+  return g_fd;
+}
+
+int frame_begin(void)
+{
+  struct itimerspec its;
+  uint64_t now;
+  uint64_t left;
+
+  now = now_ns();
+
+  if (g_interval_ns == 0 || now - g_last_ns >= g_interval_ns)
+  {
+    g_last_ns = now;
+    return 1;
+  }
+
+  /* one timer for however many changes come in during the frame */
+  if (!g_armed)
+  {
+    left = g_last_ns + g_interval_ns - now;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = left / 1000000000;
+    its.it_value.tv_nsec = left % 1000000000;
+
+    if (timerfd_settime(g_fd, 0, &its, NULL) == 0)
+      g_armed = 1;
+  }
+
+  return 0;
+}
+
+void frame_expired(void)
+{
+  uint64_t expirations;
+
+  /* drained only so it stops being readable, the next frame_begin() arms it again */
+  (void)!read(g_fd, &expirations, sizeof(expirations));
+
+  g_armed = 0;
+}
+
+int frame_output_open(void)
+{
+  g_io_fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+
+  return g_io_fd < 0 ? -1 : 0;
+}
+
+static
+unsigned long
+thread_written(void)
+{
+  char buf[256];
+  unsigned long bytes;
+  ssize_t len;
+
+  if (g_io_fd < 0)
+    return 0;
+
+  len = pread(g_io_fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+    return 0;
+
+  buf[len] = '\0';
+
+  if (sscanf(buf, "rchar: %*u wchar: %lu", &bytes) != 1)
+    return 0;
+
+  return bytes;
+}
+
+void frame_output_begin(void)
+{
+  g_written = thread_written();
+}
+
+void frame_output_end(void)
+{
+  unsigned long written;
+
+  written = thread_written();
+  if (written > g_written)
+    g_output += written - g_written;
+}
+
+unsigned long frame_output_bytes(void)
+{
+  return g_output;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Frame scheduler.
+ *
+ *  Announces, meter samples, control socket requests and keys only mark
+ *  the screen as changed; it is drawn at most once per frame interval.
+ *  A change that comes in before the interval is over arms a timerfd for
+ *  the rest of it, so a storm of hundreds of announces costs one render
+ *  per frame however long it lasts.
+ *
+ *  At 0 frames per second the screen is idle: it is drawn only after a
+ *  key and nothing wakes the main loop periodically.
+ *
+ *  On a slow link each refresh of the screen is bracketed with reads of
+ *  the bytes the UI thread wrote from /proc/thread-self/io. Inside a
+ *  refresh ncurses writes nothing but terminal output, so the sum of
+ *  these differences leaves out control socket replies, trace records
+ *  and cache writes, and a frame can be held to an output budget.
+ *
+ *****************************************************************************/
+
+#ifndef FRAME_H__
+#define FRAME_H__
+
+#define FRAME_DEFAULT_FPS 20
+#define FRAME_MAX_FPS 240
+
+/* returns 0, or -1 if the timer cannot be created */
+int frame_open(int fps);
+void frame_close(void);
+
+/* 1 when drawn only after keys */
+int frame_idle(void);
+
+/* ms between frames, -1 when idle */
+int frame_interval_ms(void);
+
+/* readable when a deferred frame is due, -1 when idle */
+int frame_fd(void);
+
+/* 1 if a frame may be drawn now, else the timer is armed for it and 0 is returned */
+int frame_begin(void);
+
+/* call when frame_fd() gets readable */
+void frame_expired(void);
+
+/* on the UI thread, returns 0 or -1 if its counters cannot be read */
+int frame_output_open(void);
+
+/* around a refresh of the screen, what the UI thread writes in between is terminal output */
+void frame_output_begin(void);
+void frame_output_end(void);
+
+/* terminal output so far, 0 without frame_output_open() */
+unsigned long frame_output_bytes(void);
+
+#endif /* #ifndef FRAME_H__ */
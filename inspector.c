@@ -0,0 +1,300 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - event inspector
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "naconnect.h"
+#include "inspector.h"
+#include "tap.h"
+
+/* must be a power of two */
+#define RING_SIZE 4096
+
+/* more events than this in one frame are sampled */
+#define SAMPLE_LINES 32
+
+struct ring_event
+{
+  uint64_t time_ns;
+  snd_seq_event_t event;
+};
+
+/*
+ * head is written by the reader thread only, tail by the UI only. The
+ * slot contents are published with the release store of head and
+ * handed back with the release store of tail.
+ */
+static struct ring_event g_ring[RING_SIZE];
+static unsigned long g_head __attribute__((aligned(64)));
+static unsigned long g_tail __attribute__((aligned(64)));
+static unsigned long g_received;
+static unsigned long g_dropped;
+
+static int g_port = -1;
+static int g_active;
+static snd_seq_addr_t g_source;
+static uint64_t g_start_ns;
+
+static char g_lines[INSPECTOR_LINES][INSPECTOR_LINE_MAX];
+static unsigned int g_lines_count;
+static unsigned int g_lines_next;
+
+static unsigned long g_base_received;
+static unsigned long g_base_dropped;
+static unsigned int g_sample_step;
+static uint64_t g_rate_start_ns;
+static unsigned long g_rate_start_received;
+static unsigned long g_rate;
+
+static
+void
+tap_event(void * context, const snd_seq_event_t * event_ptr, uint64_t time_ns)
+{
+  unsigned long head;
+  struct ring_event * slot_ptr;
+
+  head = g_head;
+
+  __atomic_store_n(&g_received, g_received + 1, __ATOMIC_RELAXED);
+
+  if (head - __atomic_load_n(&g_tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+  {
+    __atomic_store_n(&g_dropped, g_dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  slot_ptr = g_ring + (head & (RING_SIZE - 1));
+  slot_ptr->time_ns = time_ns;
+  slot_ptr->event = *event_ptr;
+
+  /* variable length data lives in the input buffer, keep only its length */
+  if (snd_seq_ev_is_variable(event_ptr))
+    slot_ptr->event.data.ext.ptr = NULL;
+
+  __atomic_store_n(&g_head, head + 1, __ATOMIC_RELEASE);
+}
+
+int inspector_start(snd_seq_t * seq_handle, const snd_seq_addr_t * source_ptr)
+{
+  snd_seq_addr_t dest;
+
+  if (tap_open() < 0)
+    return -1;
+
+  if (g_port < 0)
+  {
+    g_port = tap_create_port("inspector", 0, tap_event, NULL);
+    if (g_port < 0)
+      return -1;
+  }
+
+  inspector_stop(seq_handle);
+
+  dest.client = tap_client();
+  dest.port = g_port;
+
+  if (subscribe_ports(seq_handle, source_ptr, &dest) < 0)
+    return -1;
+
+  g_source = *source_ptr;
+  g_active = 1;
+  g_start_ns = tap_now_ns();
+  g_rate_start_ns = g_start_ns;
+  g_rate_start_received = __atomic_load_n(&g_received, __ATOMIC_RELAXED);
+  g_base_received = g_rate_start_received;
+  g_base_dropped = __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+  g_rate = 0;
+  g_sample_step = 1;
+  g_lines_count = 0;
+  g_lines_next = 0;
+
+  return 0;
+}
+
+void inspector_stop(snd_seq_t * seq_handle)
+{
+  snd_seq_addr_t dest;
+
+  if (!g_active)
+    return;
+
+  dest.client = tap_client();
+  dest.port = g_port;
+
+  unsubscribe_ports(seq_handle, &g_source, &dest);
+
+  g_active = 0;
+}
+
+const snd_seq_addr_t * inspector_source(void)
+{
+  return g_active ? &g_source : NULL;
+}
+
+static
+const char *
+note_name(unsigned int note, char * buf, size_t size)
+{
+  static const char * names[12] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+
+  snprintf(buf, size, "%s%d", names[note % 12], (int)note / 12 - 1);
+
+  return buf;
+}
+
+int inspector_describe(const snd_seq_event_t * event_ptr, char * buf, size_t size)
+{
+  char note[8];
+
+  switch (event_ptr->type)
+  {
+  case SND_SEQ_EVENT_NOTEON:
+    return snprintf(buf, size, "ch %2u note on  %-4s %3u vel %u", event_ptr->data.note.channel + 1, note_name(event_ptr->data.note.note, note, sizeof(note)), event_ptr->data.note.note, event_ptr->data.note.velocity);
+  case SND_SEQ_EVENT_NOTEOFF:
+    return snprintf(buf, size, "ch %2u note off %-4s %3u vel %u", event_ptr->data.note.channel + 1, note_name(event_ptr->data.note.note, note, sizeof(note)), event_ptr->data.note.note, event_ptr->data.note.velocity);
+  case SND_SEQ_EVENT_KEYPRESS:
+    return snprintf(buf, size, "ch %2u aftertouch %-4s %u", event_ptr->data.note.channel + 1, note_name(event_ptr->data.note.note, note, sizeof(note)), event_ptr->data.note.velocity);
+  case SND_SEQ_EVENT_CONTROLLER:
+    return snprintf(buf, size, "ch %2u cc %3u = %d", event_ptr->data.control.channel + 1, event_ptr->data.control.param, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_CONTROL14:
+    return snprintf(buf, size, "ch %2u cc14 %3u = %d", event_ptr->data.control.channel + 1, event_ptr->data.control.param, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_NONREGPARAM:
+    return snprintf(buf, size, "ch %2u nrpn %u = %d", event_ptr->data.control.channel + 1, event_ptr->data.control.param, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_REGPARAM:
+    return snprintf(buf, size, "ch %2u rpn %u = %d", event_ptr->data.control.channel + 1, event_ptr->data.control.param, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_PGMCHANGE:
+    return snprintf(buf, size, "ch %2u program %d", event_ptr->data.control.channel + 1, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_CHANPRESS:
+    return snprintf(buf, size, "ch %2u pressure %d", event_ptr->data.control.channel + 1, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_PITCHBEND:
+    return snprintf(buf, size, "ch %2u pitch bend %d", event_ptr->data.control.channel + 1, event_ptr->data.control.value);
+  case SND_SEQ_EVENT_SONGPOS:
+    return snprintf(buf, size, "song position %d", event_ptr->data.control.value);
+  case SND_SEQ_EVENT_SONGSEL:
+    return snprintf(buf, size, "song select %d", event_ptr->data.control.value);
+  case SND_SEQ_EVENT_QFRAME:
+    return snprintf(buf, size, "mtc quarter frame %d", event_ptr->data.control.value);
+  case SND_SEQ_EVENT_START:
+    return snprintf(buf, size, "start");
+  case SND_SEQ_EVENT_CONTINUE:
+    return snprintf(buf, size, "continue");
+  case SND_SEQ_EVENT_STOP:
+    return snprintf(buf, size, "stop");
+  case SND_SEQ_EVENT_CLOCK:
+    return snprintf(buf, size, "clock");
+  case SND_SEQ_EVENT_TICK:
+    return snprintf(buf, size, "tick");
+  case SND_SEQ_EVENT_TUNE_REQUEST:
+    return snprintf(buf, size, "tune request");
+  case SND_SEQ_EVENT_RESET:
+    return snprintf(buf, size, "reset");
+  case SND_SEQ_EVENT_SENSING:
+    return snprintf(buf, size, "active sensing");
+  case SND_SEQ_EVENT_SYSEX:
+    return snprintf(buf, size, "sysex %u bytes", event_ptr->data.ext.len);
+  }
+
+  return snprintf(buf, size, "event type %u", event_ptr->type);
+}
+
+static
+void
+add_line(const struct ring_event * slot_ptr)
+{
+  char * line;
+  uint64_t time_ns;
+  int len;
+
+  line = g_lines[g_lines_next];
+
+  time_ns = slot_ptr->time_ns > g_start_ns ? slot_ptr->time_ns - g_start_ns : 0;
+
+  len = snprintf(
+    line,
+    INSPECTOR_LINE_MAX,
+    "%6lu.%03lu %3u:%-3u ",
+    (unsigned long)(time_ns / 1000000000),
+    (unsigned long)(time_ns / 1000000 % 1000),
+    slot_ptr->event.source.client,
+    slot_ptr->event.source.port);
+
+  inspector_describe(&slot_ptr->event, line + len, INSPECTOR_LINE_MAX - len);
+
+  g_lines_next = (g_lines_next + 1) % INSPECTOR_LINES;
+  if (g_lines_count < INSPECTOR_LINES)
+    g_lines_count++;
+}
+
+int inspector_drain(void)
+{
+  unsigned long head;
+  unsigned long tail;
+  unsigned long pending;
+  uint64_t now;
+
+  head = __atomic_load_n(&g_head, __ATOMIC_ACQUIRE);
+  tail = g_tail;
+
+  pending = head - tail;
+
+  now = tap_now_ns();
+  if (now - g_rate_start_ns >= 1000000000)
+  {
+    g_rate = __atomic_load_n(&g_received, __ATOMIC_RELAXED) - g_rate_start_received;
+    g_rate = g_rate * 1000000000 / (now - g_rate_start_ns);
+    g_rate_start_ns = now;
+    g_rate_start_received = __atomic_load_n(&g_received, __ATOMIC_RELAXED);
+  }
+
+  if (pending == 0)
+    return 0;
+
+  /* decoding is the expensive part, at high rates decode every n-th event */
+  g_sample_step = (pending + SAMPLE_LINES - 1) / SAMPLE_LINES;
+
+  /* a stopped inspector still drains, leftovers of the old source are dropped */
+  for ( ; tail != head ; tail++)
+  {
+    if (g_active && (head - tail - 1) % g_sample_step == 0)
+      add_line(g_ring + (tail & (RING_SIZE - 1)));
+  }
+
+  __atomic_store_n(&g_tail, tail, __ATOMIC_RELEASE);
+
+  return g_active;
+}
+
+unsigned int inspector_lines(void)
+{
+  return g_lines_count;
+}
+
+const char * inspector_line(unsigned int age)
+{
+  if (age >= g_lines_count)
+    return "";
+
+  return g_lines[(g_lines_next + INSPECTOR_LINES - 1 - age) % INSPECTOR_LINES];
+}
+
+void inspector_get_stats(struct inspector_stats * stats_ptr)
+{
+  stats_ptr->received = __atomic_load_n(&g_received, __ATOMIC_RELAXED) - g_base_received;
+  stats_ptr->dropped = __atomic_load_n(&g_dropped, __ATOMIC_RELAXED) - g_base_dropped;
+  stats_ptr->rate = g_rate;
+  stats_ptr->sample_step = g_sample_step;
+}
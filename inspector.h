@@ -0,0 +1,51 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Event inspector.
+ *
+ *  A port on the tap client is subscribed to one source. Its callback
+ *  copies every event into a single producer, single consumer ring; when
+ *  the ring is full the event is counted as dropped, the reader thread
+ *  never waits. The UI drains the ring once per frame and decodes into a
+ *  fixed history of text lines. If more events arrived in a frame than
+ *  can be shown, only every n-th one is decoded (sampled 1/n).
+ *
+ *****************************************************************************/
+
+#ifndef INSPECTOR_H__
+#define INSPECTOR_H__
+
+#include <alsa/asoundlib.h>
+
+#define INSPECTOR_LINES 256
+#define INSPECTOR_LINE_MAX 96
+
+struct inspector_stats
+{
+  unsigned long received;       /* events seen by the reader thread, since start */
+  unsigned long dropped;        /* lost because the ring was full */
+  unsigned long rate;           /* events per second, last full second */
+  unsigned int sample_step;     /* 1 if every event of the last frame was decoded */
+};
+
+/* subscribe the inspector to source, replacing the previous one */
+int inspector_start(snd_seq_t * seq_handle, const snd_seq_addr_t * source_ptr);
+void inspector_stop(snd_seq_t * seq_handle);
+
+/* source being inspected, NULL when off */
+const snd_seq_addr_t * inspector_source(void);
+
+/* drain the ring, once per frame; returns 1 if anything new was decoded */
+int inspector_drain(void);
+
+/* lines are numbered from the newest, 0..inspector_lines()-1 */
+unsigned int inspector_lines(void);
+const char * inspector_line(unsigned int age);
+
+void inspector_get_stats(struct inspector_stats * stats_ptr);
+
+/* one line human readable description of a MIDI event */
+int inspector_describe(const snd_seq_event_t * event_ptr, char * buf, size_t size);
+
+#endif /* #ifndef INSPECTOR_H__ */
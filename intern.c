@@ -0,0 +1,277 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - name interner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+#define ARENA_BLOCK_SIZE 4096
+
+struct interned
+{
+  const char * str;
+  unsigned int hash;
+  unsigned int len;
+  unsigned int width;
+};
+
+struct arena_block
+{
+  struct arena_block * next_ptr;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+static struct interned * g_names;
+static unsigned int g_names_count;
+static unsigned int g_names_size;
+
+/* open addressing, slots hold ids, 0 marks a free slot */
+static unsigned int * g_slots;
+static unsigned int g_slots_mask;
+
+static struct arena_block * g_arena_ptr;
+static unsigned long g_arena_bytes;
+
+static
+unsigned int
+hash_str(const char * str, unsigned int * len_ptr)
+{
+  const unsigned char * byte_ptr;
+  unsigned int hash;
+
+  hash = 2166136261u;
+
+  for (byte_ptr = (const unsigned char *)str ; *byte_ptr != 0 ; byte_ptr++)
+  {
+    hash = (hash ^ *byte_ptr) * 16777619u;
+  }
+
+  *len_ptr = byte_ptr - (const unsigned char *)str;
+
+  return hash;
+}
+
+/* columns taken on screen, counting UTF-8 sequences as one column */
+static
+unsigned int
+display_width(const char * str, unsigned int len)
+{
+  unsigned int i;
+  unsigned int width;
+
+  width = 0;
+  for (i = 0 ; i < len ; i++)
+  {
+    if (((unsigned char)str[i] & 0xC0) != 0x80)
+      width++;
+  }
+
+  return width;
+}
+
+static
+char *
+arena_copy(const char * str, unsigned int len)
+{
+  struct arena_block * block_ptr;
+  size_t size;
+  char * copy_ptr;
+
+  block_ptr = g_arena_ptr;
+  if (block_ptr == NULL || block_ptr->size - block_ptr->used < len + 1)
+  {
+    size = len + 1 > ARENA_BLOCK_SIZE ? len + 1 : ARENA_BLOCK_SIZE;
+    block_ptr = malloc(sizeof(struct arena_block) + size);
+    if (block_ptr == NULL)
+      return NULL;
+
+    block_ptr->next_ptr = g_arena_ptr;
+    block_ptr->used = 0;
+    block_ptr->size = size;
+    g_arena_ptr = block_ptr;
+    g_arena_bytes += size;
+  }
+
+  copy_ptr = block_ptr->data + block_ptr->used;
+  memcpy(copy_ptr, str, len + 1);
+  block_ptr->used += len + 1;
+
+  return copy_ptr;
+}
+
+static
+int
+grow_slots(void)
+{
+  unsigned int * slots;
+  unsigned int mask;
+  unsigned int id;
+  unsigned int i;
+
+  mask = g_slots_mask == 0 ? 255 : g_slots_mask * 2 + 1;
+
+  slots = calloc(mask + 1, sizeof(unsigned int));
+  if (slots == NULL)
+    return -1;
+
+  for (id = 1 ; id < g_names_count ; id++)
+  {
+    i = g_names[id].hash & mask;
+    while (slots[i] != 0)
+      i = (i + 1) & mask;
+    slots[i] = id;
+  }
+
+  free(g_slots);
+  g_slots = slots;
+  g_slots_mask = mask;
+
+  return 0;
+}
+
+static
+int
+init_names(void)
+{
+  g_names_size = 256;
+  g_names = malloc(g_names_size * sizeof(struct interned));
+  if (g_names == NULL)
+    return -1;
+
+  g_names[INTERN_EMPTY].str = "";
+  g_names[INTERN_EMPTY].hash = 2166136261u;
+  g_names[INTERN_EMPTY].len = 0;
+  g_names[INTERN_EMPTY].width = 0;
+  g_names_count = 1;
+
+  return grow_slots();
+}
+
+unsigned int intern(const char * str)
+{
+  struct interned * names;
+  unsigned int hash;
+  unsigned int len;
+  unsigned int i;
+  unsigned int id;
+
+  if (str == NULL || *str == 0)
+    return INTERN_EMPTY;
+
+  if (g_names == NULL && init_names() < 0)
+    return INTERN_EMPTY;
+
+  hash = hash_str(str, &len);
+
+  for (i = hash & g_slots_mask ; g_slots[i] != 0 ; i = (i + 1) & g_slots_mask)
+  {
+    id = g_slots[i];
+    if (g_names[id].hash == hash && g_names[id].len == len && memcmp(g_names[id].str, str, len) == 0)
+      return id;
+  }
+
+  /* keep the load factor under 3/4 */
+  if ((g_names_count + 1) * 4 > (g_slots_mask + 1) * 3)
+  {
+    if (grow_slots() < 0)
+      return INTERN_EMPTY;
+
+    for (i = hash & g_slots_mask ; g_slots[i] != 0 ; i = (i + 1) & g_slots_mask)
+      ;
+  }
+
+  if (g_names_count == g_names_size)
+  {
+    names = realloc(g_names, g_names_size * 2 * sizeof(struct interned));
+    if (names == NULL)
+      return INTERN_EMPTY;
+
+    g_names = names;
+    g_names_size *= 2;
+  }
+
+  id = g_names_count;
+
+  g_names[id].str = arena_copy(str, len);
+  if (g_names[id].str == NULL)
+    return INTERN_EMPTY;
+
+  g_names[id].hash = hash;
+  g_names[id].len = len;
+  g_names[id].width = display_width(str, len);
+
+  g_slots[i] = id;
+  g_names_count++;
+
+  return id;
+}
+
+const char * intern_str(unsigned int id)
+{
+  if (id >= g_names_count)
+    return "";
+
+  return g_names[id].str;
+}
+
+unsigned int intern_len(unsigned int id)
+{
+  if (id >= g_names_count)
+    return 0;
+
+  return g_names[id].len;
+}
+
+unsigned int intern_width(unsigned int id)
+{
+  if (id >= g_names_count)
+    return 0;
+
+  return g_names[id].width;
+}
+
+void intern_stats(unsigned int * count_ptr, unsigned long * bytes_ptr)
+{
+  *count_ptr = g_names_count > 0 ? g_names_count - 1 : 0;
+  *bytes_ptr =
+    g_arena_bytes +
+    g_names_size * sizeof(struct interned) +
+    (g_slots_mask + 1) * sizeof(unsigned int);
+}
+
+void intern_free_all(void)
+{
+  struct arena_block * block_ptr;
+
+  while (g_arena_ptr != NULL)
+  {
+    block_ptr = g_arena_ptr;
+    g_arena_ptr = block_ptr->next_ptr;
+    free(block_ptr);
+  }
+
+  free(g_names);
+  free(g_slots);
+  g_names = NULL;
+  g_slots = NULL;
+  g_names_count = 0;
+  g_names_size = 0;
+  g_slots_mask = 0;
+  g_arena_bytes = 0;
+}
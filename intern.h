@@ -0,0 +1,31 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  String interner for port and client names.
+ *
+ *  Every distinct name is stored once, together with its hash, byte length
+ *  and display width. Names are referred to by small integer ids that stay
+ *  valid for the lifetime of the process, so equal names compare equal by
+ *  id and drawing code never has to strlen() them. Id 0 is the empty name.
+ *
+ *****************************************************************************/
+
+#ifndef INTERN_H__
+#define INTERN_H__
+
+#define INTERN_EMPTY 0
+
+/* returns id of str, adding it if needed; INTERN_EMPTY on allocation failure */
+unsigned int intern(const char * str);
+
+const char * intern_str(unsigned int id);
+unsigned int intern_len(unsigned int id);
+unsigned int intern_width(unsigned int id);
+
+/* number of distinct names and bytes used for them */
+void intern_stats(unsigned int * count_ptr, unsigned long * bytes_ptr);
+
+void intern_free_all(void);
+
+#endif /* #ifndef INTERN_H__ */
@@ -0,0 +1,254 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - event loss and pool monitor
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "naconnect.h"
+#include "monitor.h"
+
+#define MONITOR_PROC_PATH "/proc/asound/seq/clients"
+
+struct history
+{
+  unsigned int lost;                            /* counter at the last sample */
+  unsigned char lost_deltas[MONITOR_HISTORY];   /* events lost per sample, saturated */
+  unsigned char pool[MONITOR_HISTORY];          /* fullest pool, percent */
+  unsigned char next;
+  unsigned char known;
+};
+
+static struct history g_history[256];
+static unsigned long long g_next_ns;
+static unsigned int g_cursor;           /* client to start the next sample with */
+
+static
+unsigned long long
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int monitor_timeout(void)
+{
+  unsigned long long now;
+
+  now = now_ns();
+  if (now >= g_next_ns)
+    return 0;
+
+  return (g_next_ns - now + 999999) / 1000000;
+}
+
+/* percent in use of the fullest pool of every client, all in one read */
+static
+void
+read_pools(unsigned char * pools)
+{
+  FILE * file;
+  char line[128];
+  int client;
+  int size;
+  int used;
+  int percent;
+
+  memset(pools, 0, 256);
+
+  file = fopen(MONITOR_PROC_PATH, "r");
+  if (file == NULL)
+    return;
+
+  client = -1;
+  size = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    if (sscanf(line, "Client %d", &client) == 1)
+      continue;
+
+    if (sscanf(line, " Pool size : %d", &size) == 1)
+      continue;
+
+    if (sscanf(line, " Cells in use : %d", &used) == 1 && client >= 0 && client < 256 && size > 0)
+    {
+      percent = used * 100 / size;
+      if (percent > 100)
+        percent = 100;
+      if (percent > pools[client])
+        pools[client] = percent;
+    }
+  }
+
+  fclose(file);
+}
+
+static
+int
+is_flagged(const struct history * history_ptr)
+{
+  int i;
+
+  if (!history_ptr->known)
+    return 0;
+
+  if (history_ptr->pool[(history_ptr->next + MONITOR_HISTORY - 1) % MONITOR_HISTORY] >= MONITOR_POOL_WARN)
+    return 1;
+
+  for (i = 0 ; i < MONITOR_HISTORY ; i++)
+  {
+    if (history_ptr->lost_deltas[i] != 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* returns 1 if the client is or was flagged */
+static
+int
+sample_client(snd_seq_t * seq_handle, snd_seq_client_info_t * info_ptr, unsigned int client, unsigned char pool)
+{
+  struct history * history_ptr;
+  unsigned int lost;
+  unsigned int delta;
+  int flagged;
+
+  if (snd_seq_get_any_client_info(seq_handle, client, info_ptr) < 0)
+    return 0;
+
+  lost = snd_seq_client_info_get_event_lost(info_ptr);
+
+  history_ptr = g_history + client;
+  flagged = is_flagged(history_ptr);
+
+  /* a counter going back is a new client with a reused number */
+  if (history_ptr->known && lost < history_ptr->lost)
+    memset(history_ptr, 0, sizeof(struct history));
+
+  delta = history_ptr->known ? lost - history_ptr->lost : 0;
+
+  history_ptr->lost = lost;
+  history_ptr->known = 1;
+  history_ptr->lost_deltas[history_ptr->next] = delta > 255 ? 255 : delta;
+  history_ptr->pool[history_ptr->next] = pool;
+  history_ptr->next = (history_ptr->next + 1) % MONITOR_HISTORY;
+
+  return flagged || is_flagged(history_ptr);
+}
+
+int monitor_sample(snd_seq_t * seq_handle)
+{
+  snd_seq_client_info_t * info_ptr;
+  unsigned char pools[256];
+  struct list_head * node_ptr;
+  struct list_head * start_ptr;
+  struct client * client_ptr;
+  unsigned int count;
+  int changed;
+
+  if (monitor_timeout() > 0)
+    return 0;
+
+  g_next_ns = now_ns() + MONITOR_INTERVAL_MS * 1000000ULL;
+
+  if (list_empty(&g_seq_clients))
+    return 0;
+
+  snd_seq_client_info_alloca(&info_ptr);
+
+  read_pools(pools);
+
+  /* the clients are ordered by number, carry on where the last sample stopped */
+  start_ptr = g_seq_clients.next;
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    if (list_entry(node_ptr, struct client, siblings)->id >= g_cursor)
+    {
+      start_ptr = node_ptr;
+      break;
+    }
+  }
+
+  changed = 0;
+  node_ptr = start_ptr;
+
+  for (count = 0 ; count < MONITOR_QUERIES ; count++)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+
+    if (sample_client(seq_handle, info_ptr, client_ptr->id, pools[client_ptr->id]))
+      changed = 1;
+
+    node_ptr = node_ptr->next;
+    if (node_ptr == &g_seq_clients)
+      node_ptr = node_ptr->next;
+
+    if (node_ptr == start_ptr)
+      break;
+  }
+
+  g_cursor = list_entry(node_ptr, struct client, siblings)->id;
+
+  return changed;
+}
+
+int monitor_describe(unsigned int client, char * buf, size_t size)
+{
+  static const char lost_levels[] = " .:*#";
+  static const char pool_levels[] = " ._-=#";
+  const struct history * history_ptr;
+  char lost[MONITOR_HISTORY];
+  char pool[MONITOR_HISTORY];
+  unsigned int delta;
+  int level;
+  int i;
+  int slot;
+
+  if (client >= 256 || !is_flagged(g_history + client))
+    return 0;
+
+  history_ptr = g_history + client;
+
+  /* oldest sample first */
+  for (i = 0 ; i < MONITOR_HISTORY ; i++)
+  {
+    slot = (history_ptr->next + i) % MONITOR_HISTORY;
+
+    delta = history_ptr->lost_deltas[slot];
+    level = delta == 0 ? 0 : delta == 1 ? 1 : delta < 10 ? 2 : delta < 100 ? 3 : 4;
+    lost[i] = lost_levels[level];
+
+    pool[i] = pool_levels[history_ptr->pool[slot] / 20];
+  }
+
+  snprintf(
+    buf,
+    size,
+    "lost[%.*s] pool[%.*s]%3u%%",
+    MONITOR_HISTORY,
+    lost,
+    MONITOR_HISTORY,
+    pool,
+    history_ptr->pool[(history_ptr->next + MONITOR_HISTORY - 1) % MONITOR_HISTORY]);
+
+  return 1;
+}
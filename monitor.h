@@ -0,0 +1,37 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Event loss and pool pressure monitor.
+ *
+ *  Every MONITOR_INTERVAL_MS the lost event counters of the clients in
+ *  the model are read, at most MONITOR_QUERIES clients per sample in
+ *  round robin, so the number of ioctls per second stays bounded however
+ *  many clients there are. Pool usage of all clients comes from a single
+ *  read of /proc/asound/seq/clients, because alsa-lib only reports the
+ *  pool of the calling client. Each client keeps the last MONITOR_HISTORY
+ *  samples in a small ring, and clients that lost events or are near
+ *  the end of a pool are flagged.
+ *
+ *****************************************************************************/
+
+#ifndef MONITOR_H__
+#define MONITOR_H__
+
+#include <alsa/asoundlib.h>
+
+#define MONITOR_INTERVAL_MS 500
+#define MONITOR_HISTORY 16
+#define MONITOR_QUERIES 100     /* client info ioctls per sample at most */
+#define MONITOR_POOL_WARN 80    /* percent of a pool in use */
+
+/* ms until the next sample is due, 0 if it is due now */
+int monitor_timeout(void);
+
+/* take a sample if one is due, returns 1 if a client's flag or history changed */
+int monitor_sample(snd_seq_t * seq_handle);
+
+/* sparkline of a flagged client into buf, returns 0 and leaves buf alone if the client is fine */
+int monitor_describe(unsigned int client, char * buf, size_t size);
+
+#endif /* #ifndef MONITOR_H__ */
@@ -21,21 +21,161 @@
  *****************************************************************************/
 
 #include <ncurses.h>
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
 #include <alsa/asoundlib.h>
 
 #include "list.h"
+#include "naconnect.h"
+#include "ctlsock.h"
+#include "shmtopo.h"
+#include "intern.h"
+#include "navindex.h"
+#include "tap.h"
+#include "inspector.h"
+#include "recorder.h"
+#include "player.h"
+#include "router.h"
+#include "tempo.h"
+#include "monitor.h"
+#include "reach.h"
+#include "seqops.h"
+#include "scenes.h"
+#include "frame.h"
+#include "topocache.h"
+#include "trace.h"
+#include "watch.h"
+#include "probes.h"
+#include "bandwidth.h"
+
+struct list_head g_seq_clients;
+struct list_head g_input_ports;
+struct list_head g_output_ports;
+struct list_head g_connections;
+
+int g_self_client = -1;
+
+/* load every client's ports at startup, cleared by --collapsed */
+int g_expand_all = 1;
+
+/* enumeration threads of a rebuild, each a sequencer client, see topocache.h */
+unsigned int g_jobs = 1;
+
+/*
+ * Per frame output budget in bytes on a slow link, 0 otherwise. The panes
+ * are then drawn with attributes instead of colours, rows are not padded
+ * and ncurses may scroll with insert and delete line.
+ */
+unsigned int g_low_bandwidth;
+
+/* attributes standing in for the colour pairs of open_screen() */
+static const attr_t g_mono_attrs[8] = { A_NORMAL, A_NORMAL, A_REVERSE, A_REVERSE | A_BOLD, A_NORMAL, A_REVERSE, A_NORMAL, A_BOLD };
 
-#define MSG_OUT(format, arg...) printf(format "\n", ## arg)
-#define ERR_OUT(format, arg...) fprintf(stderr, format "\n", ## arg)
+#define PAIR(n) (g_low_bandwidth ? g_mono_attrs[n] : COLOR_PAIR(n))
 
-struct port
+/* client ids are 8 bit, flags in the per client state kept over a rebuild */
+#define CLIENT_IDS 256
+#define CLIENT_KNOWN  4
+#define CLIENT_LOADED 8
+
+/* naconnect's own clients are not part of the topology */
+int is_own_client(unsigned int client)
 {
-  struct list_head siblings;
-  snd_seq_port_info_t * pinfo_ptr;
-};
+  return client == g_self_client || (int)client == tap_client() || (int)client == seqops_client() || (int)client == topocache_enumerate_client() || topocache_is_enumerator(client);
+}
 
-struct list_head g_input_ports;
-struct list_head g_output_ports;
+struct client *
+find_client(unsigned int id)
+{
+  struct list_head * node_ptr;
+  struct client * client_ptr;
+
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    if (client_ptr->id == id)
+    {
+      return client_ptr;
+    }
+  }
+
+  return NULL;
+}
+
+void free_clients()
+{
+  struct list_head * node_ptr;
+
+  while (!list_empty(&g_seq_clients))
+  {
+    node_ptr = g_seq_clients.next;
+
+    list_del(node_ptr);
+
+    free(list_entry(node_ptr, struct client, siblings));
+  }
+}
+
+static
+void
+copy_record_name(char * dest, const char * name)
+{
+  size_t len;
+
+  len = strnlen(name, SHMTOPO_NAME_MAX - 1);
+  memcpy(dest, name, len);
+  memset(dest + len, 0, SHMTOPO_NAME_MAX - len);
+}
+
+/* client info in the form the cache and traces keep it */
+void fill_client_record(struct topocache_client * record_ptr, const snd_seq_client_info_t * cinfo_ptr)
+{
+  record_ptr->client = snd_seq_client_info_get_client(cinfo_ptr);
+  record_ptr->type = snd_seq_client_info_get_type(cinfo_ptr);
+  record_ptr->reserved = 0;
+  record_ptr->num_ports = snd_seq_client_info_get_num_ports(cinfo_ptr);
+  copy_record_name(record_ptr->name, snd_seq_client_info_get_name((snd_seq_client_info_t *)cinfo_ptr));
+}
+
+/* clients are kept ordered by id, enumeration order appends at the tail */
+struct client *
+add_client(const struct topocache_client * record_ptr)
+{
+  struct client * client_ptr;
+  struct list_head * node_ptr;
+  unsigned int id;
+
+  id = record_ptr->client;
+
+  client_ptr = (struct client *)malloc(sizeof(struct client));
+  if (client_ptr == NULL)
+  {
+    ERR_OUT("malloc() failed.");
+    return NULL;
+  }
+
+  client_ptr->id = id;
+  client_ptr->name_id = intern(record_ptr->name);
+  client_ptr->type = record_ptr->type;
+  client_ptr->num_ports = record_ptr->num_ports;
+  client_ptr->ports_loaded = 0;
+  client_ptr->readers_queried = 0;
+  client_ptr->expanded = g_expand_all ? CLIENT_EXPANDED_ALL : 0;
+
+  for (node_ptr = g_seq_clients.prev ; node_ptr != &g_seq_clients ; node_ptr = node_ptr->prev)
+  {
+    if (list_entry(node_ptr, struct client, siblings)->id < id)
+      break;
+  }
+
+  list_add(&client_ptr->siblings, node_ptr);
+
+  return client_ptr;
+}
 
 void free_ports(struct list_head * ports_ptr)
 {
@@ -50,7 +190,6 @@ void free_ports(struct list_head * ports_ptr)
 
     port_ptr = list_entry(node_ptr, struct port, siblings);
 
-    snd_seq_port_info_free(port_ptr->pinfo_ptr);
     free(port_ptr);
   }
 }
@@ -63,11 +202,29 @@ void free_all_ports()
 
 #define check_port_caps(pinfo_ptr, bits) ((snd_seq_port_info_get_capability(pinfo_ptr) & (bits)) == (bits))
 
+/* port info in the form the cache and traces keep it, flags say which panes list it */
+void fill_port_record(struct shmtopo_port * record_ptr, const snd_seq_port_info_t * pinfo_ptr)
+{
+  record_ptr->client = snd_seq_port_info_get_client(pinfo_ptr);
+  record_ptr->port = snd_seq_port_info_get_port(pinfo_ptr);
+  record_ptr->flags = 0;
+  if (check_port_caps(pinfo_ptr, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ))
+    record_ptr->flags |= SHMTOPO_PORT_INPUT;
+  if (check_port_caps(pinfo_ptr, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE))
+    record_ptr->flags |= SHMTOPO_PORT_OUTPUT;
+  record_ptr->reserved = 0;
+  record_ptr->capability = snd_seq_port_info_get_capability(pinfo_ptr);
+  record_ptr->type = snd_seq_port_info_get_type(pinfo_ptr);
+  copy_record_name(record_ptr->name, snd_seq_port_info_get_name(pinfo_ptr));
+}
+
+/* port lists are kept ordered by address, enumeration order appends at the tail */
 int
-add_port(const snd_seq_port_info_t * pinfo_ptr, struct list_head * ports_ptr)
+add_port(const struct shmtopo_port * record_ptr, unsigned int client_name_id, struct list_head * ports_ptr)
 {
-  int ret;
   struct port * port_ptr;
+  struct port * other_ptr;
+  struct list_head * node_ptr;
 
   port_ptr = (struct port *)malloc(sizeof(struct port));
   if (port_ptr == NULL)
@@ -76,93 +233,111 @@ add_port(const snd_seq_port_info_t * pinfo_ptr, struct list_head * ports_ptr)
     return -1;
   }
 
-  ret = snd_seq_port_info_malloc(&port_ptr->pinfo_ptr);
-  if (ret < 0)
+  port_ptr->client = record_ptr->client;
+  port_ptr->port = record_ptr->port;
+  port_ptr->capability = record_ptr->capability;
+  port_ptr->type = record_ptr->type;
+  port_ptr->name_id = intern(record_ptr->name);
+  port_ptr->client_name_id = client_name_id;
+  port_ptr->marked = 0;
+
+  for (node_ptr = ports_ptr->prev ; node_ptr != ports_ptr ; node_ptr = node_ptr->prev)
   {
-    ERR_OUT("Cannot allocate port info - %s", snd_strerror(ret));
-    return -1;
+    other_ptr = list_entry(node_ptr, struct port, siblings);
+    if (other_ptr->client < port_ptr->client ||
+        (other_ptr->client == port_ptr->client && other_ptr->port < port_ptr->port))
+      break;
   }
 
-  snd_seq_port_info_copy(port_ptr->pinfo_ptr, pinfo_ptr);
-
-  list_add_tail(&port_ptr->siblings, ports_ptr);
+  list_add(&port_ptr->siblings, node_ptr);
 
   return 0;
 }
 
-void build_ports(snd_seq_t * seq_handle)
+struct port *
+find_port(
+  unsigned int client,
+  unsigned int port,
+  struct list_head * ports_ptr)
 {
-  int ret;
-  snd_seq_client_info_t * cinfo_ptr;
-  snd_seq_port_info_t * pinfo_ptr;
-
-  snd_seq_client_info_alloca(&cinfo_ptr);
-  snd_seq_port_info_alloca(&pinfo_ptr);
-
-  snd_seq_client_info_set_client(cinfo_ptr, -1);
+  struct list_head * node_ptr;
+  struct port * port_ptr;
 
-  while (snd_seq_query_next_client(seq_handle, cinfo_ptr) >= 0)
+  list_for_each(node_ptr, ports_ptr)
   {
-    snd_seq_port_info_set_client(pinfo_ptr, snd_seq_client_info_get_client(cinfo_ptr));
-    snd_seq_port_info_set_port(pinfo_ptr, -1);
-    while (snd_seq_query_next_port(seq_handle, pinfo_ptr) >= 0)
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+    if (port_ptr->client == client && port_ptr->port == port)
     {
-      if (check_port_caps(pinfo_ptr, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ))
-      {
-        ret = add_port(pinfo_ptr, &g_input_ports);
-        if (ret < 0)
-          goto free_ports;
-      }
-
-      if (check_port_caps(pinfo_ptr, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE))
-      {
-        ret = add_port(pinfo_ptr, &g_output_ports);
-        if (ret < 0)
-          goto free_ports;
-      }
+      return port_ptr;
     }
   }
 
-  return;
+  return NULL;
+}
 
-free_ports:
-  free_all_ports();
+void remove_port(unsigned int client, unsigned int port)
+{
+  struct port * port_ptr;
+
+  port_ptr = find_port(client, port, &g_input_ports);
+  if (port_ptr != NULL)
+  {
+    list_del(&port_ptr->siblings);
+    free(port_ptr);
+  }
+
+  port_ptr = find_port(client, port, &g_output_ports);
+  if (port_ptr != NULL)
+  {
+    list_del(&port_ptr->siblings);
+    free(port_ptr);
+  }
 }
 
-snd_seq_port_info_t *
-find_port(
-  unsigned int client,
-  unsigned int port,
-  struct list_head * ports_ptr)
+void remove_client_ports(unsigned int client)
 {
   struct list_head * node_ptr;
+  struct list_head * next_ptr;
   struct port * port_ptr;
 
-  list_for_each(node_ptr, ports_ptr)
+  list_for_each_safe(node_ptr, next_ptr, &g_input_ports)
   {
     port_ptr = list_entry(node_ptr, struct port, siblings);
-    if (snd_seq_port_info_get_client(port_ptr->pinfo_ptr) == client &&
-        snd_seq_port_info_get_port(port_ptr->pinfo_ptr) == port)
+    if (port_ptr->client == client)
     {
-      return port_ptr->pinfo_ptr;
+      list_del(node_ptr);
+      free(port_ptr);
     }
   }
 
-  return NULL;
+  list_for_each_safe(node_ptr, next_ptr, &g_output_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+    if (port_ptr->client == client)
+    {
+      list_del(node_ptr);
+      free(port_ptr);
+    }
+  }
 }
 
-struct connection
+int
+load_port(const struct shmtopo_port * record_ptr, struct client * client_ptr)
 {
-  struct list_head siblings;
-  snd_seq_port_info_t * source_pinfo_ptr;
-  snd_seq_port_info_t * dest_pinfo_ptr;
-  unsigned int source_client;
-  unsigned int source_port;
-  unsigned int dest_client;
-  unsigned int dest_port;
-};
+  if (record_ptr->flags & SHMTOPO_PORT_INPUT)
+  {
+    if (add_port(record_ptr, client_ptr->name_id, &g_input_ports) < 0)
+      return -1;
+  }
 
-struct list_head g_connections;
+  if (record_ptr->flags & SHMTOPO_PORT_OUTPUT)
+  {
+    if (add_port(record_ptr, client_ptr->name_id, &g_output_ports) < 0)
+      return -1;
+  }
+
+  return 0;
+}
 
 void free_connections()
 {
@@ -179,9 +354,31 @@ void free_connections()
 
     free(connection_ptr);
   }
+
+  reach_reset();
+}
+
+/* name of a port that may belong to a client whose ports were not loaded */
+unsigned int
+lookup_port_name(snd_seq_t * seq_handle, unsigned int client, unsigned int port, struct list_head * ports_ptr)
+{
+  struct port * port_ptr;
+  snd_seq_port_info_t * pinfo_ptr;
+
+  port_ptr = find_port(client, port, ports_ptr);
+  if (port_ptr != NULL)
+    return port_ptr->name_id;
+
+  snd_seq_port_info_alloca(&pinfo_ptr);
+
+  if (seq_handle == NULL || snd_seq_get_any_port_info(seq_handle, client, port, pinfo_ptr) < 0)
+    return INTERN_EMPTY;
+
+  return intern(snd_seq_port_info_get_name(pinfo_ptr));
 }
 
 int add_connection(
+  snd_seq_t * seq_handle,
   unsigned int source_client,
   unsigned int source_port,
   unsigned int dest_client,
@@ -190,6 +387,10 @@ int add_connection(
 {
   struct connection * connection_ptr;
 
+  /* our own announce and tap subscriptions are not user connections */
+  if (is_own_client(source_client) || is_own_client(dest_client))
+    return 0;
+
   connection_ptr = (struct connection *)malloc(sizeof(struct connection));
   if (connection_ptr == NULL)
   {
@@ -197,544 +398,3552 @@ int add_connection(
     return -1;
   }
 
-  connection_ptr->source_pinfo_ptr = find_port(source_client, source_port, &g_input_ports);
-  connection_ptr->dest_pinfo_ptr = find_port(dest_client, dest_port, &g_output_ports);
+  connection_ptr->source_name_id = lookup_port_name(seq_handle, source_client, source_port, &g_input_ports);
+  connection_ptr->dest_name_id = lookup_port_name(seq_handle, dest_client, dest_port, &g_output_ports);
 
   connection_ptr->source_client = source_client;
   connection_ptr->source_port = source_port;
   connection_ptr->dest_client = dest_client;
   connection_ptr->dest_port = dest_port;
+  connection_ptr->marked = 0;
+  connection_ptr->pending = 0;
 
   list_add_tail(&connection_ptr->siblings, &g_connections);
 
+  reach_connected(source_client, source_port, dest_client, dest_port);
+
   return 0;
 }
 
-void build_connections(snd_seq_t * seq_handle)
+struct connection *
+find_connection(
+  unsigned int source_client,
+  unsigned int source_port,
+  unsigned int dest_client,
+  unsigned int dest_port)
 {
-  snd_seq_client_info_t * cinfo_ptr;
-  snd_seq_port_info_t * pinfo_ptr;
-  snd_seq_query_subscribe_t * subscr_ptr;
-  const snd_seq_addr_t * addr_ptr;
-
-  snd_seq_client_info_alloca(&cinfo_ptr);
-  snd_seq_port_info_alloca(&pinfo_ptr);
-  snd_seq_query_subscribe_alloca(&subscr_ptr);
-
-  snd_seq_client_info_set_client(cinfo_ptr, -1);
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
 
-  while (snd_seq_query_next_client(seq_handle, cinfo_ptr) >= 0)
+  list_for_each(node_ptr, &g_connections)
   {
-    snd_seq_port_info_set_client(pinfo_ptr, snd_seq_client_info_get_client(cinfo_ptr));
-    snd_seq_port_info_set_port(pinfo_ptr, -1);
-    while (snd_seq_query_next_port(seq_handle, pinfo_ptr) >= 0)
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if (connection_ptr->source_client == source_client &&
+        connection_ptr->source_port == source_port &&
+        connection_ptr->dest_client == dest_client &&
+        connection_ptr->dest_port == dest_port)
     {
-      snd_seq_query_subscribe_set_root(subscr_ptr, snd_seq_port_info_get_addr(pinfo_ptr));
-#if 0
-      snd_seq_query_subscribe_set_type(subscr_ptr, SND_SEQ_QUERY_SUBS_READ);
-
-      snd_seq_query_subscribe_set_index(subscr_ptr, 0);
-      while (snd_seq_query_port_subscribers(seq_handle, subscr_ptr) >= 0)
-      {
-        addr_ptr = snd_seq_query_subscribe_get_addr(subscr_ptr);
+      return connection_ptr;
+    }
+  }
 
-        add_connection(snd_seq_port_info_get_client(pinfo_ptr), snd_seq_port_info_get_port(pinfo_ptr), addr_ptr->client, addr_ptr->port);
+  return NULL;
+}
 
-        snd_seq_query_subscribe_set_index(subscr_ptr, snd_seq_query_subscribe_get_index(subscr_ptr) + 1);
-      }
-#endif
-      snd_seq_query_subscribe_set_type(subscr_ptr, SND_SEQ_QUERY_SUBS_WRITE);
+void drop_connection(struct connection * connection_ptr)
+{
+  reach_disconnected(connection_ptr->source_client, connection_ptr->source_port, connection_ptr->dest_client, connection_ptr->dest_port);
+  list_del(&connection_ptr->siblings);
+  free(connection_ptr);
+}
 
-      snd_seq_query_subscribe_set_index(subscr_ptr, 0);
-      while (snd_seq_query_port_subscribers(seq_handle, subscr_ptr) >= 0)
-      {
-        addr_ptr = snd_seq_query_subscribe_get_addr(subscr_ptr);
+/* drop connections with an end matching client (and port, unless port is -1) */
+int remove_connections(unsigned int client, int port)
+{
+  struct list_head * node_ptr;
+  struct list_head * next_ptr;
+  struct connection * connection_ptr;
+  int removed;
 
-        add_connection(addr_ptr->client, addr_ptr->port, snd_seq_port_info_get_client(pinfo_ptr), snd_seq_port_info_get_port(pinfo_ptr));
+  removed = 0;
 
-        snd_seq_query_subscribe_set_index(subscr_ptr, snd_seq_query_subscribe_get_index(subscr_ptr) + 1);
-      }
+  list_for_each_safe(node_ptr, next_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if ((connection_ptr->source_client == client && (port == -1 || connection_ptr->source_port == port)) ||
+        (connection_ptr->dest_client == client && (port == -1 || connection_ptr->dest_port == port)))
+    {
+      drop_connection(connection_ptr);
+      removed++;
     }
   }
+
+  return removed;
 }
 
-void dump_ports()
+/* refresh names of connection ends on client, after its ports changed */
+void rename_connections(snd_seq_t * seq_handle, unsigned int client)
 {
   struct list_head * node_ptr;
-  struct port * port_ptr;
+  struct connection * connection_ptr;
 
-  list_for_each(node_ptr, &g_input_ports)
+  list_for_each(node_ptr, &g_connections)
   {
-    port_ptr = list_entry(node_ptr, struct port, siblings);
-
-    MSG_OUT("IN: %s", snd_seq_port_info_get_name(port_ptr->pinfo_ptr));
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if (connection_ptr->source_client == client)
+      connection_ptr->source_name_id = lookup_port_name(seq_handle, client, connection_ptr->source_port, &g_input_ports);
+    if (connection_ptr->dest_client == client)
+      connection_ptr->dest_name_id = lookup_port_name(seq_handle, client, connection_ptr->dest_port, &g_output_ports);
   }
+}
 
-  list_for_each(node_ptr, &g_output_ports)
-  {
-    port_ptr = list_entry(node_ptr, struct port, siblings);
+/* entries of a model list, for the probes */
+unsigned int
+count_entries(struct list_head * list_ptr)
+{
+  struct list_head * node_ptr;
+  unsigned int count;
 
-    MSG_OUT("OUT: %s", snd_seq_port_info_get_name(port_ptr->pinfo_ptr));
-  }
+  count = 0;
+
+  list_for_each(node_ptr, list_ptr)
+    count++;
+
+  return count;
 }
 
-struct window
+int
+count_unloaded_clients(void)
 {
-  struct list_head * list_ptr;
-  WINDOW * window_ptr;
-  int selected;
-  int height;
-  int width;
-  const char * name;
-  int index;
+  struct list_head * node_ptr;
   int count;
-};
 
+  count = 0;
+
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    if (!list_entry(node_ptr, struct client, siblings)->ports_loaded)
+      count++;
+  }
+
+  return count;
+}
+
+/*
+ * g_connections holds every subscription with at least one end on a
+ * client whose ports are loaded. Subscribers of a port are queried when
+ * its client gets loaded: writers into it are taken unless their client
+ * was loaded before and queried its readers (then they were found from
+ * that side), and, only while some clients are still unloaded, readers
+ * from it are taken when they belong to a not yet loaded client.
+ */
 void
-draw_border(struct window * window_ptr)
+query_port_connections(snd_seq_t * seq_handle, const snd_seq_port_info_t * pinfo_ptr, int unloaded_clients)
 {
-  int col;
-  const char * title_prefix_ptr;
-  const char * title_suffix_ptr;
+  snd_seq_query_subscribe_t * subscr_ptr;
+  const snd_seq_addr_t * addr_ptr;
+  struct client * peer_ptr;
+  unsigned int client;
+  unsigned int port;
+  unsigned int connections;
+  uint64_t start_ns;
 
-  if (window_ptr->selected)
+  snd_seq_query_subscribe_alloca(&subscr_ptr);
+
+  client = snd_seq_port_info_get_client(pinfo_ptr);
+  port = snd_seq_port_info_get_port(pinfo_ptr);
+
+  PROBE(query_start, client, port);
+  start_ns = PROBE_START(query_done);
+  connections = 0;
+
+  snd_seq_query_subscribe_set_root(subscr_ptr, snd_seq_port_info_get_addr(pinfo_ptr));
+
+  snd_seq_query_subscribe_set_type(subscr_ptr, SND_SEQ_QUERY_SUBS_WRITE);
+
+  snd_seq_query_subscribe_set_index(subscr_ptr, 0);
+  while (snd_seq_query_port_subscribers(seq_handle, subscr_ptr) >= 0)
   {
-    wattron(window_ptr->window_ptr, COLOR_PAIR(4));
-    wattron(window_ptr->window_ptr, WA_BOLD);
+    addr_ptr = snd_seq_query_subscribe_get_addr(subscr_ptr);
+
+    peer_ptr = find_client(addr_ptr->client);
+    if (addr_ptr->client == client || peer_ptr == NULL || !peer_ptr->ports_loaded || !peer_ptr->readers_queried)
+      add_connection(seq_handle, addr_ptr->client, addr_ptr->port, client, port);
+
+    connections++;
+    snd_seq_query_subscribe_set_index(subscr_ptr, snd_seq_query_subscribe_get_index(subscr_ptr) + 1);
   }
 
-  /* 0, 0 gives default characters for the vertical and horizontal lines */
-  box(window_ptr->window_ptr, 0, 0);
+  if (unloaded_clients == 0)
+    goto done;
 
-  if (window_ptr->selected)
+  snd_seq_query_subscribe_set_type(subscr_ptr, SND_SEQ_QUERY_SUBS_READ);
+
+  snd_seq_query_subscribe_set_index(subscr_ptr, 0);
+  while (snd_seq_query_port_subscribers(seq_handle, subscr_ptr) >= 0)
   {
-    title_prefix_ptr = "=[";
-    title_suffix_ptr = "]=";
+    addr_ptr = snd_seq_query_subscribe_get_addr(subscr_ptr);
+
+    peer_ptr = find_client(addr_ptr->client);
+    if (addr_ptr->client != client && (peer_ptr == NULL || !peer_ptr->ports_loaded))
+      add_connection(seq_handle, client, port, addr_ptr->client, addr_ptr->port);
+
+    connections++;
+    snd_seq_query_subscribe_set_index(subscr_ptr, snd_seq_query_subscribe_get_index(subscr_ptr) + 1);
   }
-  else
+
+done:
+  PROBE(query_done, client, port, connections, PROBE_SINCE(start_ns));
+}
+
+/* enumerate ports of one client together with their subscriptions */
+int
+load_client_ports(snd_seq_t * seq_handle, struct client * client_ptr, int unloaded_clients)
+{
+  snd_seq_port_info_t * pinfo_ptr;
+  struct shmtopo_port record;
+
+  snd_seq_port_info_alloca(&pinfo_ptr);
+
+  if (client_ptr->ports_loaded)
+    return 0;
+
+  /* mark first, so connections from the client to itself are found once */
+  client_ptr->ports_loaded = 1;
+  client_ptr->readers_queried = unloaded_clients > 0;
+
+  snd_seq_port_info_set_client(pinfo_ptr, client_ptr->id);
+  snd_seq_port_info_set_port(pinfo_ptr, -1);
+  while (snd_seq_query_next_port(seq_handle, pinfo_ptr) >= 0)
   {
-    title_prefix_ptr = " [";
-    title_suffix_ptr = "] ";
+    fill_port_record(&record, pinfo_ptr);
+    if (load_port(&record, client_ptr) < 0)
+      return -1;
+
+    query_port_connections(seq_handle, pinfo_ptr, unloaded_clients);
   }
 
-  col = (window_ptr->width - strlen(window_ptr->name) - strlen(title_suffix_ptr) - strlen(title_prefix_ptr))/2;
+  /* connections found earlier from the other end were named by a query */
+  rename_connections(NULL, client_ptr->id);
 
-  if (col < 0)
+  return 0;
+}
+
+int expand_client(snd_seq_t * seq_handle, struct client * client_ptr, unsigned int mask)
+{
+  int loaded;
+
+  client_ptr->expanded |= mask;
+
+  loaded = !client_ptr->ports_loaded;
+  if (loaded)
   {
-    col = 0;
+    load_client_ports(seq_handle, client_ptr, count_unloaded_clients() - 1);
   }
 
-  mvwprintw(
-    window_ptr->window_ptr,
-    0,
-    col,
-    title_prefix_ptr);
+  return loaded;
+}
 
-  mvwprintw(
-    window_ptr->window_ptr,
-    0,
-    col+strlen(title_prefix_ptr),
-    window_ptr->name);
+/*
+ * Clients are always enumerated. Ports (and their subscriptions) only for
+ * clients that are expanded or, on a rebuild, were loaded before. state is
+ * indexed by client id and carries CLIENT_* flags over a rebuild, or NULL.
+ */
+void build_topology(snd_seq_t * seq_handle, const unsigned char * state)
+{
+  snd_seq_client_info_t * cinfo_ptr;
+  struct topocache_client record;
+  struct client * client_ptr;
+  struct list_head * node_ptr;
+  int unloaded_clients;
 
-  mvwprintw(
-    window_ptr->window_ptr,
-    0,
-    col+strlen(title_prefix_ptr)+strlen(window_ptr->name),
-    title_suffix_ptr);
+  snd_seq_client_info_alloca(&cinfo_ptr);
 
-  if (window_ptr->selected)
+  snd_seq_client_info_set_client(cinfo_ptr, -1);
+
+  while (snd_seq_query_next_client(seq_handle, cinfo_ptr) >= 0)
   {
-    wattroff(window_ptr->window_ptr, COLOR_PAIR(4));
-    wattroff(window_ptr->window_ptr, WA_BOLD);
+    if (is_own_client(snd_seq_client_info_get_client(cinfo_ptr)))
+      continue;
+
+    fill_client_record(&record, cinfo_ptr);
+    client_ptr = add_client(&record);
+    if (client_ptr == NULL)
+      goto free;
+
+    if (state != NULL && (state[client_ptr->id] & CLIENT_KNOWN))
+      client_ptr->expanded = state[client_ptr->id] & CLIENT_EXPANDED_ALL;
+  }
+
+  unloaded_clients = 0;
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    if (!client_ptr->expanded && (state == NULL || !(state[client_ptr->id] & CLIENT_LOADED)))
+      unloaded_clients++;
+  }
+
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    if (client_ptr->expanded || (state != NULL && (state[client_ptr->id] & CLIENT_LOADED)))
+    {
+      if (load_client_ports(seq_handle, client_ptr, unloaded_clients) < 0)
+        goto free;
+    }
   }
+
+  return;
+
+free:
+  free_connections();
+  free_all_ports();
+  free_clients();
+}
+
+struct shmtopo_writer * g_shm_writer;
+
+static
+void
+fill_shm_port(struct shmtopo_port * shm_port_ptr, const struct port * port_ptr, uint8_t flags)
+{
+  unsigned int len;
+
+  shm_port_ptr->client = port_ptr->client;
+  shm_port_ptr->port = port_ptr->port;
+  shm_port_ptr->flags = flags;
+  shm_port_ptr->reserved = 0;
+  shm_port_ptr->capability = port_ptr->capability;
+  shm_port_ptr->type = port_ptr->type;
+
+  len = intern_len(port_ptr->name_id);
+  if (len > SHMTOPO_NAME_MAX - 1)
+    len = SHMTOPO_NAME_MAX - 1;
+  memcpy(shm_port_ptr->name, intern_str(port_ptr->name_id), len);
+  memset(shm_port_ptr->name + len, 0, SHMTOPO_NAME_MAX - len);
 }
 
+static
 int
-print_port_info(WINDOW * window_ptr, int row, int col, int client, int port, const char * name)
+port_addr_cmp(const struct port * a_ptr, const struct port * b_ptr)
 {
-  char buf[1024];
-  snprintf(buf, 1024, "%3u:%u %s", client, port, name);
-  buf[1023] = 0;
-  mvwprintw(window_ptr, row, col, "%s", buf);
-  return strlen(buf);
+  return ((int)a_ptr->client - (int)b_ptr->client) * 256 + (int)a_ptr->port - (int)b_ptr->port;
 }
 
-void
-draw_ports(struct window * window_ptr)
+/* both port lists are ordered by address, merge them into one table, returns the count */
+static
+uint32_t
+merge_ports(struct shmtopo_port * ports, uint32_t ports_capacity, uint32_t * flags_ptr)
+{
+  uint32_t port_count;
+  struct list_head * in_node_ptr;
+  struct list_head * out_node_ptr;
+  struct port * in_port_ptr;
+  struct port * out_port_ptr;
+  int cmp;
+
+  port_count = 0;
+
+  in_node_ptr = g_input_ports.next;
+  out_node_ptr = g_output_ports.next;
+  while (in_node_ptr != &g_input_ports || out_node_ptr != &g_output_ports)
+  {
+    if (port_count == ports_capacity)
+    {
+      *flags_ptr |= SHMTOPO_TRUNCATED;
+      break;
+    }
+
+    in_port_ptr = (in_node_ptr != &g_input_ports) ? list_entry(in_node_ptr, struct port, siblings) : NULL;
+    out_port_ptr = (out_node_ptr != &g_output_ports) ? list_entry(out_node_ptr, struct port, siblings) : NULL;
+
+    if (in_port_ptr == NULL)
+      cmp = 1;
+    else if (out_port_ptr == NULL)
+      cmp = -1;
+    else
+      cmp = port_addr_cmp(in_port_ptr, out_port_ptr);
+
+    if (cmp < 0)
+    {
+      fill_shm_port(ports + port_count, in_port_ptr, SHMTOPO_PORT_INPUT);
+      in_node_ptr = in_node_ptr->next;
+    }
+    else if (cmp > 0)
+    {
+      fill_shm_port(ports + port_count, out_port_ptr, SHMTOPO_PORT_OUTPUT);
+      out_node_ptr = out_node_ptr->next;
+    }
+    else
+    {
+      fill_shm_port(ports + port_count, in_port_ptr, SHMTOPO_PORT_INPUT | SHMTOPO_PORT_OUTPUT);
+      in_node_ptr = in_node_ptr->next;
+      out_node_ptr = out_node_ptr->next;
+    }
+
+    port_count++;
+  }
+
+  return port_count;
+}
+
+void publish_topology()
+{
+  struct shmtopo_port * ports;
+  struct shmtopo_connection * connections;
+  uint32_t ports_capacity, connections_capacity;
+  uint32_t port_count, connection_count;
+  uint32_t flags;
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
+
+  if (g_shm_writer == NULL)
+    return;
+
+  shmtopo_writer_begin(g_shm_writer, &ports, &ports_capacity, &connections, &connections_capacity);
+
+  flags = 0;
+  port_count = merge_ports(ports, ports_capacity, &flags);
+
+  connection_count = 0;
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    if (connection_count == connections_capacity)
+    {
+      flags |= SHMTOPO_TRUNCATED;
+      break;
+    }
+
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+
+    connections[connection_count].source_client = connection_ptr->source_client;
+    connections[connection_count].source_port = connection_ptr->source_port;
+    connections[connection_count].dest_client = connection_ptr->dest_client;
+    connections[connection_count].dest_port = connection_ptr->dest_port;
+    connection_count++;
+  }
+
+  shmtopo_writer_end(g_shm_writer, port_count, connection_count, flags);
+}
+
+/* what the user expanded, and what was loaded because of it, indexed by client id */
+void topology_state(unsigned char * state)
+{
+  struct list_head * node_ptr;
+  struct client * client_ptr;
+
+  memset(state, 0, CLIENT_IDS);
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    state[client_ptr->id] = CLIENT_KNOWN | client_ptr->expanded | (client_ptr->ports_loaded ? CLIENT_LOADED : 0);
+  }
+}
+
+/* bytes the names would take with a copy in every client, port and connection */
+static
+unsigned long
+name_copy_bytes(void)
 {
   struct list_head * node_ptr;
+  struct client * client_ptr;
   struct port * port_ptr;
-  int row, col;
-  int rows, cols;
+  struct connection * connection_ptr;
+  unsigned long bytes;
 
-  getmaxyx(window_ptr->window_ptr, rows, cols);
+  bytes = 0;
 
-  row = 0;
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    bytes += intern_len(client_ptr->name_id) + 1;
+  }
 
-  list_for_each(node_ptr, window_ptr->list_ptr)
+  list_for_each(node_ptr, &g_input_ports)
   {
     port_ptr = list_entry(node_ptr, struct port, siblings);
+    bytes += intern_len(port_ptr->name_id) + 1 + intern_len(port_ptr->client_name_id) + 1;
+  }
 
-    if (row == window_ptr->index)
+  list_for_each(node_ptr, &g_output_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+    bytes += intern_len(port_ptr->name_id) + 1 + intern_len(port_ptr->client_name_id) + 1;
+  }
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    bytes += intern_len(connection_ptr->source_name_id) + 1 + intern_len(connection_ptr->dest_name_id) + 1;
+  }
+
+  return bytes;
+}
+
+/* the model in cache tables, to save it */
+int snapshot_topology(struct topocache * cache_ptr)
+{
+  struct list_head * node_ptr;
+  struct client * client_ptr;
+  struct connection * connection_ptr;
+  uint32_t flags;
+  uint32_t capacity;
+
+  memset(cache_ptr, 0, sizeof(*cache_ptr));
+
+  list_for_each(node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    if (topocache_add_client(cache_ptr, client_ptr->id, client_ptr->type, client_ptr->num_ports, intern_str(client_ptr->name_id)) < 0)
+      goto fail;
+  }
+
+  capacity = 0;
+  list_for_each(node_ptr, &g_input_ports)
+    capacity++;
+  list_for_each(node_ptr, &g_output_ports)
+    capacity++;
+
+  if (capacity > 0)
+  {
+    cache_ptr->ports = malloc(capacity * sizeof(struct shmtopo_port));
+    if (cache_ptr->ports == NULL)
+      goto fail;
+    cache_ptr->ports_capacity = capacity;
+    flags = 0;
+    cache_ptr->port_count = merge_ports(cache_ptr->ports, capacity, &flags);
+  }
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    if (topocache_add_connection(cache_ptr, connection_ptr->source_client, connection_ptr->source_port, connection_ptr->dest_client, connection_ptr->dest_port) < 0)
+      goto fail;
+  }
+
+  topocache_sort(cache_ptr);
+
+  return 0;
+
+fail:
+  ERR_OUT("malloc() failed.");
+  topocache_free(cache_ptr);
+  return -1;
+}
+
+/*
+ * Replace the model with cache tables, which are ordered as the lists, so
+ * everything is appended. state carries expanded flags as for
+ * build_topology(), or is NULL. Every client counts as loaded.
+ */
+void load_topology(const struct topocache * cache_ptr, const unsigned char * state)
+{
+  const struct shmtopo_port * port_record_ptr;
+  const struct shmtopo_connection * connection_record_ptr;
+  struct client * client_ptr;
+  struct list_head * node_ptr;
+  uint32_t i;
+
+  free_connections();
+  free_all_ports();
+  free_clients();
+
+  for (i = 0 ; i < cache_ptr->client_count ; i++)
+  {
+    if (is_own_client(cache_ptr->clients[i].client))
+      continue;
+
+    client_ptr = add_client(cache_ptr->clients + i);
+    if (client_ptr == NULL)
+      goto free;
+
+    client_ptr->ports_loaded = 1;
+    client_ptr->expanded = CLIENT_EXPANDED_ALL;
+    if (state != NULL && (state[client_ptr->id] & CLIENT_KNOWN))
+      client_ptr->expanded = state[client_ptr->id] & CLIENT_EXPANDED_ALL;
+  }
+
+  /* walk the clients along with their ports */
+  node_ptr = g_seq_clients.next;
+
+  for (i = 0 ; i < cache_ptr->port_count ; i++)
+  {
+    port_record_ptr = cache_ptr->ports + i;
+
+    while (node_ptr != &g_seq_clients && list_entry(node_ptr, struct client, siblings)->id < port_record_ptr->client)
+      node_ptr = node_ptr->next;
+
+    if (node_ptr == &g_seq_clients)
+      break;
+
+    client_ptr = list_entry(node_ptr, struct client, siblings);
+    if (client_ptr->id != port_record_ptr->client)
+      continue;
+
+    if (load_port(port_record_ptr, client_ptr) < 0)
+      goto free;
+  }
+
+  for (i = 0 ; i < cache_ptr->connection_count ; i++)
+  {
+    connection_record_ptr = cache_ptr->connections + i;
+    if (add_connection(NULL, connection_record_ptr->source_client, connection_record_ptr->source_port, connection_record_ptr->dest_client, connection_record_ptr->dest_port) < 0)
+      goto free;
+  }
+
+  return;
+
+free:
+  free_connections();
+  free_all_ports();
+  free_clients();
+}
+
+void rebuild_topology(snd_seq_t * seq_handle)
+{
+  unsigned char state[CLIENT_IDS];
+  struct topocache live;
+  uint64_t start_ns;
+
+  PROBE(refresh_start);
+  start_ns = PROBE_START(refresh_done);
+
+  topology_state(state);
+
+  /* everything is loaded when expanded, so the walk can be shared out */
+  if (g_jobs > 1 && g_expand_all && topocache_enumerate(g_jobs, is_own_client, &live) == 0)
+  {
+    load_topology(&live, state);
+    topocache_free(&live);
+  }
+  else
+  {
+    free_connections();
+    free_all_ports();
+    free_clients();
+
+    build_topology(seq_handle, state);
+  }
+
+  publish_topology();
+
+  PROBE(refresh_done, count_entries(&g_seq_clients), count_entries(&g_input_ports) + count_entries(&g_output_ports), count_entries(&g_connections), PROBE_SINCE(start_ns));
+}
+
+/* what applying an announce needs from the sequencer, fetched when it is read */
+void fetch_announce(snd_seq_t * seq_handle, const snd_seq_event_t * event_ptr, struct trace_event * announce_ptr)
+{
+  snd_seq_client_info_t * cinfo_ptr;
+  snd_seq_port_info_t * pinfo_ptr;
+  struct client * client_ptr;
+
+  memset(announce_ptr, 0, sizeof(*announce_ptr));
+
+  announce_ptr->type = event_ptr->type;
+
+  if (event_ptr->type == SND_SEQ_EVENT_PORT_SUBSCRIBED || event_ptr->type == SND_SEQ_EVENT_PORT_UNSUBSCRIBED)
+  {
+    announce_ptr->client = event_ptr->data.connect.sender.client;
+    announce_ptr->port = event_ptr->data.connect.sender.port;
+    announce_ptr->dest_client = event_ptr->data.connect.dest.client;
+    announce_ptr->dest_port = event_ptr->data.connect.dest.port;
+    return;
+  }
+
+  announce_ptr->client = event_ptr->data.addr.client;
+  announce_ptr->port = event_ptr->data.addr.port;
+
+  client_ptr = find_client(announce_ptr->client);
+
+  switch (event_ptr->type)
+  {
+  case SND_SEQ_EVENT_CLIENT_START:
+  case SND_SEQ_EVENT_CLIENT_CHANGE:
+    /* only a new client or a change of a known one is looked up */
+    if (is_own_client(announce_ptr->client) || (client_ptr == NULL) != (event_ptr->type == SND_SEQ_EVENT_CLIENT_START))
+      return;
+
+    snd_seq_client_info_alloca(&cinfo_ptr);
+    if (snd_seq_get_any_client_info(seq_handle, announce_ptr->client, cinfo_ptr) < 0)
+      return;
+
+    fill_client_record(&announce_ptr->client_info, cinfo_ptr);
+    announce_ptr->found = 1;
+    return;
+
+  case SND_SEQ_EVENT_PORT_START:
+  case SND_SEQ_EVENT_PORT_CHANGE:
+    if (client_ptr == NULL)
+      return;
+
+    snd_seq_port_info_alloca(&pinfo_ptr);
+    if (snd_seq_get_any_port_info(seq_handle, announce_ptr->client, announce_ptr->port, pinfo_ptr) < 0)
+      return;
+
+    fill_port_record(&announce_ptr->port_info, pinfo_ptr);
+    announce_ptr->found = 1;
+    return;
+  }
+}
+
+/*
+ * Apply one event from System:Announce to the model, returns 1 if it
+ * changed. seq_handle is NULL when a trace is replayed; ports of a new
+ * client are then left to the port announces that follow.
+ */
+int
+apply_announce(snd_seq_t * seq_handle, const struct trace_event * announce_ptr)
+{
+  struct client * client_ptr;
+  struct connection * connection_ptr;
+  struct list_head * node_ptr;
+
+  switch (announce_ptr->type)
+  {
+  case SND_SEQ_EVENT_CLIENT_START:
+    if (!announce_ptr->found || find_client(announce_ptr->client) != NULL)
+      return 0;
+
+    client_ptr = add_client(&announce_ptr->client_info);
+    if (client_ptr == NULL)
+      return 0;
+
+    if (client_ptr->expanded && seq_handle != NULL)
+      load_client_ports(seq_handle, client_ptr, count_unloaded_clients() - 1);
+    else if (client_ptr->expanded)
+      client_ptr->ports_loaded = 1;
+
+    return 1;
+
+  case SND_SEQ_EVENT_CLIENT_EXIT:
+    client_ptr = find_client(announce_ptr->client);
+    if (client_ptr == NULL)
+      return 0;
+
+    remove_client_ports(client_ptr->id);
+    remove_connections(client_ptr->id, -1);
+    list_del(&client_ptr->siblings);
+    free(client_ptr);
+    return 1;
+
+  case SND_SEQ_EVENT_CLIENT_CHANGE:
+    client_ptr = find_client(announce_ptr->client);
+    if (client_ptr == NULL || !announce_ptr->found)
+      return 0;
+
+    client_ptr->name_id = intern(announce_ptr->client_info.name);
+    client_ptr->type = announce_ptr->client_info.type;
+
+    list_for_each(node_ptr, &g_input_ports)
     {
-      if (window_ptr->selected)
-      {
-        wattron(window_ptr->window_ptr, COLOR_PAIR(3));
-      }
-      else
-      {
-        wattron(window_ptr->window_ptr, COLOR_PAIR(2));
-      }
+      if (list_entry(node_ptr, struct port, siblings)->client == client_ptr->id)
+        list_entry(node_ptr, struct port, siblings)->client_name_id = client_ptr->name_id;
     }
-    else
+
+    list_for_each(node_ptr, &g_output_ports)
     {
-      wattron(window_ptr->window_ptr, COLOR_PAIR(1));
+      if (list_entry(node_ptr, struct port, siblings)->client == client_ptr->id)
+        list_entry(node_ptr, struct port, siblings)->client_name_id = client_ptr->name_id;
     }
 
-    col = 1;
+    return 1;
 
-    col += print_port_info(
-      window_ptr->window_ptr,
-      row+1,
-      col,
-      snd_seq_port_info_get_client(port_ptr->pinfo_ptr),
-      snd_seq_port_info_get_port(port_ptr->pinfo_ptr),
-      snd_seq_port_info_get_name(port_ptr->pinfo_ptr));
+  case SND_SEQ_EVENT_PORT_START:
+  case SND_SEQ_EVENT_PORT_CHANGE:
+    client_ptr = find_client(announce_ptr->client);
+    if (client_ptr == NULL || !announce_ptr->found)
+      return 0;
+
+    if (announce_ptr->type == SND_SEQ_EVENT_PORT_START)
+      client_ptr->num_ports++;
+
+    /* ports of a collapsed client are fetched when it is expanded */
+    if (!client_ptr->ports_loaded)
+      return 1;
+
+    remove_port(announce_ptr->client, announce_ptr->port);
+    load_port(&announce_ptr->port_info, client_ptr);
+    rename_connections(seq_handle, announce_ptr->client);
+
+    /* whether the port passes events on may have changed */
+    reach_reset();
+    return 1;
+
+  case SND_SEQ_EVENT_PORT_EXIT:
+    client_ptr = find_client(announce_ptr->client);
+    if (client_ptr == NULL)
+      return 0;
+
+    if (client_ptr->num_ports > 0)
+      client_ptr->num_ports--;
 
-    while (col < cols)
+    remove_port(announce_ptr->client, announce_ptr->port);
+    remove_connections(announce_ptr->client, announce_ptr->port);
+    return 1;
+
+  case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+    /* a queued connect of ours that is shown already */
+    connection_ptr = find_connection(announce_ptr->client, announce_ptr->port, announce_ptr->dest_client, announce_ptr->dest_port);
+    if (connection_ptr != NULL)
     {
-      mvwprintw(window_ptr->window_ptr, row+1, col, " ");
-      col++;
+      if (connection_ptr->pending != CONNECTION_PENDING_CONNECT)
+        return 0;
+
+      connection_ptr->pending = 0;
+      return 1;
     }
 
-    if (row == window_ptr->index)
+    client_ptr = find_client(announce_ptr->client);
+    if (client_ptr == NULL || !client_ptr->ports_loaded)
     {
-      if (window_ptr->selected)
-      {
-        wattroff(window_ptr->window_ptr, COLOR_PAIR(3));
-      }
-      else
-      {
-        wattroff(window_ptr->window_ptr, COLOR_PAIR(2));
-      }
+      client_ptr = find_client(announce_ptr->dest_client);
+      if (client_ptr == NULL || !client_ptr->ports_loaded)
+        return 0;
+    }
+
+    add_connection(seq_handle, announce_ptr->client, announce_ptr->port, announce_ptr->dest_client, announce_ptr->dest_port);
+    return 1;
+
+  case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+    connection_ptr = find_connection(announce_ptr->client, announce_ptr->port, announce_ptr->dest_client, announce_ptr->dest_port);
+
+    /* a connect queued after this disconnect is still to come */
+    if (connection_ptr == NULL || connection_ptr->pending == CONNECTION_PENDING_CONNECT)
+      return 0;
+
+    drop_connection(connection_ptr);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* drain pending announce events, returns 1 if the topology changed */
+int
+read_announces(snd_seq_t * seq_handle)
+{
+  snd_seq_event_t * event_ptr;
+  struct trace_event announce;
+  uint64_t start_ns;
+  int changed;
+  int applied;
+  int ret;
+
+  changed = 0;
+
+  while ((ret = snd_seq_event_input(seq_handle, &event_ptr)) >= 0)
+  {
+    /* the player's queue wakes it through the same handle */
+    if (event_ptr->type == SND_SEQ_EVENT_ECHO)
+    {
+      player_echo(seq_handle, event_ptr);
+      continue;
+    }
+
+    PROBE(announce_start, event_ptr->type, event_ptr->data.addr.client, event_ptr->data.addr.port);
+    start_ns = PROBE_START(announce_done);
+
+    fetch_announce(seq_handle, event_ptr, &announce);
+    trace_write(&announce);
+
+    applied = apply_announce(seq_handle, &announce);
+    if (applied)
+      changed = 1;
+
+    PROBE(announce_done, announce.type, announce.client, announce.port, applied, PROBE_SINCE(start_ns));
+  }
+
+  if (ret == -ENOSPC)
+  {
+    /* input overran and events were lost, start over */
+    rebuild_topology(seq_handle);
+    return 1;
+  }
+
+  if (changed)
+    publish_topology();
+
+  return changed;
+}
+
+void dump_ports()
+{
+  struct list_head * node_ptr;
+  struct port * port_ptr;
+
+  list_for_each(node_ptr, &g_input_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+
+    MSG_OUT("IN: %s", intern_str(port_ptr->name_id));
+  }
+
+  list_for_each(node_ptr, &g_output_ports)
+  {
+    port_ptr = list_entry(node_ptr, struct port, siblings);
+
+    MSG_OUT("OUT: %s", intern_str(port_ptr->name_id));
+  }
+}
+
+#define JUMP_MAX 64
+
+/* a line of a ports pane, port_ptr is NULL for the client header */
+struct row
+{
+  struct client * client_ptr;
+  struct port * port_ptr;
+};
+
+struct window
+{
+  struct list_head * list_ptr;
+  WINDOW * window_ptr;
+  int selected;
+  int height;
+  int width;
+  const char * name;
+  int index;
+  int count;
+  int top;                      /* first list row shown */
+  unsigned int expand_mask;     /* CLIENT_EXPANDED_* bit of a ports pane, 0 for connections */
+  struct row * rows;
+  int rows_size;
+  struct navindex * navindex_ptr;
+  char jump[JUMP_MAX];          /* typed prefix */
+  int jump_len;                 /* -1 when not jumping */
+  unsigned int jump_nodes[JUMP_MAX + 1]; /* trie node after each typed char */
+};
+
+/* what a refresh writes is the terminal output a slow link budgets */
+static
+void
+refresh_window(WINDOW * window_ptr)
+{
+  frame_output_begin();
+  wrefresh(window_ptr);
+  frame_output_end();
+}
+
+void
+draw_border(struct window * window_ptr)
+{
+  int col;
+  const char * title_prefix_ptr;
+  const char * title_suffix_ptr;
+
+  if (window_ptr->selected)
+  {
+    wattron(window_ptr->window_ptr, PAIR(4));
+    wattron(window_ptr->window_ptr, WA_BOLD);
+  }
+
+  /* 0, 0 gives default characters for the vertical and horizontal lines */
+  box(window_ptr->window_ptr, 0, 0);
+
+  if (window_ptr->selected)
+  {
+    title_prefix_ptr = "=[";
+    title_suffix_ptr = "]=";
+  }
+  else
+  {
+    title_prefix_ptr = " [";
+    title_suffix_ptr = "] ";
+  }
+
+  col = (window_ptr->width - strlen(window_ptr->name) - strlen(title_suffix_ptr) - strlen(title_prefix_ptr))/2;
+
+  if (col < 0)
+  {
+    col = 0;
+  }
+
+  mvwprintw(
+    window_ptr->window_ptr,
+    0,
+    col,
+    title_prefix_ptr);
+
+  mvwprintw(
+    window_ptr->window_ptr,
+    0,
+    col+strlen(title_prefix_ptr),
+    window_ptr->name);
+
+  mvwprintw(
+    window_ptr->window_ptr,
+    0,
+    col+strlen(title_prefix_ptr)+strlen(window_ptr->name),
+    title_suffix_ptr);
+
+  if (window_ptr->selected)
+  {
+    wattroff(window_ptr->window_ptr, PAIR(4));
+    wattroff(window_ptr->window_ptr, WA_BOLD);
+  }
+}
+
+/* address plus interned name; the printed width comes from the interner, not strlen() */
+int
+print_port_info(WINDOW * window_ptr, int row, int col, int client, int port, unsigned int name_id)
+{
+  char buf[16];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "%3u:%u ", client, port);
+  mvwaddnstr(window_ptr, row, col, buf, len);
+
+  if (name_id == INTERN_EMPTY)
+  {
+    waddstr(window_ptr, "???");
+    return len + 3;
+  }
+
+  waddnstr(window_ptr, intern_str(name_id), intern_len(name_id));
+
+  return len + intern_width(name_id);
+}
+
+/* keep the selected row inside the visible part of the list */
+void
+scroll_to_index(struct window * window_ptr, int visible_rows)
+{
+  if (visible_rows < 1)
+    visible_rows = 1;
+
+  if (window_ptr->index >= window_ptr->top + visible_rows)
+    window_ptr->top = window_ptr->index - visible_rows + 1;
+
+  if (window_ptr->index < window_ptr->top)
+    window_ptr->top = window_ptr->index;
+
+  if (window_ptr->top > window_ptr->count - visible_rows)
+    window_ptr->top = window_ptr->count - visible_rows;
+
+  if (window_ptr->top < 0)
+    window_ptr->top = 0;
+}
+
+/* "[+]" or "[-]", client number and interned client name */
+int
+print_client_info(WINDOW * window_ptr, int row, int col, const struct client * client_ptr, int expanded)
+{
+  char buf[16];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "[%c] %3u ", expanded ? '-' : '+', client_ptr->id);
+  mvwaddnstr(window_ptr, row, col, buf, len);
+
+  waddnstr(window_ptr, intern_str(client_ptr->name_id), intern_len(client_ptr->name_id));
+
+  return len + intern_width(client_ptr->name_id);
+}
+
+void
+draw_ports(struct window * window_ptr)
+{
+  struct row * row_ptr;
+  char monitor[64];
+  int row, col;
+  int rows, cols;
+  int name_end;
+  int pair;
+  int warn_pair;
+  uint64_t start_ns;
+
+  PROBE(draw_start, window_ptr->list_ptr == &g_input_ports ? 0 : 1);
+  start_ns = PROBE_START(draw_done);
+
+  getmaxyx(window_ptr->window_ptr, rows, cols);
+
+  scroll_to_index(window_ptr, rows - 2);
+
+  for (row = window_ptr->top ; row < window_ptr->count ; row++)
+  {
+    if (row - window_ptr->top >= rows - 2)
+      break;
+
+    row_ptr = window_ptr->rows + row;
+
+    /* ports reached from the origin of a reachability query */
+    if (row_ptr->port_ptr == NULL)
+      pair = reach_client(row_ptr->client_ptr->id) ? 7 : 1;
+    else
+      pair = reach_port(row_ptr->client_ptr->id, row_ptr->port_ptr->port) ? 7 : 1;
+
+    if (row == window_ptr->index)
+    {
+      if (window_ptr->selected)
+      {
+        wattron(window_ptr->window_ptr, PAIR(3));
+      }
+      else
+      {
+        wattron(window_ptr->window_ptr, PAIR(2));
+      }
+    }
+    else
+    {
+      wattron(window_ptr->window_ptr, PAIR(pair));
+    }
+
+    col = 1;
+
+    if (row_ptr->port_ptr == NULL)
+    {
+      col += print_client_info(
+        window_ptr->window_ptr,
+        row-window_ptr->top+1,
+        col,
+        row_ptr->client_ptr,
+        row_ptr->client_ptr->expanded & window_ptr->expand_mask);
+    }
+    else
+    {
+      mvwaddstr(window_ptr->window_ptr, row-window_ptr->top+1, col, row_ptr->port_ptr->marked ? "  * " : "    ");
+      col += 4;
+
+      col += print_port_info(
+        window_ptr->window_ptr,
+        row-window_ptr->top+1,
+        col,
+        row_ptr->port_ptr->client,
+        row_ptr->port_ptr->port,
+        row_ptr->port_ptr->name_id);
+    }
+
+    name_end = col;
+
+    /* one erase instead of a bar of spaces on a slow link */
+    if (g_low_bandwidth)
+      wclrtoeol(window_ptr->window_ptr);
+
+    while (col < cols && !g_low_bandwidth)
+    {
+      mvwprintw(window_ptr->window_ptr, row-window_ptr->top+1, col, " ");
+      col++;
+    }
+
+    /* clients losing events or short of pool space and destinations over budget, right aligned after the name */
+    warn_pair = 0;
+    if (row_ptr->port_ptr == NULL && monitor_describe(row_ptr->client_ptr->id, monitor, sizeof(monitor)))
+      warn_pair = 6;
+    else if (row_ptr->port_ptr != NULL && window_ptr->list_ptr == &g_output_ports && bandwidth_describe(row_ptr->port_ptr->client, row_ptr->port_ptr->port, monitor, sizeof(monitor)))
+      warn_pair = 5;
+
+    if (warn_pair != 0)
+    {
+      col = cols - 1 - strlen(monitor);
+      if (col < name_end + 1)
+        col = name_end + 1;
+
+      if (row != window_ptr->index)
+        wattron(window_ptr->window_ptr, PAIR(warn_pair));
+
+      if (col < cols - 1)
+        mvwaddnstr(window_ptr->window_ptr, row-window_ptr->top+1, col, monitor, cols - 1 - col);
+
+      if (row != window_ptr->index)
+      {
+        wattroff(window_ptr->window_ptr, PAIR(warn_pair));
+        wattron(window_ptr->window_ptr, PAIR(pair));
+      }
+    }
+
+    if (row == window_ptr->index)
+    {
+      if (window_ptr->selected)
+      {
+        wattroff(window_ptr->window_ptr, PAIR(3));
+      }
+      else
+      {
+        wattroff(window_ptr->window_ptr, PAIR(2));
+      }
+    }
+    else
+    {
+      wattroff(window_ptr->window_ptr, PAIR(pair));
+    }
+  }
+
+  draw_border(window_ptr);
+
+  refresh_window(window_ptr->window_ptr);
+
+  PROBE(draw_done, window_ptr->list_ptr == &g_input_ports ? 0 : 1, window_ptr->count, PROBE_SINCE(start_ns));
+}
+
+void
+draw_connections(struct window * window_ptr)
+{
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
+  const char * line;
+  int row, col;
+  int rows, cols;
+  int pair;
+  uint64_t start_ns;
+
+  PROBE(draw_start, 2);
+  start_ns = PROBE_START(draw_done);
+
+  getmaxyx(window_ptr->window_ptr, rows, cols);
+
+  scroll_to_index(window_ptr, rows - 2);
+
+  row = 0;
+
+  list_for_each(node_ptr, window_ptr->list_ptr)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+
+    if (row < window_ptr->top)
+    {
+      row++;
+      continue;
+    }
+
+    if (row - window_ptr->top >= rows - 2)
+      break;
+
+    /* marked connections are drawn with a double line, queued changes dotted */
+    line = connection_ptr->marked ? "=" : connection_ptr->pending ? "." : "-";
+    pair = connection_ptr->pending && row != window_ptr->index ? 6 : 1;
+
+    if (row == window_ptr->index)
+    {
+      if (window_ptr->selected)
+      {
+        wattron(window_ptr->window_ptr, PAIR(3));
+      }
+      else
+      {
+        wattron(window_ptr->window_ptr, PAIR(1));
+      }
+    }
+    else
+    {
+      wattron(window_ptr->window_ptr, PAIR(pair));
+    }
+
+    col = 1;
+    col += print_port_info(
+      window_ptr->window_ptr,
+      row-window_ptr->top+1,
+      col,
+      connection_ptr->source_client,
+      connection_ptr->source_port,
+      connection_ptr->source_name_id);
+
+    mvwprintw(window_ptr->window_ptr, row-window_ptr->top+1, col, " ");
+    col++;
+
+    while (col < cols/2 - 3)
+    {
+      mvwaddstr(window_ptr->window_ptr, row-window_ptr->top+1, col, line);
+      col++;
+    }
+
+    mvwaddstr(window_ptr->window_ptr, row-window_ptr->top+1, col, line);
+    col++;
+    mvwaddstr(window_ptr->window_ptr, row-window_ptr->top+1, col, connection_ptr->pending == CONNECTION_PENDING_DISCONNECT ? "x" : ">");
+    col++;
+
+    mvwprintw(window_ptr->window_ptr, row-window_ptr->top+1, col, " ");
+    col++;
+
+    col += print_port_info(
+      window_ptr->window_ptr,
+      row-window_ptr->top+1,
+      col,
+      connection_ptr->dest_client,
+      connection_ptr->dest_port,
+      connection_ptr->dest_name_id);
+
+    if (g_low_bandwidth)
+      wclrtoeol(window_ptr->window_ptr);
+
+    while (col < cols && !g_low_bandwidth)
+    {
+      mvwprintw(window_ptr->window_ptr, row-window_ptr->top+1, col, " ");
+      col++;
+    }
+
+    if (row == window_ptr->index)
+    {
+      if (window_ptr->selected)
+      {
+        wattroff(window_ptr->window_ptr, PAIR(3));
+      }
+      else
+      {
+        wattroff(window_ptr->window_ptr, PAIR(1));
+      }
+    }
+    else
+    {
+      wattroff(window_ptr->window_ptr, PAIR(pair));
+    }
+
+    row++;
+  }
+
+  draw_border(window_ptr);
+
+  refresh_window(window_ptr->window_ptr);
+
+  PROBE(draw_done, 2, row, PROBE_SINCE(start_ns));
+}
+
+void
+draw_inspector(struct window * window_ptr)
+{
+  struct inspector_stats stats;
+  int row;
+  int rows, cols;
+
+  getmaxyx(window_ptr->window_ptr, rows, cols);
+
+  inspector_get_stats(&stats);
+
+  wattron(window_ptr->window_ptr, PAIR(6));
+  mvwprintw(window_ptr->window_ptr, 1, 1, "%lu/s, %lu received, %lu dropped", stats.rate, stats.received, stats.dropped);
+  if (stats.sample_step > 1)
+    wprintw(window_ptr->window_ptr, ", sampled 1/%u", stats.sample_step);
+  wclrtoeol(window_ptr->window_ptr);
+  wattroff(window_ptr->window_ptr, PAIR(6));
+
+  /* newest first */
+  wattron(window_ptr->window_ptr, PAIR(1));
+  for (row = 0 ; row < rows - 3 ; row++)
+  {
+    mvwprintw(window_ptr->window_ptr, row + 2, 1, "%-*.*s", cols - 2, cols - 2, inspector_line(row));
+  }
+  wattroff(window_ptr->window_ptr, PAIR(1));
+
+  draw_border(window_ptr);
+
+  refresh_window(window_ptr->window_ptr);
+}
+
+void
+draw_tempo(struct window * window_ptr)
+{
+  struct tempo_stats stats;
+  unsigned long peak;
+  int bin;
+  int first;
+  int row;
+  int rows, cols;
+  int bar;
+
+  getmaxyx(window_ptr->window_ptr, rows, cols);
+
+  tempo_get_stats(&stats);
+
+  wattron(window_ptr->window_ptr, PAIR(6));
+  mvwprintw(window_ptr->window_ptr, 1, 1, "%.2f bpm, last beat %.2f bpm, %lu ticks", stats.bpm, stats.beat_bpm, stats.ticks);
+  wclrtoeol(window_ptr->window_ptr);
+  mvwprintw(window_ptr->window_ptr, 2, 1, "interval %.0f us, sd %.1f, min %.0f, max %.0f, max dev %.0f", stats.mean_us, stats.stddev_us, stats.min_us, stats.max_us, stats.max_dev_us);
+  wclrtoeol(window_ptr->window_ptr);
+  wattroff(window_ptr->window_ptr, PAIR(6));
+
+  peak = 1;
+  for (bin = 0 ; bin < TEMPO_HIST_BINS ; bin++)
+  {
+    if (stats.hist[bin] > peak)
+      peak = stats.hist[bin];
+  }
+
+  /* as many bins around the middle as fit */
+  first = TEMPO_HIST_BINS / 2 - (rows - 4) / 2;
+  if (first < 0)
+    first = 0;
+
+  wattron(window_ptr->window_ptr, PAIR(1));
+  for (row = 3, bin = first ; row < rows - 1 ; row++, bin++)
+  {
+    wmove(window_ptr->window_ptr, row, 1);
+
+    if (bin < TEMPO_HIST_BINS)
+    {
+      bar = cols - 21 > 0 ? (int)(stats.hist[bin] * (cols - 21) / peak) : 0;
+      wprintw(
+        window_ptr->window_ptr,
+        "%c%+5d us %7lu ",
+        (bin == 0) ? '<' : (bin == TEMPO_HIST_BINS - 1) ? '>' : ' ',
+        (bin - TEMPO_HIST_BINS / 2) * TEMPO_HIST_BIN_US,
+        stats.hist[bin]);
+      while (bar-- > 0)
+        waddch(window_ptr->window_ptr, '#');
+    }
+
+    wclrtoeol(window_ptr->window_ptr);
+  }
+  wattroff(window_ptr->window_ptr, PAIR(1));
+
+  draw_border(window_ptr);
+
+  refresh_window(window_ptr->window_ptr);
+}
+
+/*
+ * Flatten clients and the ports pane list into rows. Clients with loaded
+ * ports show only if they have ports in this pane, collapsed clients show
+ * if they have any ports at all.
+ */
+int
+build_rows(struct window * window_ptr)
+{
+  struct list_head * client_node_ptr;
+  struct list_head * port_node_ptr;
+  struct client * client_ptr;
+  struct port * port_ptr;
+  struct row * rows;
+  int size;
+  int count;
+  int header;
+
+  size = 0;
+  list_for_each(client_node_ptr, &g_seq_clients)
+    size++;
+  list_for_each(port_node_ptr, window_ptr->list_ptr)
+    size++;
+
+  if (size > window_ptr->rows_size)
+  {
+    rows = realloc(window_ptr->rows, size * sizeof(struct row));
+    if (rows == NULL)
+    {
+      return -1;
+    }
+
+    window_ptr->rows = rows;
+    window_ptr->rows_size = size;
+  }
+
+  count = 0;
+  port_node_ptr = window_ptr->list_ptr->next;
+
+  list_for_each(client_node_ptr, &g_seq_clients)
+  {
+    client_ptr = list_entry(client_node_ptr, struct client, siblings);
+
+    /* both lists are ordered by client id, walk them together */
+    while (port_node_ptr != window_ptr->list_ptr &&
+           list_entry(port_node_ptr, struct port, siblings)->client < client_ptr->id)
+    {
+      port_node_ptr = port_node_ptr->next;
+    }
+
+    if (!client_ptr->ports_loaded)
+    {
+      if (client_ptr->num_ports > 0)
+      {
+        window_ptr->rows[count].client_ptr = client_ptr;
+        window_ptr->rows[count].port_ptr = NULL;
+        count++;
+      }
+
+      continue;
+    }
+
+    header = 1;
+
+    while (port_node_ptr != window_ptr->list_ptr)
+    {
+      port_ptr = list_entry(port_node_ptr, struct port, siblings);
+      if (port_ptr->client != client_ptr->id)
+        break;
+
+      if (header)
+      {
+        window_ptr->rows[count].client_ptr = client_ptr;
+        window_ptr->rows[count].port_ptr = NULL;
+        count++;
+        header = 0;
+      }
+
+      if (client_ptr->expanded & window_ptr->expand_mask)
+      {
+        window_ptr->rows[count].client_ptr = client_ptr;
+        window_ptr->rows[count].port_ptr = port_ptr;
+        count++;
+      }
+
+      port_node_ptr = port_node_ptr->next;
+    }
+  }
+
+  return count;
+}
+
+/* row index of client (and port, or -1 for its header), -1 if not shown */
+int
+find_row(struct window * window_ptr, int client, int port)
+{
+  int i;
+
+  for (i = 0 ; i < window_ptr->count ; i++)
+  {
+    if (window_ptr->rows[i].client_ptr->id != client)
+      continue;
+
+    if (port == -1 && window_ptr->rows[i].port_ptr == NULL)
+      return i;
+
+    if (window_ptr->rows[i].port_ptr != NULL && window_ptr->rows[i].port_ptr->port == port)
+      return i;
+  }
+
+  return -1;
+}
+
+void index_rows(struct window * window_ptr)
+{
+  struct row * row_ptr;
+  int i;
+
+  if (window_ptr->navindex_ptr == NULL)
+    return;
+
+  navindex_reset(window_ptr->navindex_ptr);
+
+  for (i = 0 ; i < window_ptr->count ; i++)
+  {
+    row_ptr = window_ptr->rows + i;
+
+    if (row_ptr->port_ptr == NULL)
+      navindex_add(window_ptr->navindex_ptr, i, row_ptr->client_ptr->id, -1, row_ptr->client_ptr->name_id);
+    else
+      navindex_add(window_ptr->navindex_ptr, i, row_ptr->client_ptr->id, row_ptr->port_ptr->port, row_ptr->port_ptr->name_id);
+  }
+
+  /* the rows changed under a jump in progress, walk the prefix again */
+  for (i = 0 ; i < window_ptr->jump_len ; i++)
+  {
+    window_ptr->jump_nodes[i + 1] = navindex_step(window_ptr->navindex_ptr, window_ptr->jump_nodes[i], window_ptr->jump[i]);
+  }
+}
+
+/*
+ * Row for the typed prefix, -1 if nothing matches. A prefix starting
+ * with a digit is an address, "20", "20:" or "20:1", anything else the
+ * start of a client or port name.
+ */
+int
+jump_row(struct window * window_ptr)
+{
+  unsigned int client;
+  int port;
+  int i;
+
+  if (window_ptr->jump_len <= 0 || window_ptr->navindex_ptr == NULL)
+    return -1;
+
+  if (!isdigit((unsigned char)window_ptr->jump[0]))
+    return navindex_row(window_ptr->navindex_ptr, window_ptr->jump_nodes[window_ptr->jump_len]);
+
+  client = 0;
+  for (i = 0 ; i < window_ptr->jump_len && isdigit((unsigned char)window_ptr->jump[i]) ; i++)
+    client = client * 10 + window_ptr->jump[i] - '0';
+
+  port = -1;
+  if (i < window_ptr->jump_len && window_ptr->jump[i] == ':')
+  {
+    for (i++ ; i < window_ptr->jump_len && isdigit((unsigned char)window_ptr->jump[i]) ; i++)
+      port = (port < 0 ? 0 : port * 10) + window_ptr->jump[i] - '0';
+  }
+
+  if (i < window_ptr->jump_len || client > 255 || port > 255)
+    return -1;
+
+  return navindex_find_addr(window_ptr->navindex_ptr, client, port);
+}
+
+/* returns 1 if the key belonged to the jump prompt */
+int
+jump_handle_key(struct window * window_ptr, int ch)
+{
+  int row;
+
+  if (window_ptr->jump_len < 0)
+  {
+    if (ch != '/')
+      return 0;
+
+    window_ptr->jump_len = 0;
+    window_ptr->jump_nodes[0] = NAVINDEX_ROOT;
+    return 1;
+  }
+
+  if (ch == KEY_BACKSPACE || ch == 127 || ch == 8)
+  {
+    if (window_ptr->jump_len == 0)
+    {
+      window_ptr->jump_len = -1;
+      return 1;
+    }
+
+    window_ptr->jump_len--;
+  }
+  else if (ch >= ' ' && ch < 127 && window_ptr->jump_len < JUMP_MAX)
+  {
+    window_ptr->jump[window_ptr->jump_len] = ch;
+    window_ptr->jump_nodes[window_ptr->jump_len + 1] =
+      navindex_step(window_ptr->navindex_ptr, window_ptr->jump_nodes[window_ptr->jump_len], ch);
+    window_ptr->jump_len++;
+  }
+  else
+  {
+    /* ENTER and ESC end the jump, other keys end it and do their thing */
+    window_ptr->jump_len = -1;
+    return ch == '\n' || ch == KEY_ENTER || ch == 27;
+  }
+
+  row = jump_row(window_ptr);
+  if (row >= 0)
+    window_ptr->index = row;
+
+  return 1;
+}
+
+void
+draw_jump_prompt(WINDOW * help_window, struct window * window_ptr)
+{
+  int color;
+
+  /* red while the prefix matches nothing */
+  color = (window_ptr->jump_len > 0 && jump_row(window_ptr) < 0) ? 5 : 6;
+
+  wattron(help_window, PAIR(color));
+  mvwprintw(help_window, 0, 1, "jump: %.*s", window_ptr->jump_len, window_ptr->jump);
+  wattroff(help_window, PAIR(color));
+}
+
+void items_count(struct window * window_ptr)
+{
+  struct list_head * node_ptr;
+  int client, port;
+  int index;
+
+  if (window_ptr->expand_mask != 0)
+  {
+    /* rows point into the model, remember the selection by address */
+    client = port = -1;
+    if (window_ptr->index >= 0 && window_ptr->index < window_ptr->count)
+    {
+      client = window_ptr->rows[window_ptr->index].client_ptr->id;
+      if (window_ptr->rows[window_ptr->index].port_ptr != NULL)
+        port = window_ptr->rows[window_ptr->index].port_ptr->port;
+    }
+
+    window_ptr->count = build_rows(window_ptr);
+    if (window_ptr->count < 0)
+    {
+      ERR_OUT("realloc() failed.");
+      window_ptr->count = 0;
+    }
+
+    index_rows(window_ptr);
+
+    if (client != -1)
+    {
+      index = find_row(window_ptr, client, port);
+      if (index == -1)
+        index = find_row(window_ptr, client, -1);
+      if (index != -1)
+        window_ptr->index = index;
+    }
+  }
+  else
+  {
+    window_ptr->count = 0;
+
+    list_for_each(node_ptr, window_ptr->list_ptr)
+    {
+      window_ptr->count++;
+    }
+  }
+
+  if (window_ptr->count > 0)
+  {
+    if (window_ptr->index == -1)
+    {
+      window_ptr->index = 0;
+    }
+    else
+    {
+      if (window_ptr->index >= window_ptr->count)
+      {
+        window_ptr->index = window_ptr->count - 1;
+      }
+    }
+  }
+  else
+  {
+    window_ptr->index = -1;
+  }
+}
+
+/* rows of all three panes after the topology changed */
+void recount_windows(struct window * windows)
+{
+  items_count(windows);
+  items_count(windows+1);
+  items_count(windows+2);
+
+  /* a slow link gets only what changed, not a repaint */
+  if (g_low_bandwidth)
+  {
+    werase(windows[0].window_ptr);
+    werase(windows[1].window_ptr);
+    werase(windows[2].window_ptr);
+    return;
+  }
+
+  wclear(windows[0].window_ptr);
+  wclear(windows[1].window_ptr);
+  wclear(windows[2].window_ptr);
+}
+
+void create_ports_win(struct window * window_ptr, struct list_head * ports_ptr, const char * name, unsigned int expand_mask)
+{
+  window_ptr->list_ptr = ports_ptr;
+  window_ptr->window_ptr = NULL;
+  window_ptr->selected = 0;
+  window_ptr->name = name;
+  window_ptr->index = -1;
+  window_ptr->top = 0;
+  window_ptr->expand_mask = expand_mask;
+  window_ptr->rows = NULL;
+  window_ptr->rows_size = 0;
+  window_ptr->navindex_ptr = navindex_create();
+  window_ptr->jump_len = -1;
+
+  items_count(window_ptr);
+}
+
+void create_connections_win(struct window * window_ptr)
+{
+  window_ptr->list_ptr = &g_connections;
+  window_ptr->window_ptr = NULL;
+  window_ptr->selected = 0;
+  window_ptr->name = "Connections";
+  window_ptr->index = -1;
+  window_ptr->top = 0;
+  window_ptr->expand_mask = 0;
+  window_ptr->rows = NULL;
+  window_ptr->rows_size = 0;
+  window_ptr->navindex_ptr = NULL;
+  window_ptr->jump_len = -1;
+
+  items_count(window_ptr);
+}
+
+void place_window(struct window * window_ptr, int height, int width, int starty, int startx)
+{
+  if (window_ptr->window_ptr != NULL)
+  {
+    delwin(window_ptr->window_ptr);
+  }
+
+  window_ptr->window_ptr = newwin(height, width, starty, startx);
+  idlok(window_ptr->window_ptr, g_low_bandwidth != 0);
+  window_ptr->width = width;
+  window_ptr->height = height;
+}
+
+/*
+ * (Re)create the curses windows for the current terminal size. List
+ * contents, selection and scroll position live in struct window and
+ * survive, so a resize costs a single redraw.
+ */
+WINDOW *
+layout_windows(struct window * windows, WINDOW * help_window)
+{
+  int rows, cols;
+
+  getmaxyx(stdscr, rows, cols);
+
+  place_window(windows, rows/2, cols/2, 0, 0);
+  place_window(windows+1, rows/2, cols - cols/2, 0, cols/2);
+
+  /* the inspector or the clock analyzer takes the right half of the connections pane */
+  if (inspector_source() != NULL || tempo_source() != NULL)
+  {
+    place_window(windows+2, rows-rows/2-1, cols/2, rows/2, 0);
+    place_window(windows+3, rows-rows/2-1, cols - cols/2, rows/2, cols/2);
+  }
+  else
+  {
+    place_window(windows+2, rows-rows/2-1, cols, rows/2, 0);
+
+    if (windows[3].window_ptr != NULL)
+    {
+      delwin(windows[3].window_ptr);
+      windows[3].window_ptr = NULL;
+    }
+  }
+
+  if (help_window != NULL)
+  {
+    delwin(help_window);
+  }
+
+  return newwin(0, cols, rows-1, 0);
+}
+
+/* returns 1 if the rows changed */
+int ports_handle_key(snd_seq_t * seq_handle, struct window * window_ptr, int ch)
+{
+  struct row * row_ptr;
+
+  if (jump_handle_key(window_ptr, ch))
+    return 0;
+
+  if (ch == KEY_DOWN)
+  {
+    if (window_ptr->index + 1 < window_ptr->count)
+    {
+      window_ptr->index++;
+    }
+
+    return 0;
+  }
+
+  if (ch == KEY_UP)
+  {
+    if (window_ptr->index > 0)
+    {
+      window_ptr->index--;
+    }
+
+    return 0;
+  }
+
+  if (window_ptr->index < 0)
+    return 0;
+
+  row_ptr = window_ptr->rows + window_ptr->index;
+
+  if (ch == KEY_LEFT && row_ptr->port_ptr != NULL)
+  {
+    /* from a port go to its client */
+    window_ptr->index = find_row(window_ptr, row_ptr->client_ptr->id, -1);
+    return 0;
+  }
+
+  if (row_ptr->port_ptr != NULL)
+    return 0;
+
+  if (ch == KEY_LEFT ||
+      ((ch == '\n' || ch == KEY_ENTER) && (row_ptr->client_ptr->expanded & window_ptr->expand_mask)))
+  {
+    row_ptr->client_ptr->expanded &= ~window_ptr->expand_mask;
+    return 1;
+  }
+
+  if (ch == KEY_RIGHT || ch == '\n' || ch == KEY_ENTER)
+  {
+    /* the first expand fetches the ports of the client */
+    if (expand_client(seq_handle, row_ptr->client_ptr, window_ptr->expand_mask))
+      publish_topology();
+
+    return 1;
+  }
+
+  return 0;
+}
+
+void connections_handle_key(struct window * window_ptr, int ch)
+{
+  if (ch == KEY_DOWN)
+  {
+    if (window_ptr->index + 1 < window_ptr->count)
+    {
+      window_ptr->index++;
+    }
+
+    return;
+  }
+
+  if (ch == KEY_UP)
+  {
+    if (window_ptr->index > 0)
+    {
+      window_ptr->index--;
+    }
+
+    return;
+  }
+}
+
+int
+subscribe_ports(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr)
+{
+  snd_seq_port_subscribe_t * subscr_ptr;
+
+  snd_seq_port_subscribe_alloca(&subscr_ptr);
+
+  snd_seq_port_subscribe_set_sender(subscr_ptr, sender_ptr);
+  snd_seq_port_subscribe_set_dest(subscr_ptr, dest_ptr);
+  snd_seq_port_subscribe_set_queue(subscr_ptr, 0);
+  snd_seq_port_subscribe_set_exclusive(subscr_ptr, 0);
+  snd_seq_port_subscribe_set_time_update(subscr_ptr, 0);
+  snd_seq_port_subscribe_set_time_real(subscr_ptr, 0);
+
+  return snd_seq_subscribe_port(seq_handle, subscr_ptr);
+}
+
+int
+unsubscribe_ports(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr)
+{
+  snd_seq_port_subscribe_t * subscr_ptr;
+
+  snd_seq_port_subscribe_alloca(&subscr_ptr);
+
+  snd_seq_port_subscribe_set_sender(subscr_ptr, sender_ptr);
+  snd_seq_port_subscribe_set_dest(subscr_ptr, dest_ptr);
+
+  return snd_seq_unsubscribe_port(seq_handle, subscr_ptr);
+}
+
+/*
+ * The announce that follows finds the model already changed and leaves it
+ * alone, so a batch costs no rebuild.
+ */
+int
+change_subscription(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe)
+{
+  int ret;
+
+  if (subscribe)
+    ret = subscribe_ports(seq_handle, sender_ptr, dest_ptr);
+  else
+    ret = unsubscribe_ports(seq_handle, sender_ptr, dest_ptr);
+
+  if (ret < 0)
+    return ret;
+
+  model_subscription(seq_handle, sender_ptr, dest_ptr, subscribe);
+
+  return 0;
+}
+
+/* a change that was made, applied to the model */
+void
+model_subscription(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe)
+{
+  struct connection * connection_ptr;
+  struct client * client_ptr;
+
+  connection_ptr = find_connection(sender_ptr->client, sender_ptr->port, dest_ptr->client, dest_ptr->port);
+
+  if (!subscribe)
+  {
+    if (connection_ptr != NULL)
+      drop_connection(connection_ptr);
+
+    return;
+  }
+
+  if (connection_ptr != NULL)
+    return;
+
+  /* the same rule as for announces, one end must have its ports loaded */
+  client_ptr = find_client(sender_ptr->client);
+  if (client_ptr == NULL || !client_ptr->ports_loaded)
+  {
+    client_ptr = find_client(dest_ptr->client);
+    if (client_ptr == NULL || !client_ptr->ports_loaded)
+      return;
+  }
+
+  add_connection(seq_handle, sender_ptr->client, sender_ptr->port, dest_ptr->client, dest_ptr->port);
+}
+
+/* makes the changes the operations worker cannot take, keybench() swaps in its own */
+static int (* g_make_subscription)(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe) = change_subscription;
+
+/* a change submitted to the operations worker, shown as pending */
+void
+model_pending(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe)
+{
+  struct connection * connection_ptr;
+
+  connection_ptr = find_connection(sender_ptr->client, sender_ptr->port, dest_ptr->client, dest_ptr->port);
+
+  /* connecting what is made already fails, and must not take it away */
+  if (subscribe && connection_ptr != NULL && connection_ptr->pending == 0)
+    return;
+
+  if (subscribe && connection_ptr == NULL)
+  {
+    add_connection(seq_handle, sender_ptr->client, sender_ptr->port, dest_ptr->client, dest_ptr->port);
+    connection_ptr = find_connection(sender_ptr->client, sender_ptr->port, dest_ptr->client, dest_ptr->port);
+  }
+
+  if (connection_ptr != NULL)
+    connection_ptr->pending = subscribe ? CONNECTION_PENDING_CONNECT : CONNECTION_PENDING_DISCONNECT;
+}
+
+/*
+ * The change is made by the operations worker and shown right away as
+ * pending; its result or the announce settles it, whichever comes first.
+ * Without the worker, or with its queue full, it is made here.
+ */
+int
+queue_subscription(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe)
+{
+  if (seqops_submit(subscribe, sender_ptr, dest_ptr, 0) < 0)
+    return g_make_subscription(seq_handle, sender_ptr, dest_ptr, subscribe);
+
+  model_pending(seq_handle, sender_ptr, dest_ptr, subscribe);
+
+  return 0;
+}
+
+/* settle the results of queued changes, returns how many failed */
+int
+reap_subscriptions(char * message, size_t message_size)
+{
+  struct seqops_result result;
+  struct connection * connection_ptr;
+  int failed;
+
+  failed = 0;
+
+  while (seqops_reap(&result))
+  {
+    connection_ptr = find_connection(result.sender.client, result.sender.port, result.dest.client, result.dest.port);
+
+    /* the announce may have come first, or a later change taken over */
+    if (connection_ptr != NULL && connection_ptr->pending == (result.subscribe ? CONNECTION_PENDING_CONNECT : CONNECTION_PENDING_DISCONNECT))
+    {
+      /* a connect that was made and a disconnect that failed stay */
+      if (result.subscribe == (result.error == 0))
+        connection_ptr->pending = 0;
+      else
+        drop_connection(connection_ptr);
+    }
+
+    /* a control socket request is answered there, not on the status line */
+    if (result.owner != 0)
+    {
+      ctlsock_settle(result.owner, result.error);
+      continue;
+    }
+
+    if (result.error == 0)
+      continue;
+
+    if (failed++ == 0)
+    {
+      snprintf(
+        message,
+        message_size,
+        "%s %u:%u -> %u:%u failed - %s",
+        result.subscribe ? "Connecting" : "Disconnecting",
+        result.sender.client,
+        result.sender.port,
+        result.dest.client,
+        result.dest.port,
+        snd_strerror(result.error));
+    }
+  }
+
+  if (failed > 1)
+    snprintf(message + strlen(message), message_size - strlen(message), ", %d more", failed - 1);
+
+  return failed;
+}
+
+/* the marked connections, or the selected one if none is marked */
+const char *
+disconnect(snd_seq_t * seq_handle, struct window * window_ptr, char * message, size_t message_size)
+{
+  struct list_head * node_ptr;
+  struct list_head * next_ptr;
+  struct connection * connection_ptr;
+  snd_seq_addr_t sender, dest;
+  char first[64];
+  int marked;
+  int count;
+  int failed;
+  int ret;
+  int i;
+  uint64_t start_ns;
+
+  PROBE(disconnect_start);
+  start_ns = PROBE_START(disconnect_done);
+
+  marked = 0;
+  list_for_each(node_ptr, &g_connections)
+  {
+    if (list_entry(node_ptr, struct connection, siblings)->marked)
+      marked = 1;
+  }
+
+  count = 0;
+  failed = 0;
+  i = 0;
+
+  list_for_each_safe(node_ptr, next_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+
+    if (marked ? !connection_ptr->marked : i != window_ptr->index)
+    {
+      i++;
+      continue;
+    }
+
+    i++;
+
+    if (connection_ptr->pending == CONNECTION_PENDING_DISCONNECT)
+      continue;
+
+    count++;
+
+    sender.client = connection_ptr->source_client;
+    sender.port = connection_ptr->source_port;
+    dest.client = connection_ptr->dest_client;
+    dest.port = connection_ptr->dest_port;
+
+    /* cleared first, a disconnect made here frees the connection */
+    connection_ptr->marked = 0;
+    ret = queue_subscription(seq_handle, &sender, &dest, 0);
+    if (ret < 0)
+    {
+      /* the ones that fail here stay marked for another go */
+      connection_ptr->marked = marked;
+      if (failed++ == 0)
+        snprintf(first, sizeof(first), "%u:%u -> %u:%u - %s", sender.client, sender.port, dest.client, dest.port, snd_strerror(ret));
+    }
+  }
+
+  if (count == 0)
+    return "Select or mark a connection";
+
+  publish_topology();
+
+  PROBE(disconnect_done, count - failed, failed, PROBE_SINCE(start_ns));
+
+  if (failed == 0)
+    return NULL;
+
+  snprintf(message, message_size, "Disconnecting %d of %d failed, %s", failed, count, first);
+  return message;
+}
+
+/* port of the selected row, NULL if a client is selected */
+struct port *
+selected_port(struct window * window_ptr)
+{
+  if (window_ptr->index < 0 || window_ptr->index >= window_ptr->count)
+    return NULL;
+
+  return window_ptr->rows[window_ptr->index].port_ptr;
+}
+
+int
+has_marks(struct list_head * ports_ptr)
+{
+  struct list_head * node_ptr;
+
+  list_for_each(node_ptr, ports_ptr)
+  {
+    if (list_entry(node_ptr, struct port, siblings)->marked)
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Space marks the selected port or connection and moves on. On a client
+ * row it marks all its ports, or unmarks them if they all were.
+ */
+void
+toggle_mark(struct window * window_ptr)
+{
+  struct list_head * node_ptr;
+  struct connection * connection_ptr;
+  struct row * row_ptr;
+  struct port * port_ptr;
+  int all;
+  int i;
+
+  if (window_ptr->index < 0)
+    return;
+
+  if (window_ptr->expand_mask == 0)
+  {
+    i = 0;
+    list_for_each(node_ptr, &g_connections)
+    {
+      connection_ptr = list_entry(node_ptr, struct connection, siblings);
+      if (i++ == window_ptr->index)
+      {
+        connection_ptr->marked = !connection_ptr->marked;
+        break;
+      }
+    }
+  }
+  else
+  {
+    row_ptr = window_ptr->rows + window_ptr->index;
+
+    if (row_ptr->port_ptr != NULL)
+    {
+      row_ptr->port_ptr->marked = !row_ptr->port_ptr->marked;
+    }
+    else
+    {
+      all = 1;
+      list_for_each(node_ptr, window_ptr->list_ptr)
+      {
+        port_ptr = list_entry(node_ptr, struct port, siblings);
+        if (port_ptr->client == row_ptr->client_ptr->id && !port_ptr->marked)
+          all = 0;
+      }
+
+      list_for_each(node_ptr, window_ptr->list_ptr)
+      {
+        port_ptr = list_entry(node_ptr, struct port, siblings);
+        if (port_ptr->client == row_ptr->client_ptr->id)
+          port_ptr->marked = !all;
+      }
+    }
+  }
+
+  if (window_ptr->index + 1 < window_ptr->count)
+    window_ptr->index++;
+}
+
+/* the line typed after 'o', a route spec */
+struct route_prompt
+{
+  char text[ROUTER_SPEC_MAX];
+  int len;                      /* -1 when closed */
+  int port;                     /* route being edited, -1 for a new one */
+};
+
+/* edit the selected route, or start a new one if no route is selected */
+void
+route_prompt_open(struct route_prompt * prompt_ptr, struct window * window_ptr)
+{
+  struct port * port_ptr;
+  const char * spec;
+
+  prompt_ptr->port = -1;
+  prompt_ptr->len = 0;
+
+  port_ptr = selected_port(window_ptr);
+  if (port_ptr == NULL || port_ptr->client != router_client())
+    return;
+
+  spec = router_spec(port_ptr->port);
+  if (spec == NULL)
+    return;
+
+  prompt_ptr->port = port_ptr->port;
+  prompt_ptr->len = strlen(spec);
+  memcpy(prompt_ptr->text, spec, prompt_ptr->len);
+}
+
+/* ENTER applies the spec, an empty one removes the edited route; returns an error or NULL */
+const char *
+route_prompt_key(struct route_prompt * prompt_ptr, int ch)
+{
+  const char * err;
+
+  if (ch == KEY_BACKSPACE || ch == 127 || ch == 8)
+  {
+    if (prompt_ptr->len > 0)
+      prompt_ptr->len--;
+    return NULL;
+  }
+
+  if (ch >= ' ' && ch < 127)
+  {
+    if (prompt_ptr->len < ROUTER_SPEC_MAX - 1)
+      prompt_ptr->text[prompt_ptr->len++] = ch;
+    return NULL;
+  }
+
+  if (ch != '\n' && ch != KEY_ENTER)
+  {
+    prompt_ptr->len = -1;
+    return NULL;
+  }
+
+  prompt_ptr->text[prompt_ptr->len] = '\0';
+  prompt_ptr->len = -1;
+  err = NULL;
+
+  if (prompt_ptr->port < 0)
+    router_add(prompt_ptr->text, &err);
+  else if (prompt_ptr->text[0] == '\0')
+    router_remove(prompt_ptr->port);
+  else
+    router_set(prompt_ptr->port, prompt_ptr->text, &err);
+
+  return err;
+}
+
+void
+draw_route_prompt(WINDOW * help_window, struct route_prompt * prompt_ptr)
+{
+  wattron(help_window, PAIR(6));
+  if (prompt_ptr->port < 0)
+    mvwprintw(help_window, 0, 1, "new route: %.*s", prompt_ptr->len, prompt_ptr->text);
+  else
+    mvwprintw(help_window, 0, 1, "route %d:%d (empty removes): %.*s", router_client(), prompt_ptr->port, prompt_ptr->len, prompt_ptr->text);
+  wattroff(help_window, PAIR(6));
+}
+
+/* start or stop recording the selected input into a new file in the current directory */
+const char *
+record(struct window * window_ptr, char * message, size_t message_size)
+{
+  struct port * port_ptr;
+  struct recorder_report report;
+  snd_seq_addr_t source;
+  char path[64];
+  time_t now;
+
+  if (recorder_source() != NULL)
+  {
+    if (recorder_stop(&report) < 0)
+    {
+      snprintf(message, message_size, "Recording to %s failed - %s", recorder_path(), strerror(report.write_error));
+      return message;
+    }
+
+    snprintf(
+      message,
+      message_size,
+      "Recorded %lu events, %llu bytes in %.1f s to %s (%.0f events/s, %.1f KiB/s, peak buffer %zu KiB, %lu stalls)",
+      report.events,
+      report.bytes,
+      report.seconds,
+      recorder_path(),
+      report.seconds > 0 ? report.events / report.seconds : 0.0,
+      report.seconds > 0 ? report.bytes / 1024.0 / report.seconds : 0.0,
+      report.peak_buffered / 1024,
+      report.stalls);
+    return message;
+  }
+
+  port_ptr = selected_port(window_ptr);
+  if (port_ptr == NULL)
+    return "Select a source port, not a client";
+
+  source.client = port_ptr->client;
+  source.port = port_ptr->port;
+
+  now = time(NULL);
+  strftime(path, sizeof(path), "naconnect-%Y%m%d-%H%M%S.mid", localtime(&now));
+
+  if (recorder_start(&source, path) < 0)
+    return "Cannot start recording";
+
+  return NULL;
+}
+
+/* start playing a file to the selected output, or stop and report */
+const char *
+play(snd_seq_t * seq_handle, struct window * window_ptr, const char * path, char * message, size_t message_size)
+{
+  struct port * port_ptr;
+  struct player_report report;
+  snd_seq_addr_t dest;
+
+  if (player_dest() != NULL)
+  {
+    player_stop(seq_handle, &report);
+
+    snprintf(
+      message,
+      message_size,
+      "%s %s: %lu events sent in %.1f s, %lu batches; delivery late %.0f/%.0f/%.0f us min/avg/max, jitter %.0f us over %lu probes",
+      report.finished ? "Played" : "Stopped",
+      player_path(),
+      report.events,
+      report.seconds,
+      report.batches,
+      report.late_min_us,
+      report.late_avg_us,
+      report.late_max_us,
+      report.jitter_us,
+      report.probes);
+    return message;
+  }
+
+  if (path == NULL)
+    return "Nothing to play, record first or pass --play FILE";
+
+  port_ptr = selected_port(window_ptr);
+  if (port_ptr == NULL)
+    return "Select a dest port, not a client";
+
+  dest.client = port_ptr->client;
+  dest.port = port_ptr->port;
+
+  if (player_start(seq_handle, &dest, path) < 0)
+  {
+    snprintf(message, message_size, "Cannot play %s", path);
+    return message;
+  }
+
+  return NULL;
+}
+
+/* start, move or stop the clock analyzer on the selected input */
+const char *
+analyze(snd_seq_t * seq_handle, struct window * window_ptr, char * title, size_t title_size)
+{
+  struct port * port_ptr;
+  const snd_seq_addr_t * source_ptr;
+  snd_seq_addr_t source;
+
+  port_ptr = selected_port(window_ptr);
+  if (port_ptr == NULL)
+    return "Select a source port, not a client";
+
+  source.client = port_ptr->client;
+  source.port = port_ptr->port;
+
+  source_ptr = tempo_source();
+  if (source_ptr != NULL && source_ptr->client == source.client && source_ptr->port == source.port)
+  {
+    tempo_stop();
+    return NULL;
+  }
+
+  inspector_stop(seq_handle);
+
+  if (tempo_start(&source) < 0)
+    return "Cannot analyze the port";
+
+  snprintf(title, title_size, "Clock %u:%u", source.client, source.port);
+
+  return NULL;
+}
+
+/* start, move or stop the inspector on the selected input */
+const char *
+inspect(snd_seq_t * seq_handle, struct window * window_ptr, char * title, size_t title_size)
+{
+  struct port * port_ptr;
+  const snd_seq_addr_t * source_ptr;
+  snd_seq_addr_t source;
+
+  port_ptr = selected_port(window_ptr);
+  if (port_ptr == NULL)
+    return "Select a source port, not a client";
+
+  source.client = port_ptr->client;
+  source.port = port_ptr->port;
+
+  source_ptr = inspector_source();
+  if (source_ptr != NULL && source_ptr->client == source.client && source_ptr->port == source.port)
+  {
+    inspector_stop(seq_handle);
+    return NULL;
+  }
+
+  tempo_stop();
+
+  if (inspector_start(seq_handle, &source) < 0)
+    return "Cannot inspect the port";
+
+  snprintf(title, title_size, "Inspector %u:%u", source.client, source.port);
+
+  return NULL;
+}
+
+/*
+ * The hardware destination the pairs connect() would make put furthest
+ * over the bandwidth budget, with its rate then, or 0 if none would go
+ * over. Sources and dests are picked as by connect().
+ */
+static
+unsigned int
+over_budget_rate(struct port * selected_source_ptr, struct port * selected_dest_ptr, snd_seq_addr_t * over_ptr)
+{
+  struct list_head * source_node_ptr;
+  struct list_head * dest_node_ptr;
+  struct port * source_port_ptr;
+  struct port * dest_port_ptr;
+  snd_seq_addr_t sender, dest;
+  unsigned int over_rate;
+  unsigned int rate;
+
+  over_rate = 0;
+
+  list_for_each(dest_node_ptr, &g_output_ports)
+  {
+    dest_port_ptr = list_entry(dest_node_ptr, struct port, siblings);
+    if (selected_dest_ptr != NULL ? dest_port_ptr != selected_dest_ptr : !dest_port_ptr->marked)
+      continue;
+
+    dest.client = dest_port_ptr->client;
+    dest.port = dest_port_ptr->port;
+
+    if (!bandwidth_limited(&dest))
+      continue;
+
+    rate = bandwidth_fan_in(&dest);
+
+    list_for_each(source_node_ptr, &g_input_ports)
+    {
+      source_port_ptr = list_entry(source_node_ptr, struct port, siblings);
+      if (selected_source_ptr != NULL ? source_port_ptr != selected_source_ptr : !source_port_ptr->marked)
+        continue;
+
+      if (find_connection(source_port_ptr->client, source_port_ptr->port, dest.client, dest.port) != NULL)
+        continue;
+
+      sender.client = source_port_ptr->client;
+      sender.port = source_port_ptr->port;
+      rate += bandwidth_rate(&sender);
+    }
+
+    if (rate > bandwidth_budget() && rate > over_rate)
+    {
+      *over_ptr = dest;
+      over_rate = rate;
+    }
+  }
+
+  return over_rate;
+}
+
+/*
+ * Every marked source to every marked dest, a pane without marks gives
+ * its selected port. Pairs already connected are left alone, the others
+ * are subscribed back to back and the model is published once. Pairs
+ * that would put a destination over the bandwidth budget are only made
+ * when *over_budget_ptr is set, otherwise it is set and nothing is made.
+ */
+const char *
+connect(snd_seq_t * seq_handle, struct window * source_window_ptr, struct window * dest_window_ptr, int * over_budget_ptr, char * message, size_t message_size)
+{
+  struct list_head * source_node_ptr;
+  struct list_head * dest_node_ptr;
+  struct port * source_port_ptr;
+  struct port * dest_port_ptr;
+  struct port * selected_source_ptr;
+  struct port * selected_dest_ptr;
+  snd_seq_addr_t sender, dest;
+  snd_seq_addr_t over;
+  unsigned int over_rate;
+  char first[64];
+  int count;
+  int failed;
+  int ret;
+  uint64_t start_ns;
+
+  PROBE(connect_start);
+  start_ns = PROBE_START(connect_done);
+
+  selected_source_ptr = NULL;
+  if (!has_marks(&g_input_ports))
+  {
+    selected_source_ptr = selected_port(source_window_ptr);
+    if (selected_source_ptr == NULL)
+      return "Select or mark a source port, not a client";
+  }
+
+  selected_dest_ptr = NULL;
+  if (!has_marks(&g_output_ports))
+  {
+    selected_dest_ptr = selected_port(dest_window_ptr);
+    if (selected_dest_ptr == NULL)
+      return "Select or mark a dest port, not a client";
+  }
+
+  /* warned before the routes are made, a second 'c' makes them anyway */
+  if (bandwidth_budget() > 0 && !*over_budget_ptr)
+  {
+    over_rate = over_budget_rate(selected_source_ptr, selected_dest_ptr, &over);
+    if (over_rate > 0)
+    {
+      *over_budget_ptr = 1;
+      snprintf(message, message_size, "%u:%u would get %.1f kB/s, over its budget of %.1f - 'c' again to connect", over.client, over.port, over_rate / 1000.0, bandwidth_budget() / 1000.0);
+      return message;
+    }
+  }
+
+  *over_budget_ptr = 0;
+
+  count = 0;
+  failed = 0;
+
+  list_for_each(source_node_ptr, &g_input_ports)
+  {
+    source_port_ptr = list_entry(source_node_ptr, struct port, siblings);
+    if (selected_source_ptr != NULL ? source_port_ptr != selected_source_ptr : !source_port_ptr->marked)
+      continue;
+
+    sender.client = source_port_ptr->client;
+    sender.port = source_port_ptr->port;
+
+    list_for_each(dest_node_ptr, &g_output_ports)
+    {
+      dest_port_ptr = list_entry(dest_node_ptr, struct port, siblings);
+      if (selected_dest_ptr != NULL ? dest_port_ptr != selected_dest_ptr : !dest_port_ptr->marked)
+        continue;
+
+      dest.client = dest_port_ptr->client;
+      dest.port = dest_port_ptr->port;
+
+      if (find_connection(sender.client, sender.port, dest.client, dest.port) != NULL)
+        continue;
+
+      count++;
+
+      ret = queue_subscription(seq_handle, &sender, &dest, 1);
+      if (ret < 0 && failed++ == 0)
+        snprintf(first, sizeof(first), "%u:%u -> %u:%u - %s", sender.client, sender.port, dest.client, dest.port, snd_strerror(ret));
+    }
+  }
+
+  if (count > 0)
+    publish_topology();
+
+  PROBE(connect_done, count - failed, failed, PROBE_SINCE(start_ns));
+
+  if (failed == 0)
+  {
+    /* done with the marks, unless some pair has to be retried */
+    list_for_each(source_node_ptr, &g_input_ports)
+      list_entry(source_node_ptr, struct port, siblings)->marked = 0;
+    list_for_each(dest_node_ptr, &g_output_ports)
+      list_entry(dest_node_ptr, struct port, siblings)->marked = 0;
+
+    return NULL;
+  }
+
+  snprintf(message, message_size, "Connecting %d of %d failed, %s", failed, count, first);
+  return message;
+}
+
+static struct option g_long_options[] =
+{
+  {"socket", required_argument, NULL, 's'},
+  {"shm", required_argument, NULL, 'm'},
+  {"collapsed", no_argument, NULL, 'c'},
+  {"play", required_argument, NULL, 'p'},
+  {"route", required_argument, NULL, 'o'},
+  {"scenes", required_argument, NULL, 'S'},
+  {"fps", required_argument, NULL, 'F'},
+  {"timing", no_argument, NULL, 'T'},
+  {"trace", required_argument, NULL, 't'},
+  {"replay", required_argument, NULL, 'R'},
+  {"fast", no_argument, NULL, 'f'},
+  {"watch", no_argument, NULL, 'w'},
+  {"keybench", required_argument, NULL, 'K'},
+  {"budget", required_argument, NULL, 'b'},
+  {"slow", required_argument, NULL, 'l'},
+  {"jobs", required_argument, NULL, 'j'},
+  {"enumbench", required_argument, NULL, 'E'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+/* on the screen initscr() or newterm() set up, returns the help window, or NULL if the terminal cannot show the panes */
+WINDOW * open_screen(struct window * windows, char * side_title)
+{
+  noecho();
+
+  /* a slow link is drawn in monochrome, see g_mono_attrs */
+  if (!g_low_bandwidth)
+  {
+    if (has_colors() == FALSE)
+    {
+      ERR_OUT("Your terminal does not support color");
+      return NULL;
+    }
+
+    start_color();
+    init_pair(1, COLOR_CYAN, COLOR_BLACK);
+    init_pair(2, COLOR_BLACK, COLOR_WHITE);
+    init_pair(3, COLOR_BLACK, COLOR_GREEN);
+    init_pair(4, COLOR_WHITE, COLOR_BLACK);
+    init_pair(5, COLOR_BLACK, COLOR_RED);
+    init_pair(6, COLOR_YELLOW, COLOR_BLACK);
+    init_pair(7, COLOR_GREEN, COLOR_BLACK);
+  }
+
+  create_ports_win(windows, &g_input_ports, "Inputs", CLIENT_EXPANDED_INPUTS);
+  create_ports_win(windows+1, &g_output_ports, "Outputs", CLIENT_EXPANDED_OUTPUTS);
+  create_connections_win(windows+2);
+  windows[3].name = side_title;
+
+  return layout_windows(windows, NULL);
+}
+
+static
+uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+int
+latency_cmp(const void * a, const void * b)
+{
+  return *(const uint64_t *)a < *(const uint64_t *)b ? -1 : *(const uint64_t *)a > *(const uint64_t *)b;
+}
+
+/* the inspector or the tempo analyzer, when one is on */
+static
+void
+draw_side_pane(struct window * window_ptr)
+{
+  if (inspector_source() != NULL)
+    draw_inspector(window_ptr);
+  else if (tempo_source() != NULL)
+    draw_tempo(window_ptr);
+}
+
+/*
+ * On a slow link the focused pane is drawn first, then the panes left
+ * out of the last frame and then the rest, each only while the frame is
+ * within its output budget. Panes that did not change cost nothing, the
+ * budget is kept to a pane. Returns the panes left out, a bit each.
+ */
+static
+unsigned int
+draw_within_budget(struct window * windows, int focus, unsigned int deferred, unsigned long start_bytes)
+{
+  int order[4];
+  unsigned int left;
+  int count;
+  int i;
+
+  count = 0;
+  order[count++] = focus;
+
+  for (i = 0 ; i < 4 ; i++)
+  {
+    if (i != focus && (deferred & (1 << i)))
+      order[count++] = i;
+  }
+
+  for (i = 0 ; i < 4 ; i++)
+  {
+    if (i != focus && !(deferred & (1 << i)))
+      order[count++] = i;
+  }
+
+  left = 0;
+
+  for (i = 0 ; i < count ; i++)
+  {
+    if (i > 0 && frame_output_bytes() - start_bytes >= g_low_bandwidth)
+    {
+      left |= 1 << order[i];
+      continue;
+    }
+
+    if (order[i] < 2)
+      draw_ports(windows + order[i]);
+    else if (order[i] == 2)
+      draw_connections(windows + 2);
+    else
+      draw_side_pane(windows + 3);
+  }
+
+  return left;
+}
+
+/* the panes after the model changed */
+static
+void
+draw_panes(struct window * windows)
+{
+  recount_windows(windows);
+  draw_ports(windows);
+  draw_ports(windows+1);
+  draw_connections(windows+2);
+}
+
+/*
+ * Feed a trace through the model and the panes, without a sequencer, as
+ * the announces came or as fast as they can be applied. Frames are drawn
+ * as --fps allows, after every event with --fps 0. Each event is timed
+ * from applying it to the end of the frame it was drawn in, if any.
+ */
+int replay(const char * path, int fast)
+{
+  struct trace_reader * reader_ptr;
+  struct topocache topology;
+  struct trace_event event;
+  struct window windows[4];
+  struct timespec ts;
+  char side_title[32];
+  char err[256];
+  WINDOW * help_window;
+  uint64_t * latencies;
+  uint64_t * grown;
+  size_t count;
+  size_t capacity;
+  uint64_t start_ns;
+  uint64_t event_ns;
+  uint64_t end_ns;
+  unsigned long frames;
+  int dirty;
+  int ret;
+
+  reader_ptr = trace_reader_open(path, &topology, err, sizeof(err));
+  if (reader_ptr == NULL)
+  {
+    ERR_OUT("Cannot replay - %s", err);
+    return 1;
+  }
+
+  load_topology(&topology, NULL);
+  topocache_free(&topology);
+
+  memset(windows, 0, sizeof(windows));
+  side_title[0] = '\0';
+
+  initscr();
+  help_window = open_screen(windows, side_title);
+  if (help_window == NULL)
+  {
+    endwin();
+    trace_reader_close(reader_ptr);
+    return 1;
+  }
+
+  windows[0].selected = 1;
+  curs_set(0);
+  draw_panes(windows);
+
+  latencies = NULL;
+  count = 0;
+  capacity = 0;
+  frames = 0;
+  dirty = 0;
+
+  start_ns = monotonic_ns();
+
+  while ((ret = trace_read(reader_ptr, &event)) > 0)
+  {
+    if (!fast)
+    {
+      ts.tv_sec = (start_ns + event.time_ns) / 1000000000;
+      ts.tv_nsec = (start_ns + event.time_ns) % 1000000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
     }
-    else
+
+    event_ns = monotonic_ns();
+
+    if (apply_announce(NULL, &event))
+      dirty = 1;
+
+    if (dirty && frame_begin())
     {
-      wattroff(window_ptr->window_ptr, COLOR_PAIR(1));
+      draw_panes(windows);
+      frames++;
+      dirty = 0;
     }
 
-    row++;
+    if (count == capacity)
+    {
+      capacity = capacity == 0 ? 4096 : capacity * 2;
+      grown = realloc(latencies, capacity * sizeof(uint64_t));
+      if (grown == NULL)
+        break;
+      latencies = grown;
+    }
+
+    latencies[count++] = monotonic_ns() - event_ns;
   }
 
-  draw_border(window_ptr);
+  if (dirty)
+  {
+    draw_panes(windows);
+    frames++;
+  }
+
+  end_ns = monotonic_ns();
+
+  endwin();
+
+  if (ret < 0)
+    ERR_OUT("%s is cut short after %zu events", path, count);
 
-  wrefresh(window_ptr->window_ptr);
+  MSG_OUT("Replayed %zu events in %.3f s, %.0f events/s, %lu frames drawn", count, (end_ns - start_ns) / 1e9, count / ((end_ns - start_ns) / 1e9), frames);
+
+  if (count > 0)
+  {
+    qsort(latencies, count, sizeof(uint64_t), latency_cmp);
+    MSG_OUT("Per event: p50 %.1f us, p99 %.1f us, max %.1f us", latencies[count / 2] / 1e3, latencies[count * 99 / 100] / 1e3, latencies[count - 1] / 1e3);
+  }
+
+  free(latencies);
+  free(windows[0].rows);
+  free(windows[1].rows);
+  navindex_destroy(windows[0].navindex_ptr);
+  navindex_destroy(windows[1].navindex_ptr);
+  trace_reader_close(reader_ptr);
+
+  return 0;
 }
 
-void
-draw_connections(struct window * window_ptr)
+#define KEYBENCH_PORTS 4        /* per synthetic client, each both readable and writable */
+#define KEYBENCH_ROUNDS 200     /* of the script per graph size */
+#define KEYBENCH_ROWS 40
+#define KEYBENCH_COLS 160
+
+enum keybench_kind
 {
-  struct list_head * node_ptr;
-  struct connection * connection_ptr;
-  int row, col;
-  int rows, cols;
+  KEYBENCH_NAVIGATE,
+  KEYBENCH_CONNECT,
+  KEYBENCH_DISCONNECT,
+  KEYBENCH_REFRESH,
+  KEYBENCH_KINDS
+};
 
-  getmaxyx(window_ptr->window_ptr, rows, cols);
+static const char * g_keybench_names[KEYBENCH_KINDS] = { "navigate", "connect", "disconnect", "refresh" };
 
-  row = 0;
+/* the screen is written to a pipe, the terminal on the other end reads and drops it */
+static
+void *
+keybench_drain(void * arg)
+{
+  char buffer[4096];
 
-  list_for_each(node_ptr, window_ptr->list_ptr)
+  while (read(*(int *)arg, buffer, sizeof(buffer)) > 0)
   {
-    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+  }
 
-    if (row == window_ptr->index)
-    {
-      if (window_ptr->selected)
-      {
-        wattron(window_ptr->window_ptr, COLOR_PAIR(3));
-      }
-      else
-      {
-        wattron(window_ptr->window_ptr, COLOR_PAIR(1));
-      }
-    }
-    else
-    {
-      wattron(window_ptr->window_ptr, COLOR_PAIR(1));
-    }
+  return NULL;
+}
 
-    col = 1;
-    col += print_port_info(
-      window_ptr->window_ptr,
-      row+1,
-      col,
-      connection_ptr->source_client,
-      connection_ptr->source_port,
-      (connection_ptr->source_pinfo_ptr == NULL)?"???":snd_seq_port_info_get_name(connection_ptr->source_pinfo_ptr));
+/* clients 16 and up, each port connected to the same port of the next client */
+static
+int
+keybench_topology(struct topocache * topology_ptr, unsigned int clients)
+{
+  char name[SHMTOPO_NAME_MAX];
+  unsigned int client;
+  unsigned int port;
 
-    mvwprintw(window_ptr->window_ptr, row+1, col, " ");
-    col++;
+  memset(topology_ptr, 0, sizeof(*topology_ptr));
 
-    while (col < cols/2 - 3)
+  for (client = 16 ; client < 16 + clients ; client++)
+  {
+    snprintf(name, sizeof(name), "Synthetic %u", client);
+    if (topocache_add_client(topology_ptr, client, SND_SEQ_USER_CLIENT, KEYBENCH_PORTS, name) < 0)
+      return -1;
+
+    for (port = 0 ; port < KEYBENCH_PORTS ; port++)
     {
-      mvwprintw(window_ptr->window_ptr, row+1, col, "-");
-      col++;
-    }
+      snprintf(name, sizeof(name), "Port %u", port);
+      if (topocache_add_port(
+            topology_ptr,
+            client,
+            port,
+            SHMTOPO_PORT_INPUT | SHMTOPO_PORT_OUTPUT,
+            SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ | SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+            SND_SEQ_PORT_TYPE_MIDI_GENERIC,
+            name) < 0)
+        return -1;
 
-    mvwprintw(window_ptr->window_ptr, row+1, col, "-");
-    col++;
-    mvwprintw(window_ptr->window_ptr, row+1, col, ">");
-    col++;
+      if (client + 1 < 16 + clients && topocache_add_connection(topology_ptr, client, port, client + 1, port) < 0)
+        return -1;
+    }
+  }
 
-    mvwprintw(window_ptr->window_ptr, row+1, col, " ");
-    col++;
+  topocache_sort(topology_ptr);
 
-    col += print_port_info(
-      window_ptr->window_ptr,
-      row+1,
-      col,
-      connection_ptr->dest_client,
-      connection_ptr->dest_port,
-      (connection_ptr->dest_pinfo_ptr == NULL)?"???":snd_seq_port_info_get_name(connection_ptr->dest_pinfo_ptr));
+  return 0;
+}
 
-    while (col < cols)
-    {
-      mvwprintw(window_ptr->window_ptr, row+1, col, " ");
-      col++;
-    }
+/* the bytes the terminal sends for ch */
+static
+void
+keybench_send(int fd, int ch)
+{
+  const char * seq;
+  char c;
 
-    if (row == window_ptr->index)
-    {
-      if (window_ptr->selected)
-      {
-        wattroff(window_ptr->window_ptr, COLOR_PAIR(3));
-      }
-      else
-      {
-        wattroff(window_ptr->window_ptr, COLOR_PAIR(1));
-      }
-    }
-    else
-    {
-      wattroff(window_ptr->window_ptr, COLOR_PAIR(1));
-    }
+  seq = NULL;
+  if (ch == KEY_DOWN)
+    seq = tigetstr("kcud1");
+  else if (ch == KEY_UP)
+    seq = tigetstr("kcuu1");
 
-    row++;
+  if (seq != NULL && seq != (char *)-1)
+  {
+    if (write(fd, seq, strlen(seq)) < 0)
+      ERR_OUT("Cannot feed a key - %s", strerror(errno));
+    return;
   }
 
-  draw_border(window_ptr);
+  c = ch;
+  if (write(fd, &c, 1) < 0)
+    ERR_OUT("Cannot feed a key - %s", strerror(errno));
+}
 
-  wrefresh(window_ptr->window_ptr);
+/* there is no sequencer, connects and disconnects only change the model */
+static
+int
+keybench_subscription(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe)
+{
+  model_subscription(seq_handle, sender_ptr, dest_ptr, subscribe);
+  return 0;
 }
 
-void items_count(struct window * window_ptr)
+/*
+ * Read the key from the terminal, handle it as the main loop does and draw
+ * the frame it causes; returns the time from the read to the last update
+ * of the screen. Frames are not paced by --fps here, every key draws.
+ */
+static
+uint64_t
+keybench_key(int fd, struct window * windows, WINDOW * help_window, const struct topocache * topology_ptr, int ch)
 {
-  struct list_head * node_ptr;
+  unsigned char state[CLIENT_IDS];
+  char message[256];
+  uint64_t start_ns;
+  int rows_changed;
+  int over_budget;
 
-  window_ptr->count = 0;
+  keybench_send(fd, ch);
 
-  list_for_each(node_ptr, window_ptr->list_ptr)
+  start_ns = monotonic_ns();
+
+  ch = wgetch(windows[0].window_ptr);
+
+  rows_changed = 1;
+
+  if (ch == 'c')
   {
-    window_ptr->count++;
+    over_budget = 0;
+    connect(NULL, windows, windows+1, &over_budget, message, sizeof(message));
   }
-
-  if (window_ptr->count > 0)
+  else if (ch == 'd')
   {
-    if (window_ptr->index == -1)
-    {
-      window_ptr->index = 0;
-    }
-    else
-    {
-      if (window_ptr->index >= window_ptr->count)
-      {
-        window_ptr->index = window_ptr->count - 1;
-      }
-    }
+    disconnect(NULL, windows+2, message, sizeof(message));
+  }
+  else if (ch == 'r')
+  {
+    /* what rebuild_topology() would read back from the sequencer */
+    topology_state(state);
+    load_topology(topology_ptr, state);
+    publish_topology();
   }
   else
   {
-    window_ptr->index = -1;
+    rows_changed = ports_handle_key(NULL, windows, ch);
   }
-}
 
-void create_ports_win(struct window * window_ptr, struct list_head * ports_ptr, int height, int width, int starty, int startx, const char * name)
-{
-  window_ptr->list_ptr = ports_ptr;
-  window_ptr->window_ptr = newwin(height, width, starty, startx);
-  window_ptr->selected = 0;
-  window_ptr->width = width;
-  window_ptr->height = height;
-  window_ptr->name = name;
-  window_ptr->index = -1;
+  if (rows_changed)
+    recount_windows(windows);
 
-  items_count(window_ptr);
-}
+  draw_ports(windows);
+  draw_ports(windows+1);
+  draw_connections(windows+2);
 
-void create_connections_win(struct window * window_ptr, int height, int width, int starty, int startx)
-{
-  window_ptr->list_ptr = &g_connections;
-  window_ptr->window_ptr = newwin(height, width, starty, startx);
-  window_ptr->selected = 0;
-  window_ptr->width = width;
-  window_ptr->height = height;
-  window_ptr->name = "Connections";
-  window_ptr->index = -1;
+  mvwprintw(help_window, 0, 1, "latency harness");
+  wclrtoeol(help_window);
+  refresh_window(help_window);
 
-  items_count(window_ptr);
+  return monotonic_ns() - start_ns;
 }
 
-void ports_handle_key(struct window * window_ptr, int ch)
+/* a port row of the window, the n-th counting round */
+static
+void
+keybench_select_port(struct window * window_ptr, unsigned int n)
 {
-  if (ch == KEY_DOWN)
-  {
-    if (window_ptr->index + 1 < window_ptr->count)
-    {
-      window_ptr->index++;
-    }
-
-    return;
-  }
+  int i;
 
-  if (ch == KEY_UP)
+  for (i = 0 ; i < window_ptr->count ; i++)
   {
-    if (window_ptr->index > 0)
+    if (window_ptr->rows[(n + i) % window_ptr->count].port_ptr != NULL)
     {
-      window_ptr->index--;
+      window_ptr->index = (n + i) % window_ptr->count;
+      return;
     }
-
-    return;
   }
 }
 
-void connections_handle_key(struct window * window_ptr, int ch)
+/*
+ * Headless keystroke latency. For each graph size a synthetic topology is
+ * loaded and a script of navigation, connect, disconnect and refresh keys
+ * is fed through a pipe to an ncurses screen that writes to another pipe.
+ * Selections are set up between keys, outside the timing.
+ */
+int keybench(const char * sizes)
 {
-  if (ch == KEY_DOWN)
+  struct topocache topology;
+  struct window windows[4];
+  char side_title[32];
+  WINDOW * help_window;
+  SCREEN * screen_ptr;
+  FILE * in_file;
+  FILE * out_file;
+  pthread_t drain_thread;
+  uint64_t * latencies[KEYBENCH_KINDS];
+  size_t counts[KEYBENCH_KINDS];
+  int in_pipe[2];
+  int out_pipe[2];
+  const char * next_ptr;
+  char * end_ptr;
+  unsigned long clients;
+  unsigned int round;
+  unsigned int step;
+  int kind;
+  int ret;
+
+  for (next_ptr = sizes ; *next_ptr != '\0' ; next_ptr = *end_ptr == ',' ? end_ptr + 1 : end_ptr)
   {
-    if (window_ptr->index + 1 < window_ptr->count)
+    clients = strtoul(next_ptr, &end_ptr, 10);
+    if (end_ptr == next_ptr || (*end_ptr != ',' && *end_ptr != '\0') || clients < 2 || clients > CLIENT_IDS - 16)
     {
-      window_ptr->index++;
+      ERR_OUT("Graph sizes are client counts from 2 to %d, e.g. 16,64,192", CLIENT_IDS - 16);
+      return 1;
     }
+  }
 
-    return;
+  if (pipe(in_pipe) < 0 || pipe(out_pipe) < 0)
+  {
+    ERR_OUT("pipe() failed - %s", strerror(errno));
+    return 1;
   }
 
-  if (ch == KEY_UP)
+  in_file = fdopen(in_pipe[0], "r");
+  out_file = fdopen(out_pipe[1], "w");
+  if (in_file == NULL || out_file == NULL || pthread_create(&drain_thread, NULL, keybench_drain, out_pipe) != 0)
   {
-    if (window_ptr->index > 0)
-    {
-      window_ptr->index--;
-    }
+    ERR_OUT("Cannot set up the terminal pipes");
+    return 1;
+  }
 
-    return;
+  ret = 1;
+  g_make_subscription = keybench_subscription;
+
+  screen_ptr = newterm("xterm-256color", out_file, in_file);
+  if (screen_ptr == NULL)
+  {
+    ERR_OUT("Cannot open an xterm-256color screen");
+    goto close;
   }
-}
 
-int
-disconnect(snd_seq_t * seq_handle, int index)
-{
-  int i;
-  struct list_head * node_ptr;
-  struct connection * connection_ptr;
-  snd_seq_port_subscribe_t * subscr_ptr;
-  snd_seq_addr_t sender, dest;
+  resize_term(KEYBENCH_ROWS, KEYBENCH_COLS);
 
-  snd_seq_port_subscribe_alloca(&subscr_ptr);
+  memset(windows, 0, sizeof(windows));
+  side_title[0] = '\0';
 
-  i = 0;
-  list_for_each(node_ptr, &g_connections)
+  help_window = open_screen(windows, side_title);
+  if (help_window == NULL)
+    goto end;
+
+  windows[0].selected = 1;
+  curs_set(0);
+  keypad(windows[0].window_ptr, TRUE);
+
+  memset(latencies, 0, sizeof(latencies));
+
+  for (kind = 0 ; kind < KEYBENCH_KINDS ; kind++)
   {
-    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+    latencies[kind] = malloc(KEYBENCH_ROUNDS * 16 * sizeof(uint64_t));
+    if (latencies[kind] == NULL)
+      goto free;
+  }
 
-    if (i == index)
+  for (next_ptr = sizes ; *next_ptr != '\0' ; next_ptr = *end_ptr == ',' ? end_ptr + 1 : end_ptr)
+  {
+    clients = strtoul(next_ptr, &end_ptr, 10);
+
+    if (keybench_topology(&topology, clients) < 0)
     {
-      sender.client = connection_ptr->source_client;
-      sender.port = connection_ptr->source_port;
-      dest.client = connection_ptr->dest_client;
-      dest.port = connection_ptr->dest_port;
+      topocache_free(&topology);
+      goto free;
+    }
 
-      snd_seq_port_subscribe_set_sender(subscr_ptr, &sender);
-      snd_seq_port_subscribe_set_dest(subscr_ptr, &dest);
+    load_topology(&topology, NULL);
+    draw_panes(windows);
 
-      if (snd_seq_unsubscribe_port(seq_handle, subscr_ptr) < 0)
-      {
-        return -1;
-      }
+    memset(counts, 0, sizeof(counts));
 
-      return 0;
+    for (round = 0 ; round < KEYBENCH_ROUNDS ; round++)
+    {
+      /* down the Inputs pane and back */
+      for (step = 0 ; step < 12 ; step++)
+        latencies[KEYBENCH_NAVIGATE][counts[KEYBENCH_NAVIGATE]++] = keybench_key(in_pipe[1], windows, help_window, &topology, step < 6 ? KEY_DOWN : KEY_UP);
+
+      /* a pair that is not connected yet, then that connection */
+      keybench_select_port(windows, round * 7);
+      keybench_select_port(windows+1, round * 7 + 3 * (KEYBENCH_PORTS + 1));
+      latencies[KEYBENCH_CONNECT][counts[KEYBENCH_CONNECT]++] = keybench_key(in_pipe[1], windows, help_window, &topology, 'c');
+
+      windows[2].index = windows[2].count - 1;
+      latencies[KEYBENCH_DISCONNECT][counts[KEYBENCH_DISCONNECT]++] = keybench_key(in_pipe[1], windows, help_window, &topology, 'd');
+
+      if (round % 4 == 0)
+        latencies[KEYBENCH_REFRESH][counts[KEYBENCH_REFRESH]++] = keybench_key(in_pipe[1], windows, help_window, &topology, 'r');
     }
 
-    i++;
+    endwin();
+
+    MSG_OUT("%lu clients, %lu ports, %u connections:", clients, clients * KEYBENCH_PORTS, topology.connection_count);
+    for (kind = 0 ; kind < KEYBENCH_KINDS ; kind++)
+    {
+      qsort(latencies[kind], counts[kind], sizeof(uint64_t), latency_cmp);
+      MSG_OUT(
+        "  %-10s p50 %8.1f us, p99 %8.1f us, max %8.1f us (%zu keys)",
+        g_keybench_names[kind],
+        latencies[kind][counts[kind] / 2] / 1e3,
+        latencies[kind][counts[kind] * 99 / 100] / 1e3,
+        latencies[kind][counts[kind] - 1] / 1e3,
+        counts[kind]);
+    }
+
+    fflush(stdout);
+    topocache_free(&topology);
   }
 
-  return -1;
+  ret = 0;
+
+free:
+  for (kind = 0 ; kind < KEYBENCH_KINDS ; kind++)
+    free(latencies[kind]);
+
+  free(windows[0].rows);
+  free(windows[1].rows);
+  navindex_destroy(windows[0].navindex_ptr);
+  navindex_destroy(windows[1].navindex_ptr);
+
+end:
+  endwin();
+  delscreen(screen_ptr);
+
+close:
+  g_make_subscription = change_subscription;
+
+  fclose(out_file);
+  pthread_join(drain_thread, NULL);
+  fclose(in_file);
+  close(in_pipe[1]);
+
+  free_connections();
+  free_all_ports();
+  free_clients();
+
+  return ret;
 }
 
-struct port *
-find_port_by_index(struct list_head * ports_ptr, int index)
+#define ENUMBENCH_ROUNDS 9       /* per thread count, the median is reported */
+
+/* median time to enumerate with jobs threads, 0 on error; the last walk is left in topology_ptr */
+static
+uint64_t
+enumbench_time(unsigned long jobs, struct topocache * topology_ptr)
 {
-  int i;
-  struct list_head * node_ptr;
+  uint64_t times[ENUMBENCH_ROUNDS];
+  uint64_t start_ns;
+  unsigned int round;
 
-  i = 0;
-  list_for_each(node_ptr, ports_ptr)
+  for (round = 0 ; round < ENUMBENCH_ROUNDS ; round++)
   {
-    if (i == index)
+    if (round > 0)
+      topocache_free(topology_ptr);
+
+    start_ns = monotonic_ns();
+    if (topocache_enumerate(jobs, is_own_client, topology_ptr) < 0)
     {
-      return list_entry(node_ptr, struct port, siblings);
+      ERR_OUT("Cannot enumerate the sequencer");
+      return 0;
     }
-
-    i++;
+    times[round] = monotonic_ns() - start_ns;
   }
 
-  return NULL;
+  qsort(times, ENUMBENCH_ROUNDS, sizeof(uint64_t), latency_cmp);
+
+  return times[ENUMBENCH_ROUNDS / 2];
 }
 
-const char *
-connect(snd_seq_t * seq_handle, int index_source, int index_dest)
+/* times the enumeration of the live topology at each count of threads against the serial walk */
+int enumbench(const char * counts)
 {
-  snd_seq_port_subscribe_t * subscr_ptr;
-  struct port * source_port_ptr;
-  struct port * dest_port_ptr;
+  struct topocache topology;
+  uint64_t serial_ns;
+  uint64_t median_ns;
+  const char * next_ptr;
+  char * end_ptr;
+  unsigned long jobs;
+
+  for (next_ptr = counts ; *next_ptr != '\0' ; next_ptr = *end_ptr == ',' ? end_ptr + 1 : end_ptr)
+  {
+    jobs = strtoul(next_ptr, &end_ptr, 10);
+    if (end_ptr == next_ptr || (*end_ptr != ',' && *end_ptr != '\0') || jobs < 1 || jobs > TOPOCACHE_MAX_JOBS)
+    {
+      ERR_OUT("Thread counts are from 1 to %d, e.g. 1,2,4,8", TOPOCACHE_MAX_JOBS);
+      return 1;
+    }
+  }
 
-  snd_seq_port_subscribe_alloca(&subscr_ptr);
+  serial_ns = enumbench_time(1, &topology);
+  if (serial_ns == 0)
+    return 1;
 
-  source_port_ptr = find_port_by_index(&g_input_ports, index_source);
-  if (source_port_ptr == NULL)
-    return "Source index wrong!!!";
+  MSG_OUT("%u clients, %u ports, %u connections, serial walk %.1f us:", topology.client_count, topology.port_count, topology.connection_count, serial_ns / 1e3);
+  topocache_free(&topology);
+
+  for (next_ptr = counts ; *next_ptr != '\0' ; next_ptr = *end_ptr == ',' ? end_ptr + 1 : end_ptr)
+  {
+    jobs = strtoul(next_ptr, &end_ptr, 10);
 
-  dest_port_ptr = find_port_by_index(&g_output_ports, index_dest);
-  if (dest_port_ptr == NULL)
-    return "Dest index wrong!!!";
+    median_ns = enumbench_time(jobs, &topology);
+    if (median_ns == 0)
+      return 1;
 
-  snd_seq_port_subscribe_set_sender(subscr_ptr, snd_seq_port_info_get_addr(source_port_ptr->pinfo_ptr));
-  snd_seq_port_subscribe_set_dest(subscr_ptr, snd_seq_port_info_get_addr(dest_port_ptr->pinfo_ptr));
-  snd_seq_port_subscribe_set_queue(subscr_ptr, 0);
-  snd_seq_port_subscribe_set_exclusive(subscr_ptr, 0);
-  snd_seq_port_subscribe_set_time_update(subscr_ptr, 0);
-  snd_seq_port_subscribe_set_time_real(subscr_ptr, 0);
+    MSG_OUT("  %2lu threads %10.1f us, speedup %.2fx (%u ports)", jobs, median_ns / 1e3, (double)serial_ns / median_ns, topology.port_count);
+    topocache_free(&topology);
+  }
 
-  if (snd_seq_subscribe_port(seq_handle, subscr_ptr) < 0)
-    return "snd_seq_subscribe_port() failed.";
+  return 0;
+}
 
-  return NULL;
+void usage(const char * program_name)
+{
+  MSG_OUT("Usage: %s [options]", program_name);
+  MSG_OUT("  -s, --socket PATH   serve the control protocol on Unix socket PATH");
+  MSG_OUT("  -m, --shm NAME      publish the topology in POSIX shared memory NAME");
+  MSG_OUT("  -c, --collapsed     start with clients collapsed, fetch ports on expand");
+  MSG_OUT("  -p, --play FILE     MIDI file 'P' plays, instead of the last recording");
+  MSG_OUT("  -o, --route SPEC    add a router port, e.g. \"ch=1 out=2 notes=36-59 transpose=12\"");
+  MSG_OUT("  -S, --scenes FILE   load routing scenes switched by MIDI, see README");
+  MSG_OUT("  -F, --fps N         redraw at most N times a second (default %d), 0 only on keys", FRAME_DEFAULT_FPS);
+  MSG_OUT("  -T, --timing        report the time to the first frame on exit");
+  MSG_OUT("  -t, --trace FILE    record the topology and every announce to FILE");
+  MSG_OUT("  -R, --replay FILE   replay a trace without a sequencer and report the timing");
+  MSG_OUT("  -f, --fast          replay as fast as possible instead of at the recorded pace");
+  MSG_OUT("  -w, --watch         no UI, print topology changes as JSON lines");
+  MSG_OUT("  -b, --budget N      flag hardware ports fed more than N bytes/s, %d for DIN", BANDWIDTH_DIN_BUDGET);
+  MSG_OUT("  -l, --slow BYTES    slow terminal link: monochrome, no padding, about BYTES per frame");
+  MSG_OUT("  -j, --jobs N        enumerate the topology with N threads, up to %d", TOPOCACHE_MAX_JOBS);
+  MSG_OUT("  -K, --keybench N,.. time keys on synthetic graphs of N clients, no sequencer");
+  MSG_OUT("  -E, --enumbench N,.. time enumerating the topology with N threads against one");
+  MSG_OUT("  -h, --help          show this help");
 }
 
-int main()
+int main(int argc, char ** argv)
 {
   int ret;
   snd_seq_t * seq_handle;
-  int rows, cols;
-  struct window windows[3];
+  struct window windows[4];
+  char side_title[32];
+  char message[256];
+  int timeout;
   int ch;
   int window_selection;
   WINDOW * help_window;
   const char * err_message;
+  const char * socket_path;
+  const char * shm_name;
+  const char * play_path;
+  const char * route_err;
+  const char * scenes_path;
+  char scenes_message[128];
+  const char * info_message;
+  struct scenes_report scenes_report;
+  unsigned long scenes_switches;
+  struct route_prompt route_prompt;
+  struct pollfd pfds[5 + CTLSOCK_MAX_POLLFDS];
+  int pfds_count;
+  int announce_port;
+  int changed;
+  int recount;
+  long fps;
+  char * end_ptr;
+  unsigned int budget;
+  unsigned int deferred;
+  unsigned long frame_start_bytes;
+  unsigned long frame_bytes;
+  unsigned long slow_frames;
+  unsigned long slow_bytes;
+  unsigned long slow_max_bytes;
+  unsigned long slow_deferred;
+  char cache_path[4096];
+  struct topocache cache;
+  struct topocache live;
+  unsigned char state[CLIENT_IDS];
+  int use_cache;
+  int cached;
+  int stale;
+  int timing;
+  const char * trace_path;
+  const char * replay_path;
+  const char * keybench_sizes;
+  const char * enumbench_counts;
+  int replay_fast;
+  int watch;
+  unsigned int corrected;
+  uint64_t start_ns;
+  uint64_t first_frame_ns;
+  uint64_t live_ns;
+  int follow;
+  int reached;
+  int over_budget;
+  unsigned int names;
+  unsigned long names_bytes;
+
+  socket_path = NULL;
+  shm_name = NULL;
+  play_path = NULL;
+  scenes_path = NULL;
+  scenes_switches = 0;
+  fps = FRAME_DEFAULT_FPS;
+  budget = 0;
+  deferred = 0;
+  frame_start_bytes = 0;
+  slow_frames = 0;
+  slow_bytes = 0;
+  slow_max_bytes = 0;
+  slow_deferred = 0;
+  timing = 0;
+  trace_path = NULL;
+  replay_path = NULL;
+  keybench_sizes = NULL;
+  enumbench_counts = NULL;
+  replay_fast = 0;
+  watch = 0;
+  start_ns = monotonic_ns();
+  first_frame_ns = 0;
+  live_ns = 0;
+  cached = 0;
+  stale = 0;
+  corrected = 0;
+  memset(&cache, 0, sizeof(cache));
+  route_prompt.len = -1;
+  follow = 0;
+  reached = 0;
+  over_budget = 0;
+  memset(windows, 0, sizeof(windows));
+
+  while ((ch = getopt_long(argc, argv, "s:m:cp:o:S:F:Tt:R:fwK:b:l:j:E:h", g_long_options, NULL)) != -1)
+  {
+    switch (ch)
+    {
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'm':
+      shm_name = optarg;
+      break;
+    case 'c':
+      g_expand_all = 0;
+      break;
+    case 'p':
+      play_path = optarg;
+      break;
+    case 'o':
+      if (router_add(optarg, &route_err) < 0)
+      {
+        ERR_OUT("Bad route '%s' - %s", optarg, route_err);
+        ret = 1;
+        goto exit;
+      }
+      break;
+    case 'S':
+      scenes_path = optarg;
+      break;
+    case 'F':
+      fps = strtol(optarg, &end_ptr, 10);
+      if (end_ptr == optarg || *end_ptr != '\0' || fps < 0 || fps > FRAME_MAX_FPS)
+      {
+        ERR_OUT("Frame rates are from 0, redraw only on keys, to %d", FRAME_MAX_FPS);
+        return 1;
+      }
+      break;
+    case 'T':
+      timing = 1;
+      break;
+    case 't':
+      trace_path = optarg;
+      break;
+    case 'R':
+      replay_path = optarg;
+      break;
+    case 'f':
+      replay_fast = 1;
+      break;
+    case 'w':
+      watch = 1;
+      break;
+    case 'K':
+      keybench_sizes = optarg;
+      break;
+    case 'b':
+      budget = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      g_low_bandwidth = strtoul(optarg, NULL, 10);
+      if (g_low_bandwidth == 0)
+      {
+        ERR_OUT("The output budget is bytes per frame, more than 0");
+        return 1;
+      }
+      break;
+    case 'j':
+      g_jobs = strtoul(optarg, NULL, 10);
+      if (g_jobs < 1 || g_jobs > TOPOCACHE_MAX_JOBS)
+      {
+        ERR_OUT("Jobs are from 1 to %d", TOPOCACHE_MAX_JOBS);
+        return 1;
+      }
+      break;
+    case 'E':
+      enumbench_counts = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
 
+  INIT_LIST_HEAD(&g_seq_clients);
   INIT_LIST_HEAD(&g_input_ports);
   INIT_LIST_HEAD(&g_output_ports);
   INIT_LIST_HEAD(&g_connections);
 
+  if (replay_path != NULL)
+  {
+    ret = frame_open(fps) < 0 ? 1 : replay(replay_path, replay_fast);
+    frame_close();
+    free_connections();
+    free_all_ports();
+    free_clients();
+    intern_free_all();
+    goto exit;
+  }
+
+  if (keybench_sizes != NULL)
+  {
+    ret = keybench(keybench_sizes);
+    intern_free_all();
+    goto exit;
+  }
+
+  if (enumbench_counts != NULL)
+  {
+    ret = enumbench(enumbench_counts);
+    goto exit;
+  }
+
   ret = snd_seq_open(&seq_handle, "default", SND_SEQ_OPEN_DUPLEX, 0);
   if (ret < 0)
   {
@@ -752,33 +3961,120 @@ int main()
     goto close_sequencer;
   }
 
-  build_ports(seq_handle);
-  build_connections(seq_handle);
+  g_self_client = snd_seq_client_id(seq_handle);
 
-  initscr();
-  noecho();
+  /* follow topology changes instead of rescanning, subscribe before the scan */
+  announce_port = snd_seq_create_simple_port(
+    seq_handle,
+    "naconnect",
+    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+    SND_SEQ_PORT_TYPE_APPLICATION);
+  if (announce_port < 0)
+  {
+    ERR_OUT("Cannot create port - %s", snd_strerror(announce_port));
+    ret = 1;
+    goto close_sequencer;
+  }
 
-  if (has_colors() == FALSE)
+  ret = snd_seq_connect_from(seq_handle, announce_port, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE);
+  if (ret < 0)
   {
-    ERR_OUT("Your terminal does not support color");
-    ret = -1;
-    goto quit;
+    ERR_OUT("Cannot subscribe to announcements - %s", snd_strerror(ret));
+    ret = 1;
+    goto close_sequencer;
   }
 
-  start_color();
-  init_pair(1, COLOR_CYAN, COLOR_BLACK);
-  init_pair(2, COLOR_BLACK, COLOR_WHITE);
-  init_pair(3, COLOR_BLACK, COLOR_GREEN);
-  init_pair(4, COLOR_WHITE, COLOR_BLACK);
-  init_pair(5, COLOR_BLACK, COLOR_RED);
-  init_pair(6, COLOR_YELLOW, COLOR_BLACK);
+  snd_seq_nonblock(seq_handle, 1);
 
-  getmaxyx(stdscr, rows, cols);
+  if (watch)
+  {
+    ret = watch_run(seq_handle);
+    goto close_sequencer;
+  }
+
+  if (scenes_path != NULL && scenes_load(scenes_path, message, sizeof(message)) < 0)
+  {
+    ERR_OUT("Cannot load scenes from %s - %s", scenes_path, message);
+    ret = 1;
+    goto close_sequencer;
+  }
+
+  if (shm_name != NULL)
+  {
+    g_shm_writer = shmtopo_writer_create(shm_name, SHMTOPO_DEFAULT_PORTS, SHMTOPO_DEFAULT_CONNECTIONS);
+    if (g_shm_writer == NULL)
+    {
+      ret = 1;
+      goto close_sequencer;
+    }
+  }
+
+  if (frame_open(fps) < 0)
+  {
+    ret = 1;
+    goto free_topology;
+  }
 
-  create_ports_win(windows, &g_input_ports, rows/2, cols/2, 0, 0, "Inputs");
-  create_ports_win(windows+1, &g_output_ports, rows/2, cols - cols/2, 0, cols/2, "Outputs");
-  create_connections_win(windows+2, rows-rows/2-1, cols, rows/2, 0);
-  help_window = newwin(0, cols, rows-1, 0);
+  /* without the worker subscriptions are made on the UI thread */
+  seqops_open();
+
+  /* draw what the last run saved and enumerate the live topology meanwhile */
+  use_cache = g_expand_all && trace_path == NULL && topocache_path(cache_path, sizeof(cache_path)) == 0;
+  if (use_cache && topocache_map(cache_path, &cache) == 0 && topocache_enumerate_start(g_jobs, is_own_client) == 0)
+  {
+    load_topology(&cache, NULL);
+    publish_topology();
+    cached = 1;
+  }
+  else
+  {
+    topocache_free(&cache);
+    rebuild_topology(seq_handle);
+    live_ns = monotonic_ns();
+  }
+
+  /* announces are traced from the topology as it is now */
+  if (trace_path != NULL)
+  {
+    if (snapshot_topology(&live) < 0 || trace_open(trace_path, &live) < 0)
+    {
+      topocache_free(&live);
+      ret = 1;
+      goto free_topology;
+    }
+
+    topocache_free(&live);
+  }
+
+  if (socket_path != NULL && ctlsock_open(socket_path) < 0)
+  {
+    ret = 1;
+    goto free_topology;
+  }
+
+  if (budget > 0 && bandwidth_open(budget) < 0)
+  {
+    ERR_OUT("Cannot meter the sources");
+    ret = 1;
+    goto free_topology;
+  }
+
+  /* on a slow link what is written to the terminal is counted */
+  if (g_low_bandwidth && frame_output_open() < 0)
+  {
+    ERR_OUT("Cannot read /proc/thread-self/io - %s", strerror(errno));
+    ret = 1;
+    goto free_topology;
+  }
+
+  initscr();
+
+  help_window = open_screen(windows, side_title);
+  if (help_window == NULL)
+  {
+    ret = -1;
+    goto quit;
+  }
 
   window_selection = 0;
   windows[window_selection].selected = 1;
@@ -786,34 +4082,279 @@ int main()
   curs_set(0);                  /* set cursor invisible */
 
   err_message = NULL;
+  info_message = NULL;
+  recount = 0;
 
 loop:
-  draw_ports(windows);
-  draw_ports(windows+1);
-  draw_connections(windows+2);
+  /* place_window() may have made a new inputs pane, which reads the keys */
+  keypad(windows[0].window_ptr, TRUE);
+  nodelay(windows[0].window_ptr, TRUE);
+
+  /* whatever changed since the last frame is drawn in the next one */
+  if (!frame_begin())
+    goto wait;
+
+  if (recount)
+  {
+    recount_windows(windows);
+    recount = 0;
+  }
+
+  /* switches are made by the scenes thread, the status line reports the last one */
+  scenes_get_report(&scenes_report);
+  if (scenes_report.switches != scenes_switches)
+  {
+    scenes_switches = scenes_report.switches;
+    snprintf(
+      scenes_message,
+      sizeof(scenes_message),
+      "Scene %s: %u change%s in %.2f ms, %.2f ms from the trigger%s",
+      scenes_name(scenes_report.scene),
+      scenes_report.ops,
+      scenes_report.ops == 1 ? "" : "s",
+      scenes_report.apply_ns / 1e6,
+      scenes_report.total_ns / 1e6,
+      scenes_report.failed > 0 ? ", some failed" : "");
+    info_message = scenes_message;
+  }
+
+  /* the query follows the selection, the result is cached until it moves or the graph changes */
+  if (follow && window_selection < 2 && windows[window_selection].index >= 0)
+  {
+    reached = reach_query(
+      windows[window_selection].rows[windows[window_selection].index].client_ptr->id,
+      windows[window_selection].rows[windows[window_selection].index].port_ptr == NULL ? -1 : (int)windows[window_selection].rows[windows[window_selection].index].port_ptr->port,
+      window_selection == 0 ? REACH_DOWNSTREAM : REACH_UPSTREAM);
+  }
+
+  if (g_low_bandwidth)
+  {
+    frame_start_bytes = frame_output_bytes();
+    deferred = draw_within_budget(windows, window_selection, deferred, frame_start_bytes);
+  }
+  else
+  {
+    draw_ports(windows);
+    draw_ports(windows+1);
+    draw_connections(windows+2);
+    draw_side_pane(windows+3);
+  }
 
-  if (err_message != NULL)
+  if (window_selection < 2 && windows[window_selection].jump_len >= 0)
+  {
+    draw_jump_prompt(help_window, windows + window_selection);
+  }
+  else if (route_prompt.len >= 0)
+  {
+    draw_route_prompt(help_window, &route_prompt);
+  }
+  else if (err_message != NULL)
   {
-    wattron(help_window, COLOR_PAIR(5));
+    wattron(help_window, PAIR(5));
     mvwprintw(help_window, 0, 1, "%s", err_message);
-    wattroff(help_window, COLOR_PAIR(5));
-    err_message = NULL;
+    wattroff(help_window, PAIR(5));
+  }
+  else if (info_message != NULL)
+  {
+    wattron(help_window, PAIR(6));
+    mvwprintw(help_window, 0, 1, "%s", info_message);
+    wattroff(help_window, PAIR(6));
+  }
+  else if (recorder_source() != NULL)
+  {
+    wattron(help_window, PAIR(6));
+    mvwprintw(help_window, 0, 1, "Recording %u:%u to %s, %lu events, 'R' stops", recorder_source()->client, recorder_source()->port, recorder_path(), recorder_events());
+    wattroff(help_window, PAIR(6));
+  }
+  else if (follow && reach_active())
+  {
+    wattron(help_window, PAIR(7));
+    mvwprintw(help_window, 0, 1, "%d port%s %s, 'f' stops", reached, reached == 1 ? "" : "s", window_selection == 0 ? "downstream" : window_selection == 1 ? "upstream" : "reached");
+    wattroff(help_window, PAIR(7));
+  }
+  else if (player_dest() != NULL)
+  {
+    wattron(help_window, PAIR(6));
+    mvwprintw(help_window, 0, 1, "Playing %s to %u:%u, %lu events, 'P' stops", player_path(), player_dest()->client, player_dest()->port, player_events());
+    wattroff(help_window, PAIR(6));
   }
   else
   {
-    wattron(help_window, COLOR_PAIR(6));
-    mvwprintw(help_window, 0, 1, "'q'uit, ARROWS-selection, TAB-focus, 'r'efreshe, 'c'onnect, 'd'isconnect");
-    wattroff(help_window, COLOR_PAIR(6));
+    wattron(help_window, PAIR(6));
+    mvwprintw(help_window, 0, 1, "'q'uit, ARROWS-selection, ENTER-expand, '/'jump, SPACE-mark, TAB-focus, 'r'efresh, 'c'onnect, 'd'isconnect, 'i'nspect, 't'empo, 'R'ecord, 'P'lay, r'o'ute, 'f'ollow");
+    wattroff(help_window, PAIR(6));
   }
 
   wclrtoeol(help_window);
 
-  wrefresh(help_window);
+  refresh_window(help_window);
+
+  if (g_low_bandwidth)
+  {
+    frame_bytes = frame_output_bytes() - frame_start_bytes;
+    slow_frames++;
+    slow_bytes += frame_bytes;
+    if (frame_bytes > slow_max_bytes)
+      slow_max_bytes = frame_bytes;
+    if (deferred != 0)
+      slow_deferred++;
+  }
+
+  if (first_frame_ns == 0)
+    first_frame_ns = monotonic_ns();
 
   wmove(windows[0].window_ptr, 0, 0);
 
-  keypad(windows[0].window_ptr, TRUE);
+wait:
   ch = wgetch(windows[0].window_ptr);
+  if (ch == ERR)
+  {
+    /* nothing typed, sleep until a key, an announcement or a control socket request arrives */
+    pfds[0].fd = STDIN_FILENO;
+    pfds[0].events = POLLIN;
+    snd_seq_poll_descriptors(seq_handle, pfds + 1, 1, POLLIN);
+    pfds[2].fd = seqops_fd();
+    pfds[2].events = POLLIN;
+    pfds[3].fd = frame_fd();
+    pfds[3].events = POLLIN;
+    pfds[4].fd = topocache_enumerate_fd();
+    pfds[4].events = POLLIN;
+    pfds_count = 5 + ctlsock_pollfds(pfds + 5);
+
+    /* the inspector is drained and redrawn once per frame, idle waits for keys only */
+    timeout = (inspector_source() != NULL || tempo_source() != NULL || recorder_source() != NULL || player_dest() != NULL || deferred != 0) ? frame_interval_ms() : -1;
+
+    /* and the monitor samples every MONITOR_INTERVAL_MS */
+    if (!frame_idle() && (timeout < 0 || monitor_timeout() < timeout))
+      timeout = monitor_timeout();
+
+    /* and the bandwidth estimator every BANDWIDTH_INTERVAL_MS */
+    if (!frame_idle() && bandwidth_timeout() >= 0 && (timeout < 0 || bandwidth_timeout() < timeout))
+      timeout = bandwidth_timeout();
+
+    if (poll(pfds, pfds_count, timeout) < 0 && errno != EINTR)
+    {
+      ERR_OUT("poll() failed - %s", strerror(errno));
+      goto quit;
+    }
+
+    changed = 0;
+
+    if (pfds[1].revents & POLLIN)
+      changed = read_announces(seq_handle);
+
+    if (pfds[2].revents & POLLIN)
+    {
+      if (reap_subscriptions(message, sizeof(message)) > 0)
+        err_message = message;
+
+      publish_topology();
+      changed = 1;
+    }
+
+    if (ctlsock_dispatch(seq_handle, pfds + 5, pfds_count - 5))
+      changed = 1;
+
+    /* the enumeration may have missed what changed while it ran */
+    if (changed && topocache_enumerate_fd() >= 0)
+      stale = 1;
+
+    if (pfds[4].revents & POLLIN)
+    {
+      if (topocache_enumerate_take(&live) == 0 && !stale)
+      {
+        corrected = topocache_diff(&cache, &live);
+        if (corrected > 0)
+        {
+          topology_state(state);
+          load_topology(&live, state);
+          publish_topology();
+        }
+      }
+      else
+      {
+        rebuild_topology(seq_handle);
+      }
+
+      topocache_free(&live);
+      topocache_free(&cache);
+      live_ns = monotonic_ns();
+      changed = 1;
+    }
+
+    /* the rows are rebuilt once in the next frame however many changes come before it */
+    if (changed)
+      recount = 1;
+
+    if (pfds[3].revents & POLLIN)
+    {
+      frame_expired();
+      changed = 1;
+    }
+
+    if (!frame_idle() && monitor_sample(seq_handle))
+      changed = 1;
+
+    if (!frame_idle() && bandwidth_sample(seq_handle))
+      changed = 1;
+
+    if (inspector_source() != NULL && inspector_drain())
+      changed = 1;
+
+    if (player_done())
+    {
+      err_message = play(seq_handle, windows+1, NULL, message, sizeof(message));
+      changed = 1;
+    }
+
+    if (tempo_source() != NULL || recorder_source() != NULL || player_dest() != NULL)
+      changed = 1;
+
+    /* panes left out of the last frame for its output budget */
+    if (deferred != 0)
+      changed = 1;
+
+    if (changed && !frame_idle())
+      goto loop;
+
+    goto wait;
+  }
+
+  /* keys work on the rows, they must not point to ports gone since the last frame */
+  if (recount)
+  {
+    recount_windows(windows);
+    recount = 0;
+  }
+
+  /* a message stays up through redraws until the next key */
+  err_message = NULL;
+  info_message = NULL;
+
+  /* a connect held back by the bandwidth budget goes through on a second 'c' */
+  if (ch != 'c')
+    over_budget = 0;
+
+  if (ch == KEY_RESIZE)
+  {
+    help_window = layout_windows(windows, help_window);
+    goto loop;
+  }
+
+  /* while jumping, typed characters are the prefix, not commands */
+  if (window_selection < 2 && windows[window_selection].jump_len >= 0)
+  {
+    if (ports_handle_key(seq_handle, windows+window_selection, ch))
+      goto rebuilt;
+
+    goto loop;
+  }
+
+  if (route_prompt.len >= 0)
+  {
+    err_message = route_prompt_key(&route_prompt, ch);
+    goto loop;
+  }
 
   if (ch == '\t')
   {
@@ -831,29 +4372,80 @@ loop:
   if (ch == 'r')
     goto refresh;
 
-  if (ch == 'c')
+  if (ch == 'R')
   {
-    err_message = connect(seq_handle, windows[0].index, windows[1].index);
-    if (err_message != NULL)
-      goto loop;
+    err_message = record(windows, message, sizeof(message));
+    goto loop;
+  }
 
-    goto refresh;
+  if (ch == 'f')
+  {
+    follow = !follow;
+    if (!follow)
+      reach_off();
+    goto loop;
   }
 
-  if (ch == 'd')
+  if (ch == 'n' && scenes_count() > 0)
   {
-    if (disconnect(seq_handle, windows[2].index) < 0)
-    {
-      err_message = "Disconnection failed";
-      goto loop;
-    }
+    scenes_switch(scenes_report.scene < 0 ? 0 : (scenes_report.scene + 1) % scenes_count());
+    goto loop;
+  }
 
-    goto refresh;
+  if (ch == 'o')
+  {
+    route_prompt_open(&route_prompt, windows + (window_selection < 2 ? window_selection : 0));
+    goto loop;
+  }
+
+  if (ch == 'P')
+  {
+    if (play_path == NULL && recorder_path()[0] != '\0')
+      err_message = play(seq_handle, windows+1, recorder_path(), message, sizeof(message));
+    else
+      err_message = play(seq_handle, windows+1, play_path, message, sizeof(message));
+    goto loop;
+  }
+
+  if (ch == 't')
+  {
+    err_message = analyze(seq_handle, windows, side_title, sizeof(side_title));
+    help_window = layout_windows(windows, help_window);
+    wclear(windows[2].window_ptr);
+    goto loop;
+  }
+
+  if (ch == 'i')
+  {
+    err_message = inspect(seq_handle, windows, side_title, sizeof(side_title));
+    help_window = layout_windows(windows, help_window);
+    wclear(windows[2].window_ptr);
+    goto loop;
+  }
+
+  if (ch == ' ')
+  {
+    toggle_mark(windows + window_selection);
+    goto loop;
+  }
+
+  if (ch == 'c')
+  {
+    err_message = connect(seq_handle, windows, windows+1, &over_budget, message, sizeof(message));
+    goto rebuilt;
+  }
+
+  if (ch == 'd')
+  {
+    err_message = disconnect(seq_handle, windows+2, message, sizeof(message));
+    goto rebuilt;
   }
 
   if (window_selection < 2)
   {
-    ports_handle_key(windows+window_selection, ch);
+    /* expanding may load ports, that touches every pane */
+    if (ports_handle_key(seq_handle, windows+window_selection, ch))
+      goto rebuilt;
   }
   else
   {
@@ -863,20 +4455,10 @@ loop:
   goto loop;
 
 refresh:
-  free_connections();
-  free_all_ports();
-
-  build_ports(seq_handle);
-  build_connections(seq_handle);
-
-  items_count(windows);
-  items_count(windows+1);
-  items_count(windows+2);
-
-  wclear(windows[0].window_ptr);
-  wclear(windows[1].window_ptr);
-  wclear(windows[2].window_ptr);
+  rebuild_topology(seq_handle);
 
+rebuilt:
+  recount = 1;
   goto loop;
 
 quit:
@@ -884,11 +4466,67 @@ quit:
 
   ret = 0;
 
+  if (topocache_enumerate_take(&live) == 0)
+    topocache_free(&live);
+  topocache_free(&cache);
+
+  if (use_cache && snapshot_topology(&live) == 0)
+  {
+    if (topocache_save(cache_path, &live) < 0)
+      ERR_OUT("Cannot save the topology to %s - %s", cache_path, strerror(errno));
+    topocache_free(&live);
+  }
+
+  if (timing && cached)
+  {
+    MSG_OUT("First frame %.2f ms after start, from the cache", (first_frame_ns - start_ns) / 1e6);
+    if (live_ns != 0)
+      MSG_OUT("Live topology %.2f ms after start, %u record%s corrected", (live_ns - start_ns) / 1e6, corrected, corrected == 1 ? "" : "s");
+  }
+  else if (timing)
+  {
+    MSG_OUT("First frame %.2f ms after start, topology enumerated in %.2f ms", (first_frame_ns - start_ns) / 1e6, (live_ns - start_ns) / 1e6);
+  }
+
+  if (timing)
+  {
+    intern_stats(&names, &names_bytes);
+    MSG_OUT("%u names interned in %lu bytes, copies in the model would take %lu", names, names_bytes, name_copy_bytes());
+  }
+
+  if (timing && slow_frames > 0)
+    MSG_OUT("%lu frames, %lu bytes each on average, %lu at most, %lu cut short by the budget of %u", slow_frames, slow_bytes / slow_frames, slow_max_bytes, slow_deferred, g_low_bandwidth);
+
+  ctlsock_close();
+
+  player_stop(seq_handle, NULL);
+  recorder_stop(NULL);
+  inspector_stop(seq_handle);
+  tempo_stop();
+  bandwidth_close(seq_handle);
+  tap_close();
+  seqops_close();
+  trace_close();
+  frame_close();
+  reach_free();
+
+  free(windows[0].rows);
+  free(windows[1].rows);
+  navindex_destroy(windows[0].navindex_ptr);
+  navindex_destroy(windows[1].navindex_ptr);
+
+free_topology:
+  free_connections();
   free_all_ports();
+  free_clients();
+  shmtopo_writer_destroy(g_shm_writer);
+  intern_free_all();
 
 close_sequencer:
+  scenes_close();
   snd_seq_close(seq_handle);
 
 exit:
+  router_close();
   return ret;
 }
@@ -0,0 +1,116 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay
+ *
+ * Copyright (C) 2006 Nedko Arnaudov <nedko@arnaudov.name>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *****************************************************************************/
+
+#ifndef NACONNECT_H__
+#define NACONNECT_H__
+
+#include <alsa/asoundlib.h>
+
+#include "list.h"
+
+#define MSG_OUT(format, arg...) printf(format "\n", ## arg)
+#define ERR_OUT(format, arg...) fprintf(stderr, format "\n", ## arg)
+
+/* bits of struct client expanded, one per ports pane */
+#define CLIENT_EXPANDED_INPUTS  1
+#define CLIENT_EXPANDED_OUTPUTS 2
+#define CLIENT_EXPANDED_ALL     (CLIENT_EXPANDED_INPUTS | CLIENT_EXPANDED_OUTPUTS)
+
+/* struct connection pending, a queued change shown before it is made */
+#define CONNECTION_PENDING_CONNECT    1
+#define CONNECTION_PENDING_DISCONNECT 2
+
+/* names are ids from the interner, see intern.h */
+struct client
+{
+  struct list_head siblings;
+  unsigned int id;
+  unsigned int name_id;
+  unsigned int type;
+  unsigned int num_ports;
+  int ports_loaded;             /* ports and their subscriptions are in the lists */
+  int readers_queried;          /* readers of its ports on then unloaded clients were taken */
+  unsigned int expanded;
+};
+
+struct port
+{
+  struct list_head siblings;
+  unsigned int client;
+  unsigned int port;
+  unsigned int capability;
+  unsigned int type;
+  unsigned int name_id;
+  unsigned int client_name_id;
+  int marked;                   /* picked for a bulk connect */
+};
+
+struct connection
+{
+  struct list_head siblings;
+  unsigned int source_name_id;  /* INTERN_EMPTY if the port is not known */
+  unsigned int dest_name_id;
+  unsigned int source_client;
+  unsigned int source_port;
+  unsigned int dest_client;
+  unsigned int dest_port;
+  int marked;                   /* picked for a bulk disconnect */
+  int pending;                  /* CONNECTION_PENDING_*, 0 once made */
+};
+
+/* client and port lists are ordered by address */
+extern struct list_head g_seq_clients;
+extern struct list_head g_input_ports;
+extern struct list_head g_output_ports;
+extern struct list_head g_connections;
+
+struct client * find_client(unsigned int id);
+
+struct port *
+find_port(
+  unsigned int client,
+  unsigned int port,
+  struct list_head * ports_ptr);
+
+struct connection *
+find_connection(
+  unsigned int source_client,
+  unsigned int source_port,
+  unsigned int dest_client,
+  unsigned int dest_port);
+
+int subscribe_ports(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr);
+int unsubscribe_ports(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr);
+
+/* (un)subscribe and apply it to the model at once, publish_topology() once after a batch */
+int change_subscription(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe);
+
+/* the model side of change_subscription(), for a change made elsewhere */
+void model_subscription(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe);
+
+/* the model side of a change submitted to the operations worker */
+void model_pending(snd_seq_t * seq_handle, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, int subscribe);
+
+void rebuild_topology(snd_seq_t * seq_handle);
+void publish_topology();
+
+#endif /* #ifndef NACONNECT_H__ */
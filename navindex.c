@@ -0,0 +1,299 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - jump index
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "navindex.h"
+#include "intern.h"
+
+/* trie edges live in one open addressing table keyed by parent and byte */
+#define EDGE_KEY(node, ch) (((node) << 8) | (unsigned char)(ch))
+#define EDGE_FREE ((unsigned int)-1)
+
+/* port -1 (the client row) sorts before port 0 of the same client */
+#define ADDR_KEY(client, port) (((client) << 9) | (unsigned int)((port) + 1))
+
+struct addr_entry
+{
+  unsigned int addr;            /* ADDR_KEY() */
+  int row;
+};
+
+struct navindex
+{
+  int * node_rows;              /* first row of each trie node */
+  unsigned int nodes_count;
+  unsigned int nodes_size;
+
+  unsigned int * edge_keys;
+  unsigned int * edge_children;
+  unsigned int edges_count;
+  unsigned int edges_mask;
+
+  struct addr_entry * addrs;
+  unsigned int addrs_count;
+  unsigned int addrs_size;
+};
+
+static
+unsigned int
+edge_slot(unsigned int key, unsigned int mask)
+{
+  /* Knuth multiplicative hash, keys of siblings differ in the low bits only */
+  return (key * 2654435761u) & mask;
+}
+
+static
+int
+grow_edges(struct navindex * index_ptr)
+{
+  unsigned int * keys;
+  unsigned int * children;
+  unsigned int mask;
+  unsigned int i, j;
+
+  mask = index_ptr->edges_mask == 0 ? 255 : index_ptr->edges_mask * 2 + 1;
+
+  keys = malloc((mask + 1) * sizeof(unsigned int));
+  children = malloc((mask + 1) * sizeof(unsigned int));
+  if (keys == NULL || children == NULL)
+  {
+    free(keys);
+    free(children);
+    return -1;
+  }
+
+  memset(keys, 0xFF, (mask + 1) * sizeof(unsigned int));
+
+  for (i = 0 ; index_ptr->edges_mask != 0 && i <= index_ptr->edges_mask ; i++)
+  {
+    if (index_ptr->edge_keys[i] == EDGE_FREE)
+      continue;
+
+    for (j = edge_slot(index_ptr->edge_keys[i], mask) ; keys[j] != EDGE_FREE ; j = (j + 1) & mask)
+      ;
+
+    keys[j] = index_ptr->edge_keys[i];
+    children[j] = index_ptr->edge_children[i];
+  }
+
+  free(index_ptr->edge_keys);
+  free(index_ptr->edge_children);
+  index_ptr->edge_keys = keys;
+  index_ptr->edge_children = children;
+  index_ptr->edges_mask = mask;
+
+  return 0;
+}
+
+static
+unsigned int
+new_node(struct navindex * index_ptr, int row)
+{
+  int * rows;
+
+  if (index_ptr->nodes_count == index_ptr->nodes_size)
+  {
+    rows = realloc(index_ptr->node_rows, index_ptr->nodes_size * 2 * sizeof(int));
+    if (rows == NULL)
+      return NAVINDEX_NONE;
+
+    index_ptr->node_rows = rows;
+    index_ptr->nodes_size *= 2;
+  }
+
+  index_ptr->node_rows[index_ptr->nodes_count] = row;
+
+  return index_ptr->nodes_count++;
+}
+
+struct navindex * navindex_create(void)
+{
+  struct navindex * index_ptr;
+
+  index_ptr = calloc(1, sizeof(struct navindex));
+  if (index_ptr == NULL)
+    return NULL;
+
+  index_ptr->nodes_size = 256;
+  index_ptr->node_rows = malloc(index_ptr->nodes_size * sizeof(int));
+  if (index_ptr->node_rows == NULL || grow_edges(index_ptr) < 0)
+  {
+    navindex_destroy(index_ptr);
+    return NULL;
+  }
+
+  navindex_reset(index_ptr);
+
+  return index_ptr;
+}
+
+void navindex_destroy(struct navindex * index_ptr)
+{
+  if (index_ptr == NULL)
+    return;
+
+  free(index_ptr->node_rows);
+  free(index_ptr->edge_keys);
+  free(index_ptr->edge_children);
+  free(index_ptr->addrs);
+  free(index_ptr);
+}
+
+void navindex_reset(struct navindex * index_ptr)
+{
+  index_ptr->node_rows[NAVINDEX_ROOT] = -1;
+  index_ptr->nodes_count = 1;
+
+  memset(index_ptr->edge_keys, 0xFF, (index_ptr->edges_mask + 1) * sizeof(unsigned int));
+  index_ptr->edges_count = 0;
+
+  index_ptr->addrs_count = 0;
+}
+
+static
+int
+add_name(struct navindex * index_ptr, int row, unsigned int name_id)
+{
+  const char * name;
+  unsigned int len;
+  unsigned int node;
+  unsigned int key;
+  unsigned int i, j;
+
+  name = intern_str(name_id);
+  len = intern_len(name_id);
+
+  if (index_ptr->node_rows[NAVINDEX_ROOT] == -1)
+    index_ptr->node_rows[NAVINDEX_ROOT] = row;
+
+  node = NAVINDEX_ROOT;
+
+  for (i = 0 ; i < len ; i++)
+  {
+    key = EDGE_KEY(node, tolower((unsigned char)name[i]));
+
+    for (j = edge_slot(key, index_ptr->edges_mask) ; index_ptr->edge_keys[j] != EDGE_FREE ; j = (j + 1) & index_ptr->edges_mask)
+    {
+      if (index_ptr->edge_keys[j] == key)
+        break;
+    }
+
+    if (index_ptr->edge_keys[j] == key)
+    {
+      /* rows come in order, an existing node already has an earlier row */
+      node = index_ptr->edge_children[j];
+      continue;
+    }
+
+    /* keep the load factor under 3/4 */
+    if ((index_ptr->edges_count + 1) * 4 > (index_ptr->edges_mask + 1) * 3)
+    {
+      if (grow_edges(index_ptr) < 0)
+        return -1;
+
+      for (j = edge_slot(key, index_ptr->edges_mask) ; index_ptr->edge_keys[j] != EDGE_FREE ; j = (j + 1) & index_ptr->edges_mask)
+        ;
+    }
+
+    node = new_node(index_ptr, row);
+    if (node == NAVINDEX_NONE)
+      return -1;
+
+    index_ptr->edge_keys[j] = key;
+    index_ptr->edge_children[j] = node;
+    index_ptr->edges_count++;
+  }
+
+  return 0;
+}
+
+int navindex_add(struct navindex * index_ptr, int row, unsigned int client, int port, unsigned int name_id)
+{
+  struct addr_entry * addrs;
+  unsigned int size;
+
+  if (index_ptr->addrs_count == index_ptr->addrs_size)
+  {
+    size = index_ptr->addrs_size == 0 ? 256 : index_ptr->addrs_size * 2;
+    addrs = realloc(index_ptr->addrs, size * sizeof(struct addr_entry));
+    if (addrs == NULL)
+      return -1;
+
+    index_ptr->addrs = addrs;
+    index_ptr->addrs_size = size;
+  }
+
+  /* rows are in address order already, so appending keeps the array sorted */
+  index_ptr->addrs[index_ptr->addrs_count].addr = ADDR_KEY(client, port);
+  index_ptr->addrs[index_ptr->addrs_count].row = row;
+  index_ptr->addrs_count++;
+
+  return add_name(index_ptr, row, name_id);
+}
+
+unsigned int navindex_step(struct navindex * index_ptr, unsigned int node, char ch)
+{
+  unsigned int key;
+  unsigned int j;
+
+  if (node == NAVINDEX_NONE)
+    return NAVINDEX_NONE;
+
+  key = EDGE_KEY(node, tolower((unsigned char)ch));
+
+  for (j = edge_slot(key, index_ptr->edges_mask) ; index_ptr->edge_keys[j] != EDGE_FREE ; j = (j + 1) & index_ptr->edges_mask)
+  {
+    if (index_ptr->edge_keys[j] == key)
+      return index_ptr->edge_children[j];
+  }
+
+  return NAVINDEX_NONE;
+}
+
+int navindex_row(struct navindex * index_ptr, unsigned int node)
+{
+  if (node >= index_ptr->nodes_count)
+    return -1;
+
+  return index_ptr->node_rows[node];
+}
+
+int navindex_find_addr(struct navindex * index_ptr, unsigned int client, int port)
+{
+  unsigned int addr;
+  unsigned int low, high, middle;
+
+  addr = ADDR_KEY(client, port);
+
+  low = 0;
+  high = index_ptr->addrs_count;
+  while (low < high)
+  {
+    middle = low + (high - low) / 2;
+    if (index_ptr->addrs[middle].addr < addr)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  if (low == index_ptr->addrs_count)
+    return -1;
+
+  return index_ptr->addrs[low].row;
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Jump index for a ports pane.
+ *
+ *  A prefix trie over the (case folded) client and port names of the rows
+ *  of a pane, where every node holds the first row whose name starts with
+ *  that prefix, plus the row addresses in row order, which is address
+ *  order. Stepping the trie by one typed character is a single hash probe,
+ *  so jumping costs O(prefix length) no matter how many ports there are;
+ *  an address prefix is a binary search.
+ *
+ *****************************************************************************/
+
+#ifndef NAVINDEX_H__
+#define NAVINDEX_H__
+
+#define NAVINDEX_ROOT 0
+#define NAVINDEX_NONE ((unsigned int)-1)
+
+struct navindex;
+
+struct navindex * navindex_create(void);
+void navindex_destroy(struct navindex * index_ptr);
+
+/* forget all rows, keeping the allocations */
+void navindex_reset(struct navindex * index_ptr);
+
+/* rows must be added in increasing order, port is -1 for a client row */
+int navindex_add(struct navindex * index_ptr, int row, unsigned int client, int port, unsigned int name_id);
+
+/* child of node for ch, NAVINDEX_NONE if no name continues that way */
+unsigned int navindex_step(struct navindex * index_ptr, unsigned int node, char ch);
+
+/* first row with the prefix of node */
+int navindex_row(struct navindex * index_ptr, unsigned int node);
+
+/* first row at or after address client:port (port -1 for the client row), -1 if none */
+int navindex_find_addr(struct navindex * index_ptr, unsigned int client, int port);
+
+#endif /* #ifndef NAVINDEX_H__ */
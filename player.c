@@ -0,0 +1,719 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - Standard MIDI File player
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "player.h"
+#include "tap.h"
+
+#define DEFAULT_TEMPO 500000    /* us per quarter until the first tempo event */
+
+struct track
+{
+  const unsigned char * pos;
+  const unsigned char * end;
+  unsigned long tick;           /* of the next event */
+  unsigned char status;         /* running status, 0 if none */
+  int done;
+};
+
+static int g_port = -1;
+static int g_probe_port = -1;
+static int g_queue = -1;
+static snd_seq_addr_t g_dest;
+static char g_path[1024];
+
+static unsigned char * g_map_ptr;
+static size_t g_map_size;
+static struct track * g_tracks;
+static unsigned int g_tracks_count;
+
+/* ticks per quarter, 0 for SMPTE time where a tick is always g_smpte_num / g_smpte_den ns */
+static unsigned int g_ppq;
+static unsigned long long g_smpte_num;
+static unsigned long long g_smpte_den;
+
+/* tempo map, the current tempo started at g_tempo_tick which is g_tempo_ns into the song */
+static unsigned long g_tempo;
+static unsigned long g_tempo_tick;
+static unsigned long long g_tempo_ns;
+
+static unsigned char * g_sysex_ptr;
+static size_t g_sysex_size;
+
+static int g_eof;
+static int g_done;
+static unsigned long g_events;
+static unsigned long g_batches;
+static uint64_t g_start_ns;
+
+/* seq_cst handshake with player_stop(), like the recorder's */
+static int g_playing;
+static int g_busy;
+
+/* delivery times, written by the tap thread only */
+static unsigned long g_probes;
+static double g_late_sum;
+static double g_late_sum_sq;
+static double g_late_min;
+static double g_late_max;
+
+static
+void
+tap_event(void * context, const snd_seq_event_t * event_ptr, uint64_t time_ns)
+{
+  double late;
+
+  __atomic_add_fetch(&g_busy, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&g_playing, __ATOMIC_SEQ_CST))
+  {
+    late = (double)(int64_t)(time_ns - g_start_ns - ((uint64_t)event_ptr->time.time.tv_sec * 1000000000 + event_ptr->time.time.tv_nsec));
+    late /= 1000;
+
+    if (g_probes == 0 || late < g_late_min)
+      g_late_min = late;
+    if (g_probes == 0 || late > g_late_max)
+      g_late_max = late;
+
+    g_late_sum += late;
+    g_late_sum_sq += late * late;
+    g_probes++;
+  }
+
+  __atomic_sub_fetch(&g_busy, 1, __ATOMIC_RELEASE);
+}
+
+static
+unsigned long
+get_be(const unsigned char * data, int size)
+{
+  unsigned long value;
+
+  value = 0;
+  while (size-- > 0)
+    value = (value << 8) | *data++;
+
+  return value;
+}
+
+static
+int
+get_varlen(struct track * track_ptr, unsigned long * value_ptr)
+{
+  unsigned long value;
+  int i;
+
+  value = 0;
+
+  for (i = 0 ; i < 4 ; i++)
+  {
+    if (track_ptr->pos >= track_ptr->end)
+      return -1;
+
+    value = (value << 7) | (*track_ptr->pos & 0x7F);
+    if ((*track_ptr->pos++ & 0x80) == 0)
+    {
+      *value_ptr = value;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static
+void
+read_delta(struct track * track_ptr)
+{
+  unsigned long delta;
+
+  if (get_varlen(track_ptr, &delta) < 0)
+    track_ptr->done = 1;
+  else
+    track_ptr->tick += delta;
+}
+
+/* the track whose next event comes first, NULL at the end of the song */
+static
+struct track *
+next_track(void)
+{
+  struct track * next_ptr;
+  unsigned int i;
+
+  next_ptr = NULL;
+
+  for (i = 0 ; i < g_tracks_count ; i++)
+  {
+    if (!g_tracks[i].done && (next_ptr == NULL || g_tracks[i].tick < next_ptr->tick))
+      next_ptr = g_tracks + i;
+  }
+
+  return next_ptr;
+}
+
+static
+unsigned long long
+tick_to_ns(unsigned long tick)
+{
+  unsigned long long us;
+
+  if (g_ppq == 0)
+    return (unsigned long long)((long double)tick * g_smpte_num / g_smpte_den);
+
+  /* split the division so that us * 1000 cannot overflow */
+  us = (unsigned long long)(tick - g_tempo_tick) * g_tempo;
+
+  return g_tempo_ns + us / g_ppq * 1000 + us % g_ppq * 1000 / g_ppq;
+}
+
+static
+int
+output(snd_seq_t * seq_handle, snd_seq_event_t * event_ptr, unsigned long long ns)
+{
+  snd_seq_real_time_t time;
+
+  time.tv_sec = ns / 1000000000;
+  time.tv_nsec = ns % 1000000000;
+
+  snd_seq_ev_set_source(event_ptr, g_port);
+  snd_seq_ev_schedule_real(event_ptr, g_queue, 0, &time);
+
+  return snd_seq_event_output(seq_handle, event_ptr);
+}
+
+static
+int
+output_echo(snd_seq_t * seq_handle, int client, int port, unsigned long long ns)
+{
+  snd_seq_event_t event;
+
+  snd_seq_ev_clear(&event);
+  event.type = SND_SEQ_EVENT_ECHO;
+  snd_seq_ev_set_dest(&event, client, port);
+
+  return output(seq_handle, &event, ns);
+}
+
+static
+int
+output_sysex(snd_seq_t * seq_handle, snd_seq_event_t * event_ptr, const unsigned char * data, unsigned long len, int prefix, unsigned long long ns)
+{
+  unsigned char * buf_ptr;
+
+  /* SMF leaves the F0 out, the sequencer wants the whole message */
+  if (prefix)
+  {
+    if (len + 1 > g_sysex_size)
+    {
+      buf_ptr = realloc(g_sysex_ptr, len + 1);
+      if (buf_ptr == NULL)
+        return -ENOMEM;
+
+      g_sysex_ptr = buf_ptr;
+      g_sysex_size = len + 1;
+    }
+
+    g_sysex_ptr[0] = 0xF0;
+    memcpy(g_sysex_ptr + 1, data, len);
+    data = g_sysex_ptr;
+    len++;
+  }
+
+  snd_seq_ev_set_sysex(event_ptr, len, (void *)data);
+
+  return output(seq_handle, event_ptr, ns);
+}
+
+/* decode the next event of a track and send it, returns 1 if an event was sent */
+static
+int
+play_event(snd_seq_t * seq_handle, struct track * track_ptr, unsigned long long ns)
+{
+  snd_seq_event_t event;
+  unsigned char status;
+  unsigned char type;
+  unsigned long len;
+  const unsigned char * data;
+  int channel;
+  int ret;
+
+  snd_seq_ev_clear(&event);
+  snd_seq_ev_set_dest(&event, g_dest.client, g_dest.port);
+
+  /* a track cut short after a delta time has no event left to read */
+  if (track_ptr->pos >= track_ptr->end)
+    goto corrupt;
+
+  status = *track_ptr->pos;
+  if (status & 0x80)
+    track_ptr->pos++;
+  else
+    status = track_ptr->status;
+
+  ret = 0;
+
+  if (status >= 0x80 && status < 0xF0)
+  {
+    track_ptr->status = status;
+
+    len = (status & 0xE0) == 0xC0 ? 1 : 2;
+    if (track_ptr->end - track_ptr->pos < len)
+      goto corrupt;
+
+    data = track_ptr->pos;
+    track_ptr->pos += len;
+    channel = status & 0x0F;
+
+    switch (status & 0xF0)
+    {
+    case 0x80:
+      snd_seq_ev_set_noteoff(&event, channel, data[0], data[1]);
+      break;
+    case 0x90:
+      snd_seq_ev_set_noteon(&event, channel, data[0], data[1]);
+      break;
+    case 0xA0:
+      snd_seq_ev_set_keypress(&event, channel, data[0], data[1]);
+      break;
+    case 0xB0:
+      snd_seq_ev_set_controller(&event, channel, data[0], data[1]);
+      break;
+    case 0xC0:
+      snd_seq_ev_set_pgmchange(&event, channel, data[0]);
+      break;
+    case 0xD0:
+      snd_seq_ev_set_chanpress(&event, channel, data[0]);
+      break;
+    case 0xE0:
+      snd_seq_ev_set_pitchbend(&event, channel, (data[0] | data[1] << 7) - 8192);
+      break;
+    }
+
+    ret = output(seq_handle, &event, ns);
+    if (ret >= 0)
+      ret = 1;
+  }
+  else if (status == 0xFF)
+  {
+    track_ptr->status = 0;
+
+    if (track_ptr->pos >= track_ptr->end)
+      goto corrupt;
+
+    type = *track_ptr->pos++;
+    if (get_varlen(track_ptr, &len) < 0 || track_ptr->end - track_ptr->pos < len)
+      goto corrupt;
+
+    if (type == 0x2F)
+    {
+      track_ptr->done = 1;
+      return 0;
+    }
+
+    if (type == 0x51 && len == 3 && g_ppq != 0)
+    {
+      g_tempo_ns = ns;
+      g_tempo_tick = track_ptr->tick;
+      g_tempo = get_be(track_ptr->pos, 3);
+    }
+
+    track_ptr->pos += len;
+  }
+  else if (status == 0xF0 || status == 0xF7)
+  {
+    track_ptr->status = 0;
+
+    if (get_varlen(track_ptr, &len) < 0 || track_ptr->end - track_ptr->pos < len)
+      goto corrupt;
+
+    data = track_ptr->pos;
+    track_ptr->pos += len;
+
+    /* an F7 escape is sent as is, it may be a sysex continuation or realtime bytes */
+    if (len > 0)
+    {
+      ret = output_sysex(seq_handle, &event, data, len, status == 0xF0, ns);
+      if (ret >= 0)
+        ret = 1;
+    }
+  }
+  else
+  {
+    goto corrupt;
+  }
+
+  if (ret < 0)
+    return ret;
+
+  read_delta(track_ptr);
+
+  return ret;
+
+corrupt:
+  track_ptr->done = 1;
+  return 0;
+}
+
+/* send the events up to the lookahead from wake_ns, then ask to be woken for the next batch */
+static
+int
+refill(snd_seq_t * seq_handle, unsigned long long wake_ns)
+{
+  struct track * track_ptr;
+  unsigned long long horizon_ns;
+  unsigned long long next_wake_ns;
+  unsigned long long ns;
+  unsigned int count;
+  int ret;
+
+  horizon_ns = wake_ns + PLAYER_LOOKAHEAD_NS;
+  next_wake_ns = wake_ns + PLAYER_LOOKAHEAD_NS / 2;
+  count = 0;
+  ns = wake_ns;
+
+  while ((track_ptr = next_track()) != NULL)
+  {
+    ns = tick_to_ns(track_ptr->tick);
+    if (ns >= horizon_ns)
+    {
+      /* nothing to do until the next event comes into view, skip gaps in one go */
+      if (ns - PLAYER_LOOKAHEAD_NS / 2 > next_wake_ns)
+        next_wake_ns = ns - PLAYER_LOOKAHEAD_NS / 2;
+      break;
+    }
+
+    if (count == PLAYER_BATCH)
+      break;
+
+    /* a dense batch wakes us once half of it has been played */
+    if (count == PLAYER_BATCH / 2 && ns < next_wake_ns)
+      next_wake_ns = ns;
+
+    if (count == 0 && g_probe_port >= 0)
+    {
+      ret = output_echo(seq_handle, tap_client(), g_probe_port, ns);
+      if (ret < 0)
+        return ret;
+    }
+
+    ret = play_event(seq_handle, track_ptr, ns);
+    if (ret < 0)
+      return ret;
+
+    count += ret;
+  }
+
+  if (track_ptr == NULL)
+  {
+    g_eof = 1;
+    next_wake_ns = ns;
+  }
+
+  g_events += count;
+  g_batches++;
+
+  ret = output_echo(seq_handle, snd_seq_client_id(seq_handle), g_port, next_wake_ns);
+  if (ret < 0)
+    return ret;
+
+  return snd_seq_drain_output(seq_handle);
+}
+
+static
+int
+map_file(const char * path)
+{
+  int fd;
+  struct stat st;
+  unsigned char * pos;
+  unsigned char * end;
+  unsigned long len;
+  unsigned int format;
+  unsigned int division;
+  unsigned int i;
+  int fps;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) < 0 || st.st_size < 14)
+  {
+    close(fd);
+    return -1;
+  }
+
+  g_map_size = st.st_size;
+  g_map_ptr = mmap(NULL, g_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (g_map_ptr == MAP_FAILED)
+  {
+    g_map_ptr = NULL;
+    return -1;
+  }
+
+  /* events are decoded front to back as the song plays */
+  madvise(g_map_ptr, g_map_size, MADV_SEQUENTIAL);
+
+  pos = g_map_ptr;
+  end = g_map_ptr + g_map_size;
+
+  if (memcmp(pos, "MThd", 4) != 0 || get_be(pos + 4, 4) < 6)
+    goto unmap;
+
+  format = get_be(pos + 8, 2);
+  g_tracks_count = get_be(pos + 10, 2);
+  division = get_be(pos + 12, 2);
+
+  /* format 2 holds independent songs, they cannot be merged */
+  if (format > 1 || g_tracks_count == 0 || division == 0)
+    goto unmap;
+
+  if (division & 0x8000)
+  {
+    /* SMPTE frames per second (-29 is 29.97) and ticks per frame */
+    fps = -(signed char)(division >> 8);
+    g_ppq = 0;
+    g_smpte_num = 1000000000ULL * (fps == 29 ? 1001 : 1000);
+    g_smpte_den = (unsigned long long)(fps == 29 ? 30 : fps) * (division & 0xFF) * 1000;
+    if (g_smpte_den == 0)
+      goto unmap;
+  }
+  else
+  {
+    g_ppq = division;
+  }
+
+  g_tracks = calloc(g_tracks_count, sizeof(struct track));
+  if (g_tracks == NULL)
+    goto unmap;
+
+  pos += 8 + get_be(pos + 4, 4);
+
+  /* unknown chunks are skipped, a truncated last track plays as far as it goes */
+  for (i = 0 ; i < g_tracks_count && end - pos >= 8 ; pos += 8 + len)
+  {
+    len = get_be(pos + 4, 4);
+    if (len > end - pos - 8)
+      len = end - pos - 8;
+
+    if (memcmp(pos, "MTrk", 4) != 0)
+      continue;
+
+    g_tracks[i].pos = pos + 8;
+    g_tracks[i].end = pos + 8 + len;
+    read_delta(g_tracks + i);
+    i++;
+  }
+
+  g_tracks_count = i;
+
+  return 0;
+
+unmap:
+  munmap(g_map_ptr, g_map_size);
+  g_map_ptr = NULL;
+  return -1;
+}
+
+static
+void
+unmap_file(void)
+{
+  free(g_tracks);
+  g_tracks = NULL;
+  g_tracks_count = 0;
+
+  munmap(g_map_ptr, g_map_size);
+  g_map_ptr = NULL;
+
+  free(g_sysex_ptr);
+  g_sysex_ptr = NULL;
+  g_sysex_size = 0;
+}
+
+int player_start(snd_seq_t * seq_handle, const snd_seq_addr_t * dest_ptr, const char * path)
+{
+  if (g_playing)
+    return -1;
+
+  if (strlen(path) >= sizeof(g_path))
+    return -1;
+
+  if (g_port < 0)
+  {
+    g_port = snd_seq_create_simple_port(
+      seq_handle,
+      "player",
+      SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+      SND_SEQ_PORT_TYPE_APPLICATION);
+    if (g_port < 0)
+      return -1;
+  }
+
+  /* without the tap everything still plays, only the delivery times are not measured */
+  if (g_probe_port < 0 && tap_open() == 0)
+    g_probe_port = tap_create_port("player", 0, tap_event, NULL);
+
+  if (map_file(path) < 0)
+    return -1;
+
+  g_queue = snd_seq_alloc_named_queue(seq_handle, "naconnect player");
+  if (g_queue < 0)
+    goto unmap;
+
+  /* one batch plus the tail of the previous one have to fit in the kernel */
+  snd_seq_set_client_pool_output(seq_handle, PLAYER_POOL);
+
+  strcpy(g_path, path);
+  g_dest = *dest_ptr;
+  g_tempo = DEFAULT_TEMPO;
+  g_tempo_tick = 0;
+  g_tempo_ns = 0;
+  g_eof = 0;
+  g_done = 0;
+  g_events = 0;
+  g_batches = 0;
+  g_probes = 0;
+  g_late_sum = 0;
+  g_late_sum_sq = 0;
+
+  /* the first batch waits in the stopped queue */
+  if (refill(seq_handle, 0) < 0)
+    goto free_queue;
+
+  g_start_ns = tap_now_ns();
+  __atomic_store_n(&g_playing, 1, __ATOMIC_SEQ_CST);
+
+  snd_seq_start_queue(seq_handle, g_queue, NULL);
+  if (snd_seq_drain_output(seq_handle) < 0)
+  {
+    player_stop(seq_handle, NULL);
+    return -1;
+  }
+
+  return 0;
+
+free_queue:
+  snd_seq_drop_output(seq_handle);
+  snd_seq_free_queue(seq_handle, g_queue);
+  g_queue = -1;
+unmap:
+  unmap_file();
+  return -1;
+}
+
+int player_stop(snd_seq_t * seq_handle, struct player_report * report_ptr)
+{
+  snd_seq_event_t event;
+  double mean;
+  int channel;
+
+  if (!g_playing)
+    return -1;
+
+  __atomic_store_n(&g_playing, 0, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&g_busy, __ATOMIC_SEQ_CST) != 0)
+    sched_yield();
+
+  /* freeing the queue also throws away everything still scheduled on it */
+  snd_seq_drop_output(seq_handle);
+  snd_seq_free_queue(seq_handle, g_queue);
+  g_queue = -1;
+
+  /* cut off notes that would never get their note off */
+  if (!g_done)
+  {
+    for (channel = 0 ; channel < 16 ; channel++)
+    {
+      snd_seq_ev_clear(&event);
+      snd_seq_ev_set_source(&event, g_port);
+      snd_seq_ev_set_dest(&event, g_dest.client, g_dest.port);
+      snd_seq_ev_set_direct(&event);
+      snd_seq_ev_set_controller(&event, channel, 123, 0);
+      snd_seq_event_output(seq_handle, &event);
+    }
+
+    snd_seq_drain_output(seq_handle);
+  }
+
+  if (report_ptr != NULL)
+  {
+    mean = g_probes > 0 ? g_late_sum / g_probes : 0;
+
+    report_ptr->seconds = (tap_now_ns() - g_start_ns) / 1e9;
+    report_ptr->events = g_events;
+    report_ptr->batches = g_batches;
+    report_ptr->probes = g_probes;
+    report_ptr->late_min_us = g_probes > 0 ? g_late_min : 0;
+    report_ptr->late_avg_us = mean;
+    report_ptr->late_max_us = g_probes > 0 ? g_late_max : 0;
+    report_ptr->jitter_us = g_probes > 1 ? sqrt(fmax(0, g_late_sum_sq / g_probes - mean * mean)) : 0;
+    report_ptr->finished = g_done;
+  }
+
+  unmap_file();
+
+  return 0;
+}
+
+void player_echo(snd_seq_t * seq_handle, const snd_seq_event_t * event_ptr)
+{
+  if (!g_playing || g_done || event_ptr->dest.port != g_port)
+    return;
+
+  if (g_eof)
+  {
+    g_done = 1;
+    return;
+  }
+
+  /* a failed send ends the song early rather than leaving it stuck */
+  if (refill(seq_handle, (unsigned long long)event_ptr->time.time.tv_sec * 1000000000 + event_ptr->time.time.tv_nsec) < 0)
+    g_done = 1;
+}
+
+const snd_seq_addr_t * player_dest(void)
+{
+  return g_playing ? &g_dest : NULL;
+}
+
+const char * player_path(void)
+{
+  return g_path;
+}
+
+unsigned long player_events(void)
+{
+  return g_events;
+}
+
+int player_done(void)
+{
+  return g_playing && g_done;
+}
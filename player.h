@@ -0,0 +1,57 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Standard MIDI File player.
+ *
+ *  The file is memory mapped and decoded one event at a time, merging the
+ *  tracks by tick. Each event is converted to queue real time with the
+ *  tempo map and scheduled on a queue of the main client, so the kernel
+ *  does all the timing. Events are sent in bounded batches that reach
+ *  at most PLAYER_LOOKAHEAD_NS ahead of the queue. Each batch ends with
+ *  an echo to ourselves at half the lookahead, and its arrival on the
+ *  main sequencer handle triggers the next batch. No thread sleeps.
+ *
+ *  One echo per batch is also sent to the tap client. The tap thread
+ *  compares its arrival time with the scheduled time to measure how
+ *  late the queue delivers.
+ *
+ *****************************************************************************/
+
+#ifndef PLAYER_H__
+#define PLAYER_H__
+
+#include <alsa/asoundlib.h>
+
+#define PLAYER_LOOKAHEAD_NS 500000000ULL
+#define PLAYER_BATCH 256                /* most events sent per refill */
+#define PLAYER_POOL 2048                /* output pool of the main client while playing */
+
+struct player_report
+{
+  double seconds;
+  unsigned long events;
+  unsigned long batches;
+  unsigned long probes;         /* delivery times measured */
+  double late_min_us;           /* arrival minus scheduled time */
+  double late_avg_us;
+  double late_max_us;
+  double jitter_us;             /* standard deviation of the above */
+  int finished;                 /* 0 if stopped before the end */
+};
+
+int player_start(snd_seq_t * seq_handle, const snd_seq_addr_t * dest_ptr, const char * path);
+int player_stop(snd_seq_t * seq_handle, struct player_report * report_ptr);
+
+/* echo events read from the main handle */
+void player_echo(snd_seq_t * seq_handle, const snd_seq_event_t * event_ptr);
+
+/* destination being played to, NULL when off */
+const snd_seq_addr_t * player_dest(void);
+const char * player_path(void);
+unsigned long player_events(void);
+
+/* 1 once the last event was delivered, player_stop() collects the report */
+int player_done(void);
+
+#endif /* #ifndef PLAYER_H__ */
@@ -0,0 +1,88 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Static tracepoints (USDT) for bpftrace and perf.
+ *
+ *  Built in when <sys/sdt.h> is installed (systemtap-sdt-dev or
+ *  systemtap-sdt-devel), otherwise the macros are empty. Every probe has
+ *  a semaphore, so with no tracer attached a probe is a test of a zero
+ *  and its arguments, durations included, are not computed. The provider
+ *  is "naconnect", durations are in nanoseconds:
+ *
+ *    enumerate_start()                  enumerate_done(clients, ports, connections, ns)
+ *    query_start(client, port)          query_done(client, port, connections, ns)
+ *    connect_start()                    connect_done(connected, failed, ns)
+ *    disconnect_start()                 disconnect_done(disconnected, failed, ns)
+ *    draw_start(pane)                   draw_done(pane, rows, ns)
+ *    refresh_start()                    refresh_done(clients, ports, connections, ns)
+ *    announce_start(type, client, port) announce_done(type, client, port, changed, ns)
+ *
+ *  A query is one port's subscribers, panes are 0 Inputs, 1 Outputs and
+ *  2 Connections, announce types are SND_SEQ_EVENT_*. Enumeration is the
+ *  walk of the sequencer on the cache thread, a refresh the rebuild of the
+ *  model in the UI. naconnect.bt summarizes the latencies:
+ *
+ *    sudo bpftrace naconnect.bt ./naconnect
+ *
+ *****************************************************************************/
+
+#ifndef PROBES_H__
+#define PROBES_H__
+
+#include <stdint.h>
+
+#define PROBES(X)               \
+  X(enumerate_start)            \
+  X(enumerate_done)             \
+  X(query_start)                \
+  X(query_done)                 \
+  X(connect_start)              \
+  X(connect_done)               \
+  X(disconnect_start)           \
+  X(disconnect_done)            \
+  X(draw_start)                 \
+  X(draw_done)                  \
+  X(refresh_start)              \
+  X(refresh_done)               \
+  X(announce_start)             \
+  X(announce_done)
+
+#ifdef HAVE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) naconnect_##name##_semaphore
+#define PROBE_DECLARE(name) extern volatile unsigned short PROBE_SEMAPHORE(name);
+PROBES(PROBE_DECLARE)
+
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+
+#define PROBE(name, ...)                                        \
+  do                                                            \
+  {                                                             \
+    if (PROBE_ENABLED(name))                                    \
+      STAP_PROBEV(naconnect, name, ## __VA_ARGS__);             \
+  }                                                             \
+  while (0)
+
+uint64_t probe_now_ns(void);
+
+#else
+
+#define PROBE_ENABLED(name) 0
+#define PROBE(name, ...) do { } while (0)
+#define probe_now_ns() ((uint64_t)0)
+
+#endif
+
+/*
+ * When a span whose done probe reports its duration started, 0 when that
+ * probe is not traced. A span that started before the tracer attached
+ * reports a duration of 0, which naconnect.bt leaves out.
+ */
+#define PROBE_START(name) (PROBE_ENABLED(name) ? probe_now_ns() : 0)
+#define PROBE_SINCE(start_ns) ((start_ns) != 0 ? probe_now_ns() - (start_ns) : 0)
+
+#endif /* #ifndef PROBES_H__ */
@@ -0,0 +1,602 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - reachability
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "list.h"
+#include "naconnect.h"
+#include "intern.h"
+#include "reach.h"
+
+#define NONE ((unsigned int)-1)
+#define ADDR(client, port) (((client) << 16) | (port))
+#define WORD_BITS (8 * sizeof(unsigned long))
+
+struct node
+{
+  unsigned int addr;            /* ADDR() */
+  unsigned int out;             /* first edge from the port */
+  unsigned int in;              /* first edge to the port */
+  int forwards;
+};
+
+/* a connection, on the out list of its source and the in list of its dest */
+struct edge
+{
+  unsigned int from;
+  unsigned int to;
+  unsigned int next_out;        /* next free edge while on the free list */
+  unsigned int next_in;
+};
+
+static struct node * g_nodes;
+static unsigned int g_nodes_count;
+static unsigned int g_nodes_size;
+
+static unsigned int * g_slots;          /* node of each address, open addressing */
+static unsigned int g_slots_mask;
+
+static struct edge * g_edges;
+static unsigned int g_edges_count;
+static unsigned int g_edges_size;
+static unsigned int g_free_edge = NONE;
+
+/* the graph is rebuilt from the connection list before the next query */
+static int g_stale = 1;
+
+/* the cached query */
+static int g_active;
+static int g_valid;
+static unsigned int g_origin_client;
+static int g_origin_port;
+static int g_direction;
+static unsigned long * g_marks;         /* a bit per node */
+static unsigned long g_client_marks[256 / WORD_BITS];
+static unsigned int * g_queue;          /* every node once, plus the origins */
+static int g_count;
+
+static
+unsigned int
+slot(unsigned int addr)
+{
+  return (addr * 2654435761u) & g_slots_mask;
+}
+
+static
+unsigned int
+find_node(unsigned int addr)
+{
+  unsigned int i;
+
+  if (g_slots == NULL)
+    return NONE;
+
+  for (i = slot(addr) ; g_slots[i] != NONE ; i = (i + 1) & g_slots_mask)
+  {
+    if (g_nodes[g_slots[i]].addr == addr)
+      return g_slots[i];
+  }
+
+  return NONE;
+}
+
+static
+int
+grow_nodes(void)
+{
+  struct node * nodes;
+  unsigned long * marks;
+  unsigned int * queue;
+  unsigned int * slots;
+  unsigned int size;
+  unsigned int words;
+  unsigned int i;
+  unsigned int j;
+
+  size = g_nodes_size == 0 ? 256 : g_nodes_size * 2;
+  words = (size + WORD_BITS - 1) / WORD_BITS;
+
+  nodes = realloc(g_nodes, size * sizeof(struct node));
+  if (nodes == NULL)
+    return -1;
+  g_nodes = nodes;
+
+  marks = realloc(g_marks, words * sizeof(unsigned long));
+  if (marks == NULL)
+    return -1;
+  g_marks = marks;
+  memset(g_marks + (g_nodes_size + WORD_BITS - 1) / WORD_BITS, 0, (words - (g_nodes_size + WORD_BITS - 1) / WORD_BITS) * sizeof(unsigned long));
+
+  queue = realloc(g_queue, 2 * size * sizeof(unsigned int));
+  if (queue == NULL)
+    return -1;
+  g_queue = queue;
+
+  /* half full at most, rehash into twice the nodes */
+  slots = malloc(2 * size * sizeof(unsigned int));
+  if (slots == NULL)
+    return -1;
+
+  free(g_slots);
+  g_slots = slots;
+  g_slots_mask = 2 * size - 1;
+  memset(g_slots, 0xff, 2 * size * sizeof(unsigned int));
+
+  for (i = 0 ; i < g_nodes_count ; i++)
+  {
+    for (j = slot(g_nodes[i].addr) ; g_slots[j] != NONE ; j = (j + 1) & g_slots_mask);
+    g_slots[j] = i;
+  }
+
+  g_nodes_size = size;
+
+  return 0;
+}
+
+static
+unsigned int
+add_node(unsigned int addr)
+{
+  unsigned int node;
+  unsigned int i;
+
+  node = find_node(addr);
+  if (node != NONE)
+    return node;
+
+  if (g_nodes_count == g_nodes_size && grow_nodes() < 0)
+    return NONE;
+
+  node = g_nodes_count++;
+  g_nodes[node].addr = addr;
+  g_nodes[node].out = NONE;
+  g_nodes[node].in = NONE;
+  g_nodes[node].forwards = 0;
+
+  for (i = slot(addr) ; g_slots[i] != NONE ; i = (i + 1) & g_slots_mask);
+  g_slots[i] = node;
+
+  return node;
+}
+
+static
+int
+add_edge(unsigned int from, unsigned int to)
+{
+  struct edge * edges;
+  unsigned int edge;
+
+  if (g_free_edge != NONE)
+  {
+    edge = g_free_edge;
+    g_free_edge = g_edges[edge].next_out;
+  }
+  else
+  {
+    if (g_edges_count == g_edges_size)
+    {
+      edges = realloc(g_edges, (g_edges_size == 0 ? 256 : g_edges_size * 2) * sizeof(struct edge));
+      if (edges == NULL)
+        return -1;
+
+      g_edges = edges;
+      g_edges_size = g_edges_size == 0 ? 256 : g_edges_size * 2;
+    }
+
+    edge = g_edges_count++;
+  }
+
+  g_edges[edge].from = from;
+  g_edges[edge].to = to;
+  g_edges[edge].next_out = g_nodes[from].out;
+  g_edges[edge].next_in = g_nodes[to].in;
+  g_nodes[from].out = edge;
+  g_nodes[to].in = edge;
+
+  return 0;
+}
+
+static
+void
+remove_edge(unsigned int from, unsigned int to)
+{
+  unsigned int * link_ptr;
+  unsigned int edge;
+
+  for (link_ptr = &g_nodes[from].out ; *link_ptr != NONE ; link_ptr = &g_edges[*link_ptr].next_out)
+  {
+    if (g_edges[*link_ptr].to == to)
+      break;
+  }
+
+  if (*link_ptr == NONE)
+    return;
+
+  edge = *link_ptr;
+  *link_ptr = g_edges[edge].next_out;
+
+  for (link_ptr = &g_nodes[to].in ; *link_ptr != edge ; link_ptr = &g_edges[*link_ptr].next_in);
+  *link_ptr = g_edges[edge].next_in;
+
+  g_edges[edge].next_out = g_free_edge;
+  g_free_edge = edge;
+}
+
+/* user clients and Midi Through pass what they get on a port out of it */
+static
+int
+thru_client(unsigned int client)
+{
+  struct client * client_ptr;
+
+  client_ptr = find_client(client);
+  if (client_ptr == NULL)
+    return 0;
+
+  return client_ptr->type == SND_SEQ_USER_CLIENT || strcmp(intern_str(client_ptr->name_id), "Midi Through") == 0;
+}
+
+static
+int
+forwards(unsigned int client, unsigned int port)
+{
+  return
+    find_port(client, port, &g_input_ports) != NULL &&
+    find_port(client, port, &g_output_ports) != NULL &&
+    thru_client(client);
+}
+
+static
+int
+rebuild(void)
+{
+  struct list_head * node_ptr;
+  struct list_head * input_ptr;
+  struct list_head * output_ptr;
+  struct connection * connection_ptr;
+  struct port * input_port_ptr;
+  struct port * output_port_ptr;
+  unsigned int from;
+  unsigned int to;
+  unsigned int node;
+
+  g_nodes_count = 0;
+  g_edges_count = 0;
+  g_free_edge = NONE;
+  g_valid = 0;
+  if (g_slots != NULL)
+    memset(g_slots, 0xff, (g_slots_mask + 1) * sizeof(unsigned int));
+
+  list_for_each(node_ptr, &g_connections)
+  {
+    connection_ptr = list_entry(node_ptr, struct connection, siblings);
+
+    from = add_node(ADDR(connection_ptr->source_client, connection_ptr->source_port));
+    if (from == NONE)
+      return -1;
+
+    to = add_node(ADDR(connection_ptr->dest_client, connection_ptr->dest_port));
+    if (to == NONE)
+      return -1;
+
+    if (add_edge(from, to) < 0)
+      return -1;
+  }
+
+  /* both port lists are ordered by address, ports on both are duplex */
+  input_ptr = g_input_ports.next;
+  output_ptr = g_output_ports.next;
+
+  while (input_ptr != &g_input_ports && output_ptr != &g_output_ports)
+  {
+    input_port_ptr = list_entry(input_ptr, struct port, siblings);
+    output_port_ptr = list_entry(output_ptr, struct port, siblings);
+
+    if (ADDR(input_port_ptr->client, input_port_ptr->port) < ADDR(output_port_ptr->client, output_port_ptr->port))
+    {
+      input_ptr = input_ptr->next;
+      continue;
+    }
+
+    if (ADDR(input_port_ptr->client, input_port_ptr->port) > ADDR(output_port_ptr->client, output_port_ptr->port))
+    {
+      output_ptr = output_ptr->next;
+      continue;
+    }
+
+    node = find_node(ADDR(input_port_ptr->client, input_port_ptr->port));
+    if (node != NONE)
+      g_nodes[node].forwards = thru_client(input_port_ptr->client);
+
+    input_ptr = input_ptr->next;
+    output_ptr = output_ptr->next;
+  }
+
+  g_stale = 0;
+
+  return 0;
+}
+
+static
+int
+is_marked(unsigned int node)
+{
+  return (g_marks[node / WORD_BITS] >> (node % WORD_BITS)) & 1;
+}
+
+static
+int
+is_origin(unsigned int node)
+{
+  return
+    g_nodes[node].addr >> 16 == g_origin_client &&
+    (g_origin_port == -1 || (int)(g_nodes[node].addr & 0xffff) == g_origin_port);
+}
+
+/* the search went on from node */
+static
+int
+expands(unsigned int node)
+{
+  return is_origin(node) || (is_marked(node) && g_nodes[node].forwards);
+}
+
+static
+void
+visit(unsigned int node, unsigned int * tail_ptr)
+{
+  unsigned int client;
+
+  if (is_marked(node))
+    return;
+
+  g_marks[node / WORD_BITS] |= 1UL << (node % WORD_BITS);
+  g_count++;
+
+  client = g_nodes[node].addr >> 16;
+  g_client_marks[client / WORD_BITS] |= 1UL << (client % WORD_BITS);
+
+  if (g_nodes[node].forwards)
+    g_queue[(*tail_ptr)++] = node;
+}
+
+static
+void
+expand(unsigned int tail)
+{
+  unsigned int head;
+  unsigned int node;
+  unsigned int edge;
+
+  for (head = 0 ; head < tail ; head++)
+  {
+    node = g_queue[head];
+
+    if (g_direction == REACH_DOWNSTREAM)
+    {
+      for (edge = g_nodes[node].out ; edge != NONE ; edge = g_edges[edge].next_out)
+        visit(g_edges[edge].to, &tail);
+    }
+    else
+    {
+      for (edge = g_nodes[node].in ; edge != NONE ; edge = g_edges[edge].next_in)
+        visit(g_edges[edge].from, &tail);
+    }
+  }
+}
+
+/* bring the cached result up to date, returns 0 if there is none */
+static
+int
+search(void)
+{
+  unsigned int tail;
+  unsigned int node;
+
+  if (!g_active)
+    return 0;
+
+  if (g_valid)
+    return 1;
+
+  if (g_stale && rebuild() < 0)
+  {
+    g_active = 0;
+    return 0;
+  }
+
+  g_count = 0;
+  memset(g_client_marks, 0, sizeof(g_client_marks));
+  if (g_marks != NULL)
+    memset(g_marks, 0, (g_nodes_size + WORD_BITS - 1) / WORD_BITS * sizeof(unsigned long));
+
+  /* the origins are not marked themselves, unless a loop comes back to them */
+  tail = 0;
+
+  if (g_origin_port != -1)
+  {
+    node = find_node(ADDR(g_origin_client, g_origin_port));
+    if (node != NONE)
+      g_queue[tail++] = node;
+  }
+  else
+  {
+    for (node = 0 ; node < g_nodes_count ; node++)
+    {
+      if (is_origin(node))
+        g_queue[tail++] = node;
+    }
+  }
+
+  expand(tail);
+
+  g_valid = 1;
+
+  return 1;
+}
+
+int reach_query(unsigned int client, int port, int direction)
+{
+  if (!g_active || client != g_origin_client || port != g_origin_port || direction != g_direction)
+  {
+    g_active = 1;
+    g_valid = 0;
+    g_origin_client = client;
+    g_origin_port = port;
+    g_direction = direction;
+  }
+
+  if (!search())
+    return 0;
+
+  return g_count;
+}
+
+void reach_off(void)
+{
+  g_active = 0;
+}
+
+int reach_active(void)
+{
+  return g_active;
+}
+
+int reach_port(unsigned int client, unsigned int port)
+{
+  unsigned int node;
+
+  if (!search())
+    return 0;
+
+  node = find_node(ADDR(client, port));
+
+  return node != NONE && is_marked(node);
+}
+
+int reach_client(unsigned int client)
+{
+  if (!search() || client >= 256)
+    return 0;
+
+  return (g_client_marks[client / WORD_BITS] >> (client % WORD_BITS)) & 1;
+}
+
+static
+unsigned int
+connection_node(unsigned int client, unsigned int port)
+{
+  unsigned int node;
+  int thru;
+
+  node = add_node(ADDR(client, port));
+  if (node == NONE)
+    return NONE;
+
+  /* a port changes, or a new client takes the number of a gone one */
+  thru = forwards(client, port);
+  if (thru != g_nodes[node].forwards)
+  {
+    g_nodes[node].forwards = thru;
+    g_valid = 0;
+  }
+
+  return node;
+}
+
+void reach_connected(unsigned int source_client, unsigned int source_port, unsigned int dest_client, unsigned int dest_port)
+{
+  unsigned int from;
+  unsigned int to;
+  unsigned int tail;
+
+  if (g_stale)
+    return;
+
+  from = connection_node(source_client, source_port);
+  to = connection_node(dest_client, dest_port);
+
+  if (from == NONE || to == NONE || add_edge(from, to) < 0)
+  {
+    reach_reset();
+    return;
+  }
+
+  if (!g_active || !g_valid)
+    return;
+
+  /* carry the search on over the new edge, if it got to the near end */
+  tail = 0;
+
+  if (g_direction == REACH_DOWNSTREAM && expands(from))
+    visit(to, &tail);
+  if (g_direction == REACH_UPSTREAM && expands(to))
+    visit(from, &tail);
+
+  expand(tail);
+}
+
+void reach_disconnected(unsigned int source_client, unsigned int source_port, unsigned int dest_client, unsigned int dest_port)
+{
+  unsigned int from;
+  unsigned int to;
+
+  if (g_stale)
+    return;
+
+  from = find_node(ADDR(source_client, source_port));
+  to = find_node(ADDR(dest_client, dest_port));
+  if (from == NONE || to == NONE)
+    return;
+
+  remove_edge(from, to);
+
+  if (!g_active || !g_valid)
+    return;
+
+  /* only an edge the search went over can take ports out of the result */
+  if (g_direction == REACH_DOWNSTREAM && expands(from) && is_marked(to))
+    g_valid = 0;
+  if (g_direction == REACH_UPSTREAM && expands(to) && is_marked(from))
+    g_valid = 0;
+}
+
+void reach_reset(void)
+{
+  g_stale = 1;
+  g_valid = 0;
+}
+
+void reach_free(void)
+{
+  free(g_nodes);
+  free(g_slots);
+  free(g_edges);
+  free(g_marks);
+  free(g_queue);
+
+  g_nodes = NULL;
+  g_slots = NULL;
+  g_edges = NULL;
+  g_marks = NULL;
+  g_queue = NULL;
+  g_nodes_count = g_nodes_size = 0;
+  g_edges_count = g_edges_size = 0;
+  g_free_edge = NONE;
+  g_stale = 1;
+  g_active = 0;
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Reachability over the routing graph.
+ *
+ *  The ports at either end of a connection are nodes of a graph whose
+ *  edges are the connections, kept in step with the model as connections
+ *  come and go instead of being rebuilt. Events are taken to pass through
+ *  a port that is both read and written on a user client, or on Midi
+ *  Through, which is how the router and other thru clients are made;
+ *  a hardware or system port ends a path.
+ *
+ *  A query is a breadth first search from the ports of the selected row,
+ *  downstream or upstream, and the result is cached as a bitset. A new
+ *  connection extends a cached result in place, a removed one only drops
+ *  it if it ran from a port the search went through.
+ *
+ *****************************************************************************/
+
+#ifndef REACH_H__
+#define REACH_H__
+
+#define REACH_DOWNSTREAM 0      /* the ports events from the origin get to */
+#define REACH_UPSTREAM   1      /* the ports that feed the origin */
+
+/* keep the graph in step with the connection list */
+void reach_connected(unsigned int source_client, unsigned int source_port, unsigned int dest_client, unsigned int dest_port);
+void reach_disconnected(unsigned int source_client, unsigned int source_port, unsigned int dest_client, unsigned int dest_port);
+void reach_reset(void);
+
+/* search from client:port, or every port of client if port is -1; returns the ports reached */
+int reach_query(unsigned int client, int port, int direction);
+
+/* forget the query, nothing is marked until the next one */
+void reach_off(void);
+int reach_active(void);
+
+int reach_port(unsigned int client, unsigned int port);
+int reach_client(unsigned int client);
+
+void reach_free(void);
+
+#endif /* #ifndef REACH_H__ */
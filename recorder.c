@@ -0,0 +1,492 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - Standard MIDI File recorder
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "tap.h"
+
+/* MThd chunk plus the MTrk chunk header, the track length follows "MTrk" */
+#define SMF_HEADER_SIZE 22
+#define SMF_TRACK_LENGTH_OFFSET 18
+
+struct block
+{
+  unsigned char * data;
+  size_t used;
+};
+
+static int g_port = -1;
+static int g_queue = -1;
+static snd_seq_addr_t g_source;
+static char g_path[1024];
+static int g_fd = -1;
+static snd_midi_event_t * g_midi_ptr;
+
+/* seq_cst handshake with recorder_stop(), see there */
+static int g_recording;
+static int g_busy;
+
+/*
+ * g_current belongs to the reader. g_pending is -1 or the block owned by
+ * the writer; it changes under g_lock and is peeked at for statistics.
+ */
+static struct block g_blocks[2];
+static int g_current;
+static int g_pending = -1;
+static int g_writer_stop;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_writer_thread;
+
+static snd_seq_tick_time_t g_last_tick;
+static unsigned long g_events;
+static unsigned long long g_bytes;
+static size_t g_peak_buffered;
+static unsigned long g_stalls;
+static int g_write_error;
+static uint64_t g_start_ns;
+
+static
+void *
+writer_thread(void * arg)
+{
+  struct block * block_ptr;
+  size_t offset;
+  ssize_t ret;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&g_lock);
+
+    while (g_pending == -1 && !g_writer_stop)
+      pthread_cond_wait(&g_cond, &g_lock);
+
+    if (g_pending == -1)
+    {
+      pthread_mutex_unlock(&g_lock);
+      break;
+    }
+
+    block_ptr = g_blocks + g_pending;
+
+    pthread_mutex_unlock(&g_lock);
+
+    for (offset = 0 ; offset < block_ptr->used && g_write_error == 0 ; offset += ret)
+    {
+      ret = write(g_fd, block_ptr->data + offset, block_ptr->used - offset);
+      if (ret < 0)
+      {
+        if (errno == EINTR)
+        {
+          ret = 0;
+          continue;
+        }
+
+        g_write_error = errno;
+      }
+    }
+
+    pthread_mutex_lock(&g_lock);
+    __atomic_store_n(&g_pending, -1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+  }
+
+  return NULL;
+}
+
+/* give the current block to the writer and continue in the other one */
+static
+void
+hand_over(void)
+{
+  pthread_mutex_lock(&g_lock);
+
+  if (g_pending != -1)
+  {
+    g_stalls++;
+
+    while (g_pending != -1)
+      pthread_cond_wait(&g_cond, &g_lock);
+  }
+
+  __atomic_store_n(&g_pending, g_current, __ATOMIC_RELAXED);
+  g_current ^= 1;
+  g_blocks[g_current].used = 0;
+
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+}
+
+static
+void
+put_bytes(const unsigned char * data, size_t len)
+{
+  struct block * block_ptr;
+  size_t count;
+  size_t buffered;
+
+  g_bytes += len;
+
+  while (len > 0)
+  {
+    block_ptr = g_blocks + g_current;
+
+    count = RECORDER_BLOCK_SIZE - block_ptr->used;
+    if (count > len)
+      count = len;
+
+    memcpy(block_ptr->data + block_ptr->used, data, count);
+    block_ptr->used += count;
+    data += count;
+    len -= count;
+
+    if (block_ptr->used == RECORDER_BLOCK_SIZE)
+      hand_over();
+  }
+
+  buffered = g_blocks[g_current].used + (__atomic_load_n(&g_pending, __ATOMIC_RELAXED) != -1 ? RECORDER_BLOCK_SIZE : 0);
+  if (buffered > g_peak_buffered)
+    g_peak_buffered = buffered;
+}
+
+static
+void
+put_byte(unsigned char byte)
+{
+  put_bytes(&byte, 1);
+}
+
+/* SMF variable length quantity, 7 bits per byte, most significant first */
+static
+void
+put_varlen(unsigned long value)
+{
+  unsigned char buf[5];
+  int i;
+
+  i = sizeof(buf);
+  buf[--i] = value & 0x7F;
+  while ((value >>= 7) != 0)
+    buf[--i] = (value & 0x7F) | 0x80;
+
+  put_bytes(buf + i, sizeof(buf) - i);
+}
+
+static
+void
+put_be(unsigned long value, int size)
+{
+  while (size-- > 0)
+    put_byte((value >> (size * 8)) & 0xFF);
+}
+
+static
+void
+encode_event(const snd_seq_event_t * event_ptr)
+{
+  unsigned char buf[16];
+  const unsigned char * data;
+  long len;
+  snd_seq_tick_time_t tick;
+
+  tick = event_ptr->time.tick;
+
+  if (event_ptr->type == SND_SEQ_EVENT_SYSEX)
+  {
+    data = event_ptr->data.ext.ptr;
+    len = event_ptr->data.ext.len;
+    if (len < 1)
+      return;
+
+    put_varlen(tick >= g_last_tick ? tick - g_last_tick : 0);
+
+    if (data[0] == 0xF0)
+    {
+      put_byte(0xF0);
+      put_varlen(len - 1);
+      put_bytes(data + 1, len - 1);
+    }
+    else
+    {
+      /* continuation of a long sysex, stored as an escape */
+      put_byte(0xF7);
+      put_varlen(len);
+      put_bytes(data, len);
+    }
+  }
+  else
+  {
+    len = snd_midi_event_decode(g_midi_ptr, buf, sizeof(buf), event_ptr);
+    if (len <= 0)
+      return;
+
+    put_varlen(tick >= g_last_tick ? tick - g_last_tick : 0);
+
+    if (buf[0] >= 0xF0)
+    {
+      /* system common and realtime messages have no SMF event of their own */
+      put_byte(0xF7);
+      put_varlen(len);
+    }
+
+    put_bytes(buf, len);
+  }
+
+  g_last_tick = tick;
+  __atomic_store_n(&g_events, g_events + 1, __ATOMIC_RELAXED);
+}
+
+static
+void
+tap_event(void * context, const snd_seq_event_t * event_ptr, uint64_t time_ns)
+{
+  __atomic_add_fetch(&g_busy, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&g_recording, __ATOMIC_SEQ_CST))
+    encode_event(event_ptr);
+
+  __atomic_sub_fetch(&g_busy, 1, __ATOMIC_RELEASE);
+}
+
+static
+int
+subscribe(int subscribe)
+{
+  snd_seq_port_subscribe_t * subscr_ptr;
+  snd_seq_addr_t dest;
+
+  snd_seq_port_subscribe_alloca(&subscr_ptr);
+
+  dest.client = tap_client();
+  dest.port = g_port;
+
+  snd_seq_port_subscribe_set_sender(subscr_ptr, &g_source);
+  snd_seq_port_subscribe_set_dest(subscr_ptr, &dest);
+
+  if (!subscribe)
+    return snd_seq_unsubscribe_port(tap_seq(), subscr_ptr);
+
+  /* events get stamped with the tick of our queue on delivery */
+  snd_seq_port_subscribe_set_queue(subscr_ptr, g_queue);
+  snd_seq_port_subscribe_set_time_update(subscr_ptr, 1);
+  snd_seq_port_subscribe_set_time_real(subscr_ptr, 0);
+
+  return snd_seq_subscribe_port(tap_seq(), subscr_ptr);
+}
+
+int recorder_start(const snd_seq_addr_t * source_ptr, const char * path)
+{
+  snd_seq_queue_tempo_t * tempo_ptr;
+  int ret;
+
+  snd_seq_queue_tempo_alloca(&tempo_ptr);
+
+  if (g_recording)
+    return -1;
+
+  if (strlen(path) >= sizeof(g_path) || tap_open() < 0)
+    return -1;
+
+  if (g_port < 0)
+  {
+    g_port = tap_create_port("recorder", 0, tap_event, NULL);
+    if (g_port < 0)
+      return -1;
+  }
+
+  if (g_queue < 0)
+  {
+    g_queue = snd_seq_alloc_named_queue(tap_seq(), "naconnect recorder");
+    if (g_queue < 0)
+      return -1;
+
+    snd_seq_queue_tempo_set_tempo(tempo_ptr, RECORDER_TEMPO);
+    snd_seq_queue_tempo_set_ppq(tempo_ptr, RECORDER_PPQ);
+    snd_seq_set_queue_tempo(tap_seq(), g_queue, tempo_ptr);
+  }
+
+  g_blocks[0].data = malloc(RECORDER_BLOCK_SIZE);
+  g_blocks[1].data = malloc(RECORDER_BLOCK_SIZE);
+  if (g_blocks[0].data == NULL || g_blocks[1].data == NULL)
+    goto free;
+
+  if (snd_midi_event_new(sizeof(((snd_seq_event_t *)0)->data), &g_midi_ptr) < 0)
+    goto free;
+
+  snd_midi_event_no_status(g_midi_ptr, 1);
+
+  g_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (g_fd < 0)
+    goto free_midi;
+
+  strcpy(g_path, path);
+  g_source = *source_ptr;
+  g_blocks[0].used = 0;
+  g_blocks[1].used = 0;
+  g_current = 0;
+  g_pending = -1;
+  g_writer_stop = 0;
+  g_last_tick = 0;
+  g_events = 0;
+  g_bytes = 0;
+  g_peak_buffered = 0;
+  g_stalls = 0;
+  g_write_error = 0;
+
+  /* format 0, one track, ticks per quarter, tempo; the track length is patched at the end */
+  put_bytes((const unsigned char *)"MThd", 4);
+  put_be(6, 4);
+  put_be(0, 2);
+  put_be(1, 2);
+  put_be(RECORDER_PPQ, 2);
+  put_bytes((const unsigned char *)"MTrk", 4);
+  put_be(0, 4);
+
+  put_varlen(0);
+  put_byte(0xFF);
+  put_byte(0x51);
+  put_byte(3);
+  put_be(RECORDER_TEMPO, 3);
+
+  if (pthread_create(&g_writer_thread, NULL, writer_thread, NULL) != 0)
+    goto close;
+
+  /* START rewinds the queue to tick 0 */
+  snd_seq_start_queue(tap_seq(), g_queue, NULL);
+  snd_seq_drain_output(tap_seq());
+
+  __atomic_store_n(&g_recording, 1, __ATOMIC_SEQ_CST);
+
+  ret = subscribe(1);
+  if (ret < 0)
+  {
+    recorder_stop(NULL);
+    unlink(path);
+    return -1;
+  }
+
+  g_start_ns = tap_now_ns();
+
+  return 0;
+
+close:
+  close(g_fd);
+  g_fd = -1;
+  unlink(path);
+free_midi:
+  snd_midi_event_free(g_midi_ptr);
+  g_midi_ptr = NULL;
+free:
+  free(g_blocks[0].data);
+  free(g_blocks[1].data);
+  g_blocks[0].data = g_blocks[1].data = NULL;
+  return -1;
+}
+
+int recorder_stop(struct recorder_report * report_ptr)
+{
+  unsigned char length[4];
+  unsigned long long track_length;
+
+  if (!g_recording)
+    return -1;
+
+  subscribe(0);
+
+  /*
+   * The callback raises g_busy before it checks g_recording, both seq_cst,
+   * so once g_busy drops to 0 here no callback can still be encoding and
+   * the main thread owns the blocks.
+   */
+  __atomic_store_n(&g_recording, 0, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&g_busy, __ATOMIC_SEQ_CST) != 0)
+    sched_yield();
+
+  snd_seq_stop_queue(tap_seq(), g_queue, NULL);
+  snd_seq_drain_output(tap_seq());
+
+  /* end of track */
+  put_varlen(0);
+  put_byte(0xFF);
+  put_byte(0x2F);
+  put_byte(0);
+
+  if (g_blocks[g_current].used > 0)
+    hand_over();
+
+  pthread_mutex_lock(&g_lock);
+  g_writer_stop = 1;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+
+  pthread_join(g_writer_thread, NULL);
+
+  track_length = g_bytes - SMF_HEADER_SIZE;
+  length[0] = (track_length >> 24) & 0xFF;
+  length[1] = (track_length >> 16) & 0xFF;
+  length[2] = (track_length >> 8) & 0xFF;
+  length[3] = track_length & 0xFF;
+
+  if (pwrite(g_fd, length, 4, SMF_TRACK_LENGTH_OFFSET) != 4 && g_write_error == 0)
+    g_write_error = errno;
+
+  if (close(g_fd) < 0 && g_write_error == 0)
+    g_write_error = errno;
+
+  g_fd = -1;
+
+  if (report_ptr != NULL)
+  {
+    report_ptr->seconds = (tap_now_ns() - g_start_ns) / 1e9;
+    report_ptr->events = g_events;
+    report_ptr->bytes = g_bytes;
+    report_ptr->peak_buffered = g_peak_buffered;
+    report_ptr->stalls = g_stalls;
+    report_ptr->write_error = g_write_error;
+  }
+
+  snd_midi_event_free(g_midi_ptr);
+  g_midi_ptr = NULL;
+  free(g_blocks[0].data);
+  free(g_blocks[1].data);
+  g_blocks[0].data = g_blocks[1].data = NULL;
+
+  return g_write_error == 0 ? 0 : -1;
+}
+
+const snd_seq_addr_t * recorder_source(void)
+{
+  return g_recording ? &g_source : NULL;
+}
+
+const char * recorder_path(void)
+{
+  return g_path;
+}
+
+unsigned long recorder_events(void)
+{
+  return __atomic_load_n(&g_events, __ATOMIC_RELAXED);
+}
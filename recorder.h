@@ -0,0 +1,45 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Streaming Standard MIDI File recorder.
+ *
+ *  A port on the tap client is subscribed to one source with timestamps
+ *  from a queue of the tap, so every event arrives stamped in ticks. The
+ *  reader thread encodes events straight into one of two large blocks as
+ *  a format 0 track. A full block is handed to a writer thread and the
+ *  reader carries on in the other. Memory use is fixed at two blocks. If
+ *  the disk falls behind by a whole block, the reader waits for the
+ *  writer and counts a stall. Meanwhile events queue up in the kernel,
+ *  so none are lost unless its input pool overruns.
+ *
+ *****************************************************************************/
+
+#ifndef RECORDER_H__
+#define RECORDER_H__
+
+#include <alsa/asoundlib.h>
+
+#define RECORDER_PPQ 384
+#define RECORDER_TEMPO 500000   /* us per quarter, 120 bpm */
+#define RECORDER_BLOCK_SIZE (1024 * 1024)
+
+struct recorder_report
+{
+  double seconds;
+  unsigned long events;
+  unsigned long long bytes;     /* file size */
+  size_t peak_buffered;         /* most bytes encoded but not yet written */
+  unsigned long stalls;         /* times the reader waited for the writer */
+  int write_error;              /* errno of a failed write, 0 if none */
+};
+
+int recorder_start(const snd_seq_addr_t * source_ptr, const char * path);
+int recorder_stop(struct recorder_report * report_ptr);
+
+/* source being recorded, NULL when off */
+const snd_seq_addr_t * recorder_source(void);
+const char * recorder_path(void);
+unsigned long recorder_events(void);
+
+#endif /* #ifndef RECORDER_H__ */
@@ -0,0 +1,661 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - MIDI router
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+
+#include "router.h"
+
+#define ROUTER_MAX_POLLFDS 4
+
+/* actions by event type */
+#define ACTION_DROP 0
+#define ACTION_PASS 1           /* forwarded as is */
+#define ACTION_CHANNEL 2        /* channel mapped */
+#define ACTION_NOTE 3           /* channel and note mapped */
+
+#define MAP_DROP 0xFF
+
+struct route
+{
+  unsigned char action[256];
+  unsigned char channel_map[16];
+  unsigned char note_map[128];
+};
+
+struct router_table
+{
+  unsigned char slots[256];     /* route index + 1 by port, 0 if the port is no route */
+  struct route routes[ROUTER_MAX_ROUTES];
+};
+
+struct kind
+{
+  const char * name;
+  unsigned char action;
+  unsigned char types[5];       /* SND_SEQ_EVENT_SYSTEM terminated */
+};
+
+static const struct kind g_kinds[] =
+{
+  {"note", ACTION_NOTE, {SND_SEQ_EVENT_NOTEON, SND_SEQ_EVENT_NOTEOFF, SND_SEQ_EVENT_NOTE}},
+  {"pressure", ACTION_NOTE, {SND_SEQ_EVENT_KEYPRESS}},
+  {"pressure", ACTION_CHANNEL, {SND_SEQ_EVENT_CHANPRESS}},
+  {"cc", ACTION_CHANNEL, {SND_SEQ_EVENT_CONTROLLER, SND_SEQ_EVENT_CONTROL14, SND_SEQ_EVENT_NONREGPARAM, SND_SEQ_EVENT_REGPARAM}},
+  {"pgm", ACTION_CHANNEL, {SND_SEQ_EVENT_PGMCHANGE}},
+  {"bend", ACTION_CHANNEL, {SND_SEQ_EVENT_PITCHBEND}},
+  {"sysex", ACTION_PASS, {SND_SEQ_EVENT_SYSEX}},
+  {"clock", ACTION_PASS, {SND_SEQ_EVENT_CLOCK, SND_SEQ_EVENT_TICK}},
+  {"transport", ACTION_PASS, {SND_SEQ_EVENT_START, SND_SEQ_EVENT_CONTINUE, SND_SEQ_EVENT_STOP, SND_SEQ_EVENT_SONGPOS}},
+  {"rt", ACTION_PASS, {SND_SEQ_EVENT_SENSING, SND_SEQ_EVENT_RESET}},
+  {"common", ACTION_PASS, {SND_SEQ_EVENT_QFRAME, SND_SEQ_EVENT_SONGSEL, SND_SEQ_EVENT_TUNE_REQUEST, SND_SEQ_EVENT_TIMESIGN, SND_SEQ_EVENT_KEYSIGN}},
+};
+
+#define KINDS_COUNT (sizeof(g_kinds) / sizeof(g_kinds[0]))
+#define KINDS_ALL ((1u << KINDS_COUNT) - 1)
+
+static snd_seq_t * g_seq;
+static int g_client = -1;
+static pthread_t g_thread;
+static int g_wakeup_pipe[2] = {-1, -1};
+
+/*
+ * Swapped by the main thread, read by the router thread once per batch.
+ * g_in_batch and g_epoch tell the main thread when the old table is no
+ * longer in use.
+ */
+static struct router_table * g_table_ptr;
+static int g_in_batch;
+static unsigned long g_epoch;
+
+/* main thread only */
+static int g_ports[ROUTER_MAX_ROUTES];
+static char g_specs[ROUTER_MAX_ROUTES][ROUTER_SPEC_MAX];
+
+/* returns 1 if the event, changed in place, is to be forwarded */
+static
+int
+route_event(const struct router_table * table_ptr, snd_seq_event_t * event_ptr)
+{
+  const struct route * route_ptr;
+  unsigned char slot;
+  unsigned char value;
+
+  slot = table_ptr->slots[event_ptr->dest.port];
+  if (slot == 0)
+    return 0;
+
+  route_ptr = table_ptr->routes + slot - 1;
+
+  switch (route_ptr->action[event_ptr->type])
+  {
+  case ACTION_DROP:
+    return 0;
+  case ACTION_NOTE:
+    value = route_ptr->note_map[event_ptr->data.note.note & 0x7F];
+    if (value == MAP_DROP)
+      return 0;
+    event_ptr->data.note.note = value;
+    /* fall through, the channel is at the same place for all channel events */
+  case ACTION_CHANNEL:
+    value = route_ptr->channel_map[event_ptr->data.control.channel & 0x0F];
+    if (value == MAP_DROP)
+      return 0;
+    event_ptr->data.control.channel = value;
+    break;
+  }
+
+  snd_seq_ev_set_source(event_ptr, event_ptr->dest.port);
+  snd_seq_ev_set_subs(event_ptr);
+  snd_seq_ev_set_direct(event_ptr);
+
+  return 1;
+}
+
+static
+void *
+router_thread(void * arg)
+{
+  struct pollfd pfds[ROUTER_MAX_POLLFDS + 1];
+  const struct router_table * table_ptr;
+  snd_seq_event_t * event_ptr;
+  unsigned int count;
+  int pfds_count;
+
+  pfds_count = snd_seq_poll_descriptors(g_seq, pfds, ROUTER_MAX_POLLFDS, POLLIN);
+
+  pfds[pfds_count].fd = g_wakeup_pipe[0];
+  pfds[pfds_count].events = POLLIN;
+
+  for (;;)
+  {
+    if (poll(pfds, pfds_count + 1, -1) < 0 && errno != EINTR)
+      break;
+
+    if (pfds[pfds_count].revents & POLLIN)
+      break;
+
+    __atomic_store_n(&g_in_batch, 1, __ATOMIC_SEQ_CST);
+    table_ptr = __atomic_load_n(&g_table_ptr, __ATOMIC_SEQ_CST);
+
+    /* everything pending is one batch, sent with a single drain */
+    count = 0;
+    while (snd_seq_event_input(g_seq, &event_ptr) >= 0)
+    {
+      if (!route_event(table_ptr, event_ptr))
+        continue;
+
+      if (snd_seq_event_output_buffer(g_seq, event_ptr) == -EAGAIN)
+      {
+        snd_seq_drain_output(g_seq);
+        snd_seq_event_output_buffer(g_seq, event_ptr);
+      }
+
+      count++;
+    }
+
+    if (count > 0)
+      snd_seq_drain_output(g_seq);
+
+    __atomic_store_n(&g_epoch, g_epoch + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_in_batch, 0, __ATOMIC_SEQ_CST);
+  }
+
+  return NULL;
+}
+
+static
+int
+start_thread(void)
+{
+  pthread_attr_t attr;
+  struct sched_param param;
+  int ret;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  param.sched_priority = ROUTER_PRIORITY;
+  pthread_attr_setschedparam(&attr, &param);
+
+  ret = pthread_create(&g_thread, &attr, router_thread, NULL);
+
+  pthread_attr_destroy(&attr);
+
+  /* without the privilege for SCHED_FIFO run at normal priority */
+  if (ret == EPERM)
+    ret = pthread_create(&g_thread, NULL, router_thread, NULL);
+
+  return ret == 0 ? 0 : -1;
+}
+
+static
+int
+router_open(void)
+{
+  int ret;
+  int i;
+
+  if (g_seq != NULL)
+    return 0;
+
+  ret = snd_seq_open(&g_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
+  if (ret < 0)
+  {
+    g_seq = NULL;
+    return -1;
+  }
+
+  snd_seq_set_client_name(g_seq, "naconnect router");
+
+  g_table_ptr = calloc(1, sizeof(struct router_table));
+  if (g_table_ptr == NULL)
+    goto close;
+
+  if (pipe(g_wakeup_pipe) < 0)
+    goto free;
+
+  if (start_thread() < 0)
+    goto close_pipe;
+
+  g_client = snd_seq_client_id(g_seq);
+
+  for (i = 0 ; i < ROUTER_MAX_ROUTES ; i++)
+    g_ports[i] = -1;
+
+  return 0;
+
+close_pipe:
+  close(g_wakeup_pipe[0]);
+  close(g_wakeup_pipe[1]);
+  g_wakeup_pipe[0] = g_wakeup_pipe[1] = -1;
+free:
+  free(g_table_ptr);
+  g_table_ptr = NULL;
+close:
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  return -1;
+}
+
+void router_close(void)
+{
+  if (g_seq == NULL)
+    return;
+
+  if (write(g_wakeup_pipe[1], "", 1) != 1)
+    fprintf(stderr, "Cannot wake up the router thread.\n");
+
+  pthread_join(g_thread, NULL);
+
+  close(g_wakeup_pipe[0]);
+  close(g_wakeup_pipe[1]);
+  g_wakeup_pipe[0] = g_wakeup_pipe[1] = -1;
+
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  g_client = -1;
+
+  free(g_table_ptr);
+  g_table_ptr = NULL;
+}
+
+int router_client(void)
+{
+  return g_client;
+}
+
+/* "1,3-5" into a bit mask of lo..hi, base is the number of bit 0 */
+static
+int
+parse_numbers(const char * str, int base, int lo, int hi, unsigned long * mask_ptr)
+{
+  char * end;
+  long first;
+  long last;
+
+  *mask_ptr = 0;
+
+  for (;;)
+  {
+    first = strtol(str, &end, 10);
+    if (end == str)
+      return -1;
+
+    last = first;
+    if (*end == '-')
+    {
+      str = end + 1;
+      last = strtol(str, &end, 10);
+      if (end == str)
+        return -1;
+    }
+
+    if (first < lo || last > hi || first > last)
+      return -1;
+
+    for ( ; first <= last ; first++)
+      *mask_ptr |= 1UL << (first - base);
+
+    if (*end == '\0')
+      return 0;
+
+    if (*end != ',')
+      return -1;
+
+    str = end + 1;
+  }
+}
+
+static
+int
+parse_kinds(char * str, unsigned int * kinds_ptr)
+{
+  char * saveptr;
+  char * name;
+  unsigned int i;
+  int found;
+
+  *kinds_ptr = 0;
+
+  for (name = strtok_r(str, ",", &saveptr) ; name != NULL ; name = strtok_r(NULL, ",", &saveptr))
+  {
+    found = 0;
+
+    for (i = 0 ; i < KINDS_COUNT ; i++)
+    {
+      if (strcmp(name, g_kinds[i].name) == 0)
+      {
+        *kinds_ptr |= 1u << i;
+        found = 1;
+      }
+    }
+
+    if (!found)
+      return -1;
+  }
+
+  return 0;
+}
+
+static
+int
+compile(const char * spec, struct route * route_ptr, const char ** err_ptr)
+{
+  char buf[ROUTER_SPEC_MAX];
+  char * saveptr;
+  char * token;
+  char * value;
+  unsigned long channels;
+  unsigned long mask;
+  unsigned int kinds;
+  unsigned int excluded;
+  int out;
+  int lo;
+  int hi;
+  int transpose;
+  int note;
+  unsigned int i;
+  unsigned int j;
+
+  if (strlen(spec) >= sizeof(buf))
+  {
+    *err_ptr = "Route spec too long";
+    return -1;
+  }
+
+  strcpy(buf, spec);
+
+  channels = 0xFFFF;
+  out = -1;
+  lo = 0;
+  hi = 127;
+  transpose = 0;
+  kinds = KINDS_ALL;
+
+  for (token = strtok_r(buf, " \t", &saveptr) ; token != NULL ; token = strtok_r(NULL, " \t", &saveptr))
+  {
+    value = strchr(token, '=');
+    if (value == NULL)
+    {
+      *err_ptr = "Route spec parts are key=value";
+      return -1;
+    }
+
+    *value++ = '\0';
+
+    if (strcmp(token, "ch") == 0)
+    {
+      if (parse_numbers(value, 1, 1, 16, &channels) < 0)
+        goto bad_value;
+    }
+    else if (strcmp(token, "out") == 0)
+    {
+      if (parse_numbers(value, 1, 1, 16, &mask) < 0 || (mask & (mask - 1)) != 0)
+        goto bad_value;
+
+      for (out = 0 ; !(mask & (1UL << out)) ; out++);
+    }
+    else if (strcmp(token, "notes") == 0)
+    {
+      if (sscanf(value, "%d-%d", &lo, &hi) != 2 || lo < 0 || hi > 127 || lo > hi)
+        goto bad_value;
+    }
+    else if (strcmp(token, "transpose") == 0)
+    {
+      if (sscanf(value, "%d", &transpose) != 1 || transpose < -127 || transpose > 127)
+        goto bad_value;
+    }
+    else if (strcmp(token, "only") == 0)
+    {
+      if (parse_kinds(value, &kinds) < 0)
+        goto bad_value;
+    }
+    else if (strcmp(token, "drop") == 0)
+    {
+      if (parse_kinds(value, &excluded) < 0)
+        goto bad_value;
+
+      kinds &= ~excluded;
+    }
+    else
+    {
+      *err_ptr = "Unknown route spec key, use ch out notes transpose only drop";
+      return -1;
+    }
+  }
+
+  memset(route_ptr->action, ACTION_DROP, sizeof(route_ptr->action));
+  for (i = 0 ; i < KINDS_COUNT ; i++)
+  {
+    if (!(kinds & (1u << i)))
+      continue;
+
+    for (j = 0 ; j < sizeof(g_kinds[i].types) && g_kinds[i].types[j] != SND_SEQ_EVENT_SYSTEM ; j++)
+      route_ptr->action[g_kinds[i].types[j]] = g_kinds[i].action;
+  }
+
+  for (i = 0 ; i < 16 ; i++)
+    route_ptr->channel_map[i] = (channels & (1UL << i)) ? (out >= 0 ? out : i) : MAP_DROP;
+
+  for (i = 0 ; i < 128 ; i++)
+  {
+    note = i + transpose;
+    route_ptr->note_map[i] = ((int)i >= lo && (int)i <= hi && note >= 0 && note <= 127) ? note : MAP_DROP;
+  }
+
+  return 0;
+
+bad_value:
+  *err_ptr = "Bad value in route spec";
+  return -1;
+}
+
+/* swap the table in, free the old one once the router thread is done with it */
+static
+void
+publish(struct router_table * table_ptr)
+{
+  struct router_table * old_ptr;
+  unsigned long epoch;
+
+  old_ptr = g_table_ptr;
+
+  __atomic_store_n(&g_table_ptr, table_ptr, __ATOMIC_SEQ_CST);
+
+  /* a batch that started before the store may still use the old table, wait for its end */
+  epoch = __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE);
+  while (__atomic_load_n(&g_in_batch, __ATOMIC_SEQ_CST) && __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE) == epoch)
+    sched_yield();
+
+  free(old_ptr);
+}
+
+static
+struct router_table *
+copy_table(void)
+{
+  struct router_table * table_ptr;
+
+  table_ptr = malloc(sizeof(struct router_table));
+  if (table_ptr != NULL)
+    memcpy(table_ptr, g_table_ptr, sizeof(struct router_table));
+
+  return table_ptr;
+}
+
+static
+int
+find_slot(int port)
+{
+  int i;
+
+  if (g_seq == NULL)
+    return -1;
+
+  for (i = 0 ; i < ROUTER_MAX_ROUTES ; i++)
+  {
+    if (g_ports[i] >= 0 && g_ports[i] == port)
+      return i;
+  }
+
+  return -1;
+}
+
+static
+void
+port_name(const char * spec, char * name, size_t size)
+{
+  snprintf(name, size, "Route %s", spec[0] != '\0' ? spec : "all");
+}
+
+int router_add(const char * spec, const char ** err_ptr)
+{
+  struct router_table * table_ptr;
+  struct route route;
+  char name[64];
+  int slot;
+  int port;
+
+  if (compile(spec, &route, err_ptr) < 0)
+    return -1;
+
+  if (router_open() < 0)
+  {
+    *err_ptr = "Cannot open the router client";
+    return -1;
+  }
+
+  for (slot = 0 ; slot < ROUTER_MAX_ROUTES && g_ports[slot] >= 0 ; slot++);
+  if (slot == ROUTER_MAX_ROUTES)
+  {
+    *err_ptr = "Too many routes";
+    return -1;
+  }
+
+  table_ptr = copy_table();
+  if (table_ptr == NULL)
+  {
+    *err_ptr = "Out of memory";
+    return -1;
+  }
+
+  port_name(spec, name, sizeof(name));
+
+  port = snd_seq_create_simple_port(
+    g_seq,
+    name,
+    SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ | SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+    SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+  if (port < 0)
+  {
+    free(table_ptr);
+    *err_ptr = "Cannot create the route port";
+    return -1;
+  }
+
+  table_ptr->slots[port] = slot + 1;
+  table_ptr->routes[slot] = route;
+  publish(table_ptr);
+
+  g_ports[slot] = port;
+  strcpy(g_specs[slot], spec);
+
+  return port;
+}
+
+int router_set(int port, const char * spec, const char ** err_ptr)
+{
+  struct router_table * table_ptr;
+  snd_seq_port_info_t * info_ptr;
+  char name[64];
+  int slot;
+
+  slot = find_slot(port);
+  if (slot < 0)
+  {
+    *err_ptr = "Not a route";
+    return -1;
+  }
+
+  table_ptr = copy_table();
+  if (table_ptr == NULL)
+  {
+    *err_ptr = "Out of memory";
+    return -1;
+  }
+
+  if (compile(spec, table_ptr->routes + slot, err_ptr) < 0)
+  {
+    free(table_ptr);
+    return -1;
+  }
+
+  publish(table_ptr);
+
+  strcpy(g_specs[slot], spec);
+
+  /* the name shows the rules, renaming announces it */
+  snd_seq_port_info_alloca(&info_ptr);
+  if (snd_seq_get_port_info(g_seq, port, info_ptr) == 0)
+  {
+    port_name(spec, name, sizeof(name));
+    snd_seq_port_info_set_name(info_ptr, name);
+    snd_seq_set_port_info(g_seq, port, info_ptr);
+  }
+
+  return 0;
+}
+
+int router_remove(int port)
+{
+  struct router_table * table_ptr;
+  int slot;
+
+  slot = find_slot(port);
+  if (slot < 0)
+    return -1;
+
+  table_ptr = copy_table();
+  if (table_ptr == NULL)
+    return -1;
+
+  table_ptr->slots[port] = 0;
+  publish(table_ptr);
+
+  snd_seq_delete_simple_port(g_seq, port);
+  g_ports[slot] = -1;
+
+  return 0;
+}
+
+const char * router_spec(int port)
+{
+  int slot;
+
+  slot = find_slot(port);
+  if (slot < 0)
+    return NULL;
+
+  return g_specs[slot];
+}
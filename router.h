@@ -0,0 +1,53 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  In-process MIDI router.
+ *
+ *  A "naconnect router" client has one port per route. Events sent to a
+ *  route's port are filtered and transformed, then sent to the
+ *  subscribers of the same port, so a route is patched like any other
+ *  port. Rules are compiled into per-route lookup tables: an action per
+ *  event type, an output channel per input channel and an output note
+ *  per input note. Dispatching an event is a few table lookups.
+ *
+ *  A thread, realtime priority if allowed, drains every pending event,
+ *  buffers the results and flushes them with a single drain per batch.
+ *  Edits compile a complete new table that is swapped in between two
+ *  batches, so routes change without dropping events.
+ *
+ *  Route spec, space separated, every part optional:
+ *    ch=1,3-4          only these input channels pass
+ *    out=2             send on this channel
+ *    notes=36-59       notes outside the range are dropped
+ *    transpose=-12     shift notes, ones pushed out of 0-127 are dropped
+ *    only=note,cc      pass only these kinds of events
+ *    drop=clock,sysex  drop these kinds of events
+ *  Kinds: note, pressure, cc, pgm, bend, sysex, clock, transport, rt, common
+ *
+ *****************************************************************************/
+
+#ifndef ROUTER_H__
+#define ROUTER_H__
+
+#define ROUTER_MAX_ROUTES 32
+#define ROUTER_SPEC_MAX 128
+#define ROUTER_PRIORITY 60      /* SCHED_FIFO priority of the router thread */
+
+/* add a route, returns its port number or -1; err_ptr gets a reason on failure */
+int router_add(const char * spec, const char ** err_ptr);
+
+/* replace the rules of a route */
+int router_set(int port, const char * spec, const char ** err_ptr);
+
+int router_remove(int port);
+
+/* spec of the route on port, NULL if port is not a route */
+const char * router_spec(int port);
+
+/* -1 while no route was ever added */
+int router_client(void);
+
+void router_close(void);
+
+#endif /* #ifndef ROUTER_H__ */
@@ -0,0 +1,639 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - routing scenes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+
+#include "scenes.h"
+
+#define SCENES_MAX_POLLFDS 4
+#define SCENES_LINE_MAX 256
+#define SCENES_CONNECTIONS_MAX 4096     /* different connections in all scenes */
+#define SCENES_QUIT 0xff                /* pipe byte, others are scene numbers */
+
+#define TRIGGER_NONE 0
+#define TRIGGER_PC   1
+#define TRIGGER_CC   2
+
+struct scene
+{
+  char name[SCENES_NAME_MAX];
+  int trigger;
+  int channel;                  /* 0-15, -1 for any */
+  int param;                    /* program or controller */
+  int value;                    /* of the controller */
+  unsigned char * members;      /* a byte per connection, 1 if it is in the scene */
+};
+
+/* connection numbers times 2, plus 1 to subscribe; the unsubscribes come first */
+struct plan
+{
+  unsigned int * ops;
+  unsigned int count;
+};
+
+static snd_seq_t * g_seq;
+static int g_port = -1;
+static pthread_t g_thread;
+static int g_pipe[2] = {-1, -1};
+
+static struct scene g_scenes[SCENES_MAX];
+static int g_scenes_count;
+
+/* a ready request per connection, for subscribing and unsubscribing alike */
+static snd_seq_port_subscribe_t * g_requests[SCENES_CONNECTIONS_MAX];
+static unsigned int g_requests_count;
+
+/* from scene + 1 (0 is from no known scene) to scene */
+static struct plan g_plans[(SCENES_MAX + 1) * SCENES_MAX];
+
+/* thread state */
+static int g_current = -1;
+
+/* written by the thread under a sequence lock, as in the clock analyzer */
+static unsigned long g_sequence;
+static struct scenes_report g_report;
+
+static
+uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void
+apply(int scene, uint64_t trigger_ns)
+{
+  const struct plan * plan_ptr;
+  snd_seq_port_subscribe_t * request_ptr;
+  unsigned int failed;
+  unsigned int i;
+  uint64_t start_ns;
+  uint64_t end_ns;
+  unsigned long sequence;
+  int ret;
+
+  /* the same scene again puts it back as it was, whatever was patched by hand */
+  plan_ptr = g_plans + (scene == g_current ? 0 : g_current + 1) * SCENES_MAX + scene;
+
+  failed = 0;
+  start_ns = now_ns();
+
+  for (i = 0 ; i < plan_ptr->count ; i++)
+  {
+    request_ptr = g_requests[plan_ptr->ops[i] >> 1];
+
+    /* already connected or already gone is what was asked for */
+    if (plan_ptr->ops[i] & 1)
+    {
+      ret = snd_seq_subscribe_port(g_seq, request_ptr);
+      if (ret < 0 && ret != -EBUSY)
+        failed++;
+    }
+    else
+    {
+      ret = snd_seq_unsubscribe_port(g_seq, request_ptr);
+      if (ret < 0 && ret != -ENOENT)
+        failed++;
+    }
+  }
+
+  end_ns = now_ns();
+
+  g_current = scene;
+
+  sequence = g_sequence;
+  __atomic_store_n(&g_sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  g_report.switches++;
+  g_report.scene = scene;
+  g_report.ops = plan_ptr->count;
+  g_report.failed = failed;
+  g_report.apply_ns = end_ns - start_ns;
+  g_report.total_ns = end_ns - trigger_ns;
+
+  __atomic_store_n(&g_sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void scenes_get_report(struct scenes_report * report_ptr)
+{
+  unsigned long before;
+  unsigned long after;
+
+  do
+  {
+    before = __atomic_load_n(&g_sequence, __ATOMIC_ACQUIRE);
+    memcpy(report_ptr, &g_report, sizeof(g_report));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&g_sequence, __ATOMIC_RELAXED);
+  }
+  while ((before & 1) || before != after);
+}
+
+/* scene the event triggers, -1 if none */
+static
+int
+match(const snd_seq_event_t * event_ptr)
+{
+  const struct scene * scene_ptr;
+  int trigger;
+  int i;
+
+  if (event_ptr->type == SND_SEQ_EVENT_PGMCHANGE)
+    trigger = TRIGGER_PC;
+  else if (event_ptr->type == SND_SEQ_EVENT_CONTROLLER)
+    trigger = TRIGGER_CC;
+  else
+    return -1;
+
+  for (i = 0 ; i < g_scenes_count ; i++)
+  {
+    scene_ptr = g_scenes + i;
+
+    if (scene_ptr->trigger != trigger)
+      continue;
+
+    if (scene_ptr->channel != -1 && scene_ptr->channel != event_ptr->data.control.channel)
+      continue;
+
+    if (trigger == TRIGGER_PC && event_ptr->data.control.value == scene_ptr->param)
+      return i;
+
+    if (trigger == TRIGGER_CC && event_ptr->data.control.param == (unsigned int)scene_ptr->param && event_ptr->data.control.value == scene_ptr->value)
+      return i;
+  }
+
+  return -1;
+}
+
+static
+void *
+scenes_thread(void * arg)
+{
+  struct pollfd pfds[SCENES_MAX_POLLFDS + 1];
+  snd_seq_event_t * event_ptr;
+  unsigned char byte;
+  uint64_t trigger_ns;
+  int pfds_count;
+  int scene;
+
+  pfds_count = snd_seq_poll_descriptors(g_seq, pfds, SCENES_MAX_POLLFDS, POLLIN);
+
+  pfds[pfds_count].fd = g_pipe[0];
+  pfds[pfds_count].events = POLLIN;
+
+  for (;;)
+  {
+    if (poll(pfds, pfds_count + 1, -1) < 0 && errno != EINTR)
+      break;
+
+    trigger_ns = now_ns();
+
+    if (pfds[pfds_count].revents & POLLIN)
+    {
+      if (read(g_pipe[0], &byte, 1) != 1 || byte == SCENES_QUIT)
+        break;
+
+      apply(byte, trigger_ns);
+    }
+
+    while (snd_seq_event_input(g_seq, &event_ptr) >= 0)
+    {
+      scene = match(event_ptr);
+      if (scene >= 0)
+        apply(scene, trigger_ns);
+    }
+  }
+
+  return NULL;
+}
+
+static
+int
+start_thread(void)
+{
+  pthread_attr_t attr;
+  struct sched_param param;
+  int ret;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  param.sched_priority = SCENES_PRIORITY;
+  pthread_attr_setschedparam(&attr, &param);
+
+  ret = pthread_create(&g_thread, &attr, scenes_thread, NULL);
+
+  pthread_attr_destroy(&attr);
+
+  /* without the privilege for SCHED_FIFO run at normal priority */
+  if (ret == EPERM)
+    ret = pthread_create(&g_thread, NULL, scenes_thread, NULL);
+
+  return ret == 0 ? 0 : -1;
+}
+
+/* number of the connection, adding it the first time */
+static
+int
+connection(const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr)
+{
+  unsigned int i;
+
+  for (i = 0 ; i < g_requests_count ; i++)
+  {
+    if (snd_seq_port_subscribe_get_sender(g_requests[i])->client == sender_ptr->client &&
+        snd_seq_port_subscribe_get_sender(g_requests[i])->port == sender_ptr->port &&
+        snd_seq_port_subscribe_get_dest(g_requests[i])->client == dest_ptr->client &&
+        snd_seq_port_subscribe_get_dest(g_requests[i])->port == dest_ptr->port)
+      return i;
+  }
+
+  if (g_requests_count == SCENES_CONNECTIONS_MAX)
+    return -1;
+
+  if (snd_seq_port_subscribe_malloc(&g_requests[i]) < 0)
+    return -1;
+
+  snd_seq_port_subscribe_set_sender(g_requests[i], sender_ptr);
+  snd_seq_port_subscribe_set_dest(g_requests[i], dest_ptr);
+
+  return g_requests_count++;
+}
+
+/* "pc=N", "cc=N:V" or "ch=N" */
+static
+int
+parse_trigger(const char * word, struct scene * scene_ptr)
+{
+  int a;
+  int b;
+  char tail;
+
+  if (sscanf(word, "pc=%d%c", &a, &tail) == 1 && a >= 0 && a < 128)
+  {
+    scene_ptr->trigger = TRIGGER_PC;
+    scene_ptr->param = a;
+    return 0;
+  }
+
+  if (sscanf(word, "cc=%d:%d%c", &a, &b, &tail) == 2 && a >= 0 && a < 128 && b >= 0 && b < 128)
+  {
+    scene_ptr->trigger = TRIGGER_CC;
+    scene_ptr->param = a;
+    scene_ptr->value = b;
+    return 0;
+  }
+
+  if (sscanf(word, "ch=%d%c", &a, &tail) == 1 && a >= 1 && a <= 16)
+  {
+    scene_ptr->channel = a - 1;
+    return 0;
+  }
+
+  return -1;
+}
+
+static
+char *
+trim(char * str)
+{
+  char * end_ptr;
+
+  while (isspace((unsigned char)*str))
+    str++;
+
+  end_ptr = str + strlen(str);
+  while (end_ptr > str && isspace((unsigned char)end_ptr[-1]))
+    end_ptr--;
+  *end_ptr = '\0';
+
+  return str;
+}
+
+static
+int
+parse(FILE * file, char * err, size_t err_size)
+{
+  char line[SCENES_LINE_MAX];
+  char * text;
+  char * word;
+  char * arrow;
+  char * saveptr;
+  struct scene * scene_ptr;
+  snd_seq_addr_t sender;
+  snd_seq_addr_t dest;
+  int line_no;
+  int number;
+
+  scene_ptr = NULL;
+  line_no = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    line_no++;
+
+    text = strchr(line, '#');
+    if (text != NULL)
+      *text = '\0';
+
+    text = trim(line);
+    if (*text == '\0')
+      continue;
+
+    if (strncmp(text, "scene", 5) == 0 && isspace((unsigned char)text[5]))
+    {
+      if (g_scenes_count == SCENES_MAX)
+      {
+        snprintf(err, err_size, "line %d: more than %d scenes", line_no, SCENES_MAX);
+        return -1;
+      }
+
+      scene_ptr = g_scenes + g_scenes_count++;
+      scene_ptr->trigger = TRIGGER_NONE;
+      scene_ptr->channel = -1;
+      scene_ptr->members = calloc(SCENES_CONNECTIONS_MAX, 1);
+      if (scene_ptr->members == NULL)
+      {
+        snprintf(err, err_size, "out of memory");
+        return -1;
+      }
+
+      word = strtok_r(text + 5, " \t", &saveptr);
+      if (word == NULL)
+      {
+        snprintf(err, err_size, "line %d: scene without a name", line_no);
+        return -1;
+      }
+
+      snprintf(scene_ptr->name, sizeof(scene_ptr->name), "%s", word);
+
+      while ((word = strtok_r(NULL, " \t", &saveptr)) != NULL)
+      {
+        if (parse_trigger(word, scene_ptr) < 0)
+        {
+          snprintf(err, err_size, "line %d: bad trigger '%s'", line_no, word);
+          return -1;
+        }
+      }
+
+      continue;
+    }
+
+    if (scene_ptr == NULL)
+    {
+      snprintf(err, err_size, "line %d: connection before the first scene", line_no);
+      return -1;
+    }
+
+    /* client names may have spaces, the ends are split at the arrow */
+    arrow = strstr(text, "->");
+    if (arrow == NULL)
+    {
+      snprintf(err, err_size, "line %d: expected 'source -> dest'", line_no);
+      return -1;
+    }
+
+    *arrow = '\0';
+
+    if (snd_seq_parse_address(g_seq, &sender, trim(text)) < 0)
+    {
+      snprintf(err, err_size, "line %d: no port '%s'", line_no, trim(text));
+      return -1;
+    }
+
+    if (snd_seq_parse_address(g_seq, &dest, trim(arrow + 2)) < 0)
+    {
+      snprintf(err, err_size, "line %d: no port '%s'", line_no, trim(arrow + 2));
+      return -1;
+    }
+
+    number = connection(&sender, &dest);
+    if (number < 0)
+    {
+      snprintf(err, err_size, "line %d: more than %d connections", line_no, SCENES_CONNECTIONS_MAX);
+      return -1;
+    }
+
+    scene_ptr->members[number] = 1;
+  }
+
+  return 0;
+}
+
+/* what to drop and make to go from one scene to another, from -1 if not known */
+static
+int
+make_plan(int from, int to)
+{
+  struct plan * plan_ptr;
+  unsigned int i;
+  int in_from;
+  int in_to;
+
+  plan_ptr = g_plans + (from + 1) * SCENES_MAX + to;
+
+  plan_ptr->ops = malloc(g_requests_count * sizeof(unsigned int));
+  if (plan_ptr->ops == NULL && g_requests_count > 0)
+    return -1;
+
+  plan_ptr->count = 0;
+
+  /* from an unknown scene every connection of another scene may be there */
+  for (i = 0 ; i < g_requests_count ; i++)
+  {
+    in_from = from < 0 ? 1 : g_scenes[from].members[i];
+    in_to = g_scenes[to].members[i];
+
+    if (in_from && !in_to)
+      plan_ptr->ops[plan_ptr->count++] = i << 1;
+  }
+
+  for (i = 0 ; i < g_requests_count ; i++)
+  {
+    in_from = from < 0 ? 0 : g_scenes[from].members[i];
+    in_to = g_scenes[to].members[i];
+
+    if (in_to && !in_from)
+      plan_ptr->ops[plan_ptr->count++] = (i << 1) | 1;
+  }
+
+  return 0;
+}
+
+int scenes_load(const char * path, char * err, size_t err_size)
+{
+  FILE * file;
+  int from;
+  int to;
+  int ret;
+
+  ret = snd_seq_open(&g_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
+  if (ret < 0)
+  {
+    snprintf(err, err_size, "cannot open sequencer - %s", snd_strerror(ret));
+    g_seq = NULL;
+    return -1;
+  }
+
+  snd_seq_set_client_name(g_seq, "naconnect scenes");
+
+  file = fopen(path, "r");
+  if (file == NULL)
+  {
+    snprintf(err, err_size, "cannot open %s - %s", path, strerror(errno));
+    goto close;
+  }
+
+  ret = parse(file, err, err_size);
+  fclose(file);
+  if (ret < 0)
+    goto close;
+
+  if (g_scenes_count == 0)
+  {
+    snprintf(err, err_size, "no scenes in %s", path);
+    goto close;
+  }
+
+  for (to = 0 ; to < g_scenes_count ; to++)
+  {
+    for (from = -1 ; from < g_scenes_count ; from++)
+    {
+      if (make_plan(from, to) < 0)
+      {
+        snprintf(err, err_size, "out of memory");
+        goto close;
+      }
+    }
+  }
+
+  g_port = snd_seq_create_simple_port(
+    g_seq,
+    "scenes",
+    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+    SND_SEQ_PORT_TYPE_APPLICATION);
+  if (g_port < 0)
+  {
+    snprintf(err, err_size, "cannot create port - %s", snd_strerror(g_port));
+    goto close;
+  }
+
+  if (pipe(g_pipe) < 0)
+  {
+    snprintf(err, err_size, "pipe() failed - %s", strerror(errno));
+    goto close;
+  }
+
+  g_report.scene = -1;
+
+  if (start_thread() < 0)
+  {
+    snprintf(err, err_size, "cannot start the scenes thread");
+    goto close_pipe;
+  }
+
+  return 0;
+
+close_pipe:
+  close(g_pipe[0]);
+  close(g_pipe[1]);
+  g_pipe[0] = g_pipe[1] = -1;
+close:
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  scenes_close();
+  return -1;
+}
+
+void scenes_close(void)
+{
+  unsigned char byte;
+  unsigned int i;
+
+  if (g_seq != NULL)
+  {
+    byte = SCENES_QUIT;
+    if (write(g_pipe[1], &byte, 1) != 1)
+      fprintf(stderr, "Cannot wake up the scenes thread.\n");
+
+    pthread_join(g_thread, NULL);
+
+    close(g_pipe[0]);
+    close(g_pipe[1]);
+    g_pipe[0] = g_pipe[1] = -1;
+
+    snd_seq_close(g_seq);
+    g_seq = NULL;
+  }
+
+  for (i = 0 ; i < sizeof(g_plans) / sizeof(g_plans[0]) ; i++)
+  {
+    free(g_plans[i].ops);
+    g_plans[i].ops = NULL;
+    g_plans[i].count = 0;
+  }
+
+  for (i = 0 ; i < (unsigned int)g_scenes_count ; i++)
+    free(g_scenes[i].members);
+
+  for (i = 0 ; i < g_requests_count ; i++)
+    snd_seq_port_subscribe_free(g_requests[i]);
+
+  g_scenes_count = 0;
+  g_requests_count = 0;
+  g_port = -1;
+}
+
+int scenes_count(void)
+{
+  return g_scenes_count;
+}
+
+const char * scenes_name(int scene)
+{
+  if (scene < 0 || scene >= g_scenes_count)
+    return NULL;
+
+  return g_scenes[scene].name;
+}
+
+int scenes_switch(int scene)
+{
+  unsigned char byte;
+
+  if (g_seq == NULL || scene < 0 || scene >= g_scenes_count)
+    return -1;
+
+  byte = scene;
+
+  return write(g_pipe[1], &byte, 1) == 1 ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Routing scenes switched by MIDI.
+ *
+ *  A scene file names sets of connections and what switches to them:
+ *
+ *    # comment
+ *    scene verse pc=0 ch=10
+ *    Keystation:0 -> FluidSynth:0
+ *    20:0 -> 128:0
+ *    scene chorus cc=80:127
+ *    ...
+ *
+ *  pc= is a program number (0-127), cc= a controller and its value, ch=
+ *  limits the trigger to a channel (1-16). Ports are addresses or client
+ *  names as aconnect takes them, resolved when the file is loaded.
+ *
+ *  A "naconnect scenes" client has a "scenes" input port; a foot
+ *  controller patched to it switches scenes. For every pair of scenes,
+ *  and from the start when no scene is known, the connections to drop and
+ *  to make are worked out at load time into ready subscribe requests, so
+ *  a switch is just the ioctls of one plan, made from a thread of its own.
+ *  Connections that are in no scene are left alone.
+ *
+ *****************************************************************************/
+
+#ifndef SCENES_H__
+#define SCENES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCENES_MAX 32
+#define SCENES_NAME_MAX 32
+#define SCENES_PRIORITY 60      /* SCHED_FIFO priority of the scenes thread */
+
+/* the last switch */
+struct scenes_report
+{
+  unsigned long switches;       /* since load */
+  int scene;                    /* -1 before the first switch */
+  unsigned int ops;             /* subscriptions made or dropped */
+  unsigned int failed;
+  uint64_t apply_ns;            /* first to last ioctl */
+  uint64_t total_ns;            /* from reading the trigger */
+};
+
+/* opens the client and loads path, returns 0, or -1 with a reason in err */
+int scenes_load(const char * path, char * err, size_t err_size);
+void scenes_close(void);
+
+int scenes_count(void);
+const char * scenes_name(int scene);
+
+/* switch as if the trigger of scene came in */
+int scenes_switch(int scene);
+
+void scenes_get_report(struct scenes_report * report_ptr);
+
+#endif /* #ifndef SCENES_H__ */
@@ -0,0 +1,248 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - subscription operation queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "naconnect.h"
+#include "seqops.h"
+
+static snd_seq_t * g_seq;
+static int g_client = -1;
+static pthread_t g_thread;
+static int g_quit;
+
+/* UI to worker: something was submitted or quit; worker to UI: something is done */
+static int g_submit_pipe[2] = {-1, -1};
+static int g_done_pipe[2] = {-1, -1};
+
+/*
+ * Slots from g_reaped to g_done hold results, from g_done to g_submitted
+ * operations. g_submitted and g_reaped are written by the UI, g_done by
+ * the worker; each publishes its slots with a release store.
+ */
+static struct seqops_result g_ring[SEQOPS_MAX];
+static unsigned int g_submitted;
+static unsigned int g_done;
+static unsigned int g_reaped;
+
+static
+void
+drain(int fd)
+{
+  char buf[64];
+
+  while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+/* one byte is enough, a full pipe is as good as a new byte */
+static
+void
+wake(int fd)
+{
+  /* a full pipe wakes the other side already, which finds the ring changed on its next pass */
+  (void)!write(fd, "", 1);
+}
+
+static
+void *
+worker_thread(void * arg)
+{
+  struct pollfd pfd;
+  struct seqops_result * op_ptr;
+  unsigned int done;
+
+  pfd.fd = g_submit_pipe[0];
+  pfd.events = POLLIN;
+
+  done = g_done;
+
+  for (;;)
+  {
+    drain(g_submit_pipe[0]);
+
+    while (done != __atomic_load_n(&g_submitted, __ATOMIC_ACQUIRE))
+    {
+      op_ptr = g_ring + done % SEQOPS_MAX;
+
+      if (op_ptr->subscribe)
+        op_ptr->error = subscribe_ports(g_seq, &op_ptr->sender, &op_ptr->dest);
+      else
+        op_ptr->error = unsubscribe_ports(g_seq, &op_ptr->sender, &op_ptr->dest);
+
+      if (op_ptr->error > 0)
+        op_ptr->error = 0;
+
+      done++;
+      __atomic_store_n(&g_done, done, __ATOMIC_RELEASE);
+
+      wake(g_done_pipe[1]);
+    }
+
+    /* quit only once everything submitted before it was made */
+    if (__atomic_load_n(&g_quit, __ATOMIC_ACQUIRE) && done == __atomic_load_n(&g_submitted, __ATOMIC_ACQUIRE))
+      break;
+
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      break;
+  }
+
+  return NULL;
+}
+
+static
+int
+open_pipe(int * fds)
+{
+  if (pipe(fds) < 0)
+    return -1;
+
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+  return 0;
+}
+
+static
+void
+close_pipe(int * fds)
+{
+  if (fds[0] < 0)
+    return;
+
+  close(fds[0]);
+  close(fds[1]);
+  fds[0] = fds[1] = -1;
+}
+
+int seqops_open(void)
+{
+  int ret;
+
+  if (g_seq != NULL)
+    return 0;
+
+  ret = snd_seq_open(&g_seq, "default", SND_SEQ_OPEN_DUPLEX, 0);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Cannot open operations sequencer handle - %s\n", snd_strerror(ret));
+    g_seq = NULL;
+    return -1;
+  }
+
+  snd_seq_set_client_name(g_seq, "naconnect ops");
+
+  if (open_pipe(g_submit_pipe) < 0 || open_pipe(g_done_pipe) < 0)
+  {
+    fprintf(stderr, "pipe() failed - %s\n", strerror(errno));
+    goto close;
+  }
+
+  g_client = snd_seq_client_id(g_seq);
+  g_submitted = g_done = g_reaped = 0;
+  g_quit = 0;
+
+  if (pthread_create(&g_thread, NULL, worker_thread, NULL) != 0)
+  {
+    fprintf(stderr, "pthread_create() failed.\n");
+    goto close;
+  }
+
+  return 0;
+
+close:
+  close_pipe(g_submit_pipe);
+  close_pipe(g_done_pipe);
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  g_client = -1;
+  return -1;
+}
+
+void seqops_close(void)
+{
+  if (g_seq == NULL)
+    return;
+
+  __atomic_store_n(&g_quit, 1, __ATOMIC_RELEASE);
+
+  wake(g_submit_pipe[1]);
+
+  pthread_join(g_thread, NULL);
+
+  close_pipe(g_submit_pipe);
+  close_pipe(g_done_pipe);
+
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  g_client = -1;
+}
+
+int seqops_client(void)
+{
+  return g_client;
+}
+
+int seqops_submit(int subscribe, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, unsigned int owner)
+{
+  struct seqops_result * op_ptr;
+
+  if (g_seq == NULL || g_submitted - g_reaped == SEQOPS_MAX)
+    return -1;
+
+  op_ptr = g_ring + g_submitted % SEQOPS_MAX;
+  op_ptr->subscribe = subscribe;
+  op_ptr->sender = *sender_ptr;
+  op_ptr->dest = *dest_ptr;
+  op_ptr->error = 0;
+  op_ptr->owner = owner;
+
+  __atomic_store_n(&g_submitted, g_submitted + 1, __ATOMIC_RELEASE);
+
+  wake(g_submit_pipe[1]);
+
+  return 0;
+}
+
+int seqops_fd(void)
+{
+  return g_done_pipe[0];
+}
+
+int seqops_reap(struct seqops_result * result_ptr)
+{
+  if (g_seq == NULL)
+    return 0;
+
+  if (g_reaped == __atomic_load_n(&g_done, __ATOMIC_ACQUIRE))
+  {
+    /* the pipe is drained before the check above is repeated, no wakeup is lost */
+    drain(g_done_pipe[0]);
+    if (g_reaped == __atomic_load_n(&g_done, __ATOMIC_ACQUIRE))
+      return 0;
+  }
+
+  *result_ptr = g_ring[g_reaped % SEQOPS_MAX];
+
+  __atomic_store_n(&g_reaped, g_reaped + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
@@ -0,0 +1,53 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Subscription operation queue.
+ *
+ *  Subscribing and unsubscribing are ioctls that can block while the
+ *  kernel or the sequencer is busy, so the UI does not make them itself.
+ *  It queues them here and a worker thread with its own sequencer client
+ *  ("naconnect ops") makes them in order. Results come back through the
+ *  same ring; the descriptor from seqops_fd() gets readable when there are
+ *  results to reap.
+ *
+ *  The ring is single producer (the UI submits) and single consumer (the
+ *  worker), the UI also reaps, so no locks are taken.
+ *
+ *****************************************************************************/
+
+#ifndef SEQOPS_H__
+#define SEQOPS_H__
+
+#include <alsa/asoundlib.h>
+
+#define SEQOPS_MAX 1024         /* operations queued or not reaped yet */
+
+struct seqops_result
+{
+  int subscribe;
+  snd_seq_addr_t sender;
+  snd_seq_addr_t dest;
+  int error;                    /* 0 or a negative errno */
+  unsigned int owner;           /* handed back as submitted, 0 for the UI */
+};
+
+/* starts the client and the worker thread, returns 0 or -1 */
+int seqops_open(void);
+
+/* makes what is still queued and stops the worker */
+void seqops_close(void);
+
+/* client id of the worker, -1 when not open */
+int seqops_client(void);
+
+/* returns 0, or -1 if the queue is not open or full */
+int seqops_submit(int subscribe, const snd_seq_addr_t * sender_ptr, const snd_seq_addr_t * dest_ptr, unsigned int owner);
+
+/* readable when results are waiting, -1 when not open */
+int seqops_fd(void);
+
+/* takes the oldest result, returns 0 if there is none */
+int seqops_reap(struct seqops_result * result_ptr);
+
+#endif /* #ifndef SEQOPS_H__ */
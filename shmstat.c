@@ -0,0 +1,331 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * naconnect-shmstat - dump or stress test the shared memory topology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmtopo.h"
+
+#define MAX_STRESS_THREADS 64
+
+struct stress_reader
+{
+  pthread_t thread;
+  const char * name;
+  unsigned long reads;
+  unsigned long retries;
+  unsigned long failures;
+  unsigned long torn;
+};
+
+static volatile int g_stop;
+static unsigned long g_updates;
+static long g_update_interval_ns;
+
+int dump(const char * name)
+{
+  struct shmtopo_reader * reader_ptr;
+  struct shmtopo_snapshot snapshot;
+  uint32_t i;
+  int ret;
+
+  reader_ptr = shmtopo_reader_open(name);
+  if (reader_ptr == NULL)
+    return 1;
+
+  ret = 1;
+
+  if (shmtopo_snapshot_alloc(reader_ptr, &snapshot) < 0)
+  {
+    fprintf(stderr, "malloc() failed.\n");
+    goto close;
+  }
+
+  if (shmtopo_read(reader_ptr, &snapshot) < 0)
+  {
+    fprintf(stderr, "writer did not settle\n");
+    goto free;
+  }
+
+  printf("seq %u, %u ports, %u connections%s\n", snapshot.seq, snapshot.port_count, snapshot.connection_count, (snapshot.flags & SHMTOPO_TRUNCATED) ? " (truncated)" : "");
+
+  for (i = 0 ; i < snapshot.port_count ; i++)
+  {
+    printf(
+      "%c%c %3u:%u %s\n",
+      (snapshot.ports[i].flags & SHMTOPO_PORT_INPUT) ? 'i' : '-',
+      (snapshot.ports[i].flags & SHMTOPO_PORT_OUTPUT) ? 'o' : '-',
+      snapshot.ports[i].client,
+      snapshot.ports[i].port,
+      snapshot.ports[i].name);
+  }
+
+  for (i = 0 ; i < snapshot.connection_count ; i++)
+  {
+    printf(
+      "%3u:%u -> %u:%u\n",
+      snapshot.connections[i].source_client,
+      snapshot.connections[i].source_port,
+      snapshot.connections[i].dest_client,
+      snapshot.connections[i].dest_port);
+  }
+
+  ret = 0;
+
+free:
+  shmtopo_snapshot_free(&snapshot);
+close:
+  shmtopo_reader_close(reader_ptr);
+  return ret;
+}
+
+void * stress_writer(void * arg)
+{
+  struct shmtopo_writer * writer_ptr;
+  struct shmtopo_port * ports;
+  struct shmtopo_connection * connections;
+  uint32_t ports_capacity, connections_capacity;
+  uint32_t port_count, connection_count;
+  uint32_t i;
+  unsigned long generation;
+  struct timespec interval;
+
+  writer_ptr = arg;
+
+  interval.tv_sec = g_update_interval_ns / 1000000000;
+  interval.tv_nsec = g_update_interval_ns % 1000000000;
+
+  for (generation = 1 ; !g_stop ; generation++)
+  {
+    shmtopo_writer_begin(writer_ptr, &ports, &ports_capacity, &connections, &connections_capacity);
+
+    /* vary both the sizes and the content, every field depends on generation */
+    port_count = generation % ports_capacity;
+    connection_count = (generation * 7) % connections_capacity;
+
+    for (i = 0 ; i < port_count ; i++)
+    {
+      ports[i].client = generation + i;
+      ports[i].port = generation;
+      ports[i].flags = (generation + i) % 3 + 1;
+      ports[i].reserved = 0;
+      ports[i].capability = generation;
+      ports[i].type = i;
+      snprintf(ports[i].name, SHMTOPO_NAME_MAX, "port %lu/%u", generation, i);
+    }
+
+    for (i = 0 ; i < connection_count ; i++)
+    {
+      connections[i].source_client = generation;
+      connections[i].source_port = i;
+      connections[i].dest_client = generation >> 8;
+      connections[i].dest_port = i >> 8;
+    }
+
+    shmtopo_writer_end(writer_ptr, port_count, connection_count, 0);
+
+    __atomic_store_n(&g_updates, generation, __ATOMIC_RELAXED);
+
+    /* a writer that never pauses starves seqlock readers by design */
+    if (g_update_interval_ns > 0)
+      nanosleep(&interval, NULL);
+  }
+
+  return NULL;
+}
+
+void * stress_read(void * arg)
+{
+  struct stress_reader * stress_ptr;
+  struct shmtopo_reader * reader_ptr;
+  struct shmtopo_snapshot snapshot;
+  int ret;
+
+  stress_ptr = arg;
+
+  reader_ptr = shmtopo_reader_open(stress_ptr->name);
+  if (reader_ptr == NULL || shmtopo_snapshot_alloc(reader_ptr, &snapshot) < 0)
+  {
+    stress_ptr->failures++;
+    return NULL;
+  }
+
+  while (!g_stop)
+  {
+    ret = shmtopo_read(reader_ptr, &snapshot);
+    if (ret < 0)
+    {
+      stress_ptr->failures++;
+      continue;
+    }
+
+    stress_ptr->reads++;
+    stress_ptr->retries += ret;
+
+    if (shmtopo_checksum(snapshot.ports, snapshot.port_count, snapshot.connections, snapshot.connection_count) != snapshot.checksum)
+      stress_ptr->torn++;
+  }
+
+  shmtopo_snapshot_free(&snapshot);
+  shmtopo_reader_close(reader_ptr);
+
+  return NULL;
+}
+
+int stress(int threads, int seconds, uint32_t ports_capacity)
+{
+  char name[64];
+  struct shmtopo_writer * writer_ptr;
+  pthread_t writer_thread;
+  struct stress_reader readers[MAX_STRESS_THREADS];
+  unsigned long reads, retries, failures, torn;
+  int i;
+
+  snprintf(name, sizeof(name), "/naconnect-stress-%d", (int)getpid());
+
+  writer_ptr = shmtopo_writer_create(name, ports_capacity, ports_capacity * 4);
+  if (writer_ptr == NULL)
+    return 1;
+
+  memset(readers, 0, sizeof(readers));
+
+  pthread_create(&writer_thread, NULL, stress_writer, writer_ptr);
+
+  for (i = 0 ; i < threads ; i++)
+  {
+    readers[i].name = name;
+    pthread_create(&readers[i].thread, NULL, stress_read, readers + i);
+  }
+
+  sleep(seconds);
+  g_stop = 1;
+
+  pthread_join(writer_thread, NULL);
+
+  reads = retries = failures = torn = 0;
+  for (i = 0 ; i < threads ; i++)
+  {
+    pthread_join(readers[i].thread, NULL);
+    reads += readers[i].reads;
+    retries += readers[i].retries;
+    failures += readers[i].failures;
+    torn += readers[i].torn;
+  }
+
+  shmtopo_writer_destroy(writer_ptr);
+
+  printf("%d readers, %d s, %u ports capacity\n", threads, seconds, ports_capacity);
+  printf("writer updates: %lu (%.0f/s)\n", g_updates, (double)g_updates / seconds);
+  printf("snapshots read: %lu (%.0f/s per reader)\n", reads, (double)reads / seconds / threads);
+  printf("retries: %lu (%.3f per read)\n", retries, reads ? (double)retries / reads : 0.0);
+  printf("gave up: %lu\n", failures);
+  printf("inconsistent: %lu\n", torn);
+
+  return (torn == 0) ? 0 : 1;
+}
+
+static struct option g_long_options[] =
+{
+  {"name", required_argument, NULL, 'n'},
+  {"stress", no_argument, NULL, 's'},
+  {"threads", required_argument, NULL, 't'},
+  {"duration", required_argument, NULL, 'd'},
+  {"ports", required_argument, NULL, 'p'},
+  {"rate", required_argument, NULL, 'r'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+void usage(const char * program_name)
+{
+  printf("Usage: %s [-n NAME]\n", program_name);
+  printf("       %s --stress [-t THREADS] [-d SECONDS] [-p PORTS] [-r RATE]\n", program_name);
+  printf("  -n, --name NAME      segment to dump (default /naconnect)\n");
+  printf("  -s, --stress         run a synthetic writer against reader threads\n");
+  printf("  -t, --threads N      stress reader threads (default 4)\n");
+  printf("  -d, --duration S     stress duration in seconds (default 5)\n");
+  printf("  -p, --ports N        stress segment port capacity (default %d)\n", SHMTOPO_DEFAULT_PORTS);
+  printf("  -r, --rate N         stress writer updates per second, 0 for no pause (default 1000)\n");
+}
+
+int main(int argc, char ** argv)
+{
+  const char * name;
+  int stress_mode;
+  int threads;
+  int seconds;
+  int ports;
+  int rate;
+  int ch;
+
+  name = "/naconnect";
+  stress_mode = 0;
+  threads = 4;
+  seconds = 5;
+  ports = SHMTOPO_DEFAULT_PORTS;
+  rate = 1000;
+
+  while ((ch = getopt_long(argc, argv, "n:st:d:p:r:h", g_long_options, NULL)) != -1)
+  {
+    switch (ch)
+    {
+    case 'n':
+      name = optarg;
+      break;
+    case 's':
+      stress_mode = 1;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'p':
+      ports = atoi(optarg);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (stress_mode)
+  {
+    if (threads < 1 || threads > MAX_STRESS_THREADS || seconds < 1 || ports < 1 || rate < 0)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+    g_update_interval_ns = (rate > 0) ? 1000000000L / rate : 0;
+
+    return stress(threads, seconds, ports);
+  }
+
+  return dump(name);
+}
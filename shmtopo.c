@@ -0,0 +1,180 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - shared memory snapshot writer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shmtopo.h"
+
+struct shmtopo_writer
+{
+  char name[256];
+  struct shmtopo_header * header_ptr;
+  size_t size;
+};
+
+uint32_t shmtopo_checksum(const struct shmtopo_port * ports, uint32_t port_count, const struct shmtopo_connection * connections, uint32_t connection_count)
+{
+  const unsigned char * byte_ptr;
+  const unsigned char * end_ptr;
+  uint32_t hash;
+
+  hash = 2166136261u;
+
+  byte_ptr = (const unsigned char *)ports;
+  end_ptr = byte_ptr + port_count * sizeof(struct shmtopo_port);
+  while (byte_ptr < end_ptr)
+  {
+    hash = (hash ^ *byte_ptr++) * 16777619u;
+  }
+
+  byte_ptr = (const unsigned char *)connections;
+  end_ptr = byte_ptr + connection_count * sizeof(struct shmtopo_connection);
+  while (byte_ptr < end_ptr)
+  {
+    hash = (hash ^ *byte_ptr++) * 16777619u;
+  }
+
+  return hash;
+}
+
+struct shmtopo_writer * shmtopo_writer_create(const char * name, uint32_t ports_capacity, uint32_t connections_capacity)
+{
+  struct shmtopo_writer * writer_ptr;
+  struct shmtopo_header * header_ptr;
+  size_t ports_offset;
+  size_t connections_offset;
+  int fd;
+
+  if (strlen(name) >= sizeof(writer_ptr->name))
+  {
+    fprintf(stderr, "Shared memory name too long.\n");
+    return NULL;
+  }
+
+  writer_ptr = calloc(1, sizeof(struct shmtopo_writer));
+  if (writer_ptr == NULL)
+  {
+    fprintf(stderr, "calloc() failed.\n");
+    return NULL;
+  }
+
+  ports_offset = (sizeof(struct shmtopo_header) + 63) & ~(size_t)63;
+  connections_offset = (ports_offset + ports_capacity * sizeof(struct shmtopo_port) + 63) & ~(size_t)63;
+  writer_ptr->size = connections_offset + connections_capacity * sizeof(struct shmtopo_connection);
+
+  fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "shm_open(%s) failed - %s\n", name, strerror(errno));
+    goto free_writer;
+  }
+
+  if (ftruncate(fd, writer_ptr->size) < 0)
+  {
+    fprintf(stderr, "ftruncate() failed - %s\n", strerror(errno));
+    goto close_fd;
+  }
+
+  header_ptr = mmap(NULL, writer_ptr->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header_ptr == MAP_FAILED)
+  {
+    fprintf(stderr, "mmap() failed - %s\n", strerror(errno));
+    goto close_fd;
+  }
+
+  close(fd);
+
+  header_ptr->version = SHMTOPO_VERSION;
+  header_ptr->header_size = sizeof(struct shmtopo_header);
+  header_ptr->port_size = sizeof(struct shmtopo_port);
+  header_ptr->connection_size = sizeof(struct shmtopo_connection);
+  header_ptr->ports_offset = ports_offset;
+  header_ptr->ports_capacity = ports_capacity;
+  header_ptr->connections_offset = connections_offset;
+  header_ptr->connections_capacity = connections_capacity;
+  header_ptr->seq = 0;
+  header_ptr->checksum = shmtopo_checksum(NULL, 0, NULL, 0);
+
+  /* readers check magic last, so a half initialized header is never used */
+  __atomic_store_n(&header_ptr->magic, SHMTOPO_MAGIC, __ATOMIC_RELEASE);
+
+  strcpy(writer_ptr->name, name);
+  writer_ptr->header_ptr = header_ptr;
+
+  return writer_ptr;
+
+close_fd:
+  close(fd);
+  shm_unlink(name);
+free_writer:
+  free(writer_ptr);
+  return NULL;
+}
+
+void shmtopo_writer_destroy(struct shmtopo_writer * writer_ptr)
+{
+  if (writer_ptr == NULL)
+    return;
+
+  munmap(writer_ptr->header_ptr, writer_ptr->size);
+  shm_unlink(writer_ptr->name);
+  free(writer_ptr);
+}
+
+void shmtopo_writer_begin(struct shmtopo_writer * writer_ptr, struct shmtopo_port ** ports_ptr, uint32_t * ports_capacity_ptr, struct shmtopo_connection ** connections_ptr, uint32_t * connections_capacity_ptr)
+{
+  struct shmtopo_header * header_ptr;
+
+  header_ptr = writer_ptr->header_ptr;
+
+  /* odd seq tells readers that the tables are being rewritten */
+  __atomic_store_n(&header_ptr->seq, header_ptr->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  *ports_ptr = (struct shmtopo_port *)((char *)header_ptr + header_ptr->ports_offset);
+  *ports_capacity_ptr = header_ptr->ports_capacity;
+  *connections_ptr = (struct shmtopo_connection *)((char *)header_ptr + header_ptr->connections_offset);
+  *connections_capacity_ptr = header_ptr->connections_capacity;
+}
+
+void shmtopo_writer_end(struct shmtopo_writer * writer_ptr, uint32_t port_count, uint32_t connection_count, uint32_t flags)
+{
+  struct shmtopo_header * header_ptr;
+  struct timespec now;
+
+  header_ptr = writer_ptr->header_ptr;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  header_ptr->flags = flags;
+  header_ptr->port_count = port_count;
+  header_ptr->connection_count = connection_count;
+  header_ptr->checksum = shmtopo_checksum(
+    (struct shmtopo_port *)((char *)header_ptr + header_ptr->ports_offset),
+    port_count,
+    (struct shmtopo_connection *)((char *)header_ptr + header_ptr->connections_offset),
+    connection_count);
+  header_ptr->update_time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+  __atomic_store_n(&header_ptr->seq, header_ptr->seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,122 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Shared memory topology snapshot.
+ *
+ *  naconnect publishes its port and connection tables into a named POSIX
+ *  shared memory segment. The layout is flat and versioned: a header
+ *  followed by a fixed capacity port array and connection array, located
+ *  by offsets stored in the header.
+ *
+ *  Updates are guarded by a seqlock. The writer makes seq odd, rewrites
+ *  the tables and makes seq even again. Readers copy the tables and retry
+ *  when seq was odd or changed meanwhile, so reading needs no syscalls
+ *  and no locks.
+ *
+ *****************************************************************************/
+
+#ifndef SHMTOPO_H__
+#define SHMTOPO_H__
+
+#include <stdint.h>
+
+#define SHMTOPO_MAGIC 0x5443414e  /* "NACT" */
+#define SHMTOPO_VERSION 1
+#define SHMTOPO_NAME_MAX 64
+
+#define SHMTOPO_DEFAULT_PORTS 4096
+#define SHMTOPO_DEFAULT_CONNECTIONS 16384
+
+/* shmtopo_port.flags */
+#define SHMTOPO_PORT_INPUT  1   /* readable, listed in the Inputs pane */
+#define SHMTOPO_PORT_OUTPUT 2   /* writable, listed in the Outputs pane */
+
+/* shmtopo_header.flags */
+#define SHMTOPO_TRUNCATED 1     /* topology did not fit the capacity */
+
+struct shmtopo_port
+{
+  uint8_t client;
+  uint8_t port;
+  uint8_t flags;
+  uint8_t reserved;
+  uint32_t capability;
+  uint32_t type;
+  char name[SHMTOPO_NAME_MAX];
+};
+
+struct shmtopo_connection
+{
+  uint8_t source_client;
+  uint8_t source_port;
+  uint8_t dest_client;
+  uint8_t dest_port;
+};
+
+struct shmtopo_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t port_size;
+  uint32_t connection_size;
+  uint32_t ports_offset;
+  uint32_t ports_capacity;
+  uint32_t connections_offset;
+  uint32_t connections_capacity;
+
+  /* everything below is protected by seq */
+  uint32_t seq;
+  uint32_t flags;
+  uint32_t port_count;
+  uint32_t connection_count;
+  uint32_t checksum;            /* FNV-1a of the used part of both tables */
+  uint64_t update_time;         /* CLOCK_REALTIME, nanoseconds */
+};
+
+struct shmtopo_snapshot
+{
+  uint32_t seq;
+  uint32_t flags;
+  uint32_t port_count;
+  uint32_t connection_count;
+  uint32_t checksum;
+  uint64_t update_time;
+  uint32_t ports_capacity;
+  uint32_t connections_capacity;
+  struct shmtopo_port * ports;
+  struct shmtopo_connection * connections;
+};
+
+uint32_t shmtopo_checksum(const struct shmtopo_port * ports, uint32_t port_count, const struct shmtopo_connection * connections, uint32_t connection_count);
+
+/* writer side, shmtopo.c */
+
+struct shmtopo_writer;
+
+struct shmtopo_writer * shmtopo_writer_create(const char * name, uint32_t ports_capacity, uint32_t connections_capacity);
+void shmtopo_writer_destroy(struct shmtopo_writer * writer_ptr);
+
+/* between begin and end the tables can be filled in place */
+void shmtopo_writer_begin(struct shmtopo_writer * writer_ptr, struct shmtopo_port ** ports_ptr, uint32_t * ports_capacity_ptr, struct shmtopo_connection ** connections_ptr, uint32_t * connections_capacity_ptr);
+void shmtopo_writer_end(struct shmtopo_writer * writer_ptr, uint32_t port_count, uint32_t connection_count, uint32_t flags);
+
+/* reader side, shmtopo_reader.c */
+
+struct shmtopo_reader;
+
+struct shmtopo_reader * shmtopo_reader_open(const char * name);
+void shmtopo_reader_close(struct shmtopo_reader * reader_ptr);
+
+/* snapshot buffers are sized for the segment capacity */
+int shmtopo_snapshot_alloc(struct shmtopo_reader * reader_ptr, struct shmtopo_snapshot * snapshot_ptr);
+void shmtopo_snapshot_free(struct shmtopo_snapshot * snapshot_ptr);
+
+/* copy a consistent snapshot; returns the number of retries, or -1 if the writer never settled */
+int shmtopo_read(struct shmtopo_reader * reader_ptr, struct shmtopo_snapshot * snapshot_ptr);
+
+/* cheap check whether anything changed since the snapshot was taken */
+int shmtopo_changed(struct shmtopo_reader * reader_ptr, const struct shmtopo_snapshot * snapshot_ptr);
+
+#endif /* #ifndef SHMTOPO_H__ */
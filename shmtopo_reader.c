@@ -0,0 +1,185 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - shared memory snapshot reader
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmtopo.h"
+
+#define SHMTOPO_READ_RETRIES 100000
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#endif
+
+struct shmtopo_reader
+{
+  const struct shmtopo_header * header_ptr;
+  size_t size;
+};
+
+struct shmtopo_reader * shmtopo_reader_open(const char * name)
+{
+  struct shmtopo_reader * reader_ptr;
+  const struct shmtopo_header * header_ptr;
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+  {
+    fprintf(stderr, "shm_open(%s) failed - %s\n", name, strerror(errno));
+    return NULL;
+  }
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct shmtopo_header))
+  {
+    fprintf(stderr, "%s is not a naconnect topology segment\n", name);
+    goto close_fd;
+  }
+
+  header_ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (header_ptr == MAP_FAILED)
+  {
+    fprintf(stderr, "mmap() failed - %s\n", strerror(errno));
+    goto close_fd;
+  }
+
+  close(fd);
+
+  if (__atomic_load_n(&header_ptr->magic, __ATOMIC_ACQUIRE) != SHMTOPO_MAGIC ||
+      header_ptr->version != SHMTOPO_VERSION ||
+      header_ptr->port_size != sizeof(struct shmtopo_port) ||
+      header_ptr->connection_size != sizeof(struct shmtopo_connection) ||
+      header_ptr->ports_offset + (size_t)header_ptr->ports_capacity * sizeof(struct shmtopo_port) > (size_t)st.st_size ||
+      header_ptr->connections_offset + (size_t)header_ptr->connections_capacity * sizeof(struct shmtopo_connection) > (size_t)st.st_size)
+  {
+    fprintf(stderr, "%s has an unsupported layout\n", name);
+    munmap((void *)header_ptr, st.st_size);
+    return NULL;
+  }
+
+  reader_ptr = malloc(sizeof(struct shmtopo_reader));
+  if (reader_ptr == NULL)
+  {
+    fprintf(stderr, "malloc() failed.\n");
+    munmap((void *)header_ptr, st.st_size);
+    return NULL;
+  }
+
+  reader_ptr->header_ptr = header_ptr;
+  reader_ptr->size = st.st_size;
+
+  return reader_ptr;
+
+close_fd:
+  close(fd);
+  return NULL;
+}
+
+void shmtopo_reader_close(struct shmtopo_reader * reader_ptr)
+{
+  if (reader_ptr == NULL)
+    return;
+
+  munmap((void *)reader_ptr->header_ptr, reader_ptr->size);
+  free(reader_ptr);
+}
+
+int shmtopo_snapshot_alloc(struct shmtopo_reader * reader_ptr, struct shmtopo_snapshot * snapshot_ptr)
+{
+  memset(snapshot_ptr, 0, sizeof(struct shmtopo_snapshot));
+
+  snapshot_ptr->ports_capacity = reader_ptr->header_ptr->ports_capacity;
+  snapshot_ptr->connections_capacity = reader_ptr->header_ptr->connections_capacity;
+  snapshot_ptr->ports = malloc(snapshot_ptr->ports_capacity * sizeof(struct shmtopo_port) + 1);
+  snapshot_ptr->connections = malloc(snapshot_ptr->connections_capacity * sizeof(struct shmtopo_connection) + 1);
+  if (snapshot_ptr->ports == NULL || snapshot_ptr->connections == NULL)
+  {
+    shmtopo_snapshot_free(snapshot_ptr);
+    return -1;
+  }
+
+  return 0;
+}
+
+void shmtopo_snapshot_free(struct shmtopo_snapshot * snapshot_ptr)
+{
+  free(snapshot_ptr->ports);
+  free(snapshot_ptr->connections);
+  snapshot_ptr->ports = NULL;
+  snapshot_ptr->connections = NULL;
+}
+
+int shmtopo_read(struct shmtopo_reader * reader_ptr, struct shmtopo_snapshot * snapshot_ptr)
+{
+  const struct shmtopo_header * header_ptr;
+  uint32_t seq;
+  uint32_t port_count;
+  uint32_t connection_count;
+  int retries;
+
+  header_ptr = reader_ptr->header_ptr;
+
+  for (retries = 0 ; retries < SHMTOPO_READ_RETRIES ; retries++)
+  {
+    seq = __atomic_load_n(&header_ptr->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+    {
+      cpu_relax();
+      continue;
+    }
+
+    /* counts may be torn garbage if a write races us, clamp before copying */
+    port_count = header_ptr->port_count;
+    connection_count = header_ptr->connection_count;
+    if (port_count > snapshot_ptr->ports_capacity)
+      port_count = snapshot_ptr->ports_capacity;
+    if (connection_count > snapshot_ptr->connections_capacity)
+      connection_count = snapshot_ptr->connections_capacity;
+
+    memcpy(snapshot_ptr->ports, (const char *)header_ptr + header_ptr->ports_offset, port_count * sizeof(struct shmtopo_port));
+    memcpy(snapshot_ptr->connections, (const char *)header_ptr + header_ptr->connections_offset, connection_count * sizeof(struct shmtopo_connection));
+    snapshot_ptr->flags = header_ptr->flags;
+    snapshot_ptr->checksum = header_ptr->checksum;
+    snapshot_ptr->update_time = header_ptr->update_time;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&header_ptr->seq, __ATOMIC_RELAXED) == seq)
+    {
+      snapshot_ptr->seq = seq;
+      snapshot_ptr->port_count = port_count;
+      snapshot_ptr->connection_count = connection_count;
+      return retries;
+    }
+  }
+
+  return -1;
+}
+
+int shmtopo_changed(struct shmtopo_reader * reader_ptr, const struct shmtopo_snapshot * snapshot_ptr)
+{
+  return __atomic_load_n(&reader_ptr->header_ptr->seq, __ATOMIC_ACQUIRE) != snapshot_ptr->seq;
+}
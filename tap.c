@@ -0,0 +1,189 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - event tap
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tap.h"
+
+#define TAP_MAX_POLLFDS 4
+
+struct tap_port
+{
+  tap_callback callback;
+  void * context;
+};
+
+static snd_seq_t * g_tap_seq;
+static int g_tap_client = -1;
+static pthread_t g_tap_thread;
+static int g_wakeup_pipe[2] = {-1, -1};
+
+/* filled by the main thread, published to the reader by the release store of callback */
+static struct tap_port g_tap_ports[256];
+
+uint64_t tap_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void *
+reader_thread(void * arg)
+{
+  struct pollfd pfds[TAP_MAX_POLLFDS + 1];
+  int count;
+  snd_seq_event_t * event_ptr;
+  tap_callback callback;
+  uint64_t now;
+  int ret;
+
+  count = snd_seq_poll_descriptors(g_tap_seq, pfds, TAP_MAX_POLLFDS, POLLIN);
+
+  pfds[count].fd = g_wakeup_pipe[0];
+  pfds[count].events = POLLIN;
+
+  for (;;)
+  {
+    if (poll(pfds, count + 1, -1) < 0 && errno != EINTR)
+      break;
+
+    if (pfds[count].revents & POLLIN)
+      break;
+
+    /* drain everything that is pending, input is non-blocking */
+    while ((ret = snd_seq_event_input(g_tap_seq, &event_ptr)) >= 0)
+    {
+      now = tap_now_ns();
+
+      callback = __atomic_load_n(&g_tap_ports[event_ptr->dest.port].callback, __ATOMIC_ACQUIRE);
+      if (callback != NULL)
+        callback(g_tap_ports[event_ptr->dest.port].context, event_ptr, now);
+    }
+
+    /* -ENOSPC is an input overrun, the kernel dropped events; keep going */
+  }
+
+  return NULL;
+}
+
+int tap_open(void)
+{
+  int ret;
+
+  if (g_tap_seq != NULL)
+    return 0;
+
+  ret = snd_seq_open(&g_tap_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Cannot open tap sequencer handle - %s\n", snd_strerror(ret));
+    g_tap_seq = NULL;
+    return -1;
+  }
+
+  snd_seq_set_client_name(g_tap_seq, "naconnect tap");
+
+  if (pipe(g_wakeup_pipe) < 0)
+  {
+    fprintf(stderr, "pipe() failed - %s\n", strerror(errno));
+    goto close;
+  }
+
+  g_tap_client = snd_seq_client_id(g_tap_seq);
+
+  if (pthread_create(&g_tap_thread, NULL, reader_thread, NULL) != 0)
+  {
+    fprintf(stderr, "pthread_create() failed.\n");
+    goto close_pipe;
+  }
+
+  return 0;
+
+close_pipe:
+  close(g_wakeup_pipe[0]);
+  close(g_wakeup_pipe[1]);
+  g_wakeup_pipe[0] = g_wakeup_pipe[1] = -1;
+close:
+  snd_seq_close(g_tap_seq);
+  g_tap_seq = NULL;
+  g_tap_client = -1;
+  return -1;
+}
+
+void tap_close(void)
+{
+  if (g_tap_seq == NULL)
+    return;
+
+  if (write(g_wakeup_pipe[1], "", 1) != 1)
+    fprintf(stderr, "Cannot wake up the tap thread.\n");
+
+  pthread_join(g_tap_thread, NULL);
+
+  close(g_wakeup_pipe[0]);
+  close(g_wakeup_pipe[1]);
+  g_wakeup_pipe[0] = g_wakeup_pipe[1] = -1;
+
+  snd_seq_close(g_tap_seq);
+  g_tap_seq = NULL;
+  g_tap_client = -1;
+
+  memset(g_tap_ports, 0, sizeof(g_tap_ports));
+}
+
+int tap_client(void)
+{
+  return g_tap_client;
+}
+
+snd_seq_t * tap_seq(void)
+{
+  return g_tap_seq;
+}
+
+int tap_create_port(const char * name, unsigned int caps, tap_callback callback, void * context)
+{
+  int port;
+
+  if (g_tap_seq == NULL)
+    return -1;
+
+  port = snd_seq_create_simple_port(
+    g_tap_seq,
+    name,
+    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE | caps,
+    SND_SEQ_PORT_TYPE_APPLICATION);
+  if (port < 0)
+  {
+    fprintf(stderr, "Cannot create tap port - %s\n", snd_strerror(port));
+    return -1;
+  }
+
+  g_tap_ports[port].context = context;
+  __atomic_store_n(&g_tap_ports[port].callback, callback, __ATOMIC_RELEASE);
+
+  return port;
+}
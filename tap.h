@@ -0,0 +1,43 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Event tap: a second sequencer client of naconnect with its own reader
+ *  thread.
+ *
+ *  The UI client stays on the main thread and only handles announcements.
+ *  Features that need to see MIDI events create a port on the tap client
+ *  and get a callback, on the reader thread, for every event delivered to
+ *  it. Callbacks must not block; they hand events over to their consumer
+ *  through lock-free buffers.
+ *
+ *****************************************************************************/
+
+#ifndef TAP_H__
+#define TAP_H__
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+/* called on the reader thread, time_ns is CLOCK_MONOTONIC at receive */
+typedef void (* tap_callback)(void * context, const snd_seq_event_t * event_ptr, uint64_t time_ns);
+
+/* starts the client and the reader thread, returns 0 or -1 */
+int tap_open(void);
+void tap_close(void);
+
+/* client id of the tap, -1 when not open */
+int tap_client(void);
+
+/* sequencer handle of the tap, for port setup only; the reader thread owns input */
+snd_seq_t * tap_seq(void);
+
+/*
+ * Creates an input port, returns its number or -1. Ports live until
+ * tap_close(). caps are added to WRITE|SUBS_WRITE.
+ */
+int tap_create_port(const char * name, unsigned int caps, tap_callback callback, void * context);
+
+uint64_t tap_now_ns(void);
+
+#endif /* #ifndef TAP_H__ */
@@ -0,0 +1,263 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - MIDI clock analyzer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+
+#include "tempo.h"
+#include "tap.h"
+
+static int g_port = -1;
+static int g_queue = -1;
+static snd_seq_addr_t g_source;
+
+/* seq_cst handshake with tempo_stop(), like the recorder's */
+static int g_active;
+static int g_busy;
+
+/*
+ * Written by the tap thread only. g_sequence is odd while an update is in
+ * progress, readers retry until they copied a stable snapshot.
+ */
+static unsigned long g_sequence;
+static struct tempo_stats g_stats;
+
+/* tap thread state */
+static uint64_t g_last_ns;              /* 0 after a gap, start or stop */
+static double g_sum_sq;                 /* of differences from the mean, Welford */
+static uint64_t g_beat[TEMPO_PPQN];     /* the last intervals, ns */
+static uint64_t g_beat_sum;
+static unsigned int g_beat_count;
+static unsigned int g_beat_next;
+
+static
+void
+restart_chain(void)
+{
+  g_last_ns = 0;
+  g_beat_sum = 0;
+  g_beat_count = 0;
+  g_beat_next = 0;
+}
+
+static
+void
+add_interval(uint64_t interval_ns)
+{
+  double interval;
+  double delta;
+  double beat_mean;
+  double deviation;
+  int bin;
+
+  interval = interval_ns / 1000.0;
+
+  g_stats.intervals++;
+  delta = interval - g_stats.mean_us;
+  g_stats.mean_us += delta / g_stats.intervals;
+  g_sum_sq += delta * (interval - g_stats.mean_us);
+
+  g_stats.stddev_us = g_stats.intervals > 1 ? sqrt(g_sum_sq / (g_stats.intervals - 1)) : 0;
+  g_stats.bpm = 60e6 / (g_stats.mean_us * TEMPO_PPQN);
+
+  if (g_stats.intervals == 1 || interval < g_stats.min_us)
+    g_stats.min_us = interval;
+  if (g_stats.intervals == 1 || interval > g_stats.max_us)
+    g_stats.max_us = interval;
+
+  /* deviations count once a whole beat gives the reference */
+  if (g_beat_count == TEMPO_PPQN)
+  {
+    beat_mean = g_beat_sum / 1000.0 / TEMPO_PPQN;
+    deviation = interval - beat_mean;
+
+    if (fabs(deviation) > g_stats.max_dev_us)
+      g_stats.max_dev_us = fabs(deviation);
+
+    bin = (int)floor(deviation / TEMPO_HIST_BIN_US + 0.5) + TEMPO_HIST_BINS / 2;
+    if (bin < 0)
+      bin = 0;
+    if (bin >= TEMPO_HIST_BINS)
+      bin = TEMPO_HIST_BINS - 1;
+
+    g_stats.hist[bin]++;
+
+    g_beat_sum -= g_beat[g_beat_next];
+  }
+  else
+  {
+    g_beat_count++;
+  }
+
+  g_beat[g_beat_next] = interval_ns;
+  g_beat_sum += interval_ns;
+  g_beat_next = (g_beat_next + 1) % TEMPO_PPQN;
+
+  if (g_beat_count == TEMPO_PPQN)
+    g_stats.beat_bpm = 60e9 / g_beat_sum;
+}
+
+static
+void
+tap_event(void * context, const snd_seq_event_t * event_ptr, uint64_t time_ns)
+{
+  uint64_t stamp_ns;
+  unsigned long sequence;
+
+  __atomic_add_fetch(&g_busy, 1, __ATOMIC_SEQ_CST);
+
+  if (!__atomic_load_n(&g_active, __ATOMIC_SEQ_CST))
+    goto exit;
+
+  sequence = g_sequence;
+  __atomic_store_n(&g_sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  switch (event_ptr->type)
+  {
+  case SND_SEQ_EVENT_CLOCK:
+    g_stats.ticks++;
+
+    stamp_ns = (uint64_t)event_ptr->time.time.tv_sec * 1000000000 + event_ptr->time.time.tv_nsec;
+
+    if (g_last_ns != 0 && stamp_ns > g_last_ns)
+    {
+      if (stamp_ns - g_last_ns < TEMPO_GAP_NS)
+        add_interval(stamp_ns - g_last_ns);
+      else
+        restart_chain();
+    }
+
+    g_last_ns = stamp_ns;
+    break;
+  case SND_SEQ_EVENT_START:
+  case SND_SEQ_EVENT_CONTINUE:
+  case SND_SEQ_EVENT_STOP:
+    /* the clock may pause around transport changes */
+    restart_chain();
+    break;
+  }
+
+  __atomic_store_n(&g_sequence, sequence + 2, __ATOMIC_RELEASE);
+
+exit:
+  __atomic_sub_fetch(&g_busy, 1, __ATOMIC_RELEASE);
+}
+
+void tempo_get_stats(struct tempo_stats * stats_ptr)
+{
+  unsigned long before;
+  unsigned long after;
+
+  do
+  {
+    before = __atomic_load_n(&g_sequence, __ATOMIC_ACQUIRE);
+    memcpy(stats_ptr, &g_stats, sizeof(g_stats));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&g_sequence, __ATOMIC_RELAXED);
+  }
+  while ((before & 1) || before != after);
+}
+
+static
+int
+subscribe(int subscribe)
+{
+  snd_seq_port_subscribe_t * subscr_ptr;
+  snd_seq_addr_t dest;
+
+  snd_seq_port_subscribe_alloca(&subscr_ptr);
+
+  dest.client = tap_client();
+  dest.port = g_port;
+
+  snd_seq_port_subscribe_set_sender(subscr_ptr, &g_source);
+  snd_seq_port_subscribe_set_dest(subscr_ptr, &dest);
+
+  if (!subscribe)
+    return snd_seq_unsubscribe_port(tap_seq(), subscr_ptr);
+
+  /* events get stamped with the real time of our queue on delivery */
+  snd_seq_port_subscribe_set_queue(subscr_ptr, g_queue);
+  snd_seq_port_subscribe_set_time_update(subscr_ptr, 1);
+  snd_seq_port_subscribe_set_time_real(subscr_ptr, 1);
+
+  return snd_seq_subscribe_port(tap_seq(), subscr_ptr);
+}
+
+int tempo_start(const snd_seq_addr_t * source_ptr)
+{
+  if (tap_open() < 0)
+    return -1;
+
+  if (g_port < 0)
+  {
+    g_port = tap_create_port("tempo", 0, tap_event, NULL);
+    if (g_port < 0)
+      return -1;
+  }
+
+  if (g_queue < 0)
+  {
+    g_queue = snd_seq_alloc_named_queue(tap_seq(), "naconnect tempo");
+    if (g_queue < 0)
+      return -1;
+  }
+
+  tempo_stop();
+
+  /* the tap thread is out of the callback, the state is ours */
+  memset(&g_stats, 0, sizeof(g_stats));
+  g_sum_sq = 0;
+  restart_chain();
+
+  g_source = *source_ptr;
+
+  snd_seq_start_queue(tap_seq(), g_queue, NULL);
+  snd_seq_drain_output(tap_seq());
+
+  __atomic_store_n(&g_active, 1, __ATOMIC_SEQ_CST);
+
+  if (subscribe(1) < 0)
+  {
+    tempo_stop();
+    return -1;
+  }
+
+  return 0;
+}
+
+void tempo_stop(void)
+{
+  if (!g_active)
+    return;
+
+  subscribe(0);
+
+  __atomic_store_n(&g_active, 0, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&g_busy, __ATOMIC_SEQ_CST) != 0)
+    sched_yield();
+
+  snd_seq_stop_queue(tap_seq(), g_queue, NULL);
+  snd_seq_drain_output(tap_seq());
+}
+
+const snd_seq_addr_t * tempo_source(void)
+{
+  return g_active ? &g_source : NULL;
+}
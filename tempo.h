@@ -0,0 +1,52 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  MIDI clock analyzer.
+ *
+ *  A port on the tap client is subscribed to one source with real time
+ *  stamps from a queue of the tap, so intervals come from kernel delivery
+ *  times, not from when the tap thread got around to reading. Only clock
+ *  ticks (0xF8) are looked at. The statistics are running ones in fixed
+ *  memory, updated on the tap thread without allocating, and read by the
+ *  UI under a sequence lock.
+ *
+ *  Deviations are taken against the mean interval of the last beat, so a
+ *  tempo change does not show up as jitter.
+ *
+ *****************************************************************************/
+
+#ifndef TEMPO_H__
+#define TEMPO_H__
+
+#include <alsa/asoundlib.h>
+
+#define TEMPO_PPQN 24
+#define TEMPO_GAP_NS 500000000ULL       /* longer intervals restart the measurement */
+#define TEMPO_HIST_BINS 21
+#define TEMPO_HIST_BIN_US 100           /* the middle bin is within +-50 us */
+
+struct tempo_stats
+{
+  unsigned long ticks;          /* clock ticks since start */
+  unsigned long intervals;      /* intervals measured, gaps excluded */
+  double bpm;                   /* from the mean interval since start */
+  double beat_bpm;              /* from the last beat, 0 until a beat was seen */
+  double mean_us;
+  double stddev_us;
+  double min_us;
+  double max_us;
+  double max_dev_us;            /* largest deviation from the last beat's mean */
+  unsigned long hist[TEMPO_HIST_BINS]; /* deviations from the last beat's mean, outliers in the end bins */
+};
+
+/* subscribe the analyzer to source, replacing the previous one */
+int tempo_start(const snd_seq_addr_t * source_ptr);
+void tempo_stop(void);
+
+/* source being analyzed, NULL when off */
+const snd_seq_addr_t * tempo_source(void);
+
+void tempo_get_stats(struct tempo_stats * stats_ptr);
+
+#endif /* #ifndef TEMPO_H__ */
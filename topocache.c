@@ -0,0 +1,789 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - topology cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <alsa/asoundlib.h>
+
+#include "topocache.h"
+#include "probes.h"
+
+static snd_seq_t * g_seq;
+static int g_client = -1;
+static pthread_t g_thread;
+static int g_done_pipe[2] = {-1, -1};
+static struct topocache g_result;
+static int g_result_ret;
+static int (* g_skip)(unsigned int client);
+static unsigned int g_jobs;
+
+static
+uint32_t
+checksum(const void * data, size_t size, uint32_t hash)
+{
+  const unsigned char * byte_ptr;
+  const unsigned char * end_ptr;
+
+  byte_ptr = data;
+  end_ptr = byte_ptr + size;
+  while (byte_ptr < end_ptr)
+  {
+    hash = (hash ^ *byte_ptr++) * 16777619u;
+  }
+
+  return hash;
+}
+
+static
+uint32_t
+tables_checksum(const struct topocache * cache_ptr)
+{
+  uint32_t hash;
+
+  hash = checksum(cache_ptr->clients, cache_ptr->client_count * sizeof(struct topocache_client), 2166136261u);
+  hash = checksum(cache_ptr->ports, cache_ptr->port_count * sizeof(struct shmtopo_port), hash);
+  hash = checksum(cache_ptr->connections, cache_ptr->connection_count * sizeof(struct shmtopo_connection), hash);
+
+  return hash;
+}
+
+int topocache_path(char * path, size_t path_size)
+{
+  const char * dir;
+
+  dir = getenv("XDG_CACHE_HOME");
+  if (dir != NULL && dir[0] == '/')
+  {
+    snprintf(path, path_size, "%s/naconnect/topology", dir);
+    return 0;
+  }
+
+  dir = getenv("HOME");
+  if (dir == NULL || dir[0] == '\0')
+    return -1;
+
+  snprintf(path, path_size, "%s/.cache/naconnect/topology", dir);
+  return 0;
+}
+
+int topocache_map(const char * path, struct topocache * cache_ptr)
+{
+  const struct topocache_header * header_ptr;
+  struct stat st;
+  void * map_ptr;
+  int fd;
+
+  memset(cache_ptr, 0, sizeof(*cache_ptr));
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct topocache_header))
+  {
+    close(fd);
+    return -1;
+  }
+
+  map_ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map_ptr == MAP_FAILED)
+    return -1;
+
+  header_ptr = map_ptr;
+
+  if (header_ptr->magic != TOPOCACHE_MAGIC ||
+      header_ptr->version != TOPOCACHE_VERSION ||
+      header_ptr->header_size != sizeof(struct topocache_header) ||
+      header_ptr->client_size != sizeof(struct topocache_client) ||
+      header_ptr->port_size != sizeof(struct shmtopo_port) ||
+      header_ptr->connection_size != sizeof(struct shmtopo_connection) ||
+      header_ptr->clients_offset + (size_t)header_ptr->client_count * sizeof(struct topocache_client) > (size_t)st.st_size ||
+      header_ptr->ports_offset + (size_t)header_ptr->port_count * sizeof(struct shmtopo_port) > (size_t)st.st_size ||
+      header_ptr->connections_offset + (size_t)header_ptr->connection_count * sizeof(struct shmtopo_connection) > (size_t)st.st_size)
+    goto unmap;
+
+  cache_ptr->client_count = header_ptr->client_count;
+  cache_ptr->port_count = header_ptr->port_count;
+  cache_ptr->connection_count = header_ptr->connection_count;
+  cache_ptr->clients = (struct topocache_client *)((char *)map_ptr + header_ptr->clients_offset);
+  cache_ptr->ports = (struct shmtopo_port *)((char *)map_ptr + header_ptr->ports_offset);
+  cache_ptr->connections = (struct shmtopo_connection *)((char *)map_ptr + header_ptr->connections_offset);
+
+  /* a torn write from a crash is not worth drawing */
+  if (tables_checksum(cache_ptr) != header_ptr->checksum)
+    goto unmap;
+
+  cache_ptr->map_ptr = map_ptr;
+  cache_ptr->map_size = st.st_size;
+
+  return 0;
+
+unmap:
+  munmap(map_ptr, st.st_size);
+  memset(cache_ptr, 0, sizeof(*cache_ptr));
+  return -1;
+}
+
+static
+int
+grow(void ** array_ptr, uint32_t * capacity_ptr, uint32_t count, size_t size)
+{
+  void * array;
+  uint32_t capacity;
+
+  if (count < *capacity_ptr)
+    return 0;
+
+  /* room for the record at count */
+  capacity = *capacity_ptr == 0 ? 64 : *capacity_ptr;
+  while (capacity <= count)
+    capacity *= 2;
+
+  array = realloc(*array_ptr, capacity * size);
+  if (array == NULL)
+    return -1;
+
+  *array_ptr = array;
+  *capacity_ptr = capacity;
+
+  return 0;
+}
+
+static
+void
+copy_name(char * dest, const char * name)
+{
+  size_t len;
+
+  len = strlen(name);
+  if (len > SHMTOPO_NAME_MAX - 1)
+    len = SHMTOPO_NAME_MAX - 1;
+
+  /* zero padded, so equal records compare equal byte for byte */
+  memcpy(dest, name, len);
+  memset(dest + len, 0, SHMTOPO_NAME_MAX - len);
+}
+
+int topocache_add_client(struct topocache * cache_ptr, unsigned int client, unsigned int type, unsigned int num_ports, const char * name)
+{
+  struct topocache_client * client_ptr;
+
+  if (grow((void **)&cache_ptr->clients, &cache_ptr->clients_capacity, cache_ptr->client_count, sizeof(struct topocache_client)) < 0)
+    return -1;
+
+  client_ptr = cache_ptr->clients + cache_ptr->client_count++;
+  client_ptr->client = client;
+  client_ptr->type = type;
+  client_ptr->reserved = 0;
+  client_ptr->num_ports = num_ports;
+  copy_name(client_ptr->name, name);
+
+  return 0;
+}
+
+int topocache_add_port(struct topocache * cache_ptr, unsigned int client, unsigned int port, unsigned int flags, unsigned int capability, unsigned int type, const char * name)
+{
+  struct shmtopo_port * port_ptr;
+
+  if (grow((void **)&cache_ptr->ports, &cache_ptr->ports_capacity, cache_ptr->port_count, sizeof(struct shmtopo_port)) < 0)
+    return -1;
+
+  port_ptr = cache_ptr->ports + cache_ptr->port_count++;
+  port_ptr->client = client;
+  port_ptr->port = port;
+  port_ptr->flags = flags;
+  port_ptr->reserved = 0;
+  port_ptr->capability = capability;
+  port_ptr->type = type;
+  copy_name(port_ptr->name, name);
+
+  return 0;
+}
+
+int topocache_add_connection(struct topocache * cache_ptr, unsigned int source_client, unsigned int source_port, unsigned int dest_client, unsigned int dest_port)
+{
+  struct shmtopo_connection * connection_ptr;
+
+  if (grow((void **)&cache_ptr->connections, &cache_ptr->connections_capacity, cache_ptr->connection_count, sizeof(struct shmtopo_connection)) < 0)
+    return -1;
+
+  connection_ptr = cache_ptr->connections + cache_ptr->connection_count++;
+  connection_ptr->source_client = source_client;
+  connection_ptr->source_port = source_port;
+  connection_ptr->dest_client = dest_client;
+  connection_ptr->dest_port = dest_port;
+
+  return 0;
+}
+
+static
+int
+connection_cmp(const void * a, const void * b)
+{
+  return memcmp(a, b, sizeof(struct shmtopo_connection));
+}
+
+void topocache_sort(struct topocache * cache_ptr)
+{
+  qsort(cache_ptr->connections, cache_ptr->connection_count, sizeof(struct shmtopo_connection), connection_cmp);
+}
+
+int topocache_save(const char * path, const struct topocache * cache_ptr)
+{
+  struct topocache_header header;
+  struct timespec ts;
+  char tmp_path[4096];
+  char * slash_ptr;
+  FILE * file;
+  int ok;
+
+  /* make the directories on the way, those that are there already are fine */
+  snprintf(tmp_path, sizeof(tmp_path), "%s", path);
+  for (slash_ptr = strchr(tmp_path + 1, '/') ; slash_ptr != NULL ; slash_ptr = strchr(slash_ptr + 1, '/'))
+  {
+    *slash_ptr = '\0';
+    mkdir(tmp_path, 0700);
+    *slash_ptr = '/';
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = TOPOCACHE_MAGIC;
+  header.version = TOPOCACHE_VERSION;
+  header.header_size = sizeof(struct topocache_header);
+  header.client_size = sizeof(struct topocache_client);
+  header.port_size = sizeof(struct shmtopo_port);
+  header.connection_size = sizeof(struct shmtopo_connection);
+  header.client_count = cache_ptr->client_count;
+  header.port_count = cache_ptr->port_count;
+  header.connection_count = cache_ptr->connection_count;
+  header.clients_offset = sizeof(struct topocache_header);
+  header.ports_offset = header.clients_offset + cache_ptr->client_count * sizeof(struct topocache_client);
+  header.connections_offset = header.ports_offset + cache_ptr->port_count * sizeof(struct shmtopo_port);
+  header.checksum = tables_checksum(cache_ptr);
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header.save_time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+  file = fopen(tmp_path, "w");
+  if (file == NULL)
+    return -1;
+
+  ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && cache_ptr->client_count > 0)
+    ok = fwrite(cache_ptr->clients, sizeof(struct topocache_client), cache_ptr->client_count, file) == cache_ptr->client_count;
+  if (ok && cache_ptr->port_count > 0)
+    ok = fwrite(cache_ptr->ports, sizeof(struct shmtopo_port), cache_ptr->port_count, file) == cache_ptr->port_count;
+  if (ok && cache_ptr->connection_count > 0)
+    ok = fwrite(cache_ptr->connections, sizeof(struct shmtopo_connection), cache_ptr->connection_count, file) == cache_ptr->connection_count;
+
+  if (fclose(file) != 0)
+    ok = 0;
+
+  /* a reader sees either the old file or the whole new one */
+  if (!ok || rename(tmp_path, path) < 0)
+  {
+    unlink(tmp_path);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* records of two ordered tables that are in one of them only or differ, as in a merge */
+static
+unsigned int
+diff_tables(const void * a, uint32_t a_count, const void * b, uint32_t b_count, size_t size, size_t key_size)
+{
+  const char * a_ptr;
+  const char * b_ptr;
+  uint32_t i;
+  uint32_t j;
+  unsigned int changes;
+  int cmp;
+
+  a_ptr = a;
+  b_ptr = b;
+  changes = 0;
+  i = 0;
+  j = 0;
+
+  while (i < a_count || j < b_count)
+  {
+    if (i == a_count)
+      cmp = 1;
+    else if (j == b_count)
+      cmp = -1;
+    else
+      cmp = memcmp(a_ptr + i * size, b_ptr + j * size, key_size);
+
+    if (cmp < 0)
+    {
+      i++;
+    }
+    else if (cmp > 0)
+    {
+      j++;
+    }
+    else
+    {
+      if (memcmp(a_ptr + i * size, b_ptr + j * size, size) == 0)
+        changes--;
+      i++;
+      j++;
+    }
+
+    changes++;
+  }
+
+  return changes;
+}
+
+unsigned int topocache_diff(const struct topocache * a_ptr, const struct topocache * b_ptr)
+{
+  /* records are keyed by their leading address bytes */
+  return
+    diff_tables(a_ptr->clients, a_ptr->client_count, b_ptr->clients, b_ptr->client_count, sizeof(struct topocache_client), 1) +
+    diff_tables(a_ptr->ports, a_ptr->port_count, b_ptr->ports, b_ptr->port_count, sizeof(struct shmtopo_port), 2) +
+    diff_tables(a_ptr->connections, a_ptr->connection_count, b_ptr->connections, b_ptr->connection_count, sizeof(struct shmtopo_connection), 4);
+}
+
+void topocache_free(struct topocache * cache_ptr)
+{
+  if (cache_ptr->map_ptr != NULL)
+  {
+    munmap(cache_ptr->map_ptr, cache_ptr->map_size);
+  }
+  else
+  {
+    free(cache_ptr->clients);
+    free(cache_ptr->ports);
+    free(cache_ptr->connections);
+  }
+
+  memset(cache_ptr, 0, sizeof(*cache_ptr));
+}
+
+#define check_caps(pinfo_ptr, bits) ((snd_seq_port_info_get_capability(pinfo_ptr) & (bits)) == (bits))
+
+/* one enumeration thread and the clients it was given */
+struct worker
+{
+  snd_seq_t * seq;
+  int (* skip)(unsigned int client);
+  pthread_t thread;
+  unsigned char ids[256];
+  unsigned int count;
+  unsigned int load;            /* ports of its clients, plus one a client */
+  struct topocache result;      /* ports and connections only */
+  int ret;
+};
+
+/* clients of running enumerations, set before they walk anything */
+static unsigned char g_enumerators[256];
+
+int topocache_is_enumerator(unsigned int client)
+{
+  return client < 256 && __atomic_load_n(g_enumerators + client, __ATOMIC_RELAXED);
+}
+
+static
+void
+set_enumerator(snd_seq_t * seq, int on)
+{
+  __atomic_store_n(g_enumerators + (snd_seq_client_id(seq) & 0xff), on, __ATOMIC_RELAXED);
+}
+
+static
+int
+skipped(int (* skip)(unsigned int client), unsigned int client)
+{
+  return topocache_is_enumerator(client) || (skip != NULL && skip(client));
+}
+
+static
+int
+port_cmp(const void * a, const void * b)
+{
+  const struct shmtopo_port * a_ptr = a;
+  const struct shmtopo_port * b_ptr = b;
+
+  if (a_ptr->client != b_ptr->client)
+    return a_ptr->client < b_ptr->client ? -1 : 1;
+
+  return a_ptr->port < b_ptr->port ? -1 : a_ptr->port > b_ptr->port;
+}
+
+/* ports of a client with the connections from them */
+static
+int
+enumerate_ports(snd_seq_t * seq, int (* skip)(unsigned int client), unsigned int client, struct topocache * cache_ptr)
+{
+  snd_seq_port_info_t * pinfo_ptr;
+  snd_seq_query_subscribe_t * subscr_ptr;
+  const snd_seq_addr_t * addr_ptr;
+  unsigned int flags;
+  uint32_t first;
+
+  snd_seq_port_info_alloca(&pinfo_ptr);
+  snd_seq_query_subscribe_alloca(&subscr_ptr);
+
+  snd_seq_port_info_set_client(pinfo_ptr, client);
+  snd_seq_port_info_set_port(pinfo_ptr, -1);
+  while (snd_seq_query_next_port(seq, pinfo_ptr) >= 0)
+  {
+    flags = 0;
+    if (check_caps(pinfo_ptr, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ))
+      flags |= SHMTOPO_PORT_INPUT;
+    if (check_caps(pinfo_ptr, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE))
+      flags |= SHMTOPO_PORT_OUTPUT;
+
+    if (flags != 0 &&
+        topocache_add_port(
+          cache_ptr,
+          snd_seq_port_info_get_client(pinfo_ptr),
+          snd_seq_port_info_get_port(pinfo_ptr),
+          flags,
+          snd_seq_port_info_get_capability(pinfo_ptr),
+          snd_seq_port_info_get_type(pinfo_ptr),
+          snd_seq_port_info_get_name(pinfo_ptr)) < 0)
+      return -1;
+
+    /* every connection is found once, from its source */
+    first = cache_ptr->connection_count;
+
+    snd_seq_query_subscribe_set_root(subscr_ptr, snd_seq_port_info_get_addr(pinfo_ptr));
+    snd_seq_query_subscribe_set_type(subscr_ptr, SND_SEQ_QUERY_SUBS_READ);
+    snd_seq_query_subscribe_set_index(subscr_ptr, 0);
+    while (snd_seq_query_port_subscribers(seq, subscr_ptr) >= 0)
+    {
+      addr_ptr = snd_seq_query_subscribe_get_addr(subscr_ptr);
+
+      if (!skipped(skip, addr_ptr->client) &&
+          topocache_add_connection(cache_ptr, snd_seq_port_info_get_client(pinfo_ptr), snd_seq_port_info_get_port(pinfo_ptr), addr_ptr->client, addr_ptr->port) < 0)
+        return -1;
+
+      snd_seq_query_subscribe_set_index(subscr_ptr, snd_seq_query_subscribe_get_index(subscr_ptr) + 1);
+    }
+
+    /* the kernel lists subscribers in the order they came */
+    qsort(cache_ptr->connections + first, cache_ptr->connection_count - first, sizeof(struct shmtopo_connection), connection_cmp);
+  }
+
+  return 0;
+}
+
+static
+void *
+worker_thread(void * arg)
+{
+  struct worker * worker_ptr;
+  unsigned int i;
+
+  worker_ptr = arg;
+  worker_ptr->ret = 0;
+
+  for (i = 0 ; i < worker_ptr->count && worker_ptr->ret == 0 ; i++)
+    worker_ptr->ret = enumerate_ports(worker_ptr->seq, worker_ptr->skip, worker_ptr->ids[i], &worker_ptr->result);
+
+  return NULL;
+}
+
+/* appends the ports and connections a worker found */
+static
+int
+merge(struct topocache * cache_ptr, const struct topocache * part_ptr)
+{
+  if (grow((void **)&cache_ptr->ports, &cache_ptr->ports_capacity, cache_ptr->port_count + part_ptr->port_count, sizeof(struct shmtopo_port)) < 0 ||
+      grow((void **)&cache_ptr->connections, &cache_ptr->connections_capacity, cache_ptr->connection_count + part_ptr->connection_count, sizeof(struct shmtopo_connection)) < 0)
+    return -1;
+
+  memcpy(cache_ptr->ports + cache_ptr->port_count, part_ptr->ports, part_ptr->port_count * sizeof(struct shmtopo_port));
+  cache_ptr->port_count += part_ptr->port_count;
+
+  memcpy(cache_ptr->connections + cache_ptr->connection_count, part_ptr->connections, part_ptr->connection_count * sizeof(struct shmtopo_connection));
+  cache_ptr->connection_count += part_ptr->connection_count;
+
+  return 0;
+}
+
+/*
+ * Everything but our own clients and those skipped, ordered as the cache
+ * file. With more than one job the clients are walked on seq first and
+ * shared out by their port counts, the first share is enumerated on seq
+ * and each other one on a thread with a sequencer client of its own, so
+ * the round trips of the port and subscriber queries overlap. The parts
+ * are merged and ordered into one snapshot.
+ */
+static
+int
+enumerate(snd_seq_t * seq, unsigned int jobs, int (* skip)(unsigned int client), struct topocache * cache_ptr)
+{
+  snd_seq_client_info_t * cinfo_ptr;
+  struct worker workers[TOPOCACHE_MAX_JOBS];
+  struct worker * worker_ptr;
+  unsigned int client;
+  unsigned int started;
+  unsigned int i;
+  uint64_t start_ns;
+  int ret;
+
+  snd_seq_client_info_alloca(&cinfo_ptr);
+
+  PROBE(enumerate_start);
+  start_ns = PROBE_START(enumerate_done);
+
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > TOPOCACHE_MAX_JOBS)
+    jobs = TOPOCACHE_MAX_JOBS;
+
+  memset(workers, 0, sizeof(workers));
+  workers[0].seq = seq;
+
+  /* the clients of the workers exist before the walk, so it skips them */
+  for (i = 1 ; i < jobs ; i++)
+  {
+    if (snd_seq_open(&workers[i].seq, "default", SND_SEQ_OPEN_DUPLEX, 0) < 0)
+      break;
+
+    snd_seq_set_client_name(workers[i].seq, "naconnect enum");
+    set_enumerator(workers[i].seq, 1);
+  }
+
+  jobs = i;
+  ret = -1;
+
+  snd_seq_client_info_set_client(cinfo_ptr, -1);
+  while (snd_seq_query_next_client(seq, cinfo_ptr) >= 0)
+  {
+    client = snd_seq_client_info_get_client(cinfo_ptr);
+    if (skipped(skip, client))
+      continue;
+
+    if (topocache_add_client(
+          cache_ptr,
+          client,
+          snd_seq_client_info_get_type(cinfo_ptr),
+          snd_seq_client_info_get_num_ports(cinfo_ptr),
+          snd_seq_client_info_get_name(cinfo_ptr)) < 0)
+      goto close;
+
+    if (jobs == 1)
+    {
+      if (enumerate_ports(seq, skip, client, cache_ptr) < 0)
+        goto close;
+      continue;
+    }
+
+    /* to the least loaded worker */
+    worker_ptr = workers;
+    for (i = 1 ; i < jobs ; i++)
+    {
+      if (workers[i].load < worker_ptr->load)
+        worker_ptr = workers + i;
+    }
+
+    worker_ptr->ids[worker_ptr->count++] = client;
+    worker_ptr->load += snd_seq_client_info_get_num_ports(cinfo_ptr) + 1;
+  }
+
+  if (jobs == 1)
+  {
+    ret = 0;
+    goto close;
+  }
+
+  for (started = 1 ; started < jobs ; started++)
+  {
+    workers[started].skip = skip;
+    if (pthread_create(&workers[started].thread, NULL, worker_thread, workers + started) != 0)
+      break;
+  }
+
+  workers[0].skip = skip;
+  worker_thread(workers);
+
+  ret = workers[0].ret;
+
+  for (i = 1 ; i < started ; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    if (workers[i].ret < 0)
+      ret = -1;
+  }
+
+  /* shares that got no thread */
+  for (i = started ; i < jobs && ret == 0 ; i++)
+  {
+    worker_thread(workers + i);
+    ret = workers[i].ret;
+  }
+
+  for (i = 0 ; i < jobs && ret == 0 ; i++)
+    ret = merge(cache_ptr, &workers[i].result);
+
+  qsort(cache_ptr->ports, cache_ptr->port_count, sizeof(struct shmtopo_port), port_cmp);
+  topocache_sort(cache_ptr);
+
+close:
+  for (i = 0 ; i < jobs ; i++)
+  {
+    topocache_free(&workers[i].result);
+
+    if (i > 0)
+    {
+      set_enumerator(workers[i].seq, 0);
+      snd_seq_close(workers[i].seq);
+    }
+  }
+
+  PROBE(enumerate_done, cache_ptr->client_count, cache_ptr->port_count, cache_ptr->connection_count, PROBE_SINCE(start_ns));
+
+  return ret;
+}
+
+int topocache_enumerate(unsigned int jobs, int (* skip)(unsigned int client), struct topocache * cache_ptr)
+{
+  snd_seq_t * seq;
+  int ret;
+
+  memset(cache_ptr, 0, sizeof(*cache_ptr));
+
+  if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, 0) < 0)
+    return -1;
+
+  snd_seq_set_client_name(seq, "naconnect enum");
+  set_enumerator(seq, 1);
+
+  ret = enumerate(seq, jobs, skip, cache_ptr);
+
+  set_enumerator(seq, 0);
+  snd_seq_close(seq);
+
+  if (ret < 0)
+    topocache_free(cache_ptr);
+
+  return ret;
+}
+
+static
+void *
+enumerate_thread(void * arg)
+{
+  g_result_ret = enumerate(g_seq, g_jobs, g_skip, &g_result);
+
+  /* should this fail the UI never learns, but its next take still joins */
+  (void)!write(g_done_pipe[1], "", 1);
+
+  return NULL;
+}
+
+int topocache_enumerate_start(unsigned int jobs, int (* skip)(unsigned int client))
+{
+  int ret;
+
+  if (g_seq != NULL)
+    return -1;
+
+  g_skip = skip;
+  g_jobs = jobs;
+
+  ret = snd_seq_open(&g_seq, "default", SND_SEQ_OPEN_DUPLEX, 0);
+  if (ret < 0)
+  {
+    g_seq = NULL;
+    return -1;
+  }
+
+  snd_seq_set_client_name(g_seq, "naconnect enum");
+  set_enumerator(g_seq, 1);
+
+  if (pipe(g_done_pipe) < 0)
+    goto close;
+
+  g_client = snd_seq_client_id(g_seq);
+  memset(&g_result, 0, sizeof(g_result));
+  g_result_ret = -1;
+
+  if (pthread_create(&g_thread, NULL, enumerate_thread, NULL) != 0)
+  {
+    close(g_done_pipe[0]);
+    close(g_done_pipe[1]);
+    g_done_pipe[0] = g_done_pipe[1] = -1;
+    goto close;
+  }
+
+  return 0;
+
+close:
+  set_enumerator(g_seq, 0);
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  g_client = -1;
+  return -1;
+}
+
+int topocache_enumerate_client(void)
+{
+  return g_client;
+}
+
+int topocache_enumerate_fd(void)
+{
+  return g_done_pipe[0];
+}
+
+int topocache_enumerate_take(struct topocache * cache_ptr)
+{
+  int ret;
+
+  if (g_seq == NULL)
+    return -1;
+
+  pthread_join(g_thread, NULL);
+
+  close(g_done_pipe[0]);
+  close(g_done_pipe[1]);
+  g_done_pipe[0] = g_done_pipe[1] = -1;
+
+  set_enumerator(g_seq, 0);
+  snd_seq_close(g_seq);
+  g_seq = NULL;
+  g_client = -1;
+
+  ret = g_result_ret;
+  *cache_ptr = g_result;
+  memset(&g_result, 0, sizeof(g_result));
+
+  if (ret < 0)
+  {
+    topocache_free(cache_ptr);
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Topology cache.
+ *
+ *  The topology naconnect last showed is saved on exit to
+ *  $XDG_CACHE_HOME/naconnect/topology (~/.cache if unset) so the next
+ *  start can draw it before asking the sequencer anything. The file is
+ *  flat and versioned like the shared memory snapshot: a header, then
+ *  the client, port and connection tables located by offsets. It is
+ *  mapped read only and used in place.
+ *
+ *  The live topology is then enumerated on a thread with a sequencer
+ *  client of its own ("naconnect enum") into the same tables, so the UI
+ *  can compare it with what it drew from the cache and correct it.
+ *
+ *  With more than one job the walk only lists the clients; their ports
+ *  and subscribers are queried by up to TOPOCACHE_MAX_JOBS threads with a
+ *  sequencer client each, given clients by port count, and the parts are
+ *  merged and ordered into one snapshot as if walked serially.
+ *
+ *****************************************************************************/
+
+#ifndef TOPOCACHE_H__
+#define TOPOCACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "shmtopo.h"
+
+#define TOPOCACHE_MAGIC 0x4343414e  /* "NACC" */
+#define TOPOCACHE_VERSION 1
+
+#define TOPOCACHE_MAX_JOBS 16
+
+struct topocache_client
+{
+  uint8_t client;
+  uint8_t type;
+  uint16_t reserved;
+  uint32_t num_ports;
+  char name[SHMTOPO_NAME_MAX];
+};
+
+struct topocache_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t client_size;
+  uint32_t port_size;
+  uint32_t connection_size;
+  uint32_t client_count;
+  uint32_t port_count;
+  uint32_t connection_count;
+  uint32_t clients_offset;
+  uint32_t ports_offset;
+  uint32_t connections_offset;
+  uint32_t checksum;            /* FNV-1a of the three tables */
+  uint32_t reserved;
+  uint64_t save_time;           /* CLOCK_REALTIME, nanoseconds */
+};
+
+/* ports and connections are ordered by address, ports use SHMTOPO_PORT_* flags */
+struct topocache
+{
+  uint32_t client_count;
+  uint32_t port_count;
+  uint32_t connection_count;
+  struct topocache_client * clients;
+  struct shmtopo_port * ports;
+  struct shmtopo_connection * connections;
+
+  /* the file mapping, or NULL when the tables were allocated */
+  void * map_ptr;
+  size_t map_size;
+  uint32_t clients_capacity;
+  uint32_t ports_capacity;
+  uint32_t connections_capacity;
+};
+
+/* returns 0, or -1 if there is no home to put the cache in */
+int topocache_path(char * path, size_t path_size);
+
+/* returns 0, or -1 if the file is missing, damaged or of another version */
+int topocache_map(const char * path, struct topocache * cache_ptr);
+
+/* records, growing the tables as needed; return 0 or -1 */
+int topocache_add_client(struct topocache * cache_ptr, unsigned int client, unsigned int type, unsigned int num_ports, const char * name);
+int topocache_add_port(struct topocache * cache_ptr, unsigned int client, unsigned int port, unsigned int flags, unsigned int capability, unsigned int type, const char * name);
+int topocache_add_connection(struct topocache * cache_ptr, unsigned int source_client, unsigned int source_port, unsigned int dest_client, unsigned int dest_port);
+
+/* orders the connections, they can be added in any order */
+void topocache_sort(struct topocache * cache_ptr);
+
+/* writes a new file and renames it over path, returns 0 or -1 */
+int topocache_save(const char * path, const struct topocache * cache_ptr);
+
+/* records that differ between a and b, 0 if they are the same */
+unsigned int topocache_diff(const struct topocache * a_ptr, const struct topocache * b_ptr);
+
+void topocache_free(struct topocache * cache_ptr);
+
+/* enumerates with jobs threads and waits for it, skip() as below; returns 0 or -1 */
+int topocache_enumerate(unsigned int jobs, int (* skip)(unsigned int client), struct topocache * cache_ptr);
+
+/* true for the sequencer clients of running enumerations */
+int topocache_is_enumerator(unsigned int client);
+
+/* starts the enumeration thread, clients skip() is true for are left out; returns 0 or -1 */
+int topocache_enumerate_start(unsigned int jobs, int (* skip)(unsigned int client));
+
+/* client id of the enumeration thread, -1 when it is not running */
+int topocache_enumerate_client(void);
+
+/* readable when the enumeration is done, -1 when it is not running */
+int topocache_enumerate_fd(void);
+
+/* joins the thread and takes its tables, returns 0, or -1 if it failed */
+int topocache_enumerate_take(struct topocache * cache_ptr);
+
+#endif /* #ifndef TOPOCACHE_H__ */
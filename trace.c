@@ -0,0 +1,309 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - announce traces
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (256 * 1024)
+
+struct trace_reader
+{
+  FILE * file;
+};
+
+static FILE * g_file;
+static uint64_t g_start_ns;
+
+static
+uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+int
+is_client_event(unsigned int type)
+{
+  return type == SND_SEQ_EVENT_CLIENT_START || type == SND_SEQ_EVENT_CLIENT_CHANGE;
+}
+
+static
+int
+is_port_event(unsigned int type)
+{
+  return type == SND_SEQ_EVENT_PORT_START || type == SND_SEQ_EVENT_PORT_CHANGE;
+}
+
+int trace_open(const char * path, const struct topocache * topology_ptr)
+{
+  struct trace_header header;
+  struct timespec ts;
+
+  g_file = fopen(path, "w");
+  if (g_file == NULL)
+  {
+    fprintf(stderr, "Cannot open %s - %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  /* a storm is many small records, written out in large blocks */
+  setvbuf(g_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.header_size = sizeof(struct trace_header);
+  header.client_size = sizeof(struct topocache_client);
+  header.port_size = sizeof(struct shmtopo_port);
+  header.connection_size = sizeof(struct shmtopo_connection);
+  header.client_count = topology_ptr->client_count;
+  header.port_count = topology_ptr->port_count;
+  header.connection_count = topology_ptr->connection_count;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header.start_time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  fwrite(&header, sizeof(header), 1, g_file);
+  fwrite(topology_ptr->clients, sizeof(struct topocache_client), topology_ptr->client_count, g_file);
+  fwrite(topology_ptr->ports, sizeof(struct shmtopo_port), topology_ptr->port_count, g_file);
+  fwrite(topology_ptr->connections, sizeof(struct shmtopo_connection), topology_ptr->connection_count, g_file);
+
+  g_start_ns = now_ns();
+
+  return 0;
+}
+
+int trace_active(void)
+{
+  return g_file != NULL;
+}
+
+static
+void
+write_name(const char * name)
+{
+  uint8_t len;
+
+  len = strnlen(name, SHMTOPO_NAME_MAX - 1);
+  fwrite(&len, 1, 1, g_file);
+  fwrite(name, 1, len, g_file);
+}
+
+void trace_write(struct trace_event * event_ptr)
+{
+  unsigned char record[10];
+  uint32_t time_us;
+  uint16_t num_ports;
+
+  if (g_file == NULL)
+    return;
+
+  event_ptr->time_ns = now_ns() - g_start_ns;
+
+  time_us = event_ptr->time_ns / 1000;
+  memcpy(record, &time_us, 4);
+  record[4] = event_ptr->type;
+  record[5] = event_ptr->found;
+  record[6] = event_ptr->client;
+  record[7] = event_ptr->port;
+  record[8] = event_ptr->dest_client;
+  record[9] = event_ptr->dest_port;
+  fwrite(record, sizeof(record), 1, g_file);
+
+  if (!event_ptr->found)
+    return;
+
+  if (is_client_event(event_ptr->type))
+  {
+    num_ports = event_ptr->client_info.num_ports;
+    fwrite(&event_ptr->client_info.type, 1, 1, g_file);
+    fwrite(&num_ports, 2, 1, g_file);
+    write_name(event_ptr->client_info.name);
+  }
+  else if (is_port_event(event_ptr->type))
+  {
+    fwrite(&event_ptr->port_info.capability, 4, 1, g_file);
+    fwrite(&event_ptr->port_info.type, 4, 1, g_file);
+    fwrite(&event_ptr->port_info.flags, 1, 1, g_file);
+    write_name(event_ptr->port_info.name);
+  }
+}
+
+void trace_close(void)
+{
+  if (g_file == NULL)
+    return;
+
+  if (fclose(g_file) != 0)
+    fprintf(stderr, "Cannot write the trace - %s\n", strerror(errno));
+
+  g_file = NULL;
+}
+
+struct trace_reader * trace_reader_open(const char * path, struct topocache * topology_ptr, char * err, size_t err_size)
+{
+  struct trace_reader * reader_ptr;
+  struct trace_header header;
+  FILE * file;
+
+  memset(topology_ptr, 0, sizeof(*topology_ptr));
+
+  file = fopen(path, "r");
+  if (file == NULL)
+  {
+    snprintf(err, err_size, "cannot open %s - %s", path, strerror(errno));
+    return NULL;
+  }
+
+  setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != TRACE_MAGIC ||
+      header.version != TRACE_VERSION ||
+      header.header_size != sizeof(struct trace_header) ||
+      header.client_size != sizeof(struct topocache_client) ||
+      header.port_size != sizeof(struct shmtopo_port) ||
+      header.connection_size != sizeof(struct shmtopo_connection))
+  {
+    snprintf(err, err_size, "%s is not a naconnect trace of this version", path);
+    goto close;
+  }
+
+  topology_ptr->clients = malloc(header.client_count * sizeof(struct topocache_client) + 1);
+  topology_ptr->ports = malloc(header.port_count * sizeof(struct shmtopo_port) + 1);
+  topology_ptr->connections = malloc(header.connection_count * sizeof(struct shmtopo_connection) + 1);
+  if (topology_ptr->clients == NULL || topology_ptr->ports == NULL || topology_ptr->connections == NULL)
+  {
+    snprintf(err, err_size, "out of memory");
+    goto free;
+  }
+
+  topology_ptr->clients_capacity = topology_ptr->client_count = header.client_count;
+  topology_ptr->ports_capacity = topology_ptr->port_count = header.port_count;
+  topology_ptr->connections_capacity = topology_ptr->connection_count = header.connection_count;
+
+  if (fread(topology_ptr->clients, sizeof(struct topocache_client), header.client_count, file) != header.client_count ||
+      fread(topology_ptr->ports, sizeof(struct shmtopo_port), header.port_count, file) != header.port_count ||
+      fread(topology_ptr->connections, sizeof(struct shmtopo_connection), header.connection_count, file) != header.connection_count)
+  {
+    snprintf(err, err_size, "%s is cut short", path);
+    goto free;
+  }
+
+  reader_ptr = malloc(sizeof(struct trace_reader));
+  if (reader_ptr == NULL)
+  {
+    snprintf(err, err_size, "out of memory");
+    goto free;
+  }
+
+  reader_ptr->file = file;
+
+  return reader_ptr;
+
+free:
+  topocache_free(topology_ptr);
+close:
+  fclose(file);
+  return NULL;
+}
+
+void trace_reader_close(struct trace_reader * reader_ptr)
+{
+  fclose(reader_ptr->file);
+  free(reader_ptr);
+}
+
+static
+int
+read_name(FILE * file, char * name)
+{
+  uint8_t len;
+
+  memset(name, 0, SHMTOPO_NAME_MAX);
+
+  if (fread(&len, 1, 1, file) != 1 || len > SHMTOPO_NAME_MAX - 1)
+    return -1;
+
+  if (len > 0 && fread(name, 1, len, file) != len)
+    return -1;
+
+  return 0;
+}
+
+int trace_read(struct trace_reader * reader_ptr, struct trace_event * event_ptr)
+{
+  unsigned char record[10];
+  uint32_t time_us;
+  uint16_t num_ports;
+  FILE * file;
+  size_t ret;
+
+  file = reader_ptr->file;
+
+  ret = fread(record, 1, sizeof(record), file);
+  if (ret == 0)
+    return 0;
+  if (ret != sizeof(record))
+    return -1;
+
+  memset(event_ptr, 0, sizeof(*event_ptr));
+
+  memcpy(&time_us, record, 4);
+  event_ptr->time_ns = (uint64_t)time_us * 1000;
+  event_ptr->type = record[4];
+  event_ptr->found = record[5];
+  event_ptr->client = record[6];
+  event_ptr->port = record[7];
+  event_ptr->dest_client = record[8];
+  event_ptr->dest_port = record[9];
+
+  if (!event_ptr->found)
+    return 1;
+
+  if (is_client_event(event_ptr->type))
+  {
+    event_ptr->client_info.client = event_ptr->client;
+    if (fread(&event_ptr->client_info.type, 1, 1, file) != 1 ||
+        fread(&num_ports, 2, 1, file) != 1 ||
+        read_name(file, event_ptr->client_info.name) < 0)
+      return -1;
+    event_ptr->client_info.num_ports = num_ports;
+  }
+  else if (is_port_event(event_ptr->type))
+  {
+    event_ptr->port_info.client = event_ptr->client;
+    event_ptr->port_info.port = event_ptr->port;
+    if (fread(&event_ptr->port_info.capability, 4, 1, file) != 1 ||
+        fread(&event_ptr->port_info.type, 4, 1, file) != 1 ||
+        fread(&event_ptr->port_info.flags, 1, 1, file) != 1 ||
+        read_name(file, event_ptr->port_info.name) < 0)
+      return -1;
+  }
+
+  return 1;
+}
@@ -0,0 +1,81 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  Announce traces.
+ *
+ *  `--trace FILE` records the topology when naconnect starts and then
+ *  every announce it handles, together with the client or port info it
+ *  fetched for it, so a trace replays without a sequencer. The file is
+ *  a header, the client, port and connection tables of the topology cache
+ *  (topocache.h) and then one record per announce:
+ *
+ *    uint32 time in us since the start, uint8 event type, uint8 found,
+ *    uint8 client, port, dest client, dest port
+ *    client events that found the client: uint8 type, uint16 ports,
+ *      uint8 name length, the name
+ *    port events that found the port: uint32 capability, uint32 type,
+ *      uint8 flags, uint8 name length, the name
+ *
+ *  An overrun of the announce queue makes naconnect read the topology
+ *  again, which is not in the trace; its replay is only exact up to there.
+ *
+ *****************************************************************************/
+
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include <stdint.h>
+
+#include "topocache.h"
+
+#define TRACE_MAGIC 0x5243414e  /* "NACR" */
+#define TRACE_VERSION 1
+
+struct trace_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t client_size;
+  uint32_t port_size;
+  uint32_t connection_size;
+  uint32_t client_count;
+  uint32_t port_count;
+  uint32_t connection_count;
+  uint32_t reserved;
+  uint64_t start_time;          /* CLOCK_REALTIME, nanoseconds */
+};
+
+/* an announce and what handling it needs from the sequencer */
+struct trace_event
+{
+  uint64_t time_ns;             /* since the start of the trace */
+  unsigned int type;            /* SND_SEQ_EVENT_* */
+  unsigned int client;          /* of the client or port, the sender of a connection */
+  unsigned int port;
+  unsigned int dest_client;
+  unsigned int dest_port;
+  int found;                    /* the client or port below was there when it was handled */
+  struct topocache_client client_info;
+  struct shmtopo_port port_info;
+};
+
+/* writer, starts with the topology the events apply to; returns 0 or -1 */
+int trace_open(const char * path, const struct topocache * topology_ptr);
+int trace_active(void);
+void trace_write(struct trace_event * event_ptr);
+void trace_close(void);
+
+/* reader */
+
+struct trace_reader;
+
+/* loads the starting topology into topology_ptr, NULL on error with a reason in err */
+struct trace_reader * trace_reader_open(const char * path, struct topocache * topology_ptr, char * err, size_t err_size);
+void trace_reader_close(struct trace_reader * reader_ptr);
+
+/* returns 1 with the next event, 0 at the end, -1 if the file is cut short */
+int trace_read(struct trace_reader * reader_ptr, struct trace_event * event_ptr);
+
+#endif /* #ifndef TRACE_H__ */
@@ -0,0 +1,322 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * ncurses ALSA MIDI sequencer patchbay - NDJSON watch mode
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "watch.h"
+
+#define WATCH_LINE_MAX 512
+
+static char g_buffer[WATCH_BUFFER_SIZE];
+static size_t g_used;
+static int g_timer_fd = -1;
+static int g_failed;
+
+static
+void
+flush(void)
+{
+  size_t done;
+  ssize_t ret;
+
+  for (done = 0 ; done < g_used ; done += ret)
+  {
+    ret = write(STDOUT_FILENO, g_buffer + done, g_used - done);
+    if (ret < 0 && errno == EINTR)
+    {
+      ret = 0;
+      continue;
+    }
+
+    if (ret < 0)
+    {
+      g_failed = 1;
+      break;
+    }
+  }
+
+  g_used = 0;
+}
+
+static
+void
+arm_timer(void)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_nsec = WATCH_FLUSH_MS * 1000000L;
+
+  timerfd_settime(g_timer_fd, 0, &its, NULL);
+}
+
+static
+void
+append(const char * format, ...)
+{
+  va_list ap;
+  int len;
+
+  if (g_used + WATCH_LINE_MAX > sizeof(g_buffer))
+    flush();
+
+  /* the first line after a flush starts the timer for the next one */
+  if (g_used == 0)
+    arm_timer();
+
+  va_start(ap, format);
+  len = vsnprintf(g_buffer + g_used, WATCH_LINE_MAX, format, ap);
+  va_end(ap);
+
+  if (len >= WATCH_LINE_MAX)
+    len = WATCH_LINE_MAX - 1;
+
+  g_used += len;
+}
+
+/* a JSON string of a name, without the quotes */
+static
+void
+escape(char * dest, size_t size, const char * name)
+{
+  size_t len;
+
+  len = 0;
+
+  for ( ; *name != '\0' && len + 7 < size ; name++)
+  {
+    if (*name == '"' || *name == '\\')
+    {
+      dest[len++] = '\\';
+      dest[len++] = *name;
+    }
+    else if ((unsigned char)*name < 0x20)
+    {
+      len += snprintf(dest + len, size - len, "\\u%04x", (unsigned char)*name);
+    }
+    else
+    {
+      dest[len++] = *name;
+    }
+  }
+
+  dest[len] = '\0';
+}
+
+static
+void
+start_line(const char * event)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  append("{\"time\":%ld.%03ld,\"event\":\"%s\"", (long)ts.tv_sec, ts.tv_nsec / 1000000, event);
+}
+
+static
+void
+client_line(snd_seq_t * seq_handle, const char * event, const snd_seq_addr_t * addr_ptr, int with_info)
+{
+  snd_seq_client_info_t * cinfo_ptr;
+  char name[128];
+
+  snd_seq_client_info_alloca(&cinfo_ptr);
+
+  start_line(event);
+  append(",\"client\":%u", addr_ptr->client);
+
+  if (with_info && snd_seq_get_any_client_info(seq_handle, addr_ptr->client, cinfo_ptr) >= 0)
+  {
+    escape(name, sizeof(name), snd_seq_client_info_get_name(cinfo_ptr));
+    append(",\"name\":\"%s\",\"type\":\"%s\"", name, snd_seq_client_info_get_type(cinfo_ptr) == SND_SEQ_USER_CLIENT ? "user" : "kernel");
+  }
+
+  append("}\n");
+}
+
+static
+void
+port_line(snd_seq_t * seq_handle, const char * event, const snd_seq_addr_t * addr_ptr, int with_info)
+{
+  snd_seq_client_info_t * cinfo_ptr;
+  snd_seq_port_info_t * pinfo_ptr;
+  unsigned int caps;
+  char name[128];
+
+  snd_seq_client_info_alloca(&cinfo_ptr);
+  snd_seq_port_info_alloca(&pinfo_ptr);
+
+  start_line(event);
+  append(",\"port\":\"%u:%u\"", addr_ptr->client, addr_ptr->port);
+
+  if (with_info && snd_seq_get_any_port_info(seq_handle, addr_ptr->client, addr_ptr->port, pinfo_ptr) >= 0)
+  {
+    if (snd_seq_get_any_client_info(seq_handle, addr_ptr->client, cinfo_ptr) >= 0)
+    {
+      escape(name, sizeof(name), snd_seq_client_info_get_name(cinfo_ptr));
+      append(",\"client_name\":\"%s\"", name);
+    }
+
+    caps = snd_seq_port_info_get_capability(pinfo_ptr);
+    escape(name, sizeof(name), snd_seq_port_info_get_name(pinfo_ptr));
+    append(
+      ",\"name\":\"%s\",\"input\":%s,\"output\":%s",
+      name,
+      (caps & (SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ)) == (SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ) ? "true" : "false",
+      (caps & (SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE)) == (SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE) ? "true" : "false");
+  }
+
+  append("}\n");
+}
+
+static
+void
+connection_line(const char * event, const snd_seq_connect_t * connect_ptr)
+{
+  start_line(event);
+  append(
+    ",\"source\":\"%u:%u\",\"dest\":\"%u:%u\"}\n",
+    connect_ptr->sender.client,
+    connect_ptr->sender.port,
+    connect_ptr->dest.client,
+    connect_ptr->dest.port);
+}
+
+static
+void
+handle_event(snd_seq_t * seq_handle, const snd_seq_event_t * event_ptr, int self)
+{
+  /* our own subscription to the announces is not news */
+  if (event_ptr->data.addr.client == self)
+    return;
+
+  switch (event_ptr->type)
+  {
+  case SND_SEQ_EVENT_CLIENT_START:
+    client_line(seq_handle, "client_start", &event_ptr->data.addr, 1);
+    break;
+  case SND_SEQ_EVENT_CLIENT_EXIT:
+    client_line(seq_handle, "client_exit", &event_ptr->data.addr, 0);
+    break;
+  case SND_SEQ_EVENT_CLIENT_CHANGE:
+    client_line(seq_handle, "client_change", &event_ptr->data.addr, 1);
+    break;
+  case SND_SEQ_EVENT_PORT_START:
+    port_line(seq_handle, "port_start", &event_ptr->data.addr, 1);
+    break;
+  case SND_SEQ_EVENT_PORT_EXIT:
+    port_line(seq_handle, "port_exit", &event_ptr->data.addr, 0);
+    break;
+  case SND_SEQ_EVENT_PORT_CHANGE:
+    port_line(seq_handle, "port_change", &event_ptr->data.addr, 1);
+    break;
+  case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+    if (event_ptr->data.connect.dest.client != self)
+      connection_line("connect", &event_ptr->data.connect);
+    break;
+  case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+    if (event_ptr->data.connect.dest.client != self)
+      connection_line("disconnect", &event_ptr->data.connect);
+    break;
+  }
+}
+
+int watch_run(snd_seq_t * seq_handle)
+{
+  struct pollfd pfds[3];
+  snd_seq_event_t * event_ptr;
+  sigset_t signals;
+  uint64_t expirations;
+  int signal_fd;
+  int self;
+  int ret;
+
+  self = snd_seq_client_id(seq_handle);
+
+  /* SIGINT and SIGTERM end the watch after what is buffered is written */
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, NULL);
+
+  signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+  if (signal_fd < 0)
+  {
+    fprintf(stderr, "signalfd() failed - %s\n", strerror(errno));
+    return 1;
+  }
+
+  g_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (g_timer_fd < 0)
+  {
+    fprintf(stderr, "timerfd_create() failed - %s\n", strerror(errno));
+    close(signal_fd);
+    return 1;
+  }
+
+  snd_seq_poll_descriptors(seq_handle, pfds, 1, POLLIN);
+  pfds[1].fd = g_timer_fd;
+  pfds[1].events = POLLIN;
+  pfds[2].fd = signal_fd;
+  pfds[2].events = POLLIN;
+
+  while (!g_failed)
+  {
+    if (poll(pfds, 3, -1) < 0 && errno != EINTR)
+    {
+      fprintf(stderr, "poll() failed - %s\n", strerror(errno));
+      break;
+    }
+
+    if (pfds[2].revents & POLLIN)
+      break;
+
+    while ((ret = snd_seq_event_input(seq_handle, &event_ptr)) >= 0)
+      handle_event(seq_handle, event_ptr, self);
+
+    if (ret == -ENOSPC)
+    {
+      start_line("overrun");
+      append("}\n");
+    }
+
+    if (pfds[1].revents & POLLIN)
+    {
+      /* drained only so it stops being readable, the buffer is written anyway */
+      (void)!read(g_timer_fd, &expirations, sizeof(expirations));
+
+      flush();
+    }
+  }
+
+  flush();
+
+  close(g_timer_fd);
+  g_timer_fd = -1;
+  close(signal_fd);
+
+  return g_failed;
+}
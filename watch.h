@@ -0,0 +1,36 @@
+/* -*- Mode: C ; c-basic-offset: 2 -*- */
+/*****************************************************************************
+ *
+ * DESCRIPTION:
+ *  NDJSON watch mode.
+ *
+ *  `naconnect --watch` draws nothing; it writes one JSON object per line
+ *  to stdout for every announce, e.g.
+ *
+ *    {"time":1697650000.123,"event":"port_start","port":"20:0","client_name":"Keystation","name":"MIDI 1","input":true,"output":false}
+ *    {"time":1697650000.125,"event":"connect","source":"20:0","dest":"128:0"}
+ *
+ *  Events are client_start, client_exit, client_change, port_start,
+ *  port_exit, port_change, connect, disconnect and overrun (announces
+ *  were lost). Names are looked up when the announce is read, they are
+ *  missing if the client or port was gone by then.
+ *
+ *  Lines are collected in a buffer written out when it fills up or
+ *  WATCH_FLUSH_MS after the first line in it, from a timerfd that is only
+ *  armed while there is something to write, so an idle watch sleeps in
+ *  poll() and a storm costs one write() per buffer.
+ *
+ *****************************************************************************/
+
+#ifndef WATCH_H__
+#define WATCH_H__
+
+#include <alsa/asoundlib.h>
+
+#define WATCH_BUFFER_SIZE (64 * 1024)
+#define WATCH_FLUSH_MS 100
+
+/* seq_handle is nonblocking and subscribed to System:Announce; returns on SIGINT or SIGTERM, 0 or 1 on error */
+int watch_run(snd_seq_t * seq_handle);
+
+#endif /* #ifndef WATCH_H__ */